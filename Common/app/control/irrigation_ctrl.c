@@ -0,0 +1,400 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file irrigation_ctrl.c
+ * @brief Local closed-loop irrigation controller.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_INFO
+
+#include "logging.h"
+
+#include "FreeRTOS.h"
+
+#include "kvstore.h"
+#include "irrigation_ctrl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define IRRIGATION_KV_STR_LEN    ( 64 )
+
+static IrrigationZone_t xZones[ IRRIGATION_MAX_ZONES ];
+
+static IrrigationValveHook_t xValveHook = NULL;
+
+/*-----------------------------------------------------------*/
+
+IrrigationZone_t * pxIrrigation_GetZone( size_t uxZone )
+{
+    configASSERT( uxZone < IRRIGATION_MAX_ZONES );
+
+    return &( xZones[ uxZone ] );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvResetPid( IrrigationZone_t * pxZone )
+{
+    pxZone->fIntegral = 0.0f;
+    pxZone->xHasLastMoisture = pdFALSE;
+    pxZone->ulWindowOnMs = 0;
+    pxZone->ulWindowStartMs = pxZone->ulLastStepMs;
+}
+
+/*-----------------------------------------------------------*/
+
+void vIrrigation_Init( IrrigationZone_t * pxZone,
+                       const IrrigationConfig_t * pxConfig )
+{
+    configASSERT( pxZone != NULL );
+    configASSERT( pxConfig != NULL );
+
+    ( void ) memset( pxZone, 0, sizeof( IrrigationZone_t ) );
+
+    pxZone->xConfig = *pxConfig;
+    pxZone->xValveOn = pdFALSE;
+    pxZone->xManualRequest = pdFALSE;
+    pxZone->xCutoff = pdFALSE;
+    pxZone->xStarted = pdFALSE;
+    prvResetPid( pxZone );
+}
+
+/*-----------------------------------------------------------*/
+
+void vIrrigation_SetConfig( IrrigationZone_t * pxZone,
+                            const IrrigationConfig_t * pxConfig )
+{
+    configASSERT( pxZone != NULL );
+    configASSERT( pxConfig != NULL );
+
+    if( pxConfig->xMode != pxZone->xConfig.xMode )
+    {
+        LogInfo( "Irrigation mode changed from %d to %d.", pxZone->xConfig.xMode, pxConfig->xMode );
+        prvResetPid( pxZone );
+        pxZone->xCutoff = pdFALSE;
+    }
+
+    pxZone->xConfig = *pxConfig;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Return entry uxIdx of a comma separated list, or the last entry if the list is shorter */
+static uint32_t prvListEntry( const char * pcList,
+                              size_t uxIdx,
+                              uint32_t ulDefault )
+{
+    uint32_t ulValue = ulDefault;
+    const char * pcCursor = pcList;
+
+    for( size_t uxEntry = 0; uxEntry <= uxIdx; uxEntry++ )
+    {
+        char * pcEnd = NULL;
+        uint32_t ulEntry = 0;
+
+        while( ( *pcCursor == ' ' ) || ( *pcCursor == ',' ) )
+        {
+            pcCursor++;
+        }
+
+        ulEntry = ( uint32_t ) strtoul( pcCursor, &pcEnd, 10 );
+
+        if( pcEnd == pcCursor )
+        {
+            break;
+        }
+
+        ulValue = ulEntry;
+        pcCursor = pcEnd;
+    }
+
+    return ulValue;
+}
+
+/*-----------------------------------------------------------*/
+
+void vIrrigation_LoadConfig( IrrigationConfig_t * pxConfig,
+                             size_t uxZone )
+{
+    char pcSetpoints[ IRRIGATION_KV_STR_LEN ] = { 0 };
+    uint32_t ulMode = 0;
+
+    configASSERT( pxConfig != NULL );
+
+    ulMode = KVStore_getUInt32( CS_IRR_MODE, NULL );
+
+    if( ulMode >= IRRIGATION_MODE_MAX )
+    {
+        LogError( "Invalid irrigation mode %u, using manual.", ( unsigned int ) ulMode );
+        ulMode = IRRIGATION_MODE_MANUAL;
+    }
+
+    ( void ) KVStore_getString( CS_IRR_SETPOINTS, pcSetpoints, IRRIGATION_KV_STR_LEN );
+
+    /* Percentages are stored in hundredths, gains in thousandths */
+    pxConfig->xMode = ( IrrigationMode_t ) ulMode;
+    pxConfig->fSetpoint = ( float ) prvListEntry( pcSetpoints, uxZone, 0 ) / 100.0f;
+    pxConfig->fHysteresis = ( float ) KVStore_getUInt32( CS_IRR_HYSTERESIS, NULL ) / 100.0f;
+    pxConfig->ulMinOnMs = KVStore_getUInt32( CS_IRR_MIN_ON_MS, NULL );
+    pxConfig->ulMinOffMs = KVStore_getUInt32( CS_IRR_MIN_OFF_MS, NULL );
+    pxConfig->ulMaxRunMs = KVStore_getUInt32( CS_IRR_MAX_RUN_MS, NULL );
+    pxConfig->fKp = ( float ) KVStore_getUInt32( CS_IRR_KP, NULL ) / 1000.0f;
+    pxConfig->fKi = ( float ) KVStore_getUInt32( CS_IRR_KI, NULL ) / 1000.0f;
+    pxConfig->fKd = ( float ) KVStore_getUInt32( CS_IRR_KD, NULL ) / 1000.0f;
+    pxConfig->ulPidWindowMs = KVStore_getUInt32( CS_IRR_WINDOW_MS, NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+void vIrrigation_SetManualRequest( IrrigationZone_t * pxZone,
+                                   BaseType_t xOn )
+{
+    configASSERT( pxZone != NULL );
+
+    pxZone->xManualRequest = ( xOn != pdFALSE ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+static float prvClamp( float fValue,
+                       float fMin,
+                       float fMax )
+{
+    float fResult = fValue;
+
+    if( fResult < fMin )
+    {
+        fResult = fMin;
+    }
+    else if( fResult > fMax )
+    {
+        fResult = fMax;
+    }
+
+    return fResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Duty cycle in [ 0, 1 ] for the next window */
+static float prvPidDuty( IrrigationZone_t * pxZone,
+                         float fMoisture,
+                         float fDeltaSeconds )
+{
+    const IrrigationConfig_t * pxConfig = &( pxZone->xConfig );
+    float fError = pxConfig->fSetpoint - fMoisture;
+    float fDerivative = 0.0f;
+    float fOutput = 0.0f;
+
+    if( pxConfig->fKi > 0.0f )
+    {
+        /* Clamp the integral term on its own to avoid windup */
+        pxZone->fIntegral = prvClamp( pxZone->fIntegral + ( fError * fDeltaSeconds ),
+                                      0.0f,
+                                      1.0f / pxConfig->fKi );
+    }
+
+    /* Derivative on measurement, so setpoint changes do not kick the output */
+    if( ( pxZone->xHasLastMoisture == pdTRUE ) && ( fDeltaSeconds > 0.0f ) )
+    {
+        fDerivative = -( fMoisture - pxZone->fLastMoisture ) / fDeltaSeconds;
+    }
+
+    fOutput = ( pxConfig->fKp * fError ) +
+              ( pxConfig->fKi * pxZone->fIntegral ) +
+              ( pxConfig->fKd * fDerivative );
+
+    return prvClamp( fOutput, 0.0f, 1.0f );
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvDemand( IrrigationZone_t * pxZone,
+                             const float * pfMoisture,
+                             uint32_t ulNowMs )
+{
+    const IrrigationConfig_t * pxConfig = &( pxZone->xConfig );
+    BaseType_t xDemand = pdFALSE;
+    float fUpper = pxConfig->fSetpoint + pxConfig->fHysteresis;
+    float fLower = pxConfig->fSetpoint - pxConfig->fHysteresis;
+
+    if( pfMoisture == NULL )
+    {
+        xDemand = pdFALSE;
+    }
+    else if( pxConfig->xMode == IRRIGATION_MODE_MANUAL )
+    {
+        xDemand = ( ( pxZone->xManualRequest == pdTRUE ) && ( *pfMoisture <= fUpper ) ) ? pdTRUE : pdFALSE;
+    }
+    else if( pxConfig->xMode == IRRIGATION_MODE_HYSTERESIS )
+    {
+        if( *pfMoisture < fLower )
+        {
+            xDemand = pdTRUE;
+        }
+        else if( *pfMoisture > fUpper )
+        {
+            xDemand = pdFALSE;
+        }
+        else
+        {
+            xDemand = pxZone->xValveOn;
+        }
+    }
+    else
+    {
+        if( ( pxConfig->ulPidWindowMs == 0 ) ||
+            ( ( ulNowMs - pxZone->ulWindowStartMs ) >= pxConfig->ulPidWindowMs ) ||
+            ( pxZone->xHasLastMoisture == pdFALSE ) )
+        {
+            float fDuty = prvPidDuty( pxZone,
+                                      *pfMoisture,
+                                      ( float ) ( ulNowMs - pxZone->ulLastStepMs ) / 1000.0f );
+
+            pxZone->ulWindowStartMs = ulNowMs;
+            pxZone->ulWindowOnMs = ( uint32_t ) ( fDuty * ( float ) pxConfig->ulPidWindowMs );
+        }
+        else if( pxConfig->fKi > 0.0f )
+        {
+            /* Keep integrating between window starts */
+            pxZone->fIntegral = prvClamp( pxZone->fIntegral +
+                                          ( ( pxConfig->fSetpoint - *pfMoisture ) *
+                                            ( float ) ( ulNowMs - pxZone->ulLastStepMs ) / 1000.0f ),
+                                          0.0f,
+                                          1.0f / pxConfig->fKi );
+        }
+
+        xDemand = ( ( ulNowMs - pxZone->ulWindowStartMs ) < pxZone->ulWindowOnMs ) ? pdTRUE : pdFALSE;
+
+        pxZone->fLastMoisture = *pfMoisture;
+        pxZone->xHasLastMoisture = pdTRUE;
+    }
+
+    return xDemand;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xIrrigation_Step( IrrigationZone_t * pxZone,
+                             const float * pfMoisture,
+                             uint32_t ulNowMs )
+{
+    const IrrigationConfig_t * pxConfig = NULL;
+    BaseType_t xDemand = pdFALSE;
+    uint32_t ulInStateMs = 0;
+
+    configASSERT( pxZone != NULL );
+
+    pxConfig = &( pxZone->xConfig );
+
+    if( pxZone->xStarted == pdFALSE )
+    {
+        pxZone->ulLastStepMs = ulNowMs;
+        pxZone->ulWindowStartMs = ulNowMs;
+    }
+
+    xDemand = prvDemand( pxZone, pfMoisture, ulNowMs );
+    ulInStateMs = ulNowMs - pxZone->ulLastSwitchMs;
+
+    if( xDemand == pdFALSE )
+    {
+        pxZone->xCutoff = pdFALSE;
+    }
+    else if( pxZone->xCutoff == pdTRUE )
+    {
+        xDemand = pdFALSE;
+    }
+    else if( ( pxZone->xValveOn == pdTRUE ) &&
+             ( pxConfig->ulMaxRunMs > 0 ) &&
+             ( ulInStateMs >= pxConfig->ulMaxRunMs ) )
+    {
+        LogError( "Irrigation valve ran for %lu ms, cutting off.", ulInStateMs );
+        pxZone->xCutoff = pdTRUE;
+        pxZone->ulCutoffs++;
+        xDemand = pdFALSE;
+    }
+    else
+    {
+        /* Demand stands */
+    }
+
+    if( xDemand != pxZone->xValveOn )
+    {
+        BaseType_t xSwitch = pdFALSE;
+
+        if( pxZone->xStarted == pdFALSE )
+        {
+            xSwitch = pdTRUE;
+        }
+        else if( pxZone->xValveOn == pdTRUE )
+        {
+            xSwitch = ( ( ulInStateMs >= pxConfig->ulMinOnMs ) || ( pxZone->xCutoff == pdTRUE ) ) ? pdTRUE : pdFALSE;
+        }
+        else
+        {
+            xSwitch = ( ulInStateMs >= pxConfig->ulMinOffMs ) ? pdTRUE : pdFALSE;
+        }
+
+        if( xSwitch == pdTRUE )
+        {
+            IrrigationValveHook_t xHook = xValveHook;
+
+            pxZone->xValveOn = xDemand;
+            pxZone->ulLastSwitchMs = ulNowMs;
+
+            if( ( xHook != NULL ) &&
+                ( pxZone >= &( xZones[ 0 ] ) ) &&
+                ( pxZone < &( xZones[ IRRIGATION_MAX_ZONES ] ) ) )
+            {
+                xHook( ( size_t ) ( pxZone - &( xZones[ 0 ] ) ), xDemand );
+            }
+        }
+    }
+
+    pxZone->xStarted = pdTRUE;
+    pxZone->ulLastStepMs = ulNowMs;
+
+    return pxZone->xValveOn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xIrrigation_IsValveOn( const IrrigationZone_t * pxZone )
+{
+    configASSERT( pxZone != NULL );
+
+    return pxZone->xValveOn;
+}
+
+/*-----------------------------------------------------------*/
+
+void vIrrigation_SetValveHook( IrrigationValveHook_t xHook )
+{
+    xValveHook = xHook;
+}
@@ -68,6 +68,7 @@
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
+#include "mqtt_agent_task.h"
 
 /* Device Defender Client Library. */
 #include "defender.h"
@@ -118,6 +119,7 @@ struct MQTTAgentCommandContext
     const char * pcRejectedTopic;
     uint16_t usPublishTopicLen;
     BaseType_t xWaitingForCallback;
+    uint64_t ulReportId; /* Of the report awaiting a response */
     MQTTAgentHandle_t xAgentHandle;
 };
 
@@ -186,16 +188,18 @@ static bool prvPublishDeviceMetricsReport( DefenderAgentCtx_t * pxCtx,
 /**
  * @brief Validate the response received from the AWS IoT Device Defender Service.
  *
- * This functions checks that a valid JSON is received and the report ID
+ * This functions checks that a valid CBOR map is received and the report ID
  * is same as was sent in the published report.
  *
+ * @param[in] pxCtx The context holding the ID of the published report.
  * @param[in] pcDefenderResponse The defender response to validate.
  * @param[in] ulDefenderResponseLength Length of the defender response.
  *
  * @return true if the response is valid;
  * false otherwise.
  */
-static bool prvValidateDefenderResponse( const char * pcDefenderResponse,
+static bool prvValidateDefenderResponse( const DefenderAgentCtx_t * pxCtx,
+                                         const char * pcDefenderResponse,
                                          uint32_t ulDefenderResponseLength );
 
 /**
@@ -381,7 +385,8 @@ static void prvReportAcceptedCallback( void * pvCtx,
 
         /* Check if the response is valid and is for the report we
          * published. If so, report was accepted. */
-        if( prvValidateDefenderResponse( pxPublishInfo->pPayload,
+        if( prvValidateDefenderResponse( pxCtx,
+                                         pxPublishInfo->pPayload,
                                          pxPublishInfo->payloadLength ) )
         {
             ulResponseStatus = ReportStatusAccepted;
@@ -419,7 +424,8 @@ static void prvReportRejectedCallback( void * pvCtx,
 
         /* Check if the response is valid and is for the report we
          * published. If so, report was accepted. */
-        if( prvValidateDefenderResponse( pxPublishInfo->pPayload,
+        if( prvValidateDefenderResponse( pxCtx,
+                                         pxPublishInfo->pPayload,
                                          pxPublishInfo->payloadLength ) )
         {
             ulResponseStatus = ReportStatusRejected;
@@ -493,10 +499,151 @@ static CborError prvCollectDeviceMetrics( CborEncoder * pxEncoder )
     return xError;
 }
 
+/*-----------------------------------------------------------*/
+
+#if MQTT_AGENT_METRICS_ENABLED
 
+/* Snapshots from the previous report, so that each report covers one interval */
+static MQTTAgentHistogram_t pxLastPublishHistograms[ MQTT_AGENT_NUM_PHASES ] = { 0 };
+static uint32_t ulLastDisconnects = 0;
 
 /*-----------------------------------------------------------*/
 
+/* Encode "name": [ { "number": value } ] */
+static CborError prvEncodeNumberMetric( CborEncoder * pxEncoder,
+                                        const char * pcName,
+                                        uint32_t ulValue )
+{
+    CborEncoder xListEncoder;
+    CborEncoder xValueEncoder;
+    CborError xError = CborNoError;
+
+    xError = cbor_encode_text_stringz( pxEncoder, pcName );
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encoder_create_array( pxEncoder, &xListEncoder, 1 );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encoder_create_map( &xListEncoder, &xValueEncoder, 1 );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encode_text_stringz( &xValueEncoder, "number" );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encode_uint( &xValueEncoder, ulValue );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encoder_close_container( &xListEncoder, &xValueEncoder );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encoder_close_container( pxEncoder, &xListEncoder );
+    }
+
+    return xError;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Export the MQTT agent latency of publishes over the last reporting interval
+ * as custom metrics. The metric names must be defined in AWS IoT Device
+ * Defender before they are accepted in a report.
+ */
+static CborError prvCollectCustomMetrics( CborEncoder * pxEncoder )
+{
+    static const char * const pcP90Names[ MQTT_AGENT_NUM_PHASES ] =
+    {
+        "mqtt_pub_queued_p90_ms", "mqtt_pub_send_p90_ms", "mqtt_pub_ack_p90_ms"
+    };
+    CborEncoder xMetricsEncoder;
+    CborError xError = CborNoError;
+    MQTTAgentMetrics_t xAgentMetrics;
+    uint32_t ulAcked = 0;
+
+    configASSERT( pxEncoder != NULL );
+
+    vMqttAgent_GetMetrics( &xAgentMetrics );
+
+    xError = cbor_encode_text_stringz( pxEncoder, "cmet" );
+    configASSERT_CONTINUE( xError == CborNoError );
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encoder_create_map( pxEncoder, &xMetricsEncoder, CborIndefiniteLength );
+        configASSERT_CONTINUE( xError == CborNoError );
+    }
+
+    for( uint32_t ulPhase = 0; ( ulPhase < MQTT_AGENT_NUM_PHASES ) && ( xError == CborNoError ); ulPhase++ )
+    {
+        MQTTAgentHistogram_t xHistogram;
+        MQTTAgentHistogram_t xInterval;
+
+        vMqttAgent_GetHistogram( PUBLISH, ( MQTTAgentPhase_t ) ulPhase, &xHistogram );
+
+        xInterval = xHistogram;
+        xInterval.ulCount -= pxLastPublishHistograms[ ulPhase ].ulCount;
+
+        for( uint32_t ulBucket = 0; ulBucket < MQTT_AGENT_LATENCY_BUCKETS; ulBucket++ )
+        {
+            xInterval.pulBuckets[ ulBucket ] -= pxLastPublishHistograms[ ulPhase ].pulBuckets[ ulBucket ];
+        }
+
+        pxLastPublishHistograms[ ulPhase ] = xHistogram;
+
+        if( ulPhase == MQTT_AGENT_PHASE_ACK )
+        {
+            ulAcked = xInterval.ulCount;
+        }
+
+        xError = prvEncodeNumberMetric( &xMetricsEncoder, pcP90Names[ ulPhase ],
+                                        ulMqttAgent_HistogramPercentile( &xInterval, 90U ) );
+        configASSERT_CONTINUE( xError == CborNoError );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = prvEncodeNumberMetric( &xMetricsEncoder, "mqtt_pub_acked", ulAcked );
+        configASSERT_CONTINUE( xError == CborNoError );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = prvEncodeNumberMetric( &xMetricsEncoder, "mqtt_queue_high_water", xAgentMetrics.ulQueueHighWater );
+        configASSERT_CONTINUE( xError == CborNoError );
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = prvEncodeNumberMetric( &xMetricsEncoder, "mqtt_disconnects", xAgentMetrics.ulDisconnects - ulLastDisconnects );
+        configASSERT_CONTINUE( xError == CborNoError );
+
+        ulLastDisconnects = xAgentMetrics.ulDisconnects;
+    }
+
+    if( xError == CborNoError )
+    {
+        xError = cbor_encoder_close_container( pxEncoder, &xMetricsEncoder );
+        configASSERT_CONTINUE( xError == CborNoError );
+    }
+
+    return xError;
+}
+
+/*-----------------------------------------------------------*/
+
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
 static bool prvPublishDeviceMetricsReport( DefenderAgentCtx_t * pxCtx,
                                            uint8_t * pucReportBuf,
                                            uint32_t ulReportLength )
@@ -548,15 +695,47 @@ static bool prvPublishDeviceMetricsReport( DefenderAgentCtx_t * pxCtx,
 
 /*-----------------------------------------------------------*/
 
-static bool prvValidateDefenderResponse( const char * pcDefenderResponse,
+static bool prvValidateDefenderResponse( const DefenderAgentCtx_t * pxCtx,
+                                         const char * pcDefenderResponse,
                                          uint32_t ulDefenderResponseLength )
 {
-    bool xStatus = true;
-
-    ( void ) pcDefenderResponse;
-    ( void ) ulDefenderResponseLength;
+    bool xStatus = false;
+    CborParser xParser;
+    CborValue xResponse;
+    CborValue xReportId;
+    uint64_t ulReceivedReportId = 0;
+
+    /* The response is a single map, e.g. { "thingName": "...", "reportId": 1234, "status": "ACCEPTED" }.
+     * The reportId is looked up in one pass over the map. */
+    if( cbor_parser_init( ( const uint8_t * ) pcDefenderResponse,
+                          ulDefenderResponseLength,
+                          0,
+                          &xParser,
+                          &xResponse ) != CborNoError )
+    {
+        LogError( "Failed to parse defender response." );
+    }
+    else if( cbor_value_is_map( &xResponse ) == false )
+    {
+        LogError( "Defender response is not a map." );
+    }
+    else if( ( cbor_value_map_find_value( &xResponse, RESPONSE_REPORT_ID_FIELD, &xReportId ) != CborNoError ) ||
+             ( cbor_value_is_unsigned_integer( &xReportId ) == false ) ||
+             ( cbor_value_get_uint64( &xReportId, &ulReceivedReportId ) != CborNoError ) )
+    {
+        LogError( "No %s field in defender response.", RESPONSE_REPORT_ID_FIELD );
+    }
+    else if( ulReceivedReportId != pxCtx->ulReportId )
+    {
+        LogWarn( "Ignoring defender response for report %lu, expected %lu.",
+                 ( unsigned long ) ulReceivedReportId,
+                 ( unsigned long ) pxCtx->ulReportId );
+    }
+    else
+    {
+        xStatus = true;
+    }
 
-    /* TODO: validate that report_id / reportId field matches last sent report */
     return xStatus;
 }
 
@@ -690,6 +869,14 @@ void vDefenderAgentTask( void * pvParameters )
             configASSERT_CONTINUE( xError == CborNoError );
         }
 
+#if MQTT_AGENT_METRICS_ENABLED
+        if( xError == CborNoError )
+        {
+            xError = prvCollectCustomMetrics( &xMapEncoder );
+            configASSERT_CONTINUE( xError == CborNoError );
+        }
+#endif
+
         if( xError == CborNoError )
         {
             xError = cbor_encoder_close_container( &xEncoder, &xMapEncoder );
@@ -709,6 +896,8 @@ void vDefenderAgentTask( void * pvParameters )
             size_t xLen = cbor_encoder_get_buffer_size( &xEncoder, pucReportBuffer );
             LogInfo( "Publishing defender metrics report." );
 
+            xCtx.ulReportId = ulReportId;
+
             xSuccess = prvPublishDeviceMetricsReport( &xCtx, pucReportBuffer, xLen );
 
             if( xSuccess != true )
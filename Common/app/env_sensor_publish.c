@@ -46,6 +46,7 @@
 /* MQTT library includes. */
 #include "core_mqtt.h"
 #include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
 #include "sys_evt.h"
 
 /* Subscription manager header include. */
@@ -54,28 +55,25 @@
 /* Sensor includes */
 #include "b_u585i_iot02a_env_sensors.h"
 
+#include "telemetry_format.h"
+#include "telemetry_publisher.h"
+#include "json_writer.h"
+
+#include "cbor.h"
+#include <math.h>
+
 
 #define MQTT_PUBLISH_MAX_LEN                 ( 512 )
 #define MQTT_PUBLISH_TIME_BETWEEN_MS         ( 1000 )
 #define MQTT_PUBLISH_TOPIC                   "env_sensor_data"
 #define MQTT_PUBLICH_TOPIC_STR_LEN           ( 256 )
-#define MQTT_PUBLISH_BLOCK_TIME_MS           ( 1000 )
-#define MQTT_PUBLISH_NOTIFICATION_WAIT_MS    ( 1000 )
 
-#define MQTT_NOTIFY_IDX                      ( 1 )
 #define MQTT_PUBLISH_QOS                     ( MQTTQoS0 )
 
-/*-----------------------------------------------------------*/
+/* Arena holding samples waiting to be published as one batch */
+#define TELEMETRY_BATCH_ARENA_LEN            ( 2048 )
 
-/**
- * @brief Defines the structure to use as the command callback context in this
- * demo.
- */
-struct MQTTAgentCommandContext
-{
-    MQTTStatus_t xReturnStatus;
-    TaskHandle_t xTaskToNotify;
-};
+/*-----------------------------------------------------------*/
 
 // MICHAEL - changed to soilMoisturePercent
 typedef struct
@@ -87,111 +85,10 @@ typedef struct
 //    float_t fBarometricPressure;
 } EnvironmentalSensorData_t;
 
-/*-----------------------------------------------------------*/
-
-static void prvPublishCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
-                                       MQTTAgentReturnInfo_t * pxReturnInfo )
-{
-    configASSERT( pxCommandContext != NULL );
-    configASSERT( pxReturnInfo != NULL );
-
-    pxCommandContext->xReturnStatus = pxReturnInfo->returnCode;
-
-    if( pxCommandContext->xTaskToNotify != NULL )
-    {
-        /* Send the context's ulNotificationValue as the notification value so
-         * the receiving task can check the value it set in the context matches
-         * the value it receives in the notification. */
-        ( void ) xTaskNotifyGiveIndexed( pxCommandContext->xTaskToNotify,
-                                         MQTT_NOTIFY_IDX );
-    }
-}
-
-/*-----------------------------------------------------------*/
-
-static BaseType_t prvPublishAndWaitForAck( MQTTAgentHandle_t xAgentHandle,
-                                           const char * pcTopic,
-                                           const void * pvPublishData,
-                                           size_t xPublishDataLen )
-{
-    BaseType_t xResult = pdFALSE;
-    MQTTStatus_t xStatus;
-
-    configASSERT( pcTopic != NULL );
-    configASSERT( pvPublishData != NULL );
-    configASSERT( xPublishDataLen > 0 );
-
-    MQTTPublishInfo_t xPublishInfo =
-    {
-        .qos             = MQTT_PUBLISH_QOS,
-        .retain          = 0,
-        .dup             = 0,
-        .pTopicName      = pcTopic,
-        .topicNameLength = strlen( pcTopic ),
-        .pPayload        = pvPublishData,
-        .payloadLength   = xPublishDataLen
-    };
-
-    MQTTAgentCommandContext_t xCommandContext =
-    {
-        .xTaskToNotify = xTaskGetCurrentTaskHandle(),
-        .xReturnStatus = MQTTIllegalState,
-    };
-
-    MQTTAgentCommandInfo_t xCommandParams =
-    {
-        .blockTimeMs                 = MQTT_PUBLISH_BLOCK_TIME_MS,
-        .cmdCompleteCallback         = prvPublishCommandCallback,
-        .pCmdCompleteCallbackContext = &xCommandContext,
-    };
-
-    /* Clear the notification index */
-    xTaskNotifyStateClearIndexed( NULL, MQTT_NOTIFY_IDX );
-
-
-    xStatus = MQTTAgent_Publish( xAgentHandle,
-                                 &xPublishInfo,
-                                 &xCommandParams );
-
-    if( xStatus == MQTTSuccess )
-    {
-        xResult = ulTaskNotifyTakeIndexed( MQTT_NOTIFY_IDX,
-                                           pdTRUE,
-                                           pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-
-        if( xResult == 0 )
-        {
-            LogError( "Timed out while waiting for publish ACK or Sent event. xTimeout = %d",
-                      pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-            xResult = pdFALSE;
-        }
-        else if( xCommandContext.xReturnStatus != MQTTSuccess )
-        {
-            LogError( "MQTT Agent returned error code: %d during publish operation.",
-                      xCommandContext.xReturnStatus );
-            xResult = pdFALSE;
-        }
-    }
-    else
-    {
-        LogError( "MQTTAgent_Publish returned error code: %d.",
-                  xStatus );
-    }
-
-    return xResult;
-}
+/* Number of float fields in EnvironmentalSensorData_t checked by the report policy */
+#define ENV_SENSOR_NUM_VALUES    ( sizeof( EnvironmentalSensorData_t ) / sizeof( float_t ) )
 
-static BaseType_t xIsMqttConnected( void )
-{
-    /* Wait for MQTT to be connected */
-    EventBits_t uxEvents = xEventGroupWaitBits( xSystemEvents,
-                                                EVT_MASK_MQTT_CONNECTED,
-                                                pdFALSE,
-                                                pdTRUE,
-                                                0 );
-
-    return( ( uxEvents & EVT_MASK_MQTT_CONNECTED ) == EVT_MASK_MQTT_CONNECTED );
-}
+static char pcBatchArena[ TELEMETRY_BATCH_ARENA_LEN ];
 
 /*-----------------------------------------------------------*/
 
@@ -245,6 +142,65 @@ static BaseType_t xUpdateSensorData( EnvironmentalSensorData_t * pxData )
 
 /*-----------------------------------------------------------*/
 
+/* { "soil_moisture_pecent": 42.17 } */
+static int prvFormatSensorData( char * pcBuffer,
+                                size_t uxBufferLen,
+                                const EnvironmentalSensorData_t * pxData )
+{
+    JsonWriter_t xWriter;
+    int lWritten = 0;
+
+    vJsonWriter_Init( &xWriter, pcBuffer, uxBufferLen );
+
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_Fixed( &xWriter, "soil_moisture_pecent",
+                       ( int32_t ) lroundf( pxData->soilMoisturePercent * TELEMETRY_FIXED_POINT_SCALE ), 2 );
+    vJsonWriter_EndObject( &xWriter );
+
+    lWritten = ( int ) uxJsonWriter_Finish( &xWriter );
+
+    if( lWritten == 0 )
+    {
+        /* Report as truncated, like snprintf */
+        lWritten = ( int ) uxBufferLen;
+    }
+
+    return lWritten;
+}
+
+/*-----------------------------------------------------------*/
+
+/* { TLM_KEY_MOISTURE: percent * 100 } */
+static int prvEncodeSensorDataCbor( uint8_t * pucBuffer,
+                                    size_t uxBufferLen,
+                                    const EnvironmentalSensorData_t * pxData )
+{
+    CborEncoder xEncoder;
+    CborEncoder xMapEncoder;
+    CborError xError = CborNoError;
+    int lWritten = 0;
+
+    cbor_encoder_init( &xEncoder, pucBuffer, uxBufferLen, 0 );
+
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, 1 );
+    xError |= cbor_encode_uint( &xMapEncoder, TLM_KEY_MOISTURE );
+    xError |= cbor_encode_int( &xMapEncoder, ( int64_t ) lroundf( pxData->soilMoisturePercent * TELEMETRY_FIXED_POINT_SCALE ) );
+    xError |= cbor_encoder_close_container( &xEncoder, &xMapEncoder );
+
+    if( xError == CborNoError )
+    {
+        lWritten = ( int ) cbor_encoder_get_buffer_size( &xEncoder, pucBuffer );
+    }
+    else
+    {
+        lWritten = -1;
+    }
+
+    return lWritten;
+}
+
+/*-----------------------------------------------------------*/
+
 extern UBaseType_t uxRand( void );
 
 void vEnvironmentSensorPublishTask( void * pvParameters )
@@ -252,9 +208,10 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
     BaseType_t xResult = pdFALSE;
     BaseType_t xExitFlag = pdFALSE;
     char payloadBuf[ MQTT_PUBLISH_MAX_LEN ];
-    MQTTAgentHandle_t xAgentHandle = NULL;
     char pcTopicString[ MQTT_PUBLICH_TOPIC_STR_LEN ] = { 0 };
     size_t uxTopicLen = 0;
+    TelemetryStream_t xStream;
+    TelemetryFormat_t xFormat = xTelemetryFormat_Get();
 
     ( void ) pvParameters;
 
@@ -271,6 +228,7 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
     if( uxTopicLen > 0 )
     {
         uxTopicLen = strlcat( pcTopicString, "/" MQTT_PUBLISH_TOPIC, MQTT_PUBLICH_TOPIC_STR_LEN );
+        uxTopicLen = uxTelemetryFormat_AppendTopicSuffix( pcTopicString, MQTT_PUBLICH_TOPIC_STR_LEN, xFormat );
     }
 
     if( ( uxTopicLen == 0 ) || ( uxTopicLen >= MQTT_PUBLICH_TOPIC_STR_LEN ) )
@@ -281,7 +239,9 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
 
     vSleepUntilMQTTAgentReady();
 
-    xAgentHandle = xGetMqttAgentHandle();
+
+    vTelemetryStream_Init( &xStream, "environmental sensor", pcTopicString, MQTT_PUBLISH_QOS, CS_ENV_DEADBAND,
+                           ENV_SENSOR_NUM_VALUES, pcBatchArena, TELEMETRY_BATCH_ARENA_LEN, xFormat );
 
     while( xExitFlag == pdFALSE )
     {
@@ -290,6 +250,9 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
 
         vTaskSetTimeOutState( &xTimeOut );
 
+        /* Pick up changes made from the CLI or the device shadow */
+        vTelemetryStream_LoadConfig( &xStream );
+
         EnvironmentalSensorData_t xEnvData;
         xResult = xUpdateSensorData( &xEnvData );
 
@@ -297,23 +260,30 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
         {
             LogError( "Error while reading sensor data." );
         }
-        else if( xIsMqttConnected() == pdTRUE )
+        else if( xTelemetryStream_ShouldReport( &xStream, ( const float * ) &xEnvData ) == pdTRUE )
         {
             int bytesWritten = 0;
 
-            /* Write to */
-            // MICHAEL - changed output for soil moisture
-            bytesWritten = snprintf( payloadBuf,
-                                     MQTT_PUBLISH_MAX_LEN,
-                                     "{ \"soil_moisture_pecent\": %f }",
-                                     xEnvData.soilMoisturePercent );
+            if( xFormat == TELEMETRY_FORMAT_CBOR )
+            {
+                bytesWritten = prvEncodeSensorDataCbor( ( uint8_t * ) payloadBuf,
+                                                        MQTT_PUBLISH_MAX_LEN,
+                                                        &xEnvData );
+            }
+            else
+            {
+                bytesWritten = prvFormatSensorData( payloadBuf,
+                                                    MQTT_PUBLISH_MAX_LEN,
+                                                    &xEnvData );
+            }
 
-            if( bytesWritten < MQTT_PUBLISH_MAX_LEN )
+            if( ( bytesWritten > 0 ) && ( bytesWritten < MQTT_PUBLISH_MAX_LEN ) )
             {
-                xResult = prvPublishAndWaitForAck( xAgentHandle,
-                                                   pcTopicString,
-                                                   payloadBuf,
-                                                   bytesWritten );
+                if( ( xTelemetryStream_Add( &xStream, payloadBuf, ( size_t ) bytesWritten, ( const float * ) &xEnvData ) == pdTRUE ) &&
+                    ( xFormat == TELEMETRY_FORMAT_JSON ) )
+                {
+                    LogDebug( "%.*s", bytesWritten, payloadBuf );
+                }
             }
             else if( bytesWritten > 0 )
             {
@@ -321,15 +291,12 @@ void vEnvironmentSensorPublishTask( void * pvParameters )
             }
             else
             {
-                LogError( "Printf call failed." );
-            }
-
-            if( xResult == pdTRUE )
-            {
-                LogDebug( payloadBuf );
+                LogError( "Failed to encode sensor data." );
             }
         }
 
+        vTelemetryStream_FlushIfDue( &xStream );
+
         /* Adjust remaining tick count */
         if( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdFALSE )
         {
@@ -61,6 +61,12 @@
 /* Sensor includes */
 #include "b_u585i_iot02a_motion_sensors.h"
 
+#include "telemetry_format.h"
+#include "telemetry_publisher.h"
+#include "json_writer.h"
+
+#include "cbor.h"
+
 /**
  * @brief Size of statically allocated buffers for holding topic names and
  * payloads.
@@ -68,132 +74,117 @@
 #define MQTT_PUBLISH_MAX_LEN                 ( 200 )
 #define MQTT_PUBLISH_PERIOD_MS               ( 500 )
 #define MQTT_PUBLICH_TOPIC_STR_LEN           ( 256 )
-#define MQTT_PUBLISH_BLOCK_TIME_MS           ( 200 )
-#define MQTT_PUBLISH_NOTIFICATION_WAIT_MS    ( 1000 )
-#define MQTT_NOTIFY_IDX                      ( 1 )
 #define MQTT_PUBLISH_QOS                     ( MQTTQoS0 )
 
+/* Three axes for each of the accelerometer, gyroscope and magnetometer */
+#define MOTION_SENSOR_NUM_VALUES             ( 9 )
+
+/* Arena holding samples waiting to be published as one batch */
+#define TELEMETRY_BATCH_ARENA_LEN            ( 2048 )
+
+static char pcBatchArena[ TELEMETRY_BATCH_ARENA_LEN ];
+
 
 /*-----------------------------------------------------------*/
 
-/**
- * @brief Defines the structure to use as the command callback context in this
- * demo.
- */
-struct MQTTAgentCommandContext
+/*-----------------------------------------------------------*/
+static void prvFormatAxes( JsonWriter_t * pxWriter,
+                           const char * pcKey,
+                           const BSP_MOTION_SENSOR_Axes_t * pxAxes )
 {
-    MQTTStatus_t xReturnStatus;
-    TaskHandle_t xTaskToNotify;
-    uint32_t ulNotificationValue;
-};
+    vJsonWriter_BeginObject( pxWriter, pcKey );
+    vJsonWriter_Int( pxWriter, "x", pxAxes->x );
+    vJsonWriter_Int( pxWriter, "y", pxAxes->y );
+    vJsonWriter_Int( pxWriter, "z", pxAxes->z );
+    vJsonWriter_EndObject( pxWriter );
+}
 
 /*-----------------------------------------------------------*/
-static void prvPublishCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
-                                       MQTTAgentReturnInfo_t * pxReturnInfo )
+
+/* { "acceleration_mG": { "x": .., "y": .., "z": .. }, "gyro_mDPS": { .. }, "magnetometer_mGauss": { .. } } */
+static int prvFormatMotion( char * pcBuffer,
+                            size_t uxBufferLen,
+                            const BSP_MOTION_SENSOR_Axes_t * pxAccelero,
+                            const BSP_MOTION_SENSOR_Axes_t * pxGyro,
+                            const BSP_MOTION_SENSOR_Axes_t * pxMagneto )
 {
-    TaskHandle_t xTaskHandle = ( TaskHandle_t ) pxCommandContext;
+    JsonWriter_t xWriter;
+    int lWritten = 0;
+
+    vJsonWriter_Init( &xWriter, pcBuffer, uxBufferLen );
 
-    configASSERT( pxReturnInfo != NULL );
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    prvFormatAxes( &xWriter, "acceleration_mG", pxAccelero );
+    prvFormatAxes( &xWriter, "gyro_mDPS", pxGyro );
+    prvFormatAxes( &xWriter, "magnetometer_mGauss", pxMagneto );
+    vJsonWriter_EndObject( &xWriter );
 
-    uint32_t ulNotifyValue = pxReturnInfo->returnCode;
+    lWritten = ( int ) uxJsonWriter_Finish( &xWriter );
 
-    if( xTaskHandle != NULL )
+    if( lWritten == 0 )
     {
-        /* Send the context's ulNotificationValue as the notification value so
-         * the receiving task can check the value it set in the context matches
-         * the value it receives in the notification. */
-        ( void ) xTaskNotifyIndexed( xTaskHandle,
-                                     MQTT_NOTIFY_IDX,
-                                     ulNotifyValue,
-                                     eSetValueWithOverwrite );
+        /* Report as truncated, like snprintf */
+        lWritten = ( int ) uxBufferLen;
     }
+
+    return lWritten;
 }
 
 /*-----------------------------------------------------------*/
 
-static BaseType_t prvPublishAndWaitForAck( MQTTAgentHandle_t xAgentHandle,
-                                           const char * pcTopic,
-                                           const void * pvPublishData,
-                                           size_t xPublishDataLen )
+static CborError prvEncodeAxesCbor( CborEncoder * pxMapEncoder,
+                                    uint64_t ullKey,
+                                    const BSP_MOTION_SENSOR_Axes_t * pxAxes )
 {
-    MQTTStatus_t xStatus;
-    size_t uxTopicLen = 0;
-
-    configASSERT( pcTopic != NULL );
-    configASSERT( pvPublishData != NULL );
-    configASSERT( xPublishDataLen > 0 );
+    CborEncoder xArrayEncoder;
+    CborError xError = CborNoError;
 
-    uxTopicLen = strnlen( pcTopic, UINT16_MAX );
+    xError = cbor_encode_uint( pxMapEncoder, ullKey );
+    xError |= cbor_encoder_create_array( pxMapEncoder, &xArrayEncoder, 3 );
+    xError |= cbor_encode_int( &xArrayEncoder, pxAxes->x );
+    xError |= cbor_encode_int( &xArrayEncoder, pxAxes->y );
+    xError |= cbor_encode_int( &xArrayEncoder, pxAxes->z );
+    xError |= cbor_encoder_close_container( pxMapEncoder, &xArrayEncoder );
 
-    MQTTPublishInfo_t xPublishInfo =
-    {
-        .qos             = MQTT_PUBLISH_QOS,
-        .retain          = 0,
-        .dup             = 0,
-        .pTopicName      = pcTopic,
-        .topicNameLength = ( uint16_t ) uxTopicLen,
-        .pPayload        = pvPublishData,
-        .payloadLength   = xPublishDataLen
-    };
-
-    MQTTAgentCommandInfo_t xCommandParams =
-    {
-        .blockTimeMs                 = MQTT_PUBLISH_BLOCK_TIME_MS,
-        .cmdCompleteCallback         = prvPublishCommandCallback,
-        .pCmdCompleteCallbackContext = ( void * ) xTaskGetCurrentTaskHandle(),
-    };
+    return xError;
+}
 
-    if( xPublishInfo.qos > MQTTQoS0 )
-    {
-        xCommandParams.pCmdCompleteCallbackContext = ( void * ) xTaskGetCurrentTaskHandle();
-    }
+/*-----------------------------------------------------------*/
 
-    /* Clear the notification index */
-    xTaskNotifyStateClearIndexed( NULL, MQTT_NOTIFY_IDX );
+/* { TLM_KEY_ACCEL: [ x, y, z ], TLM_KEY_GYRO: [ x, y, z ], TLM_KEY_MAGNETO: [ x, y, z ] } */
+static int prvEncodeMotionCbor( uint8_t * pucBuffer,
+                                size_t uxBufferLen,
+                                const BSP_MOTION_SENSOR_Axes_t * pxAccelero,
+                                const BSP_MOTION_SENSOR_Axes_t * pxGyro,
+                                const BSP_MOTION_SENSOR_Axes_t * pxMagneto )
+{
+    CborEncoder xEncoder;
+    CborEncoder xMapEncoder;
+    CborError xError = CborNoError;
+    int lWritten = 0;
 
+    cbor_encoder_init( &xEncoder, pucBuffer, uxBufferLen, 0 );
 
-    xStatus = MQTTAgent_Publish( xAgentHandle,
-                                 &xPublishInfo,
-                                 &xCommandParams );
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, 3 );
+    xError |= prvEncodeAxesCbor( &xMapEncoder, TLM_KEY_ACCEL, pxAccelero );
+    xError |= prvEncodeAxesCbor( &xMapEncoder, TLM_KEY_GYRO, pxGyro );
+    xError |= prvEncodeAxesCbor( &xMapEncoder, TLM_KEY_MAGNETO, pxMagneto );
+    xError |= cbor_encoder_close_container( &xEncoder, &xMapEncoder );
 
-    if( xStatus == MQTTSuccess )
+    if( xError == CborNoError )
     {
-        uint32_t ulNotifyValue = 0;
-        BaseType_t xResult = pdFALSE;
-
-        xResult = xTaskNotifyWaitIndexed( MQTT_NOTIFY_IDX,
-                                          0xFFFFFFFF,
-                                          0xFFFFFFFF,
-                                          &ulNotifyValue,
-                                          pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-
-        if( xResult )
-        {
-            xStatus = ( MQTTStatus_t ) ulNotifyValue;
-
-            if( xStatus != MQTTSuccess )
-            {
-                LogError( "MQTT Agent returned error code: %d during publish operation.",
-                          xStatus );
-                xResult = pdFALSE;
-            }
-        }
-        else
-        {
-            LogError( "Timed out while waiting for publish ACK or Sent event. xTimeout = %d",
-                      pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-            xResult = pdFALSE;
-        }
+        lWritten = ( int ) cbor_encoder_get_buffer_size( &xEncoder, pucBuffer );
     }
     else
     {
-        LogError( "MQTTAgent_Publish returned error code: %d.", xStatus );
+        lWritten = -1;
     }
 
-    return( xStatus == MQTTSuccess );
+    return lWritten;
 }
 
 /*-----------------------------------------------------------*/
+
 static BaseType_t xInitSensors( void )
 {
     int32_t lBspError = BSP_ERROR_NONE;
@@ -220,11 +211,12 @@ void vMotionSensorsPublish( void * pvParameters )
     BaseType_t xResult = pdFALSE;
     BaseType_t xExitFlag = pdFALSE;
 
-    MQTTAgentHandle_t xAgentHandle = NULL;
     char pcPayloadBuf[ MQTT_PUBLISH_MAX_LEN ];
     char pcTopicString[ MQTT_PUBLICH_TOPIC_STR_LEN ] = { 0 };
     char * pcDeviceId = NULL;
     int lTopicLen = 0;
+    TelemetryStream_t xStream;
+    TelemetryFormat_t xFormat = xTelemetryFormat_Get();
 
     xResult = xInitSensors();
 
@@ -243,6 +235,11 @@ void vMotionSensorsPublish( void * pvParameters )
     else
     {
         lTopicLen = snprintf( pcTopicString, ( size_t ) MQTT_PUBLICH_TOPIC_STR_LEN, "%s/motion_sensor_data", pcDeviceId );
+
+        if( ( lTopicLen > 0 ) && ( lTopicLen < MQTT_PUBLICH_TOPIC_STR_LEN ) )
+        {
+            lTopicLen = ( int ) uxTelemetryFormat_AppendTopicSuffix( pcTopicString, MQTT_PUBLICH_TOPIC_STR_LEN, xFormat );
+        }
     }
 
     if( ( lTopicLen <= 0 ) || ( lTopicLen > MQTT_PUBLICH_TOPIC_STR_LEN ) )
@@ -253,7 +250,9 @@ void vMotionSensorsPublish( void * pvParameters )
 
     vSleepUntilMQTTAgentReady();
 
-    xAgentHandle = xGetMqttAgentHandle();
+
+    vTelemetryStream_Init( &xStream, "motion sensor", pcTopicString, MQTT_PUBLISH_QOS, CS_MOTION_DEADBAND,
+                           MOTION_SENSOR_NUM_VALUES, pcBatchArena, TELEMETRY_BATCH_ARENA_LEN, xFormat );
 
     while( xExitFlag == pdFALSE )
     {
@@ -261,53 +260,50 @@ void vMotionSensorsPublish( void * pvParameters )
         int32_t lBspError = BSP_ERROR_NONE;
         BSP_MOTION_SENSOR_Axes_t xAcceleroAxes, xGyroAxes, xMagnetoAxes;
 
+        /* Pick up changes made from the CLI or the device shadow */
+        vTelemetryStream_LoadConfig( &xStream );
+
         lBspError = BSP_MOTION_SENSOR_GetAxes( 0, MOTION_GYRO, &xGyroAxes );
         lBspError |= BSP_MOTION_SENSOR_GetAxes( 0, MOTION_ACCELERO, &xAcceleroAxes );
         lBspError |= BSP_MOTION_SENSOR_GetAxes( 1, MOTION_MAGNETO, &xMagnetoAxes );
 
-        if( lBspError == BSP_ERROR_NONE )
+        const float pfValues[ MOTION_SENSOR_NUM_VALUES ] =
+        {
+            ( float ) xAcceleroAxes.x, ( float ) xAcceleroAxes.y, ( float ) xAcceleroAxes.z,
+            ( float ) xGyroAxes.x,     ( float ) xGyroAxes.y,     ( float ) xGyroAxes.z,
+            ( float ) xMagnetoAxes.x,  ( float ) xMagnetoAxes.y,  ( float ) xMagnetoAxes.z,
+        };
+
+        if( ( lBspError == BSP_ERROR_NONE ) &&
+            ( xTelemetryStream_ShouldReport( &xStream, pfValues ) == pdTRUE ) )
         {
-            int lbytesWritten = snprintf( pcPayloadBuf,
-                                          MQTT_PUBLISH_MAX_LEN,
-                                          "{"
-                                          "\"acceleration_mG\":"
-                                          "{"
-                                          "\"x\": %ld,"
-                                          "\"y\": %ld,"
-                                          "\"z\": %ld"
-                                          "},"
-                                          "\"gyro_mDPS\":"
-                                          "{"
-                                          "\"x\": %ld,"
-                                          "\"y\": %ld,"
-                                          "\"z\": %ld"
-                                          "},"
-                                          "\"magnetometer_mGauss\":"
-                                          "{"
-                                          "\"x\": %ld,"
-                                          "\"y\": %ld,"
-                                          "\"z\": %ld"
-                                          "}"
-                                          "}",
-                                          xAcceleroAxes.x, xAcceleroAxes.y, xAcceleroAxes.z,
-                                          xGyroAxes.x, xGyroAxes.y, xGyroAxes.z,
-                                          xMagnetoAxes.x, xMagnetoAxes.y, xMagnetoAxes.z );
-
-            if( ( lbytesWritten < MQTT_PUBLISH_MAX_LEN ) &&
-                ( xIsMqttAgentConnected() == pdTRUE ) )
+            int lbytesWritten = 0;
+
+            if( xFormat == TELEMETRY_FORMAT_CBOR )
             {
-                xResult = prvPublishAndWaitForAck( xAgentHandle,
-                                                   pcTopicString,
-                                                   pcPayloadBuf,
-                                                   ( size_t ) lbytesWritten );
-
-                if( xResult != pdPASS )
-                {
-                    LogError( "Failed to publish motion sensor data" );
-                }
+                lbytesWritten = prvEncodeMotionCbor( ( uint8_t * ) pcPayloadBuf,
+                                                     MQTT_PUBLISH_MAX_LEN,
+                                                     &xAcceleroAxes,
+                                                     &xGyroAxes,
+                                                     &xMagnetoAxes );
+            }
+            else
+            {
+                lbytesWritten = prvFormatMotion( pcPayloadBuf,
+                                                 MQTT_PUBLISH_MAX_LEN,
+                                                 &xAcceleroAxes,
+                                                 &xGyroAxes,
+                                                 &xMagnetoAxes );
+            }
+
+            if( ( lbytesWritten > 0 ) && ( lbytesWritten < MQTT_PUBLISH_MAX_LEN ) )
+            {
+                ( void ) xTelemetryStream_Add( &xStream, pcPayloadBuf, ( size_t ) lbytesWritten, pfValues );
             }
         }
 
+        vTelemetryStream_FlushIfDue( &xStream );
+
         vTaskDelay( pdMS_TO_TICKS( MQTT_PUBLISH_PERIOD_MS ) );
     }
 
@@ -27,6 +27,13 @@
 /**
  * @file freertos_command_pool.c
  * @brief Implements functions to obtain and release commands.
+ *
+ * Free commands are kept on a singly linked free list whose head is updated
+ * with compare-and-swap, so obtaining and releasing a command does not go
+ * through a queue or the scheduler. The head holds the index of the first
+ * free command in its low half and a tag, incremented on every update, in its
+ * high half to guard against ABA. A counting semaphore is only used to wake
+ * tasks that wait for a command while the pool is exhausted.
  */
 
 #include "logging_levels.h"
@@ -42,36 +49,205 @@
 
 /* Kernel includes. */
 #include "FreeRTOS.h"
+#include "task.h"
 #include "semphr.h"
+#include "atomic.h"
+
+#include "kvstore.h"
 
 /* Header include. */
 #include "freertos_command_pool.h"
 
+#define POOL_IDX_NONE                  ( 0xFFFFUL )
+#define POOL_HEAD_IDX( ulHead )        ( ( ulHead ) & 0xFFFFUL )
+#define POOL_HEAD_TAG( ulHead )        ( ( ulHead ) >> 16 )
+#define POOL_HEAD( ulTag, ulIdx )      ( ( ( ulTag ) << 16 ) | ( ( ulIdx ) & 0xFFFFUL ) )
+
 /**
  * @brief The pool of command structures used to hold information on commands (such
  * as PUBLISH or SUBSCRIBE) between the command being created by an API call and
  * completion of the command by the execution of the command's callback.
  */
-static MQTTAgentCommand_t commandStructurePool[ MQTT_COMMAND_CONTEXTS_POOL_SIZE ];
+static MQTTAgentCommand_t * pxCommandPool = NULL;
+static uint16_t * pusNextFree = NULL;
+static size_t uxCommandPoolSize = 0;
+
+static volatile uint32_t ulFreeHead = POOL_HEAD( 0UL, POOL_IDX_NONE );
+static SemaphoreHandle_t xReleaseSemaphore = NULL;
+static volatile uint32_t ulWaitingTasks = 0;
+
+static volatile uint32_t ulInUse = 0;
+static volatile uint32_t ulHighWater = 0;
+static volatile uint32_t ulExhausted = 0;
+static volatile uint32_t ulWaits = 0;
+static volatile uint32_t ulWaitTimeouts = 0;
+static volatile uint32_t ulWaitMsTotal = 0;
+static volatile uint32_t ulWaitMsMax = 0;
+
+/*-----------------------------------------------------------*/
+
+/* Raise *pulMax to ulValue unless another task already raised it further */
+static void prvAtomicMax( uint32_t volatile * pulMax,
+                          uint32_t ulValue )
+{
+    uint32_t ulCurrent = *pulMax;
 
-static QueueHandle_t xCommandPoolQueue = NULL;
+    while( ( ulValue > ulCurrent ) &&
+           ( Atomic_CompareAndSwap_u32( pulMax, ulValue, ulCurrent ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+    {
+        ulCurrent = *pulMax;
+    }
+}
 
 /*-----------------------------------------------------------*/
 
-void Agent_InitializePool( void )
+static MQTTAgentCommand_t * prvPopFree( void )
 {
-    if( xCommandPoolQueue == NULL )
+    MQTTAgentCommand_t * pxCommand = NULL;
+    uint32_t ulHead = ulFreeHead;
+
+    while( ( pxCommand == NULL ) &&
+           ( POOL_HEAD_IDX( ulHead ) != POOL_IDX_NONE ) )
     {
-        xCommandPoolQueue = xQueueCreate( MQTT_COMMAND_CONTEXTS_POOL_SIZE, sizeof( MQTTAgentCommand_t * ) );
+        uint32_t ulIdx = POOL_HEAD_IDX( ulHead );
+        uint32_t ulNewHead = POOL_HEAD( POOL_HEAD_TAG( ulHead ) + 1UL, pusNextFree[ ulIdx ] );
 
-        /* Populate the queue with pointers to each command structure. */
-        for( uint32_t ulIdx = 0; ulIdx < MQTT_COMMAND_CONTEXTS_POOL_SIZE; ulIdx++ )
+        if( Atomic_CompareAndSwap_u32( &ulFreeHead, ulNewHead, ulHead ) == ATOMIC_COMPARE_AND_SWAP_SUCCESS )
+        {
+            pxCommand = &( pxCommandPool[ ulIdx ] );
+        }
+        else
         {
-            MQTTAgentCommand_t * pCommand = &commandStructurePool[ ulIdx ];
+            ulHead = ulFreeHead;
+        }
+    }
+
+    if( pxCommand != NULL )
+    {
+        prvAtomicMax( &ulHighWater, Atomic_Increment_u32( &ulInUse ) + 1UL );
+    }
+
+    return pxCommand;
+}
+
+/*-----------------------------------------------------------*/
 
-            ( void ) xQueueSend( xCommandPoolQueue, &pCommand, 0U );
+static void prvPushFree( uint32_t ulIdx )
+{
+    uint32_t ulHead = 0;
+
+    ( void ) Atomic_Decrement_u32( &ulInUse );
+
+    do
+    {
+        ulHead = ulFreeHead;
+        pusNextFree[ ulIdx ] = ( uint16_t ) POOL_HEAD_IDX( ulHead );
+    }
+    while( Atomic_CompareAndSwap_u32( &ulFreeHead,
+                                      POOL_HEAD( POOL_HEAD_TAG( ulHead ) + 1UL, ulIdx ),
+                                      ulHead ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS );
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTAgentCommand_t * prvWaitForFree( TickType_t xTicksToWait )
+{
+    MQTTAgentCommand_t * pxCommand = NULL;
+    TickType_t xStartTime = xTaskGetTickCount();
+    TimeOut_t xTimeOut;
+    uint32_t ulWaitMs = 0;
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    /* Register as a waiter before checking the list again, so a command
+     * released in between is either seen here or signalled. */
+    ( void ) Atomic_Increment_u32( &ulWaitingTasks );
+
+    pxCommand = prvPopFree();
+
+    while( ( pxCommand == NULL ) &&
+           ( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdFALSE ) )
+    {
+        ( void ) xSemaphoreTake( xReleaseSemaphore, xTicksToWait );
+        pxCommand = prvPopFree();
+    }
+
+    ( void ) Atomic_Decrement_u32( &ulWaitingTasks );
+
+    ulWaitMs = ( uint32_t ) ( ( xTaskGetTickCount() - xStartTime ) * portTICK_PERIOD_MS );
+
+    ( void ) Atomic_Increment_u32( &ulWaits );
+    ( void ) Atomic_Add_u32( &ulWaitMsTotal, ulWaitMs );
+    prvAtomicMax( &ulWaitMsMax, ulWaitMs );
+
+    if( pxCommand == NULL )
+    {
+        ( void ) Atomic_Increment_u32( &ulWaitTimeouts );
+    }
+
+    return pxCommand;
+}
+
+/*-----------------------------------------------------------*/
+
+bool Agent_InitializePool( void )
+{
+    if( pxCommandPool == NULL )
+    {
+        BaseType_t xSuccess = pdFALSE;
+        size_t uxPoolSize = ( size_t ) KVStore_getUInt32( CS_MQTT_CMD_POOL, &xSuccess );
+
+        if( ( xSuccess == pdFALSE ) || ( uxPoolSize == 0 ) )
+        {
+            uxPoolSize = MQTT_COMMAND_CONTEXTS_POOL_SIZE;
+        }
+        else if( uxPoolSize > MQTT_COMMAND_POOL_LIMIT )
+        {
+            uxPoolSize = MQTT_COMMAND_POOL_LIMIT;
+        }
+        else
+        {
+            /* Empty */
+        }
+
+        pxCommandPool = pvPortMalloc( sizeof( MQTTAgentCommand_t ) * uxPoolSize );
+        pusNextFree = pvPortMalloc( sizeof( uint16_t ) * uxPoolSize );
+        xReleaseSemaphore = xSemaphoreCreateCounting( uxPoolSize, 0 );
+
+        if( ( pxCommandPool == NULL ) ||
+            ( pusNextFree == NULL ) ||
+            ( xReleaseSemaphore == NULL ) )
+        {
+            LogError( "Failed to allocate a command pool of %lu entries.", ( unsigned long ) uxPoolSize );
+
+            vPortFree( pxCommandPool );
+            vPortFree( pusNextFree );
+
+            if( xReleaseSemaphore != NULL )
+            {
+                vSemaphoreDelete( xReleaseSemaphore );
+            }
+
+            pxCommandPool = NULL;
+            pusNextFree = NULL;
+            xReleaseSemaphore = NULL;
+        }
+        else
+        {
+            memset( pxCommandPool, 0, sizeof( MQTTAgentCommand_t ) * uxPoolSize );
+
+            /* Link every command structure into the free list. */
+            for( uint32_t ulIdx = 0; ulIdx < uxPoolSize; ulIdx++ )
+            {
+                pusNextFree[ ulIdx ] = ( uint16_t ) ( ( ( ulIdx + 1UL ) < uxPoolSize ) ? ( ulIdx + 1UL ) : POOL_IDX_NONE );
+            }
+
+            uxCommandPoolSize = uxPoolSize;
+            ulFreeHead = POOL_HEAD( 0UL, 0UL );
         }
     }
+
+    return( pxCommandPool != NULL );
 }
 
 /*-----------------------------------------------------------*/
@@ -80,16 +256,28 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t ulBlockTimeMs )
 {
     MQTTAgentCommand_t * pxCommandStruct = NULL;
 
-    if( xCommandPoolQueue )
+    if( pxCommandPool )
     {
-        if( !xQueueReceive( xCommandPoolQueue, &pxCommandStruct, pdMS_TO_TICKS( ulBlockTimeMs ) ) )
+        pxCommandStruct = prvPopFree();
+
+        if( pxCommandStruct == NULL )
         {
-            LogError( ( "No command structure available." ) );
+            ( void ) Atomic_Increment_u32( &ulExhausted );
+
+            if( ulBlockTimeMs > 0 )
+            {
+                pxCommandStruct = prvWaitForFree( pdMS_TO_TICKS( ulBlockTimeMs ) );
+            }
+        }
+
+        if( pxCommandStruct == NULL )
+        {
+            LogError( "No command structure available." );
         }
     }
     else
     {
-        LogError( ( "Command pool not initialized." ) );
+        LogError( "Command pool not initialized." );
     }
 
     return pxCommandStruct;
@@ -99,25 +287,64 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t ulBlockTimeMs )
 
 bool Agent_ReleaseCommand( MQTTAgentCommand_t * pCommandToRelease )
 {
-    BaseType_t xStructReturned = pdFALSE;
+    bool xStructReturned = false;
 
-    if( !xCommandPoolQueue )
+    if( !pxCommandPool )
     {
-        LogError( ( "Command pool not initialized." ) );
+        LogError( "Command pool not initialized." );
     }
     /* See if the structure being returned is actually from the pool. */
-    else if( ( pCommandToRelease < commandStructurePool ) ||
-             ( pCommandToRelease > ( commandStructurePool + MQTT_COMMAND_CONTEXTS_POOL_SIZE ) ) )
+    else if( ( pCommandToRelease < pxCommandPool ) ||
+             ( pCommandToRelease >= ( pxCommandPool + uxCommandPoolSize ) ) )
     {
-        LogError( ( "Provided pointer: %p does not belong to the command pool.", pCommandToRelease ) );
+        LogError( "Provided pointer: %p does not belong to the command pool.", pCommandToRelease );
     }
     else
     {
-        xStructReturned = xQueueSend( xCommandPoolQueue, &pCommandToRelease, 0U );
+        uint32_t ulIdx = ( uint32_t ) ( pCommandToRelease - pxCommandPool );
+
+        prvPushFree( ulIdx );
+        xStructReturned = true;
+
+        if( ulWaitingTasks > 0 )
+        {
+            ( void ) xSemaphoreGive( xReleaseSemaphore );
+        }
 
-        LogDebug( ( "Returned Command Context %d to pool",
-                    ( int ) ( pCommandToRelease - commandStructurePool ) ) );
+        LogDebug( "Returned Command Context %lu to pool", ulIdx );
     }
 
-    return ( bool ) xStructReturned;
+    return xStructReturned;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t Agent_GetCommandIndex( const MQTTAgentCommand_t * pxCommand )
+{
+    size_t uxIdx = MQTT_COMMAND_POOL_LIMIT;
+
+    if( ( pxCommandPool != NULL ) &&
+        ( pxCommand >= pxCommandPool ) &&
+        ( pxCommand < ( pxCommandPool + uxCommandPoolSize ) ) )
+    {
+        uxIdx = ( size_t ) ( pxCommand - pxCommandPool );
+    }
+
+    return uxIdx;
+}
+
+/*-----------------------------------------------------------*/
+
+void Agent_GetPoolStats( AgentCommandPoolStats_t * pxStats )
+{
+    configASSERT( pxStats );
+
+    pxStats->ulSize = ( uint32_t ) uxCommandPoolSize;
+    pxStats->ulInUse = ulInUse;
+    pxStats->ulHighWater = ulHighWater;
+    pxStats->ulExhausted = ulExhausted;
+    pxStats->ulWaits = ulWaits;
+    pxStats->ulWaitTimeouts = ulWaitTimeouts;
+    pxStats->ulWaitMsTotal = ulWaitMsTotal;
+    pxStats->ulWaitMsMax = ulWaitMsMax;
 }
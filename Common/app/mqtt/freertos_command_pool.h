@@ -35,9 +35,32 @@
 #include "core_mqtt_agent.h"
 
 /**
- * @brief Initialize the common task pool. Not thread safe.
+ * @brief Upper bound for the number of command structures set by the
+ * mqtt_cmd_pool KVStore key.
  */
-void Agent_InitializePool( void );
+#ifndef MQTT_COMMAND_POOL_LIMIT
+#define MQTT_COMMAND_POOL_LIMIT    1024U
+#endif /* MQTT_COMMAND_POOL_LIMIT */
+
+typedef struct
+{
+    uint32_t ulSize;
+    uint32_t ulInUse;
+    uint32_t ulHighWater;    /* Most structures in use at once */
+    uint32_t ulExhausted;    /* Requests that found the pool empty */
+    uint32_t ulWaits;        /* Requests that blocked waiting for a structure */
+    uint32_t ulWaitTimeouts; /* Blocked requests that timed out */
+    uint32_t ulWaitMsTotal;
+    uint32_t ulWaitMsMax;
+} AgentCommandPoolStats_t;
+
+/**
+ * @brief Initialize the common task pool, sized by the mqtt_cmd_pool KVStore
+ * key. Not thread safe.
+ *
+ * @return true if the pool is ready for use.
+ */
+bool Agent_InitializePool( void );
 
 /**
  * @brief Obtain a MQTTAgentCommand_t structure from the pool of structures managed by the agent.
@@ -45,10 +68,10 @@ void Agent_InitializePool( void );
  * @note MQTTAgentCommand_t structures hold everything the MQTT agent needs to process a
  * command that originates from application.  Examples of commands are PUBLISH and
  * SUBSCRIBE.  The MQTTAgentCommand_t structure must persist for the duration of the command's
- * operation so are obtained from a pool of statically allocated structures when a
+ * operation so are obtained from a pool of structures allocated at boot when a
  * new command is created, and returned to the pool when the command is complete.
- * The MQTT_COMMAND_CONTEXTS_POOL_SIZE configuration file constant defines how many
- * structures the pool contains.
+ * The mqtt_cmd_pool KVStore key defines how many structures the pool contains,
+ * defaulting to the MQTT_COMMAND_CONTEXTS_POOL_SIZE configuration file constant.
  *
  * @param[in] blockTimeMs The length of time the calling task should remain in the
  * Blocked state (so not consuming any CPU time) to wait for a MQTTAgentCommand_t structure to
@@ -66,10 +89,10 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t blockTimeMs );
  * @note MQTTAgentCommand_t structures hold everything the MQTT agent needs to process a
  * command that originates from application.  Examples of commands are PUBLISH and
  * SUBSCRIBE.  The MQTTAgentCommand_t structure must persist for the duration of the command's
- * operation so are obtained from a pool of statically allocated structures when a
+ * operation so are obtained from a pool of structures allocated at boot when a
  * new command is created, and returned to the pool when the command is complete.
- * The MQTT_COMMAND_CONTEXTS_POOL_SIZE configuration file constant defines how many
- * structures the pool contains.
+ * The mqtt_cmd_pool KVStore key defines how many structures the pool contains,
+ * defaulting to the MQTT_COMMAND_CONTEXTS_POOL_SIZE configuration file constant.
  *
  * @param[in] pCommandToRelease A pointer to the MQTTAgentCommand_t structure to return to
  * the pool.  The structure must first have been obtained by calling
@@ -80,4 +103,16 @@ MQTTAgentCommand_t * Agent_GetCommand( uint32_t blockTimeMs );
  */
 bool Agent_ReleaseCommand( MQTTAgentCommand_t * pCommandToRelease );
 
+/**
+ * @brief Position of a command structure within the pool, so that callers can
+ * keep per command state in an array of Agent_GetPoolStats().ulSize entries.
+ * @return The index, or MQTT_COMMAND_POOL_LIMIT if the structure is not part of the pool.
+ */
+size_t Agent_GetCommandIndex( const MQTTAgentCommand_t * pxCommand );
+
+/**
+ * @brief Take a snapshot of the command pool usage counters.
+ */
+void Agent_GetPoolStats( AgentCommandPoolStats_t * pxStats );
+
 #endif /* FREERTOS_COMMAND_POOL_H */
@@ -40,6 +40,8 @@
 #include "queue.h"
 #include "task.h"
 #include "event_groups.h"
+#include "semphr.h"
+#include "atomic.h"
 
 #include "kvstore.h"
 #include "mqtt_metrics.h"
@@ -55,12 +57,15 @@
 
 /* MQTT Agent ports. */
 #include "freertos_command_pool.h"
+#include "publish_buffer_pool.h"
+#include "mqtt_journal.h"
 
 /* Exponential backoff retry include. */
 #include "backoff_algorithm.h"
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
+#include "topic_trie.h"
 
 #include "mbedtls_transport.h"
 #include "sys_evt.h"
@@ -111,34 +116,132 @@ static_assert( ( ( uint64_t ) RETRY_BACKOFF_MULTIPLIER * ( uint64_t ) RETRY_MAX_
 #define MQTT_AGENT_NOTIFY_FLAG_M_QUEUE        ( 1U << 30 )
 
 /**
- * @brief Socket send and receive timeouts to use.
+ * @brief Longest time a send waits for the socket to become writable.
  */
 #define SEND_TIMEOUT_MS                       ( 2000U )
 
 #define AGENT_READY_EVT_MASK                  ( 1U )
 
+/**
+ * @brief Thread local storage slot holding the command lane of a task.
+ * Slot 0 is used by the lwIP port.
+ */
+#define MQTT_AGENT_TLS_IDX_LANE               ( 1 )
+
+/**
+ * @brief Thread local storage slot set while the publishes of a task are not
+ * journaled.
+ */
+#define MQTT_AGENT_TLS_IDX_NO_JOURNAL         ( 2 )
+
+/**
+ * @brief Commands taken from each lane per scheduling round while a lower
+ * lane has work waiting. A weight of 0 gives the lane strict priority over
+ * all lanes below it.
+ */
+#ifndef MQTT_AGENT_LANE_WEIGHTS
+#define MQTT_AGENT_LANE_WEIGHTS               { 0U, 4U, 1U }
+#endif
+
 #define MUTEX_IS_OWNED( xHandle )    ( xTaskGetCurrentTaskHandle() == xSemaphoreGetMutexHolder( xHandle ) )
 
+/* Longest topic name of a PUBLISH that can be streamed to a stream callback */
+#ifndef MQTT_AGENT_STREAM_TOPIC_MAX
+#define MQTT_AGENT_STREAM_TOPIC_MAX    ( 256U )
+#endif
+
+/* Fixed header, topic length, topic and packet identifier of a PUBLISH */
+#define RECV_HEADER_MAX                ( 5U + 2U + MQTT_AGENT_STREAM_TOPIC_MAX + 2U )
+
+/* A QoS1 publish holding a slot of the in-flight window */
+typedef struct WindowSlot
+{
+    MQTTAgentCommand_t * volatile pxCommand;
+    MQTTAgentCommandCallback_t xCallback; /* Completion callback of the submitter */
+    MQTTAgentCommandContext_t * pxCallbackCtx;
+    TickType_t xSentAt;
+    bool xSent;
+    uint32_t ulJournalId;
+} WindowSlot_t;
+
+#if MQTT_AGENT_METRICS_ENABLED
+
+/* Progress of a command through the agent */
+typedef enum
+{
+    TIMING_IDLE = 0,
+    TIMING_QUEUED,
+    TIMING_DEQUEUED,
+    TIMING_WRITING, /* Part of the packet was written to the socket */
+    TIMING_SENT
+} TimingStage_t;
+
+/* Kept alongside each structure of the command pool */
+typedef struct CommandTiming
+{
+    TickType_t xEnqueuedAt;
+    TickType_t xDequeuedAt;
+    TickType_t xSentAt;
+    MQTTAgentCommandType_t xType;
+    TimingStage_t xStage;
+    bool xAcknowledged; /* Completes on PUBACK, SUBACK or UNSUBACK */
+} CommandTiming_t;
+
+#define AGENT_METRICS_COUNT( pxMsgCtx, ulCounter )    ( ( pxMsgCtx )->xMetrics.ulCounter++ )
+#else
+#define AGENT_METRICS_COUNT( pxMsgCtx, ulCounter )
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
 struct MQTTAgentMessageContext
 {
-    QueueHandle_t xQueue;
+    QueueHandle_t pxLanes[ MQTT_AGENT_NUM_LANES ];
+    uint32_t pulLaneCredits[ MQTT_AGENT_NUM_LANES ];
+    MQTTAgentLaneStats_t pxLaneStats[ MQTT_AGENT_NUM_LANES ];
     TaskHandle_t xAgentTaskHandle;
+
+    /* Counts free slots of the QoS1 in-flight window */
+    SemaphoreHandle_t xWindowSem;
+    WindowSlot_t pxWindow[ MQTT_AGENT_WINDOW_LIMIT ];
+    MQTTAgentWindowStats_t xWindowStats;
+
+#if MQTT_AGENT_METRICS_ENABLED
+    CommandTiming_t * pxTimings; /* Indexed like the command pool */
+    size_t uxTimings;
+    CommandTiming_t * pxCurrentTiming; /* Command being written by the agent */
+    MQTTAgentHistogram_t pxHistograms[ NUM_COMMANDS ][ MQTT_AGENT_NUM_PHASES ];
+    MQTTAgentMetrics_t xMetrics;
+#endif
 };
 
 typedef struct MQTTAgentSubscriptionManagerCtx
 {
-    MQTTSubscribeInfo_t pxSubscriptions[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];
-    MQTTSubAckStatus_t pxSubAckStatus[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];
-    uint32_t pulSubCbCount[ MQTT_AGENT_MAX_SUBSCRIPTIONS ];
-    SubCallbackElement_t pxCallbacks[ MQTT_AGENT_MAX_CALLBACKS ];
+    MQTTSubscribeInfo_t * pxSubscriptions;
+    MQTTSubAckStatus_t * pxSubAckStatus;
+    uint32_t * pulSubCbCount;
+    SubCallbackElement_t * pxCallbacks;
 
+    size_t uxMaxSubscriptions;
+    size_t uxMaxCallbacks;
     size_t uxSubscriptionCount;
     size_t uxCallbackCount;
     MQTTAgentSubscribeArgs_t xInitialSubscribeArgs;
 
+    /* Filters of all registered callbacks, keyed by callback index */
+    TopicTrie_t xTopicTrie;
+    bool xTopicTrieValid;
+
+    /* Callbacks registered with MqttAgent_SubscribeStreamSync */
+    size_t uxStreamCallbackCount;
+
     SemaphoreHandle_t xMutex;
 } SubMgrCtx_t;
 
+typedef enum
+{
+    RECV_HEADER, /* Reading the packet header into pucRecvHeader */
+    RECV_REPLAY, /* Handing the packet to coreMQTT */
+    RECV_STREAM  /* Passing the PUBLISH payload to stream callbacks */
+} RecvState_t;
 
 typedef struct MQTTAgentTaskCtx
 {
@@ -156,11 +259,27 @@ typedef struct MQTTAgentTaskCtx
     char * pcMqttEndpoint;
     size_t uxMqttEndpointLen;
     uint32_t ulMqttPort;
+
+    /* PUBLISH header held back until it can be written with its payload */
+    const uint8_t * pucHeldHeader;
+    size_t uxHeldHeaderLen;
+    bool xHeldPayload; /* Rest of the payload is still sent vectored */
+
+    /* Framing of the incoming packet, see prvTransportRecv */
+    RecvState_t xRecvState;
+    uint8_t pucRecvHeader[ RECV_HEADER_MAX ];
+    size_t uxRecvHeaderLen;
+    size_t uxRecvHeaderPos;
+    size_t uxRecvLeft;
+    MQTTPublishInfo_t xStreamInfo;
+    uint16_t usStreamPacketId;
 } MQTTAgentTaskCtx_t;
 
 /* ALPN protocols must be a NULL-terminated list of strings. */
 static const char * pcAlpnProtocols[] = { AWS_IOT_MQTT_ALPN, NULL };
 
+static const uint32_t pulLaneWeights[ MQTT_AGENT_NUM_LANES ] = MQTT_AGENT_LANE_WEIGHTS;
+
 static MQTTAgentHandle_t xDefaultInstanceHandle = NULL;
 
 /*-----------------------------------------------------------*/
@@ -193,6 +312,14 @@ static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
 static MQTTStatus_t prvHandleResubscribe( MQTTAgentContext_t * pxMqttAgentCtx,
                                           SubMgrCtx_t * pxCtx );
 
+/**
+ * @brief Transport receive function given to coreMQTT. Payloads of publishes
+ * for stream callbacks are consumed here and never reach coreMQTT.
+ */
+static int32_t prvTransportRecv( NetworkContext_t * pxNetworkContext,
+                                 void * pvBuffer,
+                                 size_t uxBytesToRecv );
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -323,42 +450,39 @@ bool xIsMqttAgentConnected( void )
 
 /*-----------------------------------------------------------*/
 
-static inline void prvUpdateCallbackRefs( SubCallbackElement_t * pxCallbacksList,
-                                          MQTTSubscribeInfo_t * pxSubList,
+static inline void prvUpdateCallbackRefs( SubMgrCtx_t * pxCtx,
                                           size_t uxOldIdx,
                                           size_t uxNewIdx )
 {
-    configASSERT( pxCallbacksList );
-    configASSERT( pxSubList );
-    configASSERT( uxOldIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS );
-    configASSERT( uxNewIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS );
+    configASSERT( pxCtx );
+    configASSERT( uxOldIdx < pxCtx->uxMaxSubscriptions );
+    configASSERT( uxNewIdx < pxCtx->uxMaxSubscriptions );
 
-    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
+    for( size_t uxIdx = 0; uxIdx < pxCtx->uxMaxCallbacks; uxIdx++ )
     {
-        if( pxCallbacksList[ uxIdx ].pxSubInfo == &( pxSubList[ uxOldIdx ] ) )
+        if( pxCtx->pxCallbacks[ uxIdx ].pxSubInfo == &( pxCtx->pxSubscriptions[ uxOldIdx ] ) )
         {
-            pxCallbacksList[ uxIdx ].pxSubInfo = &( pxSubList[ uxNewIdx ] );
+            pxCtx->pxCallbacks[ uxIdx ].pxSubInfo = &( pxCtx->pxSubscriptions[ uxNewIdx ] );
         }
     }
 }
 
 /*-----------------------------------------------------------*/
 
-static inline void prvCompressSubscriptionList( MQTTSubscribeInfo_t * pxSubList,
-                                                SubCallbackElement_t * pxCallbacksList,
-                                                size_t * puxSubCount )
+static inline void prvCompressSubscriptionList( SubMgrCtx_t * pxCtx )
 {
+    MQTTSubscribeInfo_t * const pxSubList = pxCtx->pxSubscriptions;
     size_t uxLastOccupiedIndex = 0;
     size_t uxSubCount = 0;
 
     configASSERT( pxSubList );
-    configASSERT( pxCallbacksList );
+    configASSERT( pxCtx->pxCallbacks );
 
-    for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
+    for( size_t uxIdx = 0U; uxIdx < pxCtx->uxMaxSubscriptions; uxIdx++ )
     {
         if( ( pxSubList[ uxIdx ].pTopicFilter == NULL ) &&
             ( pxSubList[ uxIdx ].topicFilterLength == 0 ) &&
-            ( uxLastOccupiedIndex < MQTT_AGENT_MAX_SUBSCRIPTIONS ) )
+            ( uxLastOccupiedIndex < pxCtx->uxMaxSubscriptions ) )
         {
             if( uxLastOccupiedIndex <= uxIdx )
             {
@@ -366,17 +490,21 @@ static inline void prvCompressSubscriptionList( MQTTSubscribeInfo_t * pxSubList,
             }
 
             /* Iterate over remainder of list for occupied spots */
-            for( ; uxLastOccupiedIndex < MQTT_AGENT_MAX_CALLBACKS; uxLastOccupiedIndex++ )
+            for( ; uxLastOccupiedIndex < pxCtx->uxMaxSubscriptions; uxLastOccupiedIndex++ )
             {
                 if( pxSubList[ uxLastOccupiedIndex ].topicFilterLength != 0 )
                 {
-                    /* Move new item into place */
+                    /* Move new item into place, along with its callback reference count */
                     pxSubList[ uxIdx ] = pxSubList[ uxLastOccupiedIndex ];
+                    pxCtx->pulSubCbCount[ uxIdx ] = pxCtx->pulSubCbCount[ uxLastOccupiedIndex ];
+                    pxCtx->pxSubAckStatus[ uxIdx ] = pxCtx->pxSubAckStatus[ uxLastOccupiedIndex ];
 
                     /* Clear old location */
                     memset( &( pxSubList[ uxLastOccupiedIndex ] ), 0, sizeof( MQTTSubscribeInfo_t ) );
+                    pxCtx->pulSubCbCount[ uxLastOccupiedIndex ] = 0;
+                    pxCtx->pxSubAckStatus[ uxLastOccupiedIndex ] = MQTTSubAckFailure;
 
-                    prvUpdateCallbackRefs( pxCallbacksList, pxSubList, uxLastOccupiedIndex, uxIdx );
+                    prvUpdateCallbackRefs( pxCtx, uxLastOccupiedIndex, uxIdx );
 
                     /* Increment count of active subscriptions */
                     uxSubCount++;
@@ -400,24 +528,23 @@ static inline void prvCompressSubscriptionList( MQTTSubscribeInfo_t * pxSubList,
         }
     }
 
-    *puxSubCount = uxSubCount;
+    pxCtx->uxSubscriptionCount = uxSubCount;
 }
 
 /*-----------------------------------------------------------*/
 
-static inline void prvCompressCallbackList( SubCallbackElement_t * pxCallbackList,
-                                            size_t * puxCallbackCount )
+static inline void prvCompressCallbackList( SubMgrCtx_t * pxCtx )
 {
+    SubCallbackElement_t * const pxCallbackList = pxCtx->pxCallbacks;
     size_t uxLastOccupiedIndex = 0;
     size_t uxCallbackCount = 0;
 
     configASSERT( pxCallbackList );
-    configASSERT( puxCallbackCount );
 
-    for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
+    for( size_t uxIdx = 0U; uxIdx < pxCtx->uxMaxCallbacks; uxIdx++ )
     {
         if( ( pxCallbackList[ uxIdx ].pxSubInfo == NULL ) &&     /* Current slot at uxIdx is Empty */
-            ( uxLastOccupiedIndex < MQTT_AGENT_MAX_CALLBACKS ) ) /* There may be occupied slots after the current one */
+            ( uxLastOccupiedIndex < pxCtx->uxMaxCallbacks ) )    /* There may be occupied slots after the current one */
         {
             /* uxLastOccupiedIndex is always > uxIdx */
             if( uxLastOccupiedIndex <= uxIdx )
@@ -426,7 +553,7 @@ static inline void prvCompressCallbackList( SubCallbackElement_t * pxCallbackLis
             }
 
             /* Iterate over remainder of list for occupied spots */
-            for( ; uxLastOccupiedIndex < MQTT_AGENT_MAX_CALLBACKS; uxLastOccupiedIndex++ )
+            for( ; uxLastOccupiedIndex < pxCtx->uxMaxCallbacks; uxLastOccupiedIndex++ )
             {
                 if( pxCallbackList[ uxLastOccupiedIndex ].pxSubInfo != NULL )
                 {
@@ -439,6 +566,7 @@ static inline void prvCompressCallbackList( SubCallbackElement_t * pxCallbackLis
                     memset( &( pxCallbackList[ uxLastOccupiedIndex ] ), 0, sizeof( SubCallbackElement_t ) );
 
                     pxCallbackList[ uxLastOccupiedIndex ].pxIncomingPublishCallback = NULL;
+                    pxCallbackList[ uxLastOccupiedIndex ].pxIncomingStreamCallback = NULL;
                     pxCallbackList[ uxLastOccupiedIndex ].pvIncomingPublishCallbackContext = NULL;
                     pxCallbackList[ uxLastOccupiedIndex ].xTaskHandle = NULL;
                     pxCallbackList[ uxLastOccupiedIndex ].pxSubInfo = NULL;
@@ -463,7 +591,40 @@ static inline void prvCompressCallbackList( SubCallbackElement_t * pxCallbackLis
         }
     }
 
-    *puxCallbackCount = uxCallbackCount;
+    pxCtx->uxCallbackCount = uxCallbackCount;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Rebuild the topic trie from the registered callbacks. Called with the
+ * subscription manager mutex held whenever a callback is added or removed.
+ * If the trie runs out of nodes, incoming publishes fall back to a linear
+ * scan of the callback list.
+ */
+static void prvRebuildTopicTrie( SubMgrCtx_t * pxCtx )
+{
+    configASSERT( pxCtx );
+
+    vTopicTrie_Clear( &( pxCtx->xTopicTrie ) );
+    pxCtx->xTopicTrieValid = true;
+
+    for( size_t uxIdx = 0; uxIdx < pxCtx->uxMaxCallbacks; uxIdx++ )
+    {
+        MQTTSubscribeInfo_t * const pxSubInfo = pxCtx->pxCallbacks[ uxIdx ].pxSubInfo;
+
+        if( ( pxSubInfo != NULL ) &&
+            !xTopicTrie_Insert( &( pxCtx->xTopicTrie ),
+                                pxSubInfo->pTopicFilter,
+                                pxSubInfo->topicFilterLength,
+                                ( uint16_t ) uxIdx ) )
+        {
+            LogWarn( "Failed to add filter=\"%.*s\" to the topic trie, using linear dispatch.",
+                     pxSubInfo->topicFilterLength, pxSubInfo->pTopicFilter );
+            pxCtx->xTopicTrieValid = false;
+            break;
+        }
+    }
 }
 
 /*-----------------------------------------------------------*/
@@ -483,242 +644,1547 @@ static void prvSocketRecvReadyCallback( void * pvCtx )
 
 /*-----------------------------------------------------------*/
 
-static bool prvAgentMessageSend( MQTTAgentMessageContext_t * pxMsgCtx,
-                                 MQTTAgentCommand_t * const * pxCommandToSend,
-                                 uint32_t blockTimeMs )
+static MQTTAgentLane_t prvGetCommandLane( void )
 {
-    BaseType_t xQueueStatus = pdFAIL;
+    uintptr_t uxLane = ( uintptr_t ) pvTaskGetThreadLocalStoragePointer( NULL, MQTT_AGENT_TLS_IDX_LANE );
 
-    if( pxMsgCtx && pxCommandToSend )
+    return ( ( uxLane > 0U ) && ( uxLane <= MQTT_AGENT_NUM_LANES ) ) ?
+           ( MQTTAgentLane_t ) ( uxLane - 1U ) : MQTT_AGENT_LANE_NORMAL;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTAgentLane_t xMqttAgent_SetCommandLane( MQTTAgentLane_t xLane )
+{
+    MQTTAgentLane_t xPrevLane = prvGetCommandLane();
+
+    configASSERT( xLane < MQTT_AGENT_NUM_LANES );
+
+    /* Stored off by one so that an unset slot reads as the default lane */
+    vTaskSetThreadLocalStoragePointer( NULL,
+                                       MQTT_AGENT_TLS_IDX_LANE,
+                                       ( void * ) ( ( uintptr_t ) xLane + 1U ) );
+
+    return xPrevLane;
+}
+
+/*-----------------------------------------------------------*/
+
+bool xMqttAgent_SetJournaling( bool xEnable )
+{
+    bool xWasEnabled = ( pvTaskGetThreadLocalStoragePointer( NULL, MQTT_AGENT_TLS_IDX_NO_JOURNAL ) == NULL );
+
+    /* Unset reads as enabled */
+    vTaskSetThreadLocalStoragePointer( NULL,
+                                       MQTT_AGENT_TLS_IDX_NO_JOURNAL,
+                                       xEnable ? NULL : ( void * ) 1U );
+
+    return xWasEnabled;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttAgent_GetLaneStats( MQTTAgentLaneStats_t pxStats[ MQTT_AGENT_NUM_LANES ] )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+
+    configASSERT( pxStats );
+
+    for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+    {
+        if( pxCtx != NULL )
+        {
+            pxStats[ uxLane ] = pxCtx->xAgentMessageCtx.pxLaneStats[ uxLane ];
+            pxStats[ uxLane ].ulDepth = ( uint32_t ) uxQueueMessagesWaiting( pxCtx->xAgentMessageCtx.pxLanes[ uxLane ] );
+        }
+        else
+        {
+            memset( &( pxStats[ uxLane ] ), 0, sizeof( MQTTAgentLaneStats_t ) );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttAgent_GetWindowStats( MQTTAgentWindowStats_t * pxStats )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+
+    configASSERT( pxStats );
+
+    if( pxCtx != NULL )
+    {
+        *pxStats = pxCtx->xAgentMessageCtx.xWindowStats;
+        pxStats->ulInFlight = pxStats->ulWindow - ( uint32_t ) uxSemaphoreGetCount( pxCtx->xAgentMessageCtx.xWindowSem );
+    }
+    else
+    {
+        memset( pxStats, 0, sizeof( MQTTAgentWindowStats_t ) );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvWindowCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                      MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    WindowSlot_t * pxSlot = ( WindowSlot_t * ) pxCommandContext;
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+    MQTTAgentMessageContext_t * pxMsgCtx = &( pxCtx->xAgentMessageCtx );
+    MQTTAgentWindowStats_t * pxStats = &( pxMsgCtx->xWindowStats );
+
+    configASSERT( pxSlot != NULL );
+    configASSERT( pxReturnInfo != NULL );
+
+    if( ( pxReturnInfo->returnCode == MQTTSuccess ) && pxSlot->xSent )
     {
-        xQueueStatus = xQueueSendToBack( pxMsgCtx->xQueue, pxCommandToSend, pdMS_TO_TICKS( blockTimeMs ) );
+        uint32_t ulAckMs = ( uint32_t ) ( ( xTaskGetTickCount() - pxSlot->xSentAt ) * portTICK_PERIOD_MS );
 
-        /* Notify the agent that a message is waiting */
-        if( pxMsgCtx->xAgentTaskHandle )
+        pxStats->ulAcked++;
+        pxStats->ulAckMsTotal += ulAckMs;
+
+        if( ulAckMs > pxStats->ulAckMsMax )
         {
-            ( void ) xTaskNotifyIndexed( pxMsgCtx->xAgentTaskHandle,
-                                         MQTT_AGENT_NOTIFY_IDX,
-                                         MQTT_AGENT_NOTIFY_FLAG_M_QUEUE,
-                                         eSetBits );
+            pxStats->ulAckMsMax = ulAckMs;
         }
     }
 
-    return ( bool ) xQueueStatus;
+    if( pxSlot->xCallback != NULL )
+    {
+        pxSlot->xCallback( pxSlot->pxCallbackCtx, pxReturnInfo );
+    }
+
+    /* Failed publishes are handed back to the submitter, so the journal
+     * forgets them as well */
+    vMqttJournal_Remove( pxSlot->ulJournalId );
+
+    pxSlot->pxCommand = NULL;
+    ( void ) xSemaphoreGive( pxMsgCtx->xWindowSem );
 }
 
 /*-----------------------------------------------------------*/
 
-static bool prvAgentMessageReceive( MQTTAgentMessageContext_t * pxMsgCtx,
-                                    MQTTAgentCommand_t ** ppxReceivedCommand,
-                                    uint32_t blockTimeMs )
+/*
+ * Reserve a slot of the in-flight window for a QoS1 or QoS2 publish, blocking
+ * the submitter for up to xTicksToWait while the window is full. The command
+ * completion callback is diverted through the slot so that the slot is freed
+ * when the publish is acknowledged or cancelled.
+ */
+static WindowSlot_t * prvWindowAcquire( MQTTAgentMessageContext_t * pxMsgCtx,
+                                        MQTTAgentCommand_t * pxCommand,
+                                        TickType_t xTicksToWait )
 {
-    BaseType_t xQueueStatus = pdFAIL;
-    uint32_t ulNotifyValue = 0;
+    WindowSlot_t * pxSlot = NULL;
+    MQTTAgentWindowStats_t * pxStats = &( pxMsgCtx->xWindowStats );
+    BaseType_t xTaken = xSemaphoreTake( pxMsgCtx->xWindowSem, 0 );
 
-    if( pxMsgCtx && ppxReceivedCommand )
+    /* Statistics only, updated without a lock by every sending task */
+    if( ( xTaken == pdFALSE ) && ( xTicksToWait > 0 ) )
     {
-        if( xTaskNotifyWaitIndexed( MQTT_AGENT_NOTIFY_IDX,
-                                    0x0,
-                                    0xFFFFFFFF,
-                                    &ulNotifyValue,
-                                    pdMS_TO_TICKS( blockTimeMs ) ) )
+        pxStats->ulBlocked++;
+        xTaken = xSemaphoreTake( pxMsgCtx->xWindowSem, xTicksToWait );
+    }
+
+    if( xTaken == pdFALSE )
+    {
+        pxStats->ulRejected++;
+    }
+    else
+    {
+        uint32_t ulInFlight = pxStats->ulWindow - ( uint32_t ) uxSemaphoreGetCount( pxMsgCtx->xWindowSem );
+
+        /* Holding a count guarantees that a slot is free */
+        for( size_t uxIdx = 0; ( uxIdx < pxStats->ulWindow ) && ( pxSlot == NULL ); uxIdx++ )
         {
-            /* Prioritize processing incoming network packets over local requests */
-            if( ulNotifyValue & MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV )
+            if( Atomic_CompareAndSwapPointers_p32( ( void * volatile * ) &( pxMsgCtx->pxWindow[ uxIdx ].pxCommand ),
+                                                   pxCommand, NULL ) == ATOMIC_COMPARE_AND_SWAP_SUCCESS )
             {
-                *ppxReceivedCommand = NULL;
+                pxSlot = &( pxMsgCtx->pxWindow[ uxIdx ] );
             }
-            else
+        }
+
+        configASSERT( pxSlot != NULL );
+
+        pxSlot->xCallback = pxCommand->pCommandCompleteCallback;
+        pxSlot->pxCallbackCtx = pxCommand->pCmdContext;
+        pxSlot->xSent = false;
+        pxSlot->ulJournalId = 0;
+
+        pxCommand->pCommandCompleteCallback = prvWindowCommandCallback;
+        pxCommand->pCmdContext = ( MQTTAgentCommandContext_t * ) pxSlot;
+
+        if( ulInFlight > pxStats->ulHighWater )
+        {
+            pxStats->ulHighWater = ulInFlight;
+        }
+    }
+
+    return pxSlot;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Undo prvWindowAcquire for a command that never reached the agent */
+static void prvWindowCancel( MQTTAgentMessageContext_t * pxMsgCtx,
+                             WindowSlot_t * pxSlot )
+{
+    MQTTAgentCommand_t * pxCommand = pxSlot->pxCommand;
+
+    pxCommand->pCommandCompleteCallback = pxSlot->xCallback;
+    pxCommand->pCmdContext = pxSlot->pxCallbackCtx;
+
+    vMqttJournal_Remove( pxSlot->ulJournalId );
+
+    pxSlot->pxCommand = NULL;
+    ( void ) xSemaphoreGive( pxMsgCtx->xWindowSem );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvIsWindowedCommand( const MQTTAgentCommand_t * pxCommand )
+{
+    return( ( pxCommand->commandType == PUBLISH ) &&
+            ( pxCommand->pArgs != NULL ) &&
+            ( ( ( const MQTTPublishInfo_t * ) pxCommand->pArgs )->qos != MQTTQoS0 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Returns true if the buffer is the header of a PUBLISH serialized in the
+ * network buffer by coreMQTT, which sends the payload with a second call.
+ */
+static bool prvIsPublishHeader( const MQTTAgentTaskCtx_t * pxCtx,
+                                const void * pvBuffer,
+                                size_t uxBytesToSend )
+{
+    const uint8_t * pucHeader = ( const uint8_t * ) pvBuffer;
+    size_t uxRemainingLen = 0;
+    size_t uxIdx = 1;
+    uint32_t ulShift = 0;
+
+    if( ( pvBuffer == pxCtx->xNetworkFixedBuffer.pBuffer ) &&
+        ( uxBytesToSend > 1 ) &&
+        ( ( pucHeader[ 0 ] & 0xF0U ) == MQTT_PACKET_TYPE_PUBLISH ) )
+    {
+        /* Decode the remaining length field of the fixed header */
+        do
+        {
+            uxRemainingLen += ( size_t ) ( pucHeader[ uxIdx ] & 0x7FU ) << ulShift;
+            ulShift += 7U;
+            uxIdx++;
+        }
+        while( ( ( pucHeader[ uxIdx - 1U ] & 0x80U ) != 0U ) &&
+               ( uxIdx < uxBytesToSend ) &&
+               ( uxIdx <= 4U ) );
+    }
+
+    return( ( uxIdx > 1U ) && ( ( uxIdx + uxRemainingLen ) > uxBytesToSend ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * coreMQTT writes a PUBLISH header and its payload with separate transport
+ * calls, so each would become its own TLS record. The header is reported as
+ * sent and held back, then written together with the payload through
+ * mbedtls_transport_writev. After a partial write coreMQTT retries the rest
+ * of the payload, which also goes through mbedtls_transport_writev so that
+ * the records are cut at the same offsets as before.
+ */
+static int32_t prvTransportSend( NetworkContext_t * pxNetworkContext,
+                                 const void * pvBuffer,
+                                 size_t uxBytesToSend )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+    int32_t lSent = 0;
+
+    if( pxCtx == NULL )
+    {
+        lSent = mbedtls_transport_send( pxNetworkContext, pvBuffer, uxBytesToSend );
+    }
+    else if( ( pxCtx->uxHeldHeaderLen > 0 ) || pxCtx->xHeldPayload )
+    {
+        TlsOutVector_t pxVectors[ 2 ] =
+        {
+            { .pvBase = pxCtx->pucHeldHeader, .uxLen = pxCtx->uxHeldHeaderLen },
+            { .pvBase = pvBuffer,             .uxLen = uxBytesToSend          }
+        };
+        size_t uxFirst = ( pxCtx->uxHeldHeaderLen > 0 ) ? 0U : 1U;
+
+        lSent = mbedtls_transport_writev( pxNetworkContext, &( pxVectors[ uxFirst ] ), 2U - uxFirst );
+
+        if( lSent >= 0 )
+        {
+            size_t uxHeaderSent = ( ( size_t ) lSent < pxCtx->uxHeldHeaderLen ) ? ( size_t ) lSent : pxCtx->uxHeldHeaderLen;
+
+            /* Only the payload bytes are reported to coreMQTT */
+            pxCtx->pucHeldHeader = &( pxCtx->pucHeldHeader[ uxHeaderSent ] );
+            pxCtx->uxHeldHeaderLen -= uxHeaderSent;
+            lSent -= ( int32_t ) uxHeaderSent;
+            pxCtx->xHeldPayload = ( ( size_t ) lSent < uxBytesToSend );
+
+            if( ( uxHeaderSent > 0 ) && ( pxCtx->uxHeldHeaderLen == 0 ) )
             {
-                xQueueStatus = xQueueReceive( pxMsgCtx->xQueue, ppxReceivedCommand, 0 );
+                AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulPublishesCoalesced );
             }
         }
+        else
+        {
+            pxCtx->uxHeldHeaderLen = 0;
+            pxCtx->xHeldPayload = false;
+        }
+    }
+    else if( prvIsPublishHeader( pxCtx, pvBuffer, uxBytesToSend ) )
+    {
+        pxCtx->pucHeldHeader = ( const uint8_t * ) pvBuffer;
+        pxCtx->uxHeldHeaderLen = uxBytesToSend;
+        lSent = ( int32_t ) uxBytesToSend;
+    }
+    else
+    {
+        lSent = mbedtls_transport_send( pxNetworkContext, pvBuffer, uxBytesToSend );
     }
 
-    return ( bool ) xQueueStatus;
+    return lSent;
 }
 
+/*-----------------------------------------------------------*/
+
+#if MQTT_AGENT_METRICS_ENABLED
+
+void vMqttAgent_GetHistogram( MQTTAgentCommandType_t xCommandType,
+                              MQTTAgentPhase_t xPhase,
+                              MQTTAgentHistogram_t * pxHistogram )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+
+    configASSERT( pxHistogram );
+    configASSERT( xCommandType < NUM_COMMANDS );
+    configASSERT( xPhase < MQTT_AGENT_NUM_PHASES );
+
+    if( pxCtx != NULL )
+    {
+        *pxHistogram = pxCtx->xAgentMessageCtx.pxHistograms[ xCommandType ][ xPhase ];
+    }
+    else
+    {
+        memset( pxHistogram, 0, sizeof( MQTTAgentHistogram_t ) );
+    }
+}
 
 /*-----------------------------------------------------------*/
 
-static void prvResubscribeCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
-                                           MQTTAgentReturnInfo_t * pxReturnInfo )
+void vMqttAgent_GetMetrics( MQTTAgentMetrics_t * pxMetrics )
 {
-    SubMgrCtx_t * pxCtx = ( SubMgrCtx_t * ) pxCommandContext;
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
 
-    configASSERT( pxCommandContext != NULL );
-    configASSERT( pxReturnInfo != NULL );
-    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+    configASSERT( pxMetrics );
 
-    /* Ignore pxReturnInfo->returnCode */
+    if( pxCtx != NULL )
+    {
+        *pxMetrics = pxCtx->xAgentMessageCtx.xMetrics;
+        pxMetrics->ulQueueDepth = 0;
+        pxMetrics->ulAwaitingAck = 0;
 
-    for( uint32_t ulSubIdx = 0; ulSubIdx < pxCtx->uxSubscriptionCount; ulSubIdx++ )
+        for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+        {
+            pxMetrics->ulQueueDepth += ( uint32_t ) uxQueueMessagesWaiting( pxCtx->xAgentMessageCtx.pxLanes[ uxLane ] );
+        }
+
+        /* Read without a lock, the agent task may be updating the list */
+        for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_OUTSTANDING_ACKS; uxIdx++ )
+        {
+            if( pxCtx->xAgentContext.pPendingAcks[ uxIdx ].packetId != MQTT_PACKET_ID_INVALID )
+            {
+                pxMetrics->ulAwaitingAck++;
+            }
+        }
+    }
+    else
     {
-        /* Update cached SubAck status */
-        pxCtx->pxSubAckStatus[ ulSubIdx ] = pxReturnInfo->pSubackCodes[ ulSubIdx ];
+        memset( pxMetrics, 0, sizeof( MQTTAgentMetrics_t ) );
+    }
+}
 
-        if( pxReturnInfo->pSubackCodes[ ulSubIdx ] == MQTTSubAckFailure )
+/*-----------------------------------------------------------*/
+
+uint32_t ulMqttAgent_HistogramPercentile( const MQTTAgentHistogram_t * pxHistogram,
+                                          uint32_t ulPercent )
+{
+    uint32_t ulBound = 0;
+    uint64_t ullSeen = 0;
+
+    configASSERT( pxHistogram );
+    configASSERT( ulPercent <= 100U );
+
+    for( uint32_t ulBucket = 0; ( ulBucket < MQTT_AGENT_LATENCY_BUCKETS ) && ( ulBound == 0 ); ulBucket++ )
+    {
+        ullSeen += pxHistogram->pulBuckets[ ulBucket ];
+
+        if( ( ullSeen > 0 ) &&
+            ( ( ullSeen * 100U ) >= ( ( uint64_t ) pxHistogram->ulCount * ulPercent ) ) )
         {
-            MQTTSubscribeInfo_t * const pxSubInfo = &( pxCtx->pxSubscriptions[ ulSubIdx ] );
+            ulBound = 1UL << ulBucket;
 
-            LogError( "Failed to re-subscribe to topic filter \"%.*s\".",
-                      pxSubInfo->topicFilterLength,
-                      pxSubInfo->pTopicFilter );
+            /* The last bucket is open ended */
+            if( ( ulBucket == ( MQTT_AGENT_LATENCY_BUCKETS - 1U ) ) &&
+                ( pxHistogram->ulMsMax > ulBound ) )
+            {
+                ulBound = pxHistogram->ulMsMax;
+            }
+        }
+    }
+
+    return ulBound;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvMetricsInit( MQTTAgentMessageContext_t * pxMsgCtx )
+{
+    AgentCommandPoolStats_t xPoolStats;
+
+    Agent_GetPoolStats( &xPoolStats );
+
+    pxMsgCtx->pxTimings = pvPortMalloc( sizeof( CommandTiming_t ) * xPoolStats.ulSize );
+
+    if( pxMsgCtx->pxTimings != NULL )
+    {
+        memset( pxMsgCtx->pxTimings, 0, sizeof( CommandTiming_t ) * xPoolStats.ulSize );
+        pxMsgCtx->uxTimings = xPoolStats.ulSize;
+    }
+    else
+    {
+        LogWarn( "Failed to allocate command timings, latency histograms are disabled." );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static CommandTiming_t * prvMetricsTiming( MQTTAgentMessageContext_t * pxMsgCtx,
+                                           const MQTTAgentCommand_t * pxCommand )
+{
+    CommandTiming_t * pxTiming = NULL;
+    size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+    if( uxIdx < pxMsgCtx->uxTimings )
+    {
+        pxTiming = &( pxMsgCtx->pxTimings[ uxIdx ] );
+    }
+
+    return pxTiming;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Only called from the agent task, so the histograms need no lock */
+static void prvMetricsRecord( MQTTAgentMessageContext_t * pxMsgCtx,
+                              const CommandTiming_t * pxTiming,
+                              MQTTAgentPhase_t xPhase,
+                              TickType_t xTicks )
+{
+    MQTTAgentHistogram_t * pxHistogram = &( pxMsgCtx->pxHistograms[ pxTiming->xType ][ xPhase ] );
+    uint32_t ulMs = ( uint32_t ) ( xTicks * portTICK_PERIOD_MS );
+    uint32_t ulBucket = 0;
+
+    while( ( ulBucket < ( MQTT_AGENT_LATENCY_BUCKETS - 1U ) ) &&
+           ( ( ulMs >> ulBucket ) != 0 ) )
+    {
+        ulBucket++;
+    }
+
+    pxHistogram->pulBuckets[ ulBucket ]++;
+    pxHistogram->ulCount++;
+    pxHistogram->ulMsTotal += ulMs;
+
+    if( ulMs > pxHistogram->ulMsMax )
+    {
+        pxHistogram->ulMsMax = ulMs;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvMetricsEnqueued( MQTTAgentMessageContext_t * pxMsgCtx,
+                                const MQTTAgentCommand_t * pxCommand )
+{
+    CommandTiming_t * pxTiming = prvMetricsTiming( pxMsgCtx, pxCommand );
+
+    if( pxTiming != NULL )
+    {
+        pxTiming->xEnqueuedAt = xTaskGetTickCount();
+        pxTiming->xType = pxCommand->commandType;
+        pxTiming->xAcknowledged = ( prvIsWindowedCommand( pxCommand ) ||
+                                    ( pxCommand->commandType == SUBSCRIBE ) ||
+                                    ( pxCommand->commandType == UNSUBSCRIBE ) );
+        pxTiming->xStage = TIMING_QUEUED;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvMetricsDequeued( MQTTAgentMessageContext_t * pxMsgCtx,
+                                const MQTTAgentCommand_t * pxCommand )
+{
+    CommandTiming_t * pxTiming = prvMetricsTiming( pxMsgCtx, pxCommand );
+    uint32_t ulDepth = 1U;
+
+    for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+    {
+        ulDepth += ( uint32_t ) uxQueueMessagesWaiting( pxMsgCtx->pxLanes[ uxLane ] );
+    }
+
+    if( ulDepth > pxMsgCtx->xMetrics.ulQueueHighWater )
+    {
+        pxMsgCtx->xMetrics.ulQueueHighWater = ulDepth;
+    }
+
+    if( ( pxTiming != NULL ) && ( pxTiming->xStage == TIMING_QUEUED ) )
+    {
+        pxTiming->xDequeuedAt = xTaskGetTickCount();
+        pxTiming->xStage = TIMING_DEQUEUED;
+        prvMetricsRecord( pxMsgCtx, pxTiming, MQTT_AGENT_PHASE_QUEUED, pxTiming->xDequeuedAt - pxTiming->xEnqueuedAt );
+    }
+
+    pxMsgCtx->pxCurrentTiming = pxTiming;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * The agent writes the whole packet of a command before it concludes the
+ * command or reads from the socket, so either marks the end of the write.
+ */
+static void prvMetricsWriteDone( MQTTAgentMessageContext_t * pxMsgCtx )
+{
+    CommandTiming_t * pxTiming = pxMsgCtx->pxCurrentTiming;
+
+    if( ( pxTiming != NULL ) && ( pxTiming->xStage == TIMING_WRITING ) )
+    {
+        pxTiming->xStage = TIMING_SENT;
+        prvMetricsRecord( pxMsgCtx, pxTiming, MQTT_AGENT_PHASE_SEND, pxTiming->xSentAt - pxTiming->xDequeuedAt );
+    }
+
+    pxMsgCtx->pxCurrentTiming = NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Acknowledgment latency of a resent publish is measured from the resend */
+static void prvMetricsResent( MQTTAgentMessageContext_t * pxMsgCtx,
+                              const MQTTAgentCommand_t * pxCommand )
+{
+    CommandTiming_t * pxTiming = prvMetricsTiming( pxMsgCtx, pxCommand );
+
+    if( ( pxTiming != NULL ) && ( pxTiming->xStage == TIMING_SENT ) )
+    {
+        pxTiming->xSentAt = xTaskGetTickCount();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t prvMetricsTransportSend( NetworkContext_t * pxNetworkContext,
+                                        const void * pvBuffer,
+                                        size_t uxBytesToSend )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+    int32_t lSent = prvTransportSend( pxNetworkContext, pvBuffer, uxBytesToSend );
+
+    if( ( lSent > 0 ) &&
+        ( pxCtx != NULL ) &&
+        ( pxCtx->xAgentMessageCtx.pxCurrentTiming != NULL ) )
+    {
+        CommandTiming_t * pxTiming = pxCtx->xAgentMessageCtx.pxCurrentTiming;
+
+        if( ( pxTiming->xStage == TIMING_DEQUEUED ) ||
+            ( pxTiming->xStage == TIMING_WRITING ) )
+        {
+            pxTiming->xSentAt = xTaskGetTickCount();
+            pxTiming->xStage = TIMING_WRITING;
+        }
+    }
+
+    return lSent;
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t prvMetricsTransportRecv( NetworkContext_t * pxNetworkContext,
+                                        void * pvBuffer,
+                                        size_t uxBytesToRecv )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+
+    if( pxCtx != NULL )
+    {
+        prvMetricsWriteDone( &( pxCtx->xAgentMessageCtx ) );
+    }
+
+    return prvTransportRecv( pxNetworkContext, pvBuffer, uxBytesToRecv );
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvMetricsReleaseCommand( MQTTAgentCommand_t * pxCommand )
+{
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+    CommandTiming_t * pxTiming = NULL;
+
+    if( pxCtx != NULL )
+    {
+        pxTiming = prvMetricsTiming( &( pxCtx->xAgentMessageCtx ), pxCommand );
+    }
+
+    /* Commands that failed to enqueue are released by the sending task */
+    if( ( pxTiming != NULL ) &&
+        ( xTaskGetCurrentTaskHandle() == pxCtx->xAgentMessageCtx.xAgentTaskHandle ) )
+    {
+        prvMetricsWriteDone( &( pxCtx->xAgentMessageCtx ) );
+
+        /* Commands failed while reconnecting would only measure the outage */
+        if( ( pxTiming->xStage == TIMING_SENT ) &&
+            pxTiming->xAcknowledged &&
+            xIsMqttAgentConnected() )
+        {
+            prvMetricsRecord( &( pxCtx->xAgentMessageCtx ), pxTiming, MQTT_AGENT_PHASE_ACK,
+                              xTaskGetTickCount() - pxTiming->xSentAt );
+        }
+    }
+
+    if( pxTiming != NULL )
+    {
+        pxTiming->xStage = TIMING_IDLE;
+    }
+
+    return Agent_ReleaseCommand( pxCommand );
+}
+
+#else /* MQTT_AGENT_METRICS_ENABLED */
+
+static inline void prvMetricsInit( MQTTAgentMessageContext_t * pxMsgCtx )
+{
+    ( void ) pxMsgCtx;
+}
+
+static inline void prvMetricsEnqueued( MQTTAgentMessageContext_t * pxMsgCtx,
+                                       const MQTTAgentCommand_t * pxCommand )
+{
+    ( void ) pxMsgCtx;
+    ( void ) pxCommand;
+}
+
+static inline void prvMetricsDequeued( MQTTAgentMessageContext_t * pxMsgCtx,
+                                       const MQTTAgentCommand_t * pxCommand )
+{
+    ( void ) pxMsgCtx;
+    ( void ) pxCommand;
+}
+
+static inline void prvMetricsWriteDone( MQTTAgentMessageContext_t * pxMsgCtx )
+{
+    ( void ) pxMsgCtx;
+}
+
+static inline void prvMetricsResent( MQTTAgentMessageContext_t * pxMsgCtx,
+                                     const MQTTAgentCommand_t * pxCommand )
+{
+    ( void ) pxMsgCtx;
+    ( void ) pxCommand;
+}
+
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
+/*-----------------------------------------------------------*/
+
+static bool prvAgentMessageSend( MQTTAgentMessageContext_t * pxMsgCtx,
+                                 MQTTAgentCommand_t * const * pxCommandToSend,
+                                 uint32_t blockTimeMs )
+{
+    BaseType_t xQueueStatus = pdFAIL;
+
+    if( pxMsgCtx && pxCommandToSend )
+    {
+        MQTTAgentLane_t xLane = prvGetCommandLane();
+        MQTTAgentLaneStats_t * pxStats = &( pxMsgCtx->pxLaneStats[ xLane ] );
+        WindowSlot_t * pxSlot = NULL;
+        bool xWindowed = prvIsWindowedCommand( *pxCommandToSend );
+        TimeOut_t xTimeOut;
+        TickType_t xTicksToWait = pdMS_TO_TICKS( blockTimeMs );
+
+        vTaskSetTimeOutState( &xTimeOut );
+
+        if( xWindowed )
+        {
+            bool xFromAgent = ( xTaskGetCurrentTaskHandle() == pxMsgCtx->xAgentTaskHandle );
+
+            /* The agent task frees window slots, so it must never wait for one */
+            pxSlot = prvWindowAcquire( pxMsgCtx, *pxCommandToSend, xFromAgent ? 0 : xTicksToWait );
+
+            /* Nor may it write to flash */
+            if( ( pxSlot != NULL ) && !xFromAgent &&
+                ( pvTaskGetThreadLocalStoragePointer( NULL, MQTT_AGENT_TLS_IDX_NO_JOURNAL ) == NULL ) )
+            {
+                pxSlot->ulJournalId = ulMqttJournal_Append( ( const MQTTPublishInfo_t * ) ( *pxCommandToSend )->pArgs );
+            }
+
+            /* The queue gets whatever is left of the block time */
+            if( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdTRUE )
+            {
+                xTicksToWait = 0;
+            }
+        }
+
+        if( !xWindowed || ( pxSlot != NULL ) )
+        {
+            prvMetricsEnqueued( pxMsgCtx, *pxCommandToSend );
+
+            xQueueStatus = xQueueSendToBack( pxMsgCtx->pxLanes[ xLane ], pxCommandToSend, xTicksToWait );
+
+            if( xQueueStatus != pdPASS )
+            {
+                pxStats->ulRejected++;
+            }
+        }
+
+        if( xQueueStatus == pdPASS )
+        {
+            UBaseType_t uxDepth = uxQueueMessagesWaiting( pxMsgCtx->pxLanes[ xLane ] );
+
+            /* Statistics only, updated without a lock by every sending task */
+            pxStats->ulEnqueued++;
+
+            if( uxDepth > pxStats->ulHighWater )
+            {
+                pxStats->ulHighWater = ( uint32_t ) uxDepth;
+            }
+
+            /* Notify the agent that a message is waiting */
+            if( pxMsgCtx->xAgentTaskHandle )
+            {
+                ( void ) xTaskNotifyIndexed( pxMsgCtx->xAgentTaskHandle,
+                                             MQTT_AGENT_NOTIFY_IDX,
+                                             MQTT_AGENT_NOTIFY_FLAG_M_QUEUE,
+                                             eSetBits );
+            }
+        }
+        else if( pxSlot != NULL )
+        {
+            prvWindowCancel( pxMsgCtx, pxSlot );
+        }
+        else
+        {
+            /* Empty */
+        }
+    }
+
+    return ( bool ) xQueueStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvLanesPending( MQTTAgentMessageContext_t * pxMsgCtx )
+{
+    bool xPending = false;
+
+    for( size_t uxLane = 0; ( uxLane < MQTT_AGENT_NUM_LANES ) && !xPending; uxLane++ )
+    {
+        xPending = ( uxQueueMessagesWaiting( pxMsgCtx->pxLanes[ uxLane ] ) > 0 );
+    }
+
+    return xPending;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Take the next command in weighted round robin order. Within a round, lanes
+ * are visited highest first and each may deliver up to its weight in
+ * commands. Once no lane with work has credit left, a new round starts.
+ */
+static bool prvLaneReceive( MQTTAgentMessageContext_t * pxMsgCtx,
+                            MQTTAgentCommand_t ** ppxReceivedCommand )
+{
+    bool xReceived = false;
+
+    for( uint32_t ulRound = 0; ( ulRound < 2 ) && !xReceived; ulRound++ )
+    {
+        for( size_t uxLane = 0; ( uxLane < MQTT_AGENT_NUM_LANES ) && !xReceived; uxLane++ )
+        {
+            if( ( ( pulLaneWeights[ uxLane ] == 0 ) ||
+                  ( pxMsgCtx->pulLaneCredits[ uxLane ] < pulLaneWeights[ uxLane ] ) ) &&
+                ( xQueueReceive( pxMsgCtx->pxLanes[ uxLane ], ppxReceivedCommand, 0 ) == pdPASS ) )
+            {
+                pxMsgCtx->pulLaneCredits[ uxLane ]++;
+                xReceived = true;
+            }
+        }
+
+        if( !xReceived )
+        {
+            memset( pxMsgCtx->pulLaneCredits, 0, sizeof( pxMsgCtx->pulLaneCredits ) );
+        }
+    }
+
+    return xReceived;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvAgentMessageReceive( MQTTAgentMessageContext_t * pxMsgCtx,
+                                    MQTTAgentCommand_t ** ppxReceivedCommand,
+                                    uint32_t blockTimeMs )
+{
+    bool xReceived = false;
+    uint32_t ulNotifyValue = 0;
+
+    if( pxMsgCtx && ppxReceivedCommand )
+    {
+        /* The previous command, if any, has been processed */
+        prvMetricsWriteDone( pxMsgCtx );
+
+        /* Only block when no command is waiting, since notifications from
+         * several senders coalesce into one. */
+        TickType_t xTicksToWait = prvLanesPending( pxMsgCtx ) ? 0 : pdMS_TO_TICKS( blockTimeMs );
+
+        ( void ) xTaskNotifyWaitIndexed( MQTT_AGENT_NOTIFY_IDX,
+                                         0x0,
+                                         0xFFFFFFFF,
+                                         &ulNotifyValue,
+                                         xTicksToWait );
+
+        /* Prioritize processing incoming network packets over local requests */
+        if( ulNotifyValue & MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV )
+        {
+            *ppxReceivedCommand = NULL;
+            xReceived = true;
+        }
+        else
+        {
+            xReceived = prvLaneReceive( pxMsgCtx, ppxReceivedCommand );
+
+            if( xReceived )
+            {
+                prvMetricsDequeued( pxMsgCtx, *ppxReceivedCommand );
+            }
+
+            /* Acknowledgment latency of windowed publishes is measured from here */
+            if( xReceived &&
+                ( ( *ppxReceivedCommand )->pCommandCompleteCallback == prvWindowCommandCallback ) )
+            {
+                WindowSlot_t * pxSlot = ( WindowSlot_t * ) ( *ppxReceivedCommand )->pCmdContext;
+
+                pxSlot->xSentAt = xTaskGetTickCount();
+                pxSlot->xSent = true;
+            }
+        }
+    }
+
+    return xReceived;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Fail every command still waiting in the lanes, like MQTTAgent_CancelAll,
+ * but keep publishes awaiting an acknowledgment so that they are resent by
+ * MQTTAgent_ResumeSession if the broker resumes the session.
+ */
+static void prvCancelQueuedCommands( MQTTAgentTaskCtx_t * pxCtx )
+{
+    MQTTAgentCommand_t * pxCommand = NULL;
+
+    while( prvLaneReceive( &( pxCtx->xAgentMessageCtx ), &pxCommand ) )
+    {
+        MQTTAgentReturnInfo_t xReturnInfo = { 0 };
+
+        xReturnInfo.returnCode = MQTTRecvFailed;
+
+        if( pxCommand->pCommandCompleteCallback != NULL )
+        {
+            pxCommand->pCommandCompleteCallback( pxCommand->pCmdContext, &xReturnInfo );
+        }
+
+        ( void ) pxCtx->xMessageInterface.releaseCommand( pxCommand );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Every publish still holding a window slot was resent by MQTTAgent_ResumeSession */
+static void prvWindowResumed( MQTTAgentMessageContext_t * pxMsgCtx )
+{
+    MQTTAgentWindowStats_t * pxStats = &( pxMsgCtx->xWindowStats );
+    TickType_t xNow = xTaskGetTickCount();
+    uint32_t ulResent = 0;
+
+    for( size_t uxIdx = 0; uxIdx < pxStats->ulWindow; uxIdx++ )
+    {
+        WindowSlot_t * pxSlot = &( pxMsgCtx->pxWindow[ uxIdx ] );
+
+        if( ( pxSlot->pxCommand != NULL ) && pxSlot->xSent )
+        {
+            pxSlot->xSentAt = xNow;
+            prvMetricsResent( pxMsgCtx, pxSlot->pxCommand );
+            ulResent++;
+        }
+    }
+
+    if( ulResent > 0 )
+    {
+        LogInfo( "Resent %lu unacknowledged publishes.", ( unsigned long ) ulResent );
+        pxStats->ulResent += ulResent;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvResubscribeCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                           MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    SubMgrCtx_t * pxCtx = ( SubMgrCtx_t * ) pxCommandContext;
+
+    configASSERT( pxCommandContext != NULL );
+    configASSERT( pxReturnInfo != NULL );
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+
+    /* Ignore pxReturnInfo->returnCode */
+
+    for( uint32_t ulSubIdx = 0; ulSubIdx < pxCtx->uxSubscriptionCount; ulSubIdx++ )
+    {
+        /* Update cached SubAck status */
+        pxCtx->pxSubAckStatus[ ulSubIdx ] = pxReturnInfo->pSubackCodes[ ulSubIdx ];
+
+        if( pxReturnInfo->pSubackCodes[ ulSubIdx ] == MQTTSubAckFailure )
+        {
+            MQTTSubscribeInfo_t * const pxSubInfo = &( pxCtx->pxSubscriptions[ ulSubIdx ] );
+
+            LogError( "Failed to re-subscribe to topic filter \"%.*s\".",
+                      pxSubInfo->topicFilterLength,
+                      pxSubInfo->pTopicFilter );
+
+            for( uint32_t ulCbIdx = 0; ulCbIdx < pxCtx->uxMaxCallbacks; ulCbIdx++ )
+            {
+                SubCallbackElement_t * const pxCbInfo = &( pxCtx->pxCallbacks[ ulCbIdx ] );
+
+                if( ( pxCbInfo->pxSubInfo == pxSubInfo ) &&
+                    ( pxCbInfo->xTaskHandle != NULL ) )
+                {
+                    LogWarn( "Detected orphaned callback for task: %s due to failed re-subscribe operation.",
+                             pcTaskGetName( pxCbInfo->xTaskHandle ) );
+                }
+            }
+        }
+    }
+
+    ( void ) xUnlockSubCtx( pxCtx );
+}
+
+/*-----------------------------------------------------------*/
+
+static MQTTStatus_t prvHandleResubscribe( MQTTAgentContext_t * pxMqttAgentCtx,
+                                          SubMgrCtx_t * pxCtx )
+{
+    MQTTStatus_t xStatus = MQTTBadParameter;
+
+    configASSERT( pxCtx );
+    configASSERT( pxCtx->xMutex );
+    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+
+    prvCompressSubscriptionList( pxCtx );
+
+    if( ( xStatus == MQTTSuccess ) && ( pxCtx->uxSubscriptionCount > 0U ) )
+    {
+        MQTTAgentCommandInfo_t xCommandParams =
+        {
+            .blockTimeMs                 = 0U,
+            .cmdCompleteCallback         = prvResubscribeCommandCallback,
+            .pCmdCompleteCallbackContext = ( void * ) pxCtx,
+        };
+
+        pxCtx->xInitialSubscribeArgs.pSubscribeInfo = pxCtx->pxSubscriptions;
+        pxCtx->xInitialSubscribeArgs.numSubscriptions = pxCtx->uxSubscriptionCount;
+
+        /* Enqueue the subscribe command */
+        xStatus = MQTTAgent_Subscribe( pxMqttAgentCtx,
+                                       &( pxCtx->xInitialSubscribeArgs ),
+                                       &xCommandParams );
+
+        /* prvResubscribeCommandCallback handles giving the mutex */
+
+        if( xStatus != MQTTSuccess )
+        {
+            LogError( "Failed to enqueue the MQTT subscribe command. xStatus=%s.",
+                      MQTT_Status_strerror( xStatus ) );
+        }
+    }
+    else
+    {
+        ( void ) xUnlockSubCtx( pxCtx );
+
+        /* Mark the resubscribe as success if there is nothing to be subscribed to. */
+        xStatus = MQTTSuccess;
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Call xCallback with the index of each callback whose filter matches the
+ * topic. The trie and the linear fallback use the same matching rules, so the
+ * result does not depend on whether the trie could be built.
+ */
+static size_t prvForEachMatch( SubMgrCtx_t * pxCtx,
+                               const char * pcTopic,
+                               uint16_t usTopicLen,
+                               TopicTrieMatchCallback_t xCallback,
+                               void * pvCbCtx )
+{
+    size_t uxMatches = 0U;
+
+    if( pxCtx->xTopicTrieValid )
+    {
+        uxMatches = uxTopicTrie_Match( &( pxCtx->xTopicTrie ), pcTopic, usTopicLen, xCallback, pvCbCtx );
+    }
+    else
+    {
+        for( size_t uxCbIdx = 0; uxCbIdx < pxCtx->uxMaxCallbacks; uxCbIdx++ )
+        {
+            MQTTSubscribeInfo_t * const pxSubInfo = pxCtx->pxCallbacks[ uxCbIdx ].pxSubInfo;
+
+            if( ( pxSubInfo != NULL ) &&
+                xTopicTrie_MatchFilter( pxSubInfo->pTopicFilter, pxSubInfo->topicFilterLength,
+                                        pcTopic, usTopicLen ) )
+            {
+                xCallback( pvCbCtx, ( uint16_t ) uxCbIdx );
+                uxMatches++;
+            }
+        }
+    }
+
+    return uxMatches;
+}
+
+/*-----------------------------------------------------------*/
+
+static inline bool prvMatchCbCtx( SubCallbackElement_t * pxCbCtx,
+                                  MQTTSubscribeInfo_t * pxSubInfo,
+                                  IncomingPubCallback_t pxCallback,
+                                  IncomingStreamCallback_t pxStreamCallback,
+                                  void * pvCallbackCtx )
+{
+    return( pxCbCtx->pxSubInfo == pxSubInfo &&
+            pxCbCtx->pvIncomingPublishCallbackContext == pvCallbackCtx &&
+            pxCbCtx->pxIncomingPublishCallback == pxCallback &&
+            pxCbCtx->pxIncomingStreamCallback == pxStreamCallback &&
+            pxCbCtx->xTaskHandle == xTaskGetCurrentTaskHandle() );
+}
+
+/*-----------------------------------------------------------*/
+
+typedef struct
+{
+    SubMgrCtx_t * pxCtx;
+    MQTTPublishInfo_t * pxPublishInfo;
+} PublishDispatchCtx_t;
+
+static void prvDispatchPublish( void * pvCtx,
+                                uint16_t usCbIdx )
+{
+    PublishDispatchCtx_t * pxDispatch = ( PublishDispatchCtx_t * ) pvCtx;
+    SubCallbackElement_t * const pxCallback = &( pxDispatch->pxCtx->pxCallbacks[ usCbIdx ] );
+
+    configASSERT( usCbIdx < pxDispatch->pxCtx->uxMaxCallbacks );
+    configASSERT( pxCallback->pxSubInfo != NULL );
+
+    LogDebug( "Handling callback for topic=\"%.*s\", filter=\"%.*s\".",
+              pxDispatch->pxPublishInfo->topicNameLength, pxDispatch->pxPublishInfo->pTopicName,
+              pxCallback->pxSubInfo->topicFilterLength, pxCallback->pxSubInfo->pTopicFilter );
+
+    if( pxCallback->pxIncomingStreamCallback != NULL )
+    {
+        /* Publishes that could not be streamed, such as QoS2, arrive in one piece */
+        pxCallback->pxIncomingStreamCallback( pxCallback->pvIncomingPublishCallbackContext,
+                                              pxDispatch->pxPublishInfo,
+                                              0U,
+                                              pxDispatch->pxPublishInfo->pPayload,
+                                              pxDispatch->pxPublishInfo->payloadLength );
+    }
+    else
+    {
+        pxCallback->pxIncomingPublishCallback( pxCallback->pvIncomingPublishCallbackContext,
+                                               pxDispatch->pxPublishInfo );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
+                                        uint16_t packetId,
+                                        MQTTPublishInfo_t * pxPublishInfo )
+{
+    SubMgrCtx_t * pxCtx = NULL;
+    bool xPublishHandled = false;
+
+    ( void ) packetId;
+
+    configASSERT( pMqttAgentContext );
+    configASSERT( pMqttAgentContext->pIncomingCallbackContext );
+    configASSERT( pxPublishInfo );
+
+    pxCtx = ( SubMgrCtx_t * ) pMqttAgentContext->pIncomingCallbackContext;
+
+    if( xLockSubCtx( pxCtx ) )
+    {
+        PublishDispatchCtx_t xDispatch =
+        {
+            .pxCtx         = pxCtx,
+            .pxPublishInfo = pxPublishInfo,
+        };
+
+        xPublishHandled = ( prvForEachMatch( pxCtx,
+                                             pxPublishInfo->pTopicName,
+                                             pxPublishInfo->topicNameLength,
+                                             prvDispatchPublish,
+                                             &xDispatch ) > 0U );
+
+        ( void ) xUnlockSubCtx( pxCtx );
+    }
+
+    if( !xPublishHandled )
+    {
+        LogWarn( "Incoming publish with topic=\"%.*s\" does not match any callback functions.",
+                 pxPublishInfo->topicNameLength, pxPublishInfo->pTopicName );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read from the transport until pucRecvHeader holds uxLen bytes.
+ * Returns 1 once it does, 0 if no more data is available yet. */
+static int32_t prvRecvHeaderBytes( MQTTAgentTaskCtx_t * pxCtx,
+                                   NetworkContext_t * pxNetworkContext,
+                                   size_t uxLen )
+{
+    int32_t lResult = 1;
+
+    configASSERT( uxLen <= RECV_HEADER_MAX );
+
+    while( ( lResult > 0 ) && ( pxCtx->uxRecvHeaderLen < uxLen ) )
+    {
+        lResult = mbedtls_transport_recv( pxNetworkContext,
+                                          &( pxCtx->pucRecvHeader[ pxCtx->uxRecvHeaderLen ] ),
+                                          uxLen - pxCtx->uxRecvHeaderLen );
+
+        if( lResult > 0 )
+        {
+            pxCtx->uxRecvHeaderLen += ( size_t ) lResult;
+        }
+    }
+
+    return ( lResult > 0 ) ? 1 : lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Returns the length of the buffered fixed header and decodes its remaining
+ * length, or returns 0 if another remaining length byte is needed. */
+static size_t prvFixedHeaderLen( const MQTTAgentTaskCtx_t * pxCtx,
+                                 size_t * puxRemainingLen )
+{
+    size_t uxFixedLen = 0;
+    size_t uxRemainingLen = 0;
+    size_t uxMultiplier = 1;
+
+    for( size_t uxIdx = 1; ( uxIdx < pxCtx->uxRecvHeaderLen ) && ( uxFixedLen == 0 ); uxIdx++ )
+    {
+        uxRemainingLen += ( size_t ) ( pxCtx->pucRecvHeader[ uxIdx ] & 0x7FU ) * uxMultiplier;
+        uxMultiplier *= 128U;
+
+        /* A malformed length is left for coreMQTT to reject */
+        if( ( ( pxCtx->pucRecvHeader[ uxIdx ] & 0x80U ) == 0U ) ||
+            ( uxIdx == 4U ) )
+        {
+            uxFixedLen = uxIdx + 1U;
+        }
+    }
+
+    *puxRemainingLen = uxRemainingLen;
+
+    return uxFixedLen;
+}
+
+/*-----------------------------------------------------------*/
+
+typedef struct
+{
+    SubMgrCtx_t * pxCtx;
+    bool xFound;
+} StreamLookupCtx_t;
+
+static void prvFindStreamCallback( void * pvCtx,
+                                   uint16_t usCbIdx )
+{
+    StreamLookupCtx_t * pxLookup = ( StreamLookupCtx_t * ) pvCtx;
+
+    configASSERT( usCbIdx < pxLookup->pxCtx->uxMaxCallbacks );
+
+    if( pxLookup->pxCtx->pxCallbacks[ usCbIdx ].pxIncomingStreamCallback != NULL )
+    {
+        pxLookup->xFound = true;
+    }
+}
+
+static bool prvHasStreamCallback( SubMgrCtx_t * pxSubMgrCtx,
+                                  const char * pcTopic,
+                                  uint16_t usTopicLen )
+{
+    StreamLookupCtx_t xLookup =
+    {
+        .pxCtx  = pxSubMgrCtx,
+        .xFound = false,
+    };
+
+    ( void ) prvForEachMatch( pxSubMgrCtx, pcTopic, usTopicLen, prvFindStreamCallback, &xLookup );
+
+    return xLookup.xFound;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Buffer the header of the next packet. PUBLISH packets at QoS0 and QoS1 are
+ * buffered up to the end of the variable header so that the topic can be
+ * matched against stream callbacks; everything else only up to the end of the
+ * fixed header.
+ */
+static int32_t prvRecvReadHeader( MQTTAgentTaskCtx_t * pxCtx,
+                                  NetworkContext_t * pxNetworkContext )
+{
+    SubMgrCtx_t * const pxSubMgrCtx = &( pxCtx->xSubMgrCtx );
+    uint8_t ucType = 0;
+    MQTTQoS_t xQoS = MQTTQoS0;
+    int32_t lResult = 1;
+    size_t uxFixedLen = 0;
+    size_t uxRemainingLen = 0;
+    size_t uxTopicLen = 0;
+    size_t uxVarLen = 0;
+
+    /* Type byte, then the remaining length one byte at a time */
+    lResult = prvRecvHeaderBytes( pxCtx, pxNetworkContext, 1U );
+
+    while( ( lResult > 0 ) &&
+           ( ( uxFixedLen = prvFixedHeaderLen( pxCtx, &uxRemainingLen ) ) == 0 ) )
+    {
+        lResult = prvRecvHeaderBytes( pxCtx, pxNetworkContext, pxCtx->uxRecvHeaderLen + 1U );
+    }
+
+    ucType = pxCtx->pucRecvHeader[ 0 ];
+    xQoS = ( MQTTQoS_t ) ( ( ucType >> 1 ) & 0x3U );
+
+    if( lResult <= 0 )
+    {
+        /* Wait for more data */
+    }
+    else if( ( ( ucType & 0xF0U ) != MQTT_PACKET_TYPE_PUBLISH ) ||
+             ( xQoS > MQTTQoS1 ) ||
+             ( pxSubMgrCtx->uxStreamCallbackCount == 0 ) ||
+             ( uxRemainingLen < 2U ) )
+    {
+        pxCtx->uxRecvLeft = uxRemainingLen;
+        pxCtx->xRecvState = RECV_REPLAY;
+    }
+    else
+    {
+        lResult = prvRecvHeaderBytes( pxCtx, pxNetworkContext, uxFixedLen + 2U );
+
+        if( lResult > 0 )
+        {
+            uxTopicLen = ( ( size_t ) pxCtx->pucRecvHeader[ uxFixedLen ] << 8 ) |
+                         pxCtx->pucRecvHeader[ uxFixedLen + 1U ];
+            uxVarLen = 2U + uxTopicLen + ( ( xQoS == MQTTQoS0 ) ? 0U : 2U );
+
+            if( ( uxTopicLen > MQTT_AGENT_STREAM_TOPIC_MAX ) ||
+                ( uxVarLen > uxRemainingLen ) )
+            {
+                pxCtx->uxRecvLeft = uxRemainingLen - 2U;
+                pxCtx->xRecvState = RECV_REPLAY;
+            }
+            else
+            {
+                lResult = prvRecvHeaderBytes( pxCtx, pxNetworkContext, uxFixedLen + uxVarLen );
+            }
+        }
+
+        if( ( lResult > 0 ) && ( pxCtx->xRecvState == RECV_HEADER ) )
+        {
+            const char * pcTopic = ( const char * ) &( pxCtx->pucRecvHeader[ uxFixedLen + 2U ] );
+            bool xStream = false;
+
+            /* The agent task holds the lock while it connects and resubscribes */
+            if( MUTEX_IS_OWNED( pxSubMgrCtx->xMutex ) )
+            {
+                xStream = prvHasStreamCallback( pxSubMgrCtx, pcTopic, ( uint16_t ) uxTopicLen );
+            }
+            else if( xLockSubCtx( pxSubMgrCtx ) )
+            {
+                xStream = prvHasStreamCallback( pxSubMgrCtx, pcTopic, ( uint16_t ) uxTopicLen );
+                ( void ) xUnlockSubCtx( pxSubMgrCtx );
+            }
+            else
+            {
+                /* Empty */
+            }
 
-            for( uint32_t ulCbIdx = 0; ulCbIdx < MQTT_AGENT_MAX_CALLBACKS; ulCbIdx++ )
+            if( xStream )
             {
-                SubCallbackElement_t * const pxCbInfo = &( pxCtx->pxCallbacks[ ulCbIdx ] );
+                pxCtx->xStreamInfo.qos = xQoS;
+                pxCtx->xStreamInfo.retain = ( ( ucType & 0x1U ) != 0U );
+                pxCtx->xStreamInfo.dup = ( ( ucType & 0x8U ) != 0U );
+                pxCtx->xStreamInfo.pTopicName = pcTopic;
+                pxCtx->xStreamInfo.topicNameLength = ( uint16_t ) uxTopicLen;
+                pxCtx->xStreamInfo.pPayload = NULL;
+                pxCtx->xStreamInfo.payloadLength = uxRemainingLen - uxVarLen;
 
-                if( ( pxCbInfo->pxSubInfo == pxSubInfo ) &&
-                    ( pxCbInfo->xTaskHandle != NULL ) )
+                pxCtx->usStreamPacketId = 0;
+
+                if( xQoS == MQTTQoS1 )
                 {
-                    LogWarn( "Detected orphaned callback for task: %s due to failed re-subscribe operation.",
-                             pcTaskGetName( pxCbInfo->xTaskHandle ) );
+                    pxCtx->usStreamPacketId = ( uint16_t ) ( ( pxCtx->pucRecvHeader[ uxFixedLen + uxVarLen - 2U ] << 8 ) |
+                                                             pxCtx->pucRecvHeader[ uxFixedLen + uxVarLen - 1U ] );
                 }
+
+                pxCtx->uxRecvLeft = pxCtx->xStreamInfo.payloadLength;
+                pxCtx->xRecvState = RECV_STREAM;
+            }
+            else
+            {
+                pxCtx->uxRecvLeft = uxRemainingLen - uxVarLen;
+                pxCtx->xRecvState = RECV_REPLAY;
             }
         }
     }
 
-    ( void ) xUnlockSubCtx( pxCtx );
+    pxCtx->uxRecvHeaderPos = 0;
+
+    return lResult;
 }
 
 /*-----------------------------------------------------------*/
 
-static MQTTStatus_t prvHandleResubscribe( MQTTAgentContext_t * pxMqttAgentCtx,
-                                          SubMgrCtx_t * pxCtx )
+typedef struct
 {
-    MQTTStatus_t xStatus = MQTTBadParameter;
+    SubMgrCtx_t * pxCtx;
+    const MQTTPublishInfo_t * pxPublishInfo;
+    size_t uxOffset;
+    const void * pvChunk;
+    size_t uxChunkLen;
+} StreamDispatchCtx_t;
+
+static void prvDispatchStreamCallback( void * pvCtx,
+                                       uint16_t usCbIdx )
+{
+    StreamDispatchCtx_t * pxDispatch = ( StreamDispatchCtx_t * ) pvCtx;
+    SubCallbackElement_t * const pxCallback = &( pxDispatch->pxCtx->pxCallbacks[ usCbIdx ] );
 
-    configASSERT( pxCtx );
-    configASSERT( pxCtx->xMutex );
-    configASSERT( MUTEX_IS_OWNED( pxCtx->xMutex ) );
+    configASSERT( usCbIdx < pxDispatch->pxCtx->uxMaxCallbacks );
 
-    prvCompressSubscriptionList( pxCtx->pxSubscriptions,
-                                 pxCtx->pxCallbacks,
-                                 &( pxCtx->uxSubscriptionCount ) );
+    if( pxCallback->pxIncomingStreamCallback != NULL )
+    {
+        pxCallback->pxIncomingStreamCallback( pxCallback->pvIncomingPublishCallbackContext,
+                                              pxDispatch->pxPublishInfo,
+                                              pxDispatch->uxOffset,
+                                              pxDispatch->pvChunk,
+                                              pxDispatch->uxChunkLen );
+    }
+}
 
-    if( ( xStatus == MQTTSuccess ) && ( pxCtx->uxSubscriptionCount > 0U ) )
+static void prvDispatchStreamChunk( SubMgrCtx_t * pxSubMgrCtx,
+                                    const MQTTPublishInfo_t * pxPublishInfo,
+                                    size_t uxOffset,
+                                    const void * pvChunk,
+                                    size_t uxChunkLen )
+{
+    StreamDispatchCtx_t xDispatch =
     {
-        MQTTAgentCommandInfo_t xCommandParams =
-        {
-            .blockTimeMs                 = 0U,
-            .cmdCompleteCallback         = prvResubscribeCommandCallback,
-            .pCmdCompleteCallbackContext = ( void * ) pxCtx,
-        };
+        .pxCtx         = pxSubMgrCtx,
+        .pxPublishInfo = pxPublishInfo,
+        .uxOffset      = uxOffset,
+        .pvChunk       = pvChunk,
+        .uxChunkLen    = uxChunkLen,
+    };
 
-        pxCtx->xInitialSubscribeArgs.pSubscribeInfo = pxCtx->pxSubscriptions;
-        pxCtx->xInitialSubscribeArgs.numSubscriptions = pxCtx->uxSubscriptionCount;
+    ( void ) prvForEachMatch( pxSubMgrCtx,
+                              pxPublishInfo->pTopicName,
+                              pxPublishInfo->topicNameLength,
+                              prvDispatchStreamCallback,
+                              &xDispatch );
+}
 
-        /* Enqueue the subscribe command */
-        xStatus = MQTTAgent_Subscribe( pxMqttAgentCtx,
-                                       &( pxCtx->xInitialSubscribeArgs ),
-                                       &xCommandParams );
+/*-----------------------------------------------------------*/
 
-        /* prvResubscribeCommandCallback handles giving the mutex */
+/*
+ * Pass the payload of a streamed PUBLISH to the stream callbacks as it
+ * arrives. coreMQTT reads the fixed header of the next packet into locals,
+ * so the network buffer is free to hold each chunk.
+ */
+static int32_t prvRecvStream( MQTTAgentTaskCtx_t * pxCtx,
+                              NetworkContext_t * pxNetworkContext )
+{
+    SubMgrCtx_t * const pxSubMgrCtx = &( pxCtx->xSubMgrCtx );
+    uint8_t * const pucChunk = pxCtx->xNetworkFixedBuffer.pBuffer;
+    int32_t lResult = 1;
+    bool xFirst = ( pxCtx->uxRecvLeft == pxCtx->xStreamInfo.payloadLength );
 
-        if( xStatus != MQTTSuccess )
+    /* An empty payload is delivered as a single empty chunk */
+    while( ( lResult > 0 ) && ( ( pxCtx->uxRecvLeft > 0 ) || xFirst ) )
+    {
+        size_t uxChunkLen = ( pxCtx->uxRecvLeft < pxCtx->xNetworkFixedBuffer.size ) ?
+                            pxCtx->uxRecvLeft : pxCtx->xNetworkFixedBuffer.size;
+
+        if( uxChunkLen > 0 )
         {
-            LogError( "Failed to enqueue the MQTT subscribe command. xStatus=%s.",
-                      MQTT_Status_strerror( xStatus ) );
+            lResult = mbedtls_transport_recv( pxNetworkContext, pucChunk, uxChunkLen );
         }
-    }
-    else
-    {
-        ( void ) xUnlockSubCtx( pxCtx );
 
-        /* Mark the resubscribe as success if there is nothing to be subscribed to. */
-        xStatus = MQTTSuccess;
-    }
+        if( lResult > 0 )
+        {
+            size_t uxOffset = pxCtx->xStreamInfo.payloadLength - pxCtx->uxRecvLeft;
 
-    return xStatus;
-}
+            uxChunkLen = ( uxChunkLen > 0 ) ? ( size_t ) lResult : 0U;
 
-/*-----------------------------------------------------------*/
+            if( MUTEX_IS_OWNED( pxSubMgrCtx->xMutex ) )
+            {
+                prvDispatchStreamChunk( pxSubMgrCtx, &( pxCtx->xStreamInfo ), uxOffset, pucChunk, uxChunkLen );
+            }
+            else if( xLockSubCtx( pxSubMgrCtx ) )
+            {
+                prvDispatchStreamChunk( pxSubMgrCtx, &( pxCtx->xStreamInfo ), uxOffset, pucChunk, uxChunkLen );
+                ( void ) xUnlockSubCtx( pxSubMgrCtx );
+            }
+            else
+            {
+                /* Empty */
+            }
 
-static inline bool prvMatchTopic( MQTTSubscribeInfo_t * pxSubscribeInfo,
-                                  const char * pcTopicName,
-                                  const uint16_t usTopicLen )
-{
-    MQTTStatus_t xStatus = MQTTSuccess;
-    bool isMatched = false;
+            pxCtx->uxRecvLeft -= uxChunkLen;
+            xFirst = false;
+        }
+    }
 
-    xStatus = MQTT_MatchTopic( pcTopicName,
-                               usTopicLen,
-                               pxSubscribeInfo->pTopicFilter,
-                               pxSubscribeInfo->topicFilterLength,
-                               &isMatched );
-    return ( xStatus == MQTTSuccess ) && isMatched;
-}
+    if( ( lResult > 0 ) && ( pxCtx->xStreamInfo.qos == MQTTQoS1 ) )
+    {
+        uint8_t pucPubAck[ MQTT_PUBLISH_ACK_PACKET_SIZE ];
+        MQTTFixedBuffer_t xAckBuffer = { .pBuffer = pucPubAck, .size = sizeof( pucPubAck ) };
 
-/*-----------------------------------------------------------*/
+        if( ( MQTT_SerializeAck( &xAckBuffer, MQTT_PACKET_TYPE_PUBACK, pxCtx->usStreamPacketId ) != MQTTSuccess ) ||
+            ( mbedtls_transport_send( pxNetworkContext, pucPubAck, sizeof( pucPubAck ) ) != ( int32_t ) sizeof( pucPubAck ) ) )
+        {
+            LogError( "Failed to send PUBACK for streamed publish, packet id: %u.", pxCtx->usStreamPacketId );
+            lResult = -1;
+        }
+    }
 
-static inline bool prvMatchCbCtx( SubCallbackElement_t * pxCbCtx,
-                                  MQTTSubscribeInfo_t * pxSubInfo,
-                                  IncomingPubCallback_t pxCallback,
-                                  void * pvCallbackCtx )
-{
-    return( pxCbCtx->pxSubInfo == pxSubInfo &&
-            pxCbCtx->pvIncomingPublishCallbackContext == pvCallbackCtx &&
-            pxCbCtx->pxIncomingPublishCallback == pxCallback &&
-            pxCbCtx->xTaskHandle == xTaskGetCurrentTaskHandle() );
+    if( lResult > 0 )
+    {
+        AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulPublishesStreamed );
+        pxCtx->uxRecvHeaderLen = 0;
+        pxCtx->xRecvState = RECV_HEADER;
+    }
+
+    return lResult;
 }
 
 /*-----------------------------------------------------------*/
 
-static void prvIncomingPublishCallback( MQTTAgentContext_t * pMqttAgentContext,
-                                        uint16_t packetId,
-                                        MQTTPublishInfo_t * pxPublishInfo )
+/*
+ * coreMQTT only accepts packets that fit in the network buffer. Publishes for
+ * stream callbacks are framed here instead and handed out chunk by chunk;
+ * every other packet is replayed to coreMQTT unchanged, starting with the
+ * header bytes that were read to classify it.
+ */
+static int32_t prvTransportRecv( NetworkContext_t * pxNetworkContext,
+                                 void * pvBuffer,
+                                 size_t uxBytesToRecv )
 {
-    SubMgrCtx_t * pxCtx = NULL;
-    bool xPublishHandled = false;
-
-    ( void ) packetId;
-
-    configASSERT( pMqttAgentContext );
-    configASSERT( pMqttAgentContext->pIncomingCallbackContext );
-    configASSERT( pxPublishInfo );
-
-    pxCtx = ( SubMgrCtx_t * ) pMqttAgentContext->pIncomingCallbackContext;
+    MQTTAgentTaskCtx_t * pxCtx = ( MQTTAgentTaskCtx_t * ) xDefaultInstanceHandle;
+    int32_t lResult = 0;
 
-    if( xLockSubCtx( pxCtx ) )
+    if( pxCtx == NULL )
+    {
+        lResult = mbedtls_transport_recv( pxNetworkContext, pvBuffer, uxBytesToRecv );
+    }
+    else
     {
-        /* Iterate over pxCtx->pxCallbacks list */
-        for( uint32_t ulCbIdx = 0; ulCbIdx < MQTT_AGENT_MAX_CALLBACKS; ulCbIdx++ )
+        if( pxCtx->xRecvState == RECV_HEADER )
         {
-            SubCallbackElement_t * const pxCallback = &( pxCtx->pxCallbacks[ ulCbIdx ] );
-            MQTTSubscribeInfo_t * const pxSubInfo = pxCallback->pxSubInfo;
+            lResult = prvRecvReadHeader( pxCtx, pxNetworkContext );
+        }
 
-            if( ( pxSubInfo != NULL ) &&
-                prvMatchTopic( pxSubInfo,
-                               pxPublishInfo->pTopicName,
-                               pxPublishInfo->topicNameLength ) )
+        /* Report no data after a streamed publish so that the agent gets to
+         * process its queue. The next packet may already be decrypted and
+         * held by mbedtls, where no socket event will announce it, so the
+         * agent is notified again while anything is left to read. */
+        if( pxCtx->xRecvState == RECV_STREAM )
+        {
+            lResult = prvRecvStream( pxCtx, pxNetworkContext );
+
+            if( ( lResult > 0 ) &&
+                ( mbedtls_transport_recvpending( pxNetworkContext ) == pdTRUE ) )
             {
-                char * pcTaskName = pcTaskGetName( pxCallback->xTaskHandle );
+                prvSocketRecvReadyCallback( &( pxCtx->xAgentMessageCtx ) );
+            }
 
-                if( !pcTaskName )
-                {
-                    pcTaskName = "Unknown";
-                }
+            lResult = ( lResult > 0 ) ? 0 : lResult;
+        }
 
-                LogInfo( "Handling callback for task=%s, topic=\"%.*s\", filter=\"%.*s\".",
-                         pcTaskName,
-                         pxPublishInfo->topicNameLength, pxPublishInfo->pTopicName,
-                         pxSubInfo->topicFilterLength, pxSubInfo->pTopicFilter );
+        if( pxCtx->xRecvState != RECV_REPLAY )
+        {
+            /* Waiting for data or failed */
+        }
+        else if( pxCtx->uxRecvHeaderPos < pxCtx->uxRecvHeaderLen )
+        {
+            size_t uxLen = pxCtx->uxRecvHeaderLen - pxCtx->uxRecvHeaderPos;
+
+            uxLen = ( uxLen < uxBytesToRecv ) ? uxLen : uxBytesToRecv;
+            ( void ) memcpy( pvBuffer, &( pxCtx->pucRecvHeader[ pxCtx->uxRecvHeaderPos ] ), uxLen );
+            pxCtx->uxRecvHeaderPos += uxLen;
+            lResult = ( int32_t ) uxLen;
+        }
+        else
+        {
+            lResult = mbedtls_transport_recv( pxNetworkContext,
+                                              pvBuffer,
+                                              ( uxBytesToRecv < pxCtx->uxRecvLeft ) ? uxBytesToRecv : pxCtx->uxRecvLeft );
 
-                pxCallback->pxIncomingPublishCallback( pxCallback->pvIncomingPublishCallbackContext,
-                                                       pxPublishInfo );
-                xPublishHandled = true;
+            if( lResult > 0 )
+            {
+                pxCtx->uxRecvLeft -= ( size_t ) lResult;
             }
         }
 
-        ( void ) xUnlockSubCtx( pxCtx );
+        if( lResult < 0 )
+        {
+            pxCtx->xRecvState = RECV_HEADER;
+            pxCtx->uxRecvHeaderLen = 0;
+        }
+        else if( ( pxCtx->xRecvState == RECV_REPLAY ) &&
+                 ( pxCtx->uxRecvHeaderPos == pxCtx->uxRecvHeaderLen ) &&
+                 ( pxCtx->uxRecvLeft == 0 ) )
+        {
+            pxCtx->xRecvState = RECV_HEADER;
+            pxCtx->uxRecvHeaderLen = 0;
+        }
+        else
+        {
+            /* Empty */
+        }
     }
 
-    if( !xPublishHandled )
-    {
-        LogWarn( "Incoming publish with topic=\"%.*s\" does not match any callback functions.",
-                 pxPublishInfo->topicNameLength, pxPublishInfo->pTopicName );
-    }
+    return lResult;
 }
 
 /*-----------------------------------------------------------*/
@@ -732,6 +2198,18 @@ static void prvSubscriptionManagerCtxFree( SubMgrCtx_t * pxSubMgrCtx )
         configASSERT_CONTINUE( MUTEX_IS_OWNED( pxSubMgrCtx->xMutex ) );
         vSemaphoreDelete( pxSubMgrCtx->xMutex );
     }
+
+    vTopicTrie_Free( &( pxSubMgrCtx->xTopicTrie ) );
+
+    vPortFree( pxSubMgrCtx->pxSubscriptions );
+    vPortFree( pxSubMgrCtx->pxSubAckStatus );
+    vPortFree( pxSubMgrCtx->pulSubCbCount );
+    vPortFree( pxSubMgrCtx->pxCallbacks );
+
+    pxSubMgrCtx->pxSubscriptions = NULL;
+    pxSubMgrCtx->pxSubAckStatus = NULL;
+    pxSubMgrCtx->pulSubCbCount = NULL;
+    pxSubMgrCtx->pxCallbacks = NULL;
 }
 
 /*-----------------------------------------------------------*/
@@ -743,8 +2221,9 @@ static void prvSubscriptionManagerCtxReset( SubMgrCtx_t * pxSubMgrCtx )
 
     pxSubMgrCtx->uxSubscriptionCount = 0;
     pxSubMgrCtx->uxCallbackCount = 0;
+    pxSubMgrCtx->uxStreamCallbackCount = 0;
 
-    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
+    for( size_t uxIdx = 0; uxIdx < pxSubMgrCtx->uxMaxSubscriptions; uxIdx++ )
     {
         pxSubMgrCtx->pxSubAckStatus[ uxIdx ] = MQTTSubAckFailure;
         pxSubMgrCtx->pulSubCbCount[ uxIdx ] = 0;
@@ -754,16 +2233,46 @@ static void prvSubscriptionManagerCtxReset( SubMgrCtx_t * pxSubMgrCtx )
         pxSubMgrCtx->pxSubscriptions[ uxIdx ].topicFilterLength = 0;
     }
 
-    for( size_t uxIdx = 0; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
+    for( size_t uxIdx = 0; uxIdx < pxSubMgrCtx->uxMaxCallbacks; uxIdx++ )
     {
         pxSubMgrCtx->pxCallbacks[ uxIdx ].pvIncomingPublishCallbackContext = NULL;
         pxSubMgrCtx->pxCallbacks[ uxIdx ].pxIncomingPublishCallback = NULL;
+        pxSubMgrCtx->pxCallbacks[ uxIdx ].pxIncomingStreamCallback = NULL;
         pxSubMgrCtx->pxCallbacks[ uxIdx ].pxSubInfo = NULL;
         pxSubMgrCtx->pxCallbacks[ uxIdx ].xTaskHandle = NULL;
     }
 
     pxSubMgrCtx->xInitialSubscribeArgs.numSubscriptions = 0;
     pxSubMgrCtx->xInitialSubscribeArgs.pSubscribeInfo = NULL;
+
+    vTopicTrie_Clear( &( pxSubMgrCtx->xTopicTrie ) );
+    pxSubMgrCtx->xTopicTrieValid = true;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvReadCapacity( KVStoreKey_t xKey,
+                               size_t uxDefault,
+                               size_t uxLimit )
+{
+    BaseType_t xSuccess = pdFALSE;
+    size_t uxValue = ( size_t ) KVStore_getUInt32( xKey, &xSuccess );
+
+    if( ( xSuccess == pdFALSE ) || ( uxValue == 0 ) )
+    {
+        uxValue = uxDefault;
+    }
+    else if( uxValue > uxLimit )
+    {
+        LogWarn( "Limiting %s to %lu.", kvKeyToString( xKey ), ( unsigned long ) uxLimit );
+        uxValue = uxLimit;
+    }
+    else
+    {
+        /* Empty */
+    }
+
+    return uxValue;
 }
 
 /*-----------------------------------------------------------*/
@@ -771,12 +2280,43 @@ static void prvSubscriptionManagerCtxReset( SubMgrCtx_t * pxSubMgrCtx )
 static MQTTStatus_t prvSubscriptionManagerCtxInit( SubMgrCtx_t * pxSubMgrCtx )
 {
     MQTTStatus_t xStatus = MQTTSuccess;
+    size_t uxMaxSubs = 0;
+    size_t uxMaxCbs = 0;
 
     configASSERT( pxSubMgrCtx );
 
-    pxSubMgrCtx->xMutex = xSemaphoreCreateMutex();
+    uxMaxSubs = prvReadCapacity( CS_MQTT_MAX_SUBS, MQTT_MAX_SUBS_DFLT, MQTT_AGENT_SUBSCRIPTIONS_LIMIT );
+    uxMaxCbs = prvReadCapacity( CS_MQTT_MAX_CBS, MQTT_MAX_CBS_DFLT, MQTT_AGENT_CALLBACKS_LIMIT );
 
-    if( pxSubMgrCtx->xMutex )
+    pxSubMgrCtx->pxSubscriptions = pvPortMalloc( sizeof( MQTTSubscribeInfo_t ) * uxMaxSubs );
+    pxSubMgrCtx->pxSubAckStatus = pvPortMalloc( sizeof( MQTTSubAckStatus_t ) * uxMaxSubs );
+    pxSubMgrCtx->pulSubCbCount = pvPortMalloc( sizeof( uint32_t ) * uxMaxSubs );
+    pxSubMgrCtx->pxCallbacks = pvPortMalloc( sizeof( SubCallbackElement_t ) * uxMaxCbs );
+
+    if( ( pxSubMgrCtx->pxSubscriptions == NULL ) ||
+        ( pxSubMgrCtx->pxSubAckStatus == NULL ) ||
+        ( pxSubMgrCtx->pulSubCbCount == NULL ) ||
+        ( pxSubMgrCtx->pxCallbacks == NULL ) ||
+        !xTopicTrie_Init( &( pxSubMgrCtx->xTopicTrie ),
+                          ( uint16_t ) ( uxMaxSubs * MQTT_AGENT_TRIE_NODES_PER_SUB + 1U ),
+                          ( uint16_t ) uxMaxCbs ) )
+    {
+        xStatus = MQTTNoMemory;
+    }
+    else
+    {
+        pxSubMgrCtx->uxMaxSubscriptions = uxMaxSubs;
+        pxSubMgrCtx->uxMaxCallbacks = uxMaxCbs;
+
+        pxSubMgrCtx->xMutex = xSemaphoreCreateMutex();
+
+        if( pxSubMgrCtx->xMutex == NULL )
+        {
+            xStatus = MQTTNoMemory;
+        }
+    }
+
+    if( xStatus == MQTTSuccess )
     {
         LogDebug( "Creating MqttAgent Mutex." );
         ( void ) xLockSubCtx( pxSubMgrCtx );
@@ -784,7 +2324,7 @@ static MQTTStatus_t prvSubscriptionManagerCtxInit( SubMgrCtx_t * pxSubMgrCtx )
     }
     else
     {
-        xStatus = MQTTNoMemory;
+        prvSubscriptionManagerCtxFree( pxSubMgrCtx );
     }
 
     return xStatus;
@@ -796,11 +2336,23 @@ static void prvFreeAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx )
 {
     if( pxCtx )
     {
-        if( pxCtx->xAgentMessageCtx.xQueue != NULL )
+        for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+        {
+            if( pxCtx->xAgentMessageCtx.pxLanes[ uxLane ] != NULL )
+            {
+                vQueueDelete( pxCtx->xAgentMessageCtx.pxLanes[ uxLane ] );
+            }
+        }
+
+        if( pxCtx->xAgentMessageCtx.xWindowSem != NULL )
         {
-            vQueueDelete( pxCtx->xAgentMessageCtx.xQueue );
+            vSemaphoreDelete( pxCtx->xAgentMessageCtx.xWindowSem );
         }
 
+#if MQTT_AGENT_METRICS_ENABLED
+        vPortFree( pxCtx->xAgentMessageCtx.pxTimings );
+#endif
+
         if( pxCtx->xConnectInfo.pClientIdentifier != NULL )
         {
             vPortFree( ( void * ) pxCtx->xConnectInfo.pClientIdentifier );
@@ -857,8 +2409,13 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
 
         /* Setup transport interface */
         pxCtx->xTransport.pNetworkContext = pxNetworkContext;
-        pxCtx->xTransport.send = mbedtls_transport_send;
-        pxCtx->xTransport.recv = mbedtls_transport_recv;
+#if MQTT_AGENT_METRICS_ENABLED
+        pxCtx->xTransport.send = prvMetricsTransportSend;
+        pxCtx->xTransport.recv = prvMetricsTransportRecv;
+#else
+        pxCtx->xTransport.send = prvTransportSend;
+        pxCtx->xTransport.recv = prvTransportRecv;
+#endif
 
         /* MQTTConnectInfo_t */
         /* Always start the initial connection with a clean session */
@@ -886,18 +2443,39 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
 
     if( xStatus == MQTTSuccess )
     {
-        pxCtx->xAgentMessageCtx.xQueue = xQueueCreate( MQTT_AGENT_COMMAND_QUEUE_LENGTH,
-                                                       sizeof( MQTTAgentCommand_t * ) );
-
-        if( pxCtx->xAgentMessageCtx.xQueue == NULL )
+        /* One queue per lane, so bulk traffic cannot fill the slots of control traffic */
+        for( size_t uxLane = 0; ( uxLane < MQTT_AGENT_NUM_LANES ) && ( xStatus == MQTTSuccess ); uxLane++ )
         {
-            xStatus = MQTTNoMemory;
-            LogError( "Failed to allocate MQTT Agent message queue." );
+            pxCtx->xAgentMessageCtx.pxLanes[ uxLane ] = xQueueCreate( MQTT_AGENT_COMMAND_QUEUE_LENGTH,
+                                                                      sizeof( MQTTAgentCommand_t * ) );
+
+            if( pxCtx->xAgentMessageCtx.pxLanes[ uxLane ] == NULL )
+            {
+                xStatus = MQTTNoMemory;
+                LogError( "Failed to allocate MQTT Agent message queue." );
+            }
         }
 
         pxCtx->xAgentMessageCtx.xAgentTaskHandle = xTaskGetCurrentTaskHandle();
     }
 
+    if( xStatus == MQTTSuccess )
+    {
+        uint32_t ulWindow = ( uint32_t ) prvReadCapacity( CS_MQTT_QOS1_WIN, MQTT_QOS1_WIN_DFLT, MQTT_AGENT_WINDOW_LIMIT );
+
+        pxCtx->xAgentMessageCtx.xWindowSem = xSemaphoreCreateCounting( ulWindow, ulWindow );
+
+        if( pxCtx->xAgentMessageCtx.xWindowSem == NULL )
+        {
+            xStatus = MQTTNoMemory;
+            LogError( "Failed to allocate the QoS1 window semaphore." );
+        }
+        else
+        {
+            pxCtx->xAgentMessageCtx.xWindowStats.ulWindow = ulWindow;
+        }
+    }
+
     if( xStatus == MQTTSuccess )
     {
         /* Setup message interface */
@@ -905,7 +2483,11 @@ static MQTTStatus_t prvConfigureAgentTaskCtx( MQTTAgentTaskCtx_t * pxCtx,
         pxCtx->xMessageInterface.send = prvAgentMessageSend;
         pxCtx->xMessageInterface.recv = prvAgentMessageReceive;
         pxCtx->xMessageInterface.getCommand = Agent_GetCommand;
+#if MQTT_AGENT_METRICS_ENABLED
+        pxCtx->xMessageInterface.releaseCommand = prvMetricsReleaseCommand;
+#else
         pxCtx->xMessageInterface.releaseCommand = Agent_ReleaseCommand;
+#endif
     }
 
     if( xStatus == MQTTSuccess )
@@ -975,6 +2557,9 @@ void vMQTTAgentTask( void * pvParameters )
     /* Miscellaneous initialization. */
     ulGlobalEntryTimeMs = prvGetTimeMs();
 
+    /* Commands enqueued by the agent itself, such as re-subscribing after a reconnect */
+    ( void ) xMqttAgent_SetCommandLane( MQTT_AGENT_LANE_CONTROL );
+
     /* Memory Allocation */
     pucNetworkBuffer = ( uint8_t * ) pvPortMalloc( MQTT_AGENT_NETWORK_BUFFER_SIZE );
 
@@ -1011,6 +2596,15 @@ void vMQTTAgentTask( void * pvParameters )
         }
     }
 
+#if defined( MBEDTLS_TRANSPORT_PSA ) && defined( PSA_TLS_SESSION_ID )
+    if( xMQTTStatus == MQTTSuccess )
+    {
+        /* Keep the TLS session across reboots when enabled with the tls_sess_store key */
+        ( void ) mbedtls_transport_setsessionstorage( pxNetworkContext, PSA_TLS_SESSION_ID,
+                                                      ( KVStore_getUInt32( CS_TLS_SESSION_STORE, NULL ) != 0 ) ? pdTRUE : pdFALSE );
+    }
+#endif /* MBEDTLS_TRANSPORT_PSA && PSA_TLS_SESSION_ID */
+
     if( xMQTTStatus == MQTTSuccess )
     {
         pxCtx = pvPortMalloc( sizeof( MQTTAgentTaskCtx_t ) );
@@ -1028,9 +2622,16 @@ void vMQTTAgentTask( void * pvParameters )
         }
     }
 
+    if( ( xMQTTStatus == MQTTSuccess ) &&
+        ( !Agent_InitializePool() ||
+          !MqttAgent_InitPublishBufferPool() ) )
+    {
+        xMQTTStatus = MQTTNoMemory;
+    }
+
     if( xMQTTStatus == MQTTSuccess )
     {
-        Agent_InitializePool();
+        prvMetricsInit( &( pxCtx->xAgentMessageCtx ) );
     }
 
     if( xMQTTStatus == MQTTSuccess )
@@ -1104,10 +2705,12 @@ void vMQTTAgentTask( void * pvParameters )
             xTlsStatus = mbedtls_transport_connect( pxNetworkContext,
                                                     pxCtx->pcMqttEndpoint,
                                                     ( uint16_t ) pxCtx->ulMqttPort,
-                                                    0, 0 );
+                                                    0, SEND_TIMEOUT_MS );
 
             if( xTlsStatus != TLS_TRANSPORT_SUCCESS )
             {
+                AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulTlsFailures );
+
                 /* Get back-off value (in seconds) for the next connection retry. */
                 xBackoffAlgStatus = BackoffAlgorithm_GetNextBackoff( &xReconnectParams,
                                                                      uxRand(),
@@ -1134,7 +2737,13 @@ void vMQTTAgentTask( void * pvParameters )
 
             configASSERT_CONTINUE( MUTEX_IS_OWNED( pxCtx->xSubMgrCtx.xMutex ) );
 
-            ( void ) MQTTAgent_CancelAll( &( pxCtx->xAgentContext ) );
+            prvCancelQueuedCommands( pxCtx );
+
+            /* A header held when the previous connection dropped is stale */
+            pxCtx->uxHeldHeaderLen = 0;
+            pxCtx->xHeldPayload = false;
+            pxCtx->xRecvState = RECV_HEADER;
+            pxCtx->uxRecvHeaderLen = 0;
 
             xMQTTStatus = MQTT_Connect( &( pxCtx->xAgentContext.mqttContext ),
                                         &( pxCtx->xConnectInfo ),
@@ -1153,6 +2762,13 @@ void vMQTTAgentTask( void * pvParameters )
 
                 xMQTTStatus = MQTTAgent_ResumeSession( &( pxCtx->xAgentContext ), xSessionPresent );
 
+                if( ( xMQTTStatus == MQTTSuccess ) &&
+                    ( xSessionPresent == true ) )
+                {
+                    AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulSessionsResumed );
+                    prvWindowResumed( &( pxCtx->xAgentMessageCtx ) );
+                }
+
                 /* Re-subscribe to all the previously subscribed topics if there is no existing session. */
                 if( ( xMQTTStatus == MQTTSuccess ) &&
                     ( xSessionPresent == false ) )
@@ -1173,12 +2789,14 @@ void vMQTTAgentTask( void * pvParameters )
             }
             else
             {
+                AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulConnectFailures );
                 LogError( "Failed to connect to mqtt broker." );
             }
 
             /* Further reconnects will include a session resume operation */
             if( xMQTTStatus == MQTTSuccess )
             {
+                AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulConnects );
                 pxCtx->xConnectInfo.cleanSession = false;
             }
         }
@@ -1204,11 +2822,14 @@ void vMQTTAgentTask( void * pvParameters )
              * clean up and reconnect however the application writer prefers. */
             xMQTTStatus = MQTTAgent_CommandLoop( &( pxCtx->xAgentContext ) );
 
+            AGENT_METRICS_COUNT( &( pxCtx->xAgentMessageCtx ), ulDisconnects );
+
             LogDebug( "MQTTAgent_CommandLoop returned with status: %s.",
                       MQTT_Status_strerror( xMQTTStatus ) );
         }
 
-        ( void ) MQTTAgent_CancelAll( &( pxCtx->xAgentContext ) );
+        /* Publishes awaiting an acknowledgment are kept for the next session */
+        prvCancelQueuedCommands( pxCtx );
 
         mbedtls_transport_disconnect( pxNetworkContext );
 
@@ -1221,9 +2842,10 @@ void vMQTTAgentTask( void * pvParameters )
         }
 
         /* Reset subscription status */
-        memset( pxCtx->xSubMgrCtx.pxSubAckStatus,
-                MQTTSubAckFailure,
-                sizeof( pxCtx->xSubMgrCtx.pxSubAckStatus ) );
+        for( size_t uxIdx = 0; uxIdx < pxCtx->xSubMgrCtx.uxMaxSubscriptions; uxIdx++ )
+        {
+            pxCtx->xSubMgrCtx.pxSubAckStatus[ uxIdx ] = MQTTSubAckFailure;
+        }
 
         if( !xExitFlag )
         {
@@ -1249,6 +2871,8 @@ void vMQTTAgentTask( void * pvParameters )
 
     if( pxCtx != NULL )
     {
+        ( void ) MQTTAgent_CancelAll( &( pxCtx->xAgentContext ) );
+
         prvFreeAgentTaskCtx( pxCtx );
         pxCtx = NULL;
     }
@@ -1388,10 +3012,12 @@ static inline MQTTStatus_t prvSendSubRequest( MQTTAgentContext_t * pxAgentCtx,
 
 /*-----------------------------------------------------------*/
 
-MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
+/* Exactly one of pxCallback and pxStreamCallback is set */
+static MQTTStatus_t prvSubscribeSync( MQTTAgentHandle_t xHandle,
                                       const char * pcTopicFilter,
                                       MQTTQoS_t xRequestedQoS,
                                       IncomingPubCallback_t pxCallback,
+                                      IncomingStreamCallback_t pxStreamCallback,
                                       void * pvCallbackCtx )
 {
     MQTTStatus_t xStatus = MQTTSuccess;
@@ -1401,7 +3027,7 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
 
     if( ( xHandle == NULL ) ||
         ( pcTopicFilter == NULL ) ||
-        ( pxCallback == NULL ) ||
+        ( ( pxCallback == NULL ) == ( pxStreamCallback == NULL ) ) ||
         !prvValidateQoS( xRequestedQoS ) )
     {
         xStatus = MQTTBadParameter;
@@ -1420,18 +3046,18 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
     if( ( xStatus == MQTTSuccess ) &&
         xLockSubCtx( pxCtx ) )
     {
-        size_t uxTargetSubIdx = MQTT_AGENT_MAX_SUBSCRIPTIONS;
-        size_t uxTargetCbIdx = MQTT_AGENT_MAX_CALLBACKS;
+        size_t uxTargetSubIdx = pxCtx->uxMaxSubscriptions;
+        size_t uxTargetCbIdx = pxCtx->uxMaxCallbacks;
 
         /* If no slot is found, return MQTTNoMemory */
         xStatus = MQTTNoMemory;
 
-        for( size_t uxSubIdx = 0U; uxSubIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxSubIdx++ )
+        for( size_t uxSubIdx = 0U; uxSubIdx < pxCtx->uxMaxSubscriptions; uxSubIdx++ )
         {
             MQTTSubscribeInfo_t * const pxSubInfo = &( pxCtx->pxSubscriptions[ uxSubIdx ] );
 
             if( ( pxCtx->pxSubscriptions[ uxSubIdx ].pTopicFilter == NULL ) &&
-                ( uxTargetSubIdx == MQTT_AGENT_MAX_SUBSCRIPTIONS ) )
+                ( uxTargetSubIdx == pxCtx->uxMaxSubscriptions ) )
             {
                 /* Check that the current context is indeed empty */
                 configASSERT( pxCtx->pxSubscriptions[ uxSubIdx ].topicFilterLength == 0 );
@@ -1442,7 +3068,9 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
                 /* Reset SubAckStatus to trigger a subscribe op */
                 pxCtx->pxSubAckStatus[ uxTargetSubIdx ] = MQTTSubAckFailure;
             }
-            else if( strncmp( pxSubInfo->pTopicFilter, pcTopicFilter, pxSubInfo->topicFilterLength ) == 0 )
+            else if( ( pxSubInfo->pTopicFilter != NULL ) &&
+                     ( pxSubInfo->topicFilterLength == xTopicFilterLen ) &&
+                     ( strncmp( pxSubInfo->pTopicFilter, pcTopicFilter, xTopicFilterLen ) == 0 ) )
             {
                 xRequestedQoS = prvGetNewQoS( pxSubInfo->qos, xRequestedQoS );
                 xStatus = MQTTSuccess;
@@ -1469,9 +3097,9 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
             xStatus = MQTTNoMemory;
 
             /* Find matching or empty callback context */
-            for( size_t uxCbIdx = 0U; uxCbIdx < MQTT_AGENT_MAX_CALLBACKS; uxCbIdx++ )
+            for( size_t uxCbIdx = 0U; uxCbIdx < pxCtx->uxMaxCallbacks; uxCbIdx++ )
             {
-                if( ( uxTargetCbIdx == MQTT_AGENT_MAX_CALLBACKS ) &&
+                if( ( uxTargetCbIdx == pxCtx->uxMaxCallbacks ) &&
                     ( pxCtx->pxCallbacks[ uxCbIdx ].pxSubInfo == NULL ) )
                 {
                     uxTargetCbIdx = uxCbIdx;
@@ -1480,6 +3108,7 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
                 else if( prvMatchCbCtx( &( pxCtx->pxCallbacks[ uxCbIdx ] ),
                                         &( pxCtx->pxSubscriptions[ uxTargetSubIdx ] ),
                                         pxCallback,
+                                        pxStreamCallback,
                                         pvCallbackCtx ) )
                 {
                     uxTargetCbIdx = uxCbIdx;
@@ -1529,6 +3158,7 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
             pxCtx->pxCallbacks[ uxTargetCbIdx ].pxSubInfo = &( pxCtx->pxSubscriptions[ uxTargetSubIdx ] );
             pxCtx->pxCallbacks[ uxTargetCbIdx ].xTaskHandle = xTaskGetCurrentTaskHandle();
             pxCtx->pxCallbacks[ uxTargetCbIdx ].pxIncomingPublishCallback = pxCallback;
+            pxCtx->pxCallbacks[ uxTargetCbIdx ].pxIncomingStreamCallback = pxStreamCallback;
             pxCtx->pxCallbacks[ uxTargetCbIdx ].pvIncomingPublishCallbackContext = pvCallbackCtx;
 
             /* Increment subscription reference count. */
@@ -1536,6 +3166,13 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
 
             pxCtx->uxCallbackCount++;
 
+            if( pxStreamCallback != NULL )
+            {
+                pxCtx->uxStreamCallbackCount++;
+            }
+
+            prvRebuildTopicTrie( pxCtx );
+
             LogInfo( "Callback registered with filter=\"%.*s\".", xTopicFilterLen, pcTopicFilter );
         }
 
@@ -1561,6 +3198,28 @@ MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
 
 /*-----------------------------------------------------------*/
 
+MQTTStatus_t MqttAgent_SubscribeSync( MQTTAgentHandle_t xHandle,
+                                      const char * pcTopicFilter,
+                                      MQTTQoS_t xRequestedQoS,
+                                      IncomingPubCallback_t pxCallback,
+                                      void * pvCallbackCtx )
+{
+    return prvSubscribeSync( xHandle, pcTopicFilter, xRequestedQoS, pxCallback, NULL, pvCallbackCtx );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_SubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                            const char * pcTopicFilter,
+                                            MQTTQoS_t xRequestedQoS,
+                                            IncomingStreamCallback_t pxCallback,
+                                            void * pvCallbackCtx )
+{
+    return prvSubscribeSync( xHandle, pcTopicFilter, xRequestedQoS, NULL, pxCallback, pvCallbackCtx );
+}
+
+/*-----------------------------------------------------------*/
+
 static void prvAgentRequestCallback( MQTTAgentCommandContext_t * pxCommandContext,
                                      MQTTAgentReturnInfo_t * pxReturnInfo )
 {
@@ -1637,9 +3296,11 @@ static inline MQTTStatus_t prvSendUnsubRequest( MQTTAgentContext_t * pxAgentCtx,
 
 /*-----------------------------------------------------------*/
 
-MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
+/* Exactly one of pxCallback and pxStreamCallback is set */
+static MQTTStatus_t prvUnSubscribeSync( MQTTAgentHandle_t xHandle,
                                         const char * pcTopicFilter,
                                         IncomingPubCallback_t pxCallback,
+                                        IncomingStreamCallback_t pxStreamCallback,
                                         void * pvCallbackCtx )
 {
     MQTTStatus_t xStatus = MQTTSuccess;
@@ -1650,7 +3311,7 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
 
     if( ( xHandle == NULL ) ||
         ( pcTopicFilter == NULL ) ||
-        ( pxCallback == NULL ) )
+        ( ( pxCallback == NULL ) == ( pxStreamCallback == NULL ) ) )
     {
         xStatus = MQTTBadParameter;
     }
@@ -1672,7 +3333,7 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
         if( xLockSubCtx( pxCtx ) )
         {
             /* Find matching subscription context */
-            for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
+            for( size_t uxIdx = 0U; uxIdx < pxCtx->uxMaxSubscriptions; uxIdx++ )
             {
                 if( ( xTopicFilterLen == pxCtx->pxSubscriptions[ uxIdx ].topicFilterLength ) &&
                     ( strncmp( pxCtx->pxSubscriptions[ uxIdx ].pTopicFilter,
@@ -1715,10 +3376,10 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
         if( xLockSubCtx( pxCtx ) )
         {
             MQTTSubscribeInfo_t * pxSubInfo = NULL;
-            size_t uxSubInfoIdx = MQTT_AGENT_MAX_SUBSCRIPTIONS;
+            size_t uxSubInfoIdx = pxCtx->uxMaxSubscriptions;
 
             /* Find matching subscription context again */
-            for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_SUBSCRIPTIONS; uxIdx++ )
+            for( size_t uxIdx = 0U; uxIdx < pxCtx->uxMaxSubscriptions; uxIdx++ )
             {
                 if( ( pxCtx->pulSubCbCount[ uxIdx ] == 0 ) &&
                     ( xTopicFilterLen == pxCtx->pxSubscriptions[ uxIdx ].topicFilterLength ) &&
@@ -1738,15 +3399,23 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
                 xStatus = MQTTNoDataAvailable;
 
                 /* Find matching callback context, and remove it. */
-                for( size_t uxIdx = 0U; uxIdx < MQTT_AGENT_MAX_CALLBACKS; uxIdx++ )
+                for( size_t uxIdx = 0U; uxIdx < pxCtx->uxMaxCallbacks; uxIdx++ )
                 {
                     SubCallbackElement_t * pxCbCtx = &( pxCtx->pxCallbacks[ uxIdx ] );
 
-                    if( prvMatchCbCtx( pxCbCtx, pxSubInfo, pxCallback, pvCallbackCtx ) )
+                    if( prvMatchCbCtx( pxCbCtx, pxSubInfo, pxCallback, pxStreamCallback, pvCallbackCtx ) )
                     {
                         xStatus = MQTTSuccess;
+
+                        if( pxStreamCallback != NULL )
+                        {
+                            configASSERT( pxCtx->uxStreamCallbackCount > 0 );
+                            pxCtx->uxStreamCallbackCount--;
+                        }
+
                         pxCbCtx->pvIncomingPublishCallbackContext = NULL;
                         pxCbCtx->pxIncomingPublishCallback = NULL;
+                        pxCbCtx->pxIncomingStreamCallback = NULL;
                         pxCbCtx->pxSubInfo = NULL;
                         pxCbCtx->xTaskHandle = NULL;
 
@@ -1756,7 +3425,8 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
 
                         LogInfo( "Callback de-registered, filter=\"%.*s\".", xTopicFilterLen, pcTopicFilter );
 
-                        prvCompressCallbackList( pxCtx->pxCallbacks, &( pxCtx->uxCallbackCount ) );
+                        prvCompressCallbackList( pxCtx );
+                        prvRebuildTopicTrie( pxCtx );
                         break;
                     }
                 }
@@ -1793,3 +3463,23 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
 
     return xStatus;
 }
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
+                                        const char * pcTopicFilter,
+                                        IncomingPubCallback_t pxCallback,
+                                        void * pvCallbackCtx )
+{
+    return prvUnSubscribeSync( xHandle, pcTopicFilter, pxCallback, NULL, pvCallbackCtx );
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_UnSubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                              const char * pcTopicFilter,
+                                              IncomingStreamCallback_t pxCallback,
+                                              void * pvCallbackCtx )
+{
+    return prvUnSubscribeSync( xHandle, pcTopicFilter, NULL, pxCallback, pvCallbackCtx );
+}
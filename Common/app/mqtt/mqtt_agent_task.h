@@ -2,10 +2,86 @@
 #define _MQTT_AGENT_TASK_H_
 
 #include "FreeRTOS.h"
+#include "core_mqtt_agent.h"
 
 struct MQTTAgentTaskCtx;
 typedef struct MQTTAgentContext * MQTTAgentHandle_t;
 
+/* Upper bound for the QoS1 in-flight window set by the mqtt_qos1_win KVStore
+ * key. A few pending acknowledgment slots are left for subscribe and
+ * unsubscribe requests. */
+#define MQTT_AGENT_WINDOW_LIMIT    ( MQTT_AGENT_MAX_OUTSTANDING_ACKS - 2U )
+
+/* Command priority lanes, highest first */
+typedef enum
+{
+    MQTT_AGENT_LANE_CONTROL = 0, /* Shadow reports and other latency sensitive traffic */
+    MQTT_AGENT_LANE_NORMAL,      /* Default for tasks that do not select a lane */
+    MQTT_AGENT_LANE_BULK,        /* Telemetry, spool replay and OTA */
+    MQTT_AGENT_NUM_LANES
+} MQTTAgentLane_t;
+
+typedef struct
+{
+    uint32_t ulEnqueued;
+    uint32_t ulRejected;  /* Sends that timed out on a full lane */
+    uint32_t ulDepth;
+    uint32_t ulHighWater; /* Deepest the lane has been */
+} MQTTAgentLaneStats_t;
+
+typedef struct
+{
+    uint32_t ulWindow;     /* QoS1 publishes allowed in flight at once */
+    uint32_t ulInFlight;
+    uint32_t ulHighWater;
+    uint32_t ulBlocked;    /* Submitters that waited for a free slot */
+    uint32_t ulRejected;   /* Submitters that timed out waiting */
+    uint32_t ulAcked;
+    uint32_t ulResent;     /* Publishes resent on a resumed session */
+    uint32_t ulAckMsTotal; /* From dequeue by the agent to PUBACK */
+    uint32_t ulAckMsMax;
+} MQTTAgentWindowStats_t;
+
+/* Set to 0 to compile the latency metrics out of the agent */
+#ifndef MQTT_AGENT_METRICS_ENABLED
+#define MQTT_AGENT_METRICS_ENABLED    1
+#endif
+
+/* Bucket 0 counts latencies below 1 ms, bucket n those below 2^n ms and the
+ * last bucket everything longer */
+#define MQTT_AGENT_LATENCY_BUCKETS    14U
+
+/* Stages of a command measured by the latency histograms */
+typedef enum
+{
+    MQTT_AGENT_PHASE_QUEUED = 0, /* From the send to the agent until it is dequeued */
+    MQTT_AGENT_PHASE_SEND,       /* From dequeue until its packet is written to the socket */
+    MQTT_AGENT_PHASE_ACK,        /* From the socket write until PUBACK, SUBACK or UNSUBACK */
+    MQTT_AGENT_NUM_PHASES
+} MQTTAgentPhase_t;
+
+typedef struct
+{
+    uint32_t pulBuckets[ MQTT_AGENT_LATENCY_BUCKETS ];
+    uint32_t ulCount;
+    uint32_t ulMsTotal;
+    uint32_t ulMsMax;
+} MQTTAgentHistogram_t;
+
+typedef struct
+{
+    uint32_t ulQueueDepth;      /* Commands waiting in all lanes */
+    uint32_t ulQueueHighWater;
+    uint32_t ulAwaitingAck;     /* Commands sent and waiting for an acknowledgment */
+    uint32_t ulTlsFailures;     /* Failed attempts to open the TLS connection */
+    uint32_t ulConnects;        /* Accepted MQTT connections */
+    uint32_t ulConnectFailures; /* Rejected or timed out MQTT connections */
+    uint32_t ulDisconnects;     /* Connections lost after they were accepted */
+    uint32_t ulSessionsResumed;
+    uint32_t ulPublishesCoalesced; /* PUBLISH header and payload written as one TLS record */
+    uint32_t ulPublishesStreamed;  /* Incoming PUBLISH passed to a stream callback in chunks */
+} MQTTAgentMetrics_t;
+
 MQTTAgentHandle_t xGetMqttAgentHandle( void );
 
 /* Event group based mechanism that can be used to block tasks until agent is ready */
@@ -15,6 +91,34 @@ void vSleepUntilMQTTAgentConnected( void );
 
 bool xIsMqttAgentConnected( void );
 
+/* Select the lane of the commands subsequently enqueued by the calling task.
+ * Returns the previously selected lane. */
+MQTTAgentLane_t xMqttAgent_SetCommandLane( MQTTAgentLane_t xLane );
+
+/* Enable or disable the MQTT journal for the QoS1 publishes subsequently
+ * submitted by the calling task, for submitters that keep their own copy until
+ * the publish completes. Returns the previous setting. */
+bool xMqttAgent_SetJournaling( bool xEnable );
+
+void vMqttAgent_GetLaneStats( MQTTAgentLaneStats_t pxStats[ MQTT_AGENT_NUM_LANES ] );
+
+void vMqttAgent_GetWindowStats( MQTTAgentWindowStats_t * pxStats );
+
+#if MQTT_AGENT_METRICS_ENABLED
+
+/* Copy the latency histogram of one command type and phase */
+void vMqttAgent_GetHistogram( MQTTAgentCommandType_t xCommandType,
+                              MQTTAgentPhase_t xPhase,
+                              MQTTAgentHistogram_t * pxHistogram );
+
+/* Queue depth gauges and connection counters */
+void vMqttAgent_GetMetrics( MQTTAgentMetrics_t * pxMetrics );
+
+/* Upper bound in ms of the bucket holding the given percentile, 0 when empty */
+uint32_t ulMqttAgent_HistogramPercentile( const MQTTAgentHistogram_t * pxHistogram,
+                                          uint32_t ulPercent );
+#endif /* MQTT_AGENT_METRICS_ENABLED */
+
 void vMQTTAgentTask( void * pvParameters );
 
 
@@ -0,0 +1,964 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_journal.c
+ * @brief Flash backed journal of outgoing QoS1 publishes on littlefs.
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_ERROR
+#include "logging.h"
+
+/* Standard includes. */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "kvstore.h"
+#include "publish_buffer_pool.h"
+#include "mqtt_journal.h"
+
+#if KV_STORE_NVIMPL_LITTLEFS
+
+#define JOURNAL_PUT_MAGIC         ( 0x4A50U )
+#define JOURNAL_DEL_MAGIC         ( 0x4A44U )
+
+/* "/mqttj/" followed by eight hex digits */
+#define JOURNAL_PATH_LEN          ( sizeof( MQTT_JOURNAL_DIR ) + 10U )
+
+#define JOURNAL_SEQ_NAME_LEN      ( 8U )
+
+/* Time to wait for a publish buffer while replaying */
+#define JOURNAL_REPLAY_WAIT_MS    ( 100U )
+
+typedef struct
+{
+    uint16_t usMagic;
+    uint8_t ucTopicLen;
+    uint8_t ucQoS;
+    uint16_t usPayloadLen;
+    uint16_t usReserved;
+    uint32_t ulId;
+    uint32_t ulCrc;
+} JournalRecordHeader_t;
+
+#define JOURNAL_BATCH_LEN         ( sizeof( JournalRecordHeader_t ) + MQTT_JOURNAL_MAX_TOPIC_LEN + MQTT_JOURNAL_MAX_PAYLOAD_LEN )
+
+/* See the tombstone queue bound in mqtt_journal.h */
+static_assert( MQTT_JOURNAL_TOMBSTONE_QUEUE_LEN >= MQTT_AGENT_WINDOW_LIMIT );
+
+typedef struct
+{
+    uint32_t ulSeq;
+    uint32_t ulFirstId; /* 0 until the segment holds a publish */
+    uint32_t ulLastId;
+    uint32_t ulLive;    /* Publishes without a tombstone */
+    size_t uxLen;       /* Bytes committed */
+} JournalSegment_t;
+
+/* A publish recovered at boot, waiting to be submitted again */
+typedef struct
+{
+    uint32_t ulId;
+    uint32_t ulSeq;
+    uint32_t ulOffset;
+} JournalEntry_t;
+
+typedef struct
+{
+    lfs_t * pxLfs;
+    SemaphoreHandle_t xMutex;
+    QueueHandle_t xTombstones;
+    JournalSegment_t pxSegments[ MQTT_JOURNAL_MAX_SEGMENTS ];
+    size_t uxHead;
+    size_t uxCount;
+    uint32_t ulNextId;
+    uint8_t pucBatch[ JOURNAL_BATCH_LEN ];
+    size_t uxBatchLen;
+    size_t uxBatchPuts;
+    TickType_t xBatchStart;
+    JournalEntry_t pxRecovered[ MQTT_JOURNAL_MAX_RECOVERED ];
+    size_t uxRecovered;
+    size_t uxReplayed;
+    MqttJournalStats_t xStats;
+} MqttJournal_t;
+
+static MqttJournal_t xJournal = { 0 };
+
+/*-----------------------------------------------------------*/
+
+static void prvSegmentPath( char * pcPath,
+                            uint32_t ulSeq )
+{
+    ( void ) snprintf( pcPath, JOURNAL_PATH_LEN, MQTT_JOURNAL_DIR "/%08lx", ( unsigned long ) ulSeq );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRecordCrc( const JournalRecordHeader_t * pxHeader,
+                              const void * pvTopic,
+                              const void * pvPayload )
+{
+    uint32_t ulCrc = 0xFFFFFFFFUL;
+
+    ulCrc = lfs_crc( ulCrc, pxHeader, offsetof( JournalRecordHeader_t, ulCrc ) );
+    ulCrc = lfs_crc( ulCrc, pvTopic, pxHeader->ucTopicLen );
+    ulCrc = lfs_crc( ulCrc, pvPayload, pxHeader->usPayloadLen );
+
+    return ulCrc;
+}
+
+/*-----------------------------------------------------------*/
+
+static JournalSegment_t * prvSegment( size_t uxIdx )
+{
+    return &( xJournal.pxSegments[ ( xJournal.uxHead + uxIdx ) % MQTT_JOURNAL_MAX_SEGMENTS ] );
+}
+
+/*-----------------------------------------------------------*/
+
+static JournalSegment_t * prvTail( void )
+{
+    return prvSegment( xJournal.uxCount - 1U );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDropHeadSegment( void )
+{
+    char pcPath[ JOURNAL_PATH_LEN ];
+    JournalSegment_t * pxHead = prvSegment( 0 );
+
+    if( pxHead->ulLive > 0 )
+    {
+        LogWarn( "Journal full, dropping %lu publishes.", ( unsigned long ) pxHead->ulLive );
+        xJournal.xStats.ulLost += pxHead->ulLive;
+        xJournal.xStats.ulLive -= pxHead->ulLive;
+    }
+
+    prvSegmentPath( pcPath, pxHead->ulSeq );
+    ( void ) lfs_remove( xJournal.pxLfs, pcPath );
+
+    xJournal.uxHead = ( xJournal.uxHead + 1U ) % MQTT_JOURNAL_MAX_SEGMENTS;
+    xJournal.uxCount--;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Remove leading segments whose publishes have all completed */
+static void prvTrimHead( void )
+{
+    while( ( xJournal.uxCount > 1U ) &&
+           ( prvSegment( 0 )->ulLive == 0 ) )
+    {
+        prvDropHeadSegment();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvStartSegment( uint32_t ulSeq )
+{
+    JournalSegment_t * pxTail = NULL;
+
+    if( xJournal.uxCount == MQTT_JOURNAL_MAX_SEGMENTS )
+    {
+        prvDropHeadSegment();
+    }
+
+    xJournal.uxCount++;
+
+    pxTail = prvTail();
+    ( void ) memset( pxTail, 0, sizeof( JournalSegment_t ) );
+    pxTail->ulSeq = ulSeq;
+}
+
+/*-----------------------------------------------------------*/
+
+static lfs_ssize_t prvWriteBatch( const JournalSegment_t * pxTail )
+{
+    char pcPath[ JOURNAL_PATH_LEN ];
+    lfs_file_t xFile = { 0 };
+    lfs_ssize_t lReturn = LFS_ERR_OK;
+
+    prvSegmentPath( pcPath, pxTail->ulSeq );
+
+    lReturn = lfs_file_open( xJournal.pxLfs, &xFile, pcPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND );
+
+    if( lReturn == LFS_ERR_OK )
+    {
+        lReturn = lfs_file_write( xJournal.pxLfs, &xFile, xJournal.pucBatch, xJournal.uxBatchLen );
+
+        if( lReturn == ( lfs_ssize_t ) xJournal.uxBatchLen )
+        {
+            lReturn = LFS_ERR_OK;
+        }
+        else
+        {
+            lReturn = ( lReturn < 0 ) ? lReturn : LFS_ERR_IO;
+
+            /* Do not commit a partial batch */
+            ( void ) lfs_file_truncate( xJournal.pxLfs, &xFile, pxTail->uxLen );
+        }
+
+        if( ( lfs_file_close( xJournal.pxLfs, &xFile ) != LFS_ERR_OK ) &&
+            ( lReturn == LFS_ERR_OK ) )
+        {
+            lReturn = LFS_ERR_IO;
+        }
+    }
+
+    return lReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Write the batch to the tail segment. littlefs commits it on close. */
+static lfs_ssize_t prvCommitBatch( void )
+{
+    lfs_ssize_t lReturn = LFS_ERR_OK;
+    JournalSegment_t * pxTail = prvTail();
+
+    if( xJournal.uxBatchLen > 0 )
+    {
+        lReturn = prvWriteBatch( pxTail );
+
+        if( ( lReturn == LFS_ERR_NOSPC ) &&
+            ( xJournal.uxCount > 1U ) )
+        {
+            /* The volume is shared with the spool, OTA and the config store */
+            prvDropHeadSegment();
+
+            lReturn = prvWriteBatch( pxTail );
+        }
+
+        if( lReturn == LFS_ERR_OK )
+        {
+            pxTail->uxLen += xJournal.uxBatchLen;
+            xJournal.xStats.ulCommits++;
+            xJournal.uxBatchLen = 0;
+            xJournal.uxBatchPuts = 0;
+        }
+        else
+        {
+            /* The batch is kept and retried by the next service call */
+            LogError( "Failed to commit %lu bytes to the journal: %ld.",
+                      ( unsigned long ) xJournal.uxBatchLen, ( long ) lReturn );
+        }
+    }
+
+    return lReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Make room for a record after the batch failed to commit */
+static void prvDiscardBatch( void )
+{
+    if( xJournal.uxBatchLen > 0 )
+    {
+        /* The publishes are still tracked, so they go out as usual but will
+         * not survive a reset */
+        LogError( "Discarding %lu uncommitted journal bytes.", ( unsigned long ) xJournal.uxBatchLen );
+
+        xJournal.xStats.ulUncommitted += ( uint32_t ) xJournal.uxBatchPuts;
+        xJournal.uxBatchLen = 0;
+        xJournal.uxBatchPuts = 0;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAppendRecord( const JournalRecordHeader_t * pxHeader,
+                             const void * pvTopic,
+                             const void * pvPayload )
+{
+    size_t uxRecordLen = sizeof( JournalRecordHeader_t ) + pxHeader->ucTopicLen + pxHeader->usPayloadLen;
+    JournalSegment_t * pxTail = prvTail();
+
+    if( ( ( pxTail->uxLen + xJournal.uxBatchLen ) > 0 ) &&
+        ( ( pxTail->uxLen + xJournal.uxBatchLen + uxRecordLen ) > MQTT_JOURNAL_SEGMENT_LEN ) )
+    {
+        /* The batch belongs to the segment being closed */
+        if( prvCommitBatch() != LFS_ERR_OK )
+        {
+            prvDiscardBatch();
+        }
+
+        prvStartSegment( pxTail->ulSeq + 1U );
+        pxTail = prvTail();
+    }
+    else if( ( ( xJournal.uxBatchLen + uxRecordLen ) > JOURNAL_BATCH_LEN ) &&
+             ( prvCommitBatch() != LFS_ERR_OK ) )
+    {
+        prvDiscardBatch();
+    }
+    else
+    {
+        /* Empty */
+    }
+
+    if( xJournal.uxBatchLen == 0 )
+    {
+        xJournal.xBatchStart = xTaskGetTickCount();
+    }
+
+    ( void ) memcpy( &( xJournal.pucBatch[ xJournal.uxBatchLen ] ), pxHeader, sizeof( JournalRecordHeader_t ) );
+    xJournal.uxBatchLen += sizeof( JournalRecordHeader_t );
+
+    if( pxHeader->usMagic == JOURNAL_PUT_MAGIC )
+    {
+        ( void ) memcpy( &( xJournal.pucBatch[ xJournal.uxBatchLen ] ), pvTopic, pxHeader->ucTopicLen );
+        xJournal.uxBatchLen += pxHeader->ucTopicLen;
+
+        ( void ) memcpy( &( xJournal.pucBatch[ xJournal.uxBatchLen ] ), pvPayload, pxHeader->usPayloadLen );
+        xJournal.uxBatchLen += pxHeader->usPayloadLen;
+
+        if( pxTail->ulFirstId == 0 )
+        {
+            pxTail->ulFirstId = pxHeader->ulId;
+        }
+
+        pxTail->ulLastId = pxHeader->ulId;
+        pxTail->ulLive++;
+        xJournal.uxBatchPuts++;
+        xJournal.xStats.ulLive++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAppendTombstone( uint32_t ulId )
+{
+    JournalRecordHeader_t xHeader = { 0 };
+    JournalSegment_t * pxSegment = NULL;
+
+    /* Ids grow monotonically along the chain of segments */
+    for( size_t uxIdx = 0; ( uxIdx < xJournal.uxCount ) && ( pxSegment == NULL ); uxIdx++ )
+    {
+        JournalSegment_t * pxCandidate = prvSegment( uxIdx );
+
+        if( ( pxCandidate->ulFirstId != 0 ) &&
+            ( ulId >= pxCandidate->ulFirstId ) &&
+            ( ulId <= pxCandidate->ulLastId ) )
+        {
+            pxSegment = pxCandidate;
+        }
+    }
+
+    /* Nothing to do if the segment was already dropped */
+    if( ( pxSegment != NULL ) &&
+        ( pxSegment->ulLive > 0 ) )
+    {
+        pxSegment->ulLive--;
+        xJournal.xStats.ulLive--;
+        xJournal.xStats.ulRemoved++;
+
+        xHeader.usMagic = JOURNAL_DEL_MAGIC;
+        xHeader.ulId = ulId;
+        xHeader.ulCrc = prvRecordCrc( &xHeader, NULL, NULL );
+
+        prvAppendRecord( &xHeader, NULL, NULL );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvDrainTombstones( void )
+{
+    uint32_t ulId = 0;
+
+    while( xQueueReceive( xJournal.xTombstones, &ulId, 0 ) == pdTRUE )
+    {
+        prvAppendTombstone( ulId );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadRecord( lfs_file_t * pxFile,
+                                 size_t uxSegmentLen,
+                                 size_t uxOffset,
+                                 JournalRecordHeader_t * pxHeader,
+                                 char * pcTopic,
+                                 uint8_t * pucPayload )
+{
+    BaseType_t xResult = pdFALSE;
+
+    if( ( lfs_file_seek( xJournal.pxLfs, pxFile, ( lfs_soff_t ) uxOffset, LFS_SEEK_SET ) >= 0 ) &&
+        ( lfs_file_read( xJournal.pxLfs, pxFile, pxHeader, sizeof( JournalRecordHeader_t ) ) == sizeof( JournalRecordHeader_t ) ) )
+    {
+        xResult = ( ( ( pxHeader->usMagic == JOURNAL_PUT_MAGIC ) ||
+                      ( pxHeader->usMagic == JOURNAL_DEL_MAGIC ) ) &&
+                    ( pxHeader->ulId != 0 ) &&
+                    ( pxHeader->ucTopicLen <= MQTT_JOURNAL_MAX_TOPIC_LEN ) &&
+                    ( pxHeader->usPayloadLen <= MQTT_JOURNAL_MAX_PAYLOAD_LEN ) &&
+                    ( ( uxOffset + sizeof( JournalRecordHeader_t ) + pxHeader->ucTopicLen + pxHeader->usPayloadLen ) <= uxSegmentLen ) ) ? pdTRUE : pdFALSE;
+    }
+
+    if( ( xResult == pdTRUE ) &&
+        ( ( lfs_file_read( xJournal.pxLfs, pxFile, pcTopic, pxHeader->ucTopicLen ) != pxHeader->ucTopicLen ) ||
+          ( lfs_file_read( xJournal.pxLfs, pxFile, pucPayload, pxHeader->usPayloadLen ) != pxHeader->usPayloadLen ) ||
+          ( prvRecordCrc( pxHeader, pcTopic, pucPayload ) != pxHeader->ulCrc ) ) )
+    {
+        xResult = pdFALSE;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRecoverPublish( uint32_t ulId,
+                               uint32_t ulSeq,
+                               size_t uxOffset )
+{
+    if( xJournal.uxRecovered == MQTT_JOURNAL_MAX_RECOVERED )
+    {
+        /* Keep the most recent publishes */
+        xJournal.xStats.ulLost++;
+        ( void ) memmove( &( xJournal.pxRecovered[ 0 ] ), &( xJournal.pxRecovered[ 1 ] ),
+                          ( MQTT_JOURNAL_MAX_RECOVERED - 1U ) * sizeof( JournalEntry_t ) );
+        xJournal.uxRecovered--;
+    }
+
+    xJournal.pxRecovered[ xJournal.uxRecovered ].ulId = ulId;
+    xJournal.pxRecovered[ xJournal.uxRecovered ].ulSeq = ulSeq;
+    xJournal.pxRecovered[ xJournal.uxRecovered ].ulOffset = ( uint32_t ) uxOffset;
+    xJournal.uxRecovered++;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvForgetPublish( uint32_t ulId )
+{
+    for( size_t uxIdx = 0; uxIdx < xJournal.uxRecovered; uxIdx++ )
+    {
+        if( xJournal.pxRecovered[ uxIdx ].ulId == ulId )
+        {
+            xJournal.uxRecovered--;
+            ( void ) memmove( &( xJournal.pxRecovered[ uxIdx ] ), &( xJournal.pxRecovered[ uxIdx + 1U ] ),
+                              ( xJournal.uxRecovered - uxIdx ) * sizeof( JournalEntry_t ) );
+            break;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/* Collect the publishes of one segment that have no tombstone so far */
+static void prvScanSegment( uint32_t ulSeq,
+                            size_t uxSegmentLen )
+{
+    char pcPath[ JOURNAL_PATH_LEN ];
+    char pcTopic[ MQTT_JOURNAL_MAX_TOPIC_LEN ];
+    lfs_file_t xFile = { 0 };
+    JournalRecordHeader_t xHeader = { 0 };
+    size_t uxOffset = 0;
+
+    prvSegmentPath( pcPath, ulSeq );
+
+    if( lfs_file_open( xJournal.pxLfs, &xFile, pcPath, LFS_O_RDONLY ) == LFS_ERR_OK )
+    {
+        /* The batch is empty during recovery, so it doubles as the payload buffer */
+        while( ( uxOffset < uxSegmentLen ) &&
+               ( prvReadRecord( &xFile, uxSegmentLen, uxOffset, &xHeader, pcTopic, xJournal.pucBatch ) == pdTRUE ) )
+        {
+            if( xHeader.usMagic == JOURNAL_PUT_MAGIC )
+            {
+                prvRecoverPublish( xHeader.ulId, ulSeq, uxOffset );
+            }
+            else
+            {
+                prvForgetPublish( xHeader.ulId );
+            }
+
+            if( xHeader.ulId >= xJournal.ulNextId )
+            {
+                xJournal.ulNextId = xHeader.ulId + 1U;
+            }
+
+            uxOffset += sizeof( JournalRecordHeader_t ) + xHeader.ucTopicLen + xHeader.usPayloadLen;
+        }
+
+        if( uxOffset < uxSegmentLen )
+        {
+            /* The framing can not be trusted past this point */
+            LogError( "Corrupt journal record in segment %08lx at offset %lu.",
+                      ( unsigned long ) ulSeq, ( unsigned long ) uxOffset );
+            xJournal.xStats.ulCorrupt++;
+        }
+
+        ( void ) lfs_file_close( xJournal.pxLfs, &xFile );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvCompareSeq( const void * pvLeft,
+                          const void * pvRight )
+{
+    const JournalSegment_t * pxLeft = ( const JournalSegment_t * ) pvLeft;
+    const JournalSegment_t * pxRight = ( const JournalSegment_t * ) pvRight;
+
+    int lResult = 0;
+
+    if( pxLeft->ulSeq < pxRight->ulSeq )
+    {
+        lResult = -1;
+    }
+    else if( pxLeft->ulSeq > pxRight->ulSeq )
+    {
+        lResult = 1;
+    }
+    else
+    {
+        /* Equal */
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Keep the newest segments when more were found than can be tracked */
+static void prvEvictOldest( JournalSegment_t * pxSegments,
+                            size_t uxFound,
+                            uint32_t ulSeq,
+                            size_t uxLen )
+{
+    char pcPath[ JOURNAL_PATH_LEN ];
+    size_t uxOldest = 0;
+
+    for( size_t uxIdx = 1; uxIdx < uxFound; uxIdx++ )
+    {
+        if( pxSegments[ uxIdx ].ulSeq < pxSegments[ uxOldest ].ulSeq )
+        {
+            uxOldest = uxIdx;
+        }
+    }
+
+    if( pxSegments[ uxOldest ].ulSeq < ulSeq )
+    {
+        uint32_t ulOldSeq = pxSegments[ uxOldest ].ulSeq;
+
+        pxSegments[ uxOldest ].ulSeq = ulSeq;
+        pxSegments[ uxOldest ].uxLen = uxLen;
+        ulSeq = ulOldSeq;
+    }
+
+    LogError( "Too many journal segments, removing %08lx.", ( unsigned long ) ulSeq );
+    xJournal.xStats.ulCorrupt++;
+
+    prvSegmentPath( pcPath, ulSeq );
+    ( void ) lfs_remove( xJournal.pxLfs, pcPath );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Find the existing segments, collect the publishes they still hold and
+ * start a fresh tail segment, so nothing is ever appended behind a record
+ * that may have been damaged.
+ */
+static void prvRecover( void )
+{
+    lfs_dir_t xDir = { 0 };
+    struct lfs_info xInfo = { 0 };
+    JournalSegment_t * pxSegments = xJournal.pxSegments;
+    size_t uxFound = 0;
+    uint32_t ulNextSeq = 0;
+
+    if( lfs_dir_open( xJournal.pxLfs, &xDir, MQTT_JOURNAL_DIR ) == LFS_ERR_OK )
+    {
+        while( lfs_dir_read( xJournal.pxLfs, &xDir, &xInfo ) > 0 )
+        {
+            char * pcEnd = NULL;
+            uint32_t ulSeq = 0;
+
+            if( ( xInfo.type != LFS_TYPE_REG ) ||
+                ( strlen( xInfo.name ) != JOURNAL_SEQ_NAME_LEN ) )
+            {
+                continue;
+            }
+
+            ulSeq = ( uint32_t ) strtoul( xInfo.name, &pcEnd, 16 );
+
+            if( *pcEnd != '\0' )
+            {
+                continue;
+            }
+
+            /* Leave one slot for the new tail */
+            if( uxFound < ( MQTT_JOURNAL_MAX_SEGMENTS - 1U ) )
+            {
+                pxSegments[ uxFound ].ulSeq = ulSeq;
+                pxSegments[ uxFound ].uxLen = xInfo.size;
+                uxFound++;
+            }
+            else
+            {
+                prvEvictOldest( pxSegments, uxFound, ulSeq, xInfo.size );
+            }
+
+            if( ulSeq >= ulNextSeq )
+            {
+                ulNextSeq = ulSeq + 1U;
+            }
+        }
+
+        ( void ) lfs_dir_close( xJournal.pxLfs, &xDir );
+    }
+
+    qsort( pxSegments, uxFound, sizeof( JournalSegment_t ), prvCompareSeq );
+
+    xJournal.ulNextId = 1U;
+
+    for( size_t uxIdx = 0; uxIdx < uxFound; uxIdx++ )
+    {
+        prvScanSegment( pxSegments[ uxIdx ].ulSeq, pxSegments[ uxIdx ].uxLen );
+    }
+
+    /* Rebuild the segment bookkeeping from the recovered publishes */
+    for( size_t uxIdx = 0; uxIdx < xJournal.uxRecovered; uxIdx++ )
+    {
+        const JournalEntry_t * pxEntry = &( xJournal.pxRecovered[ uxIdx ] );
+
+        for( size_t uxSeg = 0; uxSeg < uxFound; uxSeg++ )
+        {
+            if( pxSegments[ uxSeg ].ulSeq == pxEntry->ulSeq )
+            {
+                if( pxSegments[ uxSeg ].ulFirstId == 0 )
+                {
+                    pxSegments[ uxSeg ].ulFirstId = pxEntry->ulId;
+                }
+
+                pxSegments[ uxSeg ].ulLastId = pxEntry->ulId;
+                pxSegments[ uxSeg ].ulLive++;
+            }
+        }
+    }
+
+    xJournal.uxHead = 0;
+    xJournal.uxCount = uxFound;
+    xJournal.xStats.ulLive = ( uint32_t ) xJournal.uxRecovered;
+
+    prvStartSegment( ulNextSeq );
+
+    /* Drop leading segments without live publishes. Segments in between are
+     * kept since they may hold tombstones for the segments before them. */
+    prvTrimHead();
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xMqttJournal_Init( lfs_t * pxLfs )
+{
+    BaseType_t xResult = pdFALSE;
+    BaseType_t xEnabled = pdFALSE;
+    int lError = LFS_ERR_INVAL;
+
+    xEnabled = ( KVStore_getUInt32( CS_MQTT_JOURNAL, NULL ) != 0 ) ? pdTRUE : pdFALSE;
+
+    if( ( xEnabled == pdTRUE ) &&
+        ( pxLfs != NULL ) &&
+        ( xJournal.xMutex == NULL ) )
+    {
+        lError = lfs_mkdir( pxLfs, MQTT_JOURNAL_DIR );
+    }
+
+    if( ( lError == LFS_ERR_OK ) || ( lError == LFS_ERR_EXIST ) )
+    {
+        xJournal.pxLfs = pxLfs;
+        xJournal.xTombstones = xQueueCreate( MQTT_JOURNAL_TOMBSTONE_QUEUE_LEN, sizeof( uint32_t ) );
+
+        if( xJournal.xTombstones != NULL )
+        {
+            prvRecover();
+
+            /* Publishing the mutex last makes the journal visible to other tasks */
+            xJournal.xMutex = xSemaphoreCreateMutex();
+        }
+
+        xResult = ( xJournal.xMutex != NULL ) ? pdTRUE : pdFALSE;
+    }
+
+    if( xResult == pdTRUE )
+    {
+        LogInfo( "Journal recovered %lu publishes.", ( unsigned long ) xJournal.uxRecovered );
+    }
+    else if( xEnabled == pdTRUE )
+    {
+        LogError( "Failed to open the MQTT journal." );
+    }
+    else
+    {
+        /* Empty */
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulMqttJournal_Append( const MQTTPublishInfo_t * pxPublishInfo )
+{
+    uint32_t ulId = 0;
+
+    configASSERT( pxPublishInfo != NULL );
+
+    if( ( xJournal.xMutex != NULL ) &&
+        ( pxPublishInfo->qos != MQTTQoS0 ) &&
+        ( pxPublishInfo->topicNameLength > 0 ) &&
+        ( pxPublishInfo->topicNameLength <= MQTT_JOURNAL_MAX_TOPIC_LEN ) &&
+        ( pxPublishInfo->pTopicName[ 0 ] != '$' ) &&
+        ( pxPublishInfo->payloadLength <= MQTT_JOURNAL_MAX_PAYLOAD_LEN ) &&
+        ( xSemaphoreTake( xJournal.xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        JournalRecordHeader_t xHeader = { 0 };
+
+        prvDrainTombstones();
+
+        ulId = xJournal.ulNextId++;
+
+        /* 0 is reserved for publishes that are not journaled */
+        if( xJournal.ulNextId == 0 )
+        {
+            xJournal.ulNextId = 1U;
+        }
+
+        xHeader.usMagic = JOURNAL_PUT_MAGIC;
+        xHeader.ucTopicLen = ( uint8_t ) pxPublishInfo->topicNameLength;
+        xHeader.ucQoS = ( uint8_t ) pxPublishInfo->qos;
+        xHeader.usPayloadLen = ( uint16_t ) pxPublishInfo->payloadLength;
+        xHeader.ulId = ulId;
+        xHeader.ulCrc = prvRecordCrc( &xHeader, pxPublishInfo->pTopicName, pxPublishInfo->pPayload );
+
+        prvAppendRecord( &xHeader, pxPublishInfo->pTopicName, pxPublishInfo->pPayload );
+        xJournal.xStats.ulAppended++;
+
+        if( ( xTaskGetTickCount() - xJournal.xBatchStart ) >= pdMS_TO_TICKS( MQTT_JOURNAL_FLUSH_MS ) )
+        {
+            ( void ) prvCommitBatch();
+        }
+
+        ( void ) xSemaphoreGive( xJournal.xMutex );
+    }
+
+    return ulId;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttJournal_Remove( uint32_t ulId )
+{
+    if( ( ulId != 0 ) &&
+        ( xJournal.xTombstones != NULL ) &&
+        ( xQueueSendToBack( xJournal.xTombstones, &ulId, 0 ) != pdTRUE ) )
+    {
+        /* Not expected given the queue length. The publish will be sent again
+         * if the device resets before its segment is dropped. */
+        LogError( "Dropped the tombstone of journal record %lu.", ( unsigned long ) ulId );
+        xJournal.xStats.ulTombstonesDropped++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Submit the next recovered publish. Its new record is appended by the
+ * agent, so the old one is only tombstoned once the submit succeeded.
+ */
+static BaseType_t prvReplayNext( MQTTAgentHandle_t xAgentHandle )
+{
+    BaseType_t xResult = pdFALSE;
+    PublishBuffer_t * pxBuffer = NULL;
+    JournalEntry_t xEntry = { 0 };
+    JournalRecordHeader_t xHeader = { 0 };
+    char pcTopic[ MQTT_JOURNAL_MAX_TOPIC_LEN ];
+    uint8_t * pucPayload = NULL;
+    size_t uxCapacity = 0;
+    BaseType_t xValid = pdFALSE;
+
+    pxBuffer = MqttAgent_BorrowPublishBuffer( pdMS_TO_TICKS( JOURNAL_REPLAY_WAIT_MS ) );
+
+    if( pxBuffer != NULL )
+    {
+        pucPayload = MqttAgent_PublishBufferPayload( pxBuffer, &uxCapacity );
+        configASSERT( uxCapacity >= MQTT_JOURNAL_MAX_PAYLOAD_LEN );
+
+        ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+
+        xEntry = xJournal.pxRecovered[ xJournal.uxReplayed ];
+
+        /* The segment may have been dropped to make room since recovery */
+        for( size_t uxIdx = 0; ( uxIdx < xJournal.uxCount ) && ( xValid == pdFALSE ); uxIdx++ )
+        {
+            JournalSegment_t * pxSegment = prvSegment( uxIdx );
+
+            if( pxSegment->ulSeq == xEntry.ulSeq )
+            {
+                char pcPath[ JOURNAL_PATH_LEN ];
+                lfs_file_t xFile = { 0 };
+
+                prvSegmentPath( pcPath, xEntry.ulSeq );
+
+                if( lfs_file_open( xJournal.pxLfs, &xFile, pcPath, LFS_O_RDONLY ) == LFS_ERR_OK )
+                {
+                    xValid = ( ( prvReadRecord( &xFile, pxSegment->uxLen, xEntry.ulOffset,
+                                                &xHeader, pcTopic, pucPayload ) == pdTRUE ) &&
+                               ( xHeader.usMagic == JOURNAL_PUT_MAGIC ) &&
+                               ( xHeader.ulId == xEntry.ulId ) ) ? pdTRUE : pdFALSE;
+
+                    ( void ) lfs_file_close( xJournal.pxLfs, &xFile );
+                }
+            }
+        }
+
+        ( void ) xSemaphoreGive( xJournal.xMutex );
+
+        if( xValid == pdTRUE )
+        {
+            xResult = ( MqttAgent_PublishBuffer( xAgentHandle,
+                                                 pxBuffer,
+                                                 pcTopic,
+                                                 xHeader.ucTopicLen,
+                                                 xHeader.usPayloadLen,
+                                                 ( MQTTQoS_t ) xHeader.ucQoS,
+                                                 NULL,
+                                                 NULL ) == MQTTSuccess ) ? pdTRUE : pdFALSE;
+        }
+        else
+        {
+            LogError( "Dropping unreadable journal record %lu.", ( unsigned long ) xEntry.ulId );
+            xJournal.xStats.ulCorrupt++;
+            MqttAgent_ReturnPublishBuffer( pxBuffer );
+        }
+
+        if( ( xResult == pdTRUE ) || ( xValid == pdFALSE ) )
+        {
+            ( void ) xSemaphoreTake( xJournal.xMutex, portMAX_DELAY );
+
+            if( xResult == pdTRUE )
+            {
+                xJournal.xStats.ulReplayed++;
+            }
+
+            /* Bypass the tombstone queue, a whole backlog may be replayed at once */
+            prvAppendTombstone( xEntry.ulId );
+            xJournal.uxReplayed++;
+
+            ( void ) xSemaphoreGive( xJournal.xMutex );
+        }
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttJournal_Service( MQTTAgentHandle_t xAgentHandle )
+{
+    if( ( xJournal.xMutex != NULL ) &&
+        ( xSemaphoreTake( xJournal.xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        prvDrainTombstones();
+
+        if( ( xJournal.uxBatchLen > 0 ) &&
+            ( ( xTaskGetTickCount() - xJournal.xBatchStart ) >= pdMS_TO_TICKS( MQTT_JOURNAL_FLUSH_MS ) ) )
+        {
+            ( void ) prvCommitBatch();
+        }
+
+        prvTrimHead();
+
+        ( void ) xSemaphoreGive( xJournal.xMutex );
+
+        /* Submit the recovered publishes while there is room in the agent */
+        while( ( xJournal.uxReplayed < xJournal.uxRecovered ) &&
+               ( xAgentHandle != NULL ) &&
+               ( xIsMqttAgentConnected() == true ) &&
+               ( prvReplayNext( xAgentHandle ) == pdTRUE ) )
+        {
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttJournal_GetStats( MqttJournalStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxStats = xJournal.xStats;
+    }
+    taskEXIT_CRITICAL();
+}
+
+#else /* KV_STORE_NVIMPL_LITTLEFS */
+
+/* No filesystem on this platform, outgoing publishes only live in RAM */
+
+uint32_t ulMqttJournal_Append( const MQTTPublishInfo_t * pxPublishInfo )
+{
+    ( void ) pxPublishInfo;
+
+    return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttJournal_Remove( uint32_t ulId )
+{
+    ( void ) ulId;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttJournal_Service( MQTTAgentHandle_t xAgentHandle )
+{
+    ( void ) xAgentHandle;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMqttJournal_GetStats( MqttJournalStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    ( void ) memset( pxStats, 0, sizeof( MqttJournalStats_t ) );
+}
+
+#endif /* KV_STORE_NVIMPL_LITTLEFS */
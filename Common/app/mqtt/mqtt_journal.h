@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mqtt_journal.h
+ * @brief Optional flash backed journal of outgoing QoS1 publishes.
+ *
+ * The MQTT agent keeps unacknowledged publishes in RAM only, so they are lost
+ * on a reset even though the session with the broker persists. When the
+ * mqtt_journal KVStore key is set, each QoS1 publish is appended to a journal
+ * on littlefs when it is submitted and a tombstone is appended once it
+ * completes. After a reset the publishes without a tombstone are submitted
+ * again, so delivery is at least once.
+ *
+ * Records are collected in RAM and committed in batches, once the batch is
+ * full or on the first append or service call after it became older than
+ * MQTT_JOURNAL_FLUSH_MS, which bounds the number of flash writes. A batch that
+ * fails to commit is retried on the next service call. The journal is a chain
+ * of segment files under MQTT_JOURNAL_DIR; the oldest segment is removed once
+ * all its publishes have completed. A publish submitted shortly before a reset
+ * may not survive it.
+ *
+ * Completions are queued by the agent task and written as tombstones by the
+ * next append or service call. Every append drains the queue first and each
+ * journaled publish holds a slot of the in-flight window until it completes,
+ * so the queue never holds more than MQTT_AGENT_WINDOW_LIMIT completions,
+ * however long the service task is held up.
+ *
+ * Publishes to topics starting with '$' (shadow, jobs and defender requests)
+ * are not journaled, since replaying them after a reset would report stale
+ * state. Publishes that fail are handed back to the submitter as before and
+ * are not retried by the journal. Submitters that keep their own copy until a
+ * publish completes, such as the telemetry spool, turn the journal off with
+ * xMqttAgent_SetJournaling so that each publish is only stored once.
+ *
+ * The filesystem context is passed to xMqttJournal_Init, so the journal can
+ * be exercised against a RAM backed littlefs volume on a host, see
+ * test/test_mqtt_journal.c.
+ */
+#ifndef MQTT_JOURNAL_H
+#define MQTT_JOURNAL_H
+
+#include "FreeRTOS.h"
+#include "kvstore_config.h"
+#include "core_mqtt.h"
+#include "mqtt_agent_task.h"
+#include "publish_buffer_pool.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#if KV_STORE_NVIMPL_LITTLEFS
+#include "lfs.h"
+#endif
+
+#define MQTT_JOURNAL_DIR                    "/mqttj"
+
+/* A new segment file is started once the current one would exceed this size */
+#ifndef MQTT_JOURNAL_SEGMENT_LEN
+#define MQTT_JOURNAL_SEGMENT_LEN            ( 8U * 1024U )
+#endif
+
+/* The oldest segment is dropped, losing its publishes, beyond this count */
+#ifndef MQTT_JOURNAL_MAX_SEGMENTS
+#define MQTT_JOURNAL_MAX_SEGMENTS           8U
+#endif
+
+/* Longest time a record is kept in RAM before it is committed */
+#ifndef MQTT_JOURNAL_FLUSH_MS
+#define MQTT_JOURNAL_FLUSH_MS               1000U
+#endif
+
+/* Publishes without a tombstone that are recovered after a reset */
+#ifndef MQTT_JOURNAL_MAX_RECOVERED
+#define MQTT_JOURNAL_MAX_RECOVERED          64U
+#endif
+
+/* Completions waiting to be written as tombstones, at least one per slot of
+ * the in-flight window */
+#ifndef MQTT_JOURNAL_TOMBSTONE_QUEUE_LEN
+#define MQTT_JOURNAL_TOMBSTONE_QUEUE_LEN    MQTT_AGENT_WINDOW_LIMIT
+#endif
+
+/* Recovered publishes are replayed through the publish buffer pool, so
+ * larger publishes are not journaled */
+#define MQTT_JOURNAL_MAX_TOPIC_LEN          MQTT_PUBLISH_BUFFER_TOPIC_LEN
+#define MQTT_JOURNAL_MAX_PAYLOAD_LEN        MQTT_PUBLISH_BUFFER_PAYLOAD_LEN
+
+typedef struct
+{
+    uint32_t ulAppended;
+    uint32_t ulRemoved;
+    uint32_t ulReplayed;
+    uint32_t ulLost;          /* Publishes dropped with an evicted segment */
+    uint32_t ulCorrupt;
+    uint32_t ulCommits;       /* Batches written to flash */
+    uint32_t ulUncommitted;   /* Publishes discarded from a batch that failed to commit */
+    uint32_t ulTombstonesDropped;
+    uint32_t ulLive;
+} MqttJournalStats_t;
+
+#if KV_STORE_NVIMPL_LITTLEFS
+
+/**
+ * @brief Open the journal on a mounted filesystem if the mqtt_journal KVStore
+ * key is set, and recover the publishes left without a tombstone.
+ */
+BaseType_t xMqttJournal_Init( lfs_t * pxLfs );
+#endif
+
+/**
+ * @brief Append a record for a publish that is about to be queued to the
+ * agent. May commit the current batch to flash, so it must not be called
+ * from the MQTT agent task.
+ *
+ * @return The id of the record, or 0 if the publish is not journaled.
+ */
+uint32_t ulMqttJournal_Append( const MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Record that a journaled publish completed. Never blocks, the
+ * tombstone is written by the next call to vMqttJournal_Service.
+ */
+void vMqttJournal_Remove( uint32_t ulId );
+
+/**
+ * @brief Commit records older than MQTT_JOURNAL_FLUSH_MS and, while the agent
+ * is connected, submit the publishes recovered at boot. Called periodically
+ * by a task that may access the filesystem.
+ */
+void vMqttJournal_Service( MQTTAgentHandle_t xAgentHandle );
+
+void vMqttJournal_GetStats( MqttJournalStats_t * pxStats );
+
+#endif /* MQTT_JOURNAL_H */
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file publish_buffer_pool.c
+ * @brief Pool of publish buffers returned by the MQTT agent on completion.
+ *
+ * All buffers are carved from a single allocation made at init. Free buffers
+ * are kept in a queue of pointers so a borrowing task can block until one is
+ * returned, while the agent task returns them without blocking from the
+ * command completion callback.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_ERROR
+
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "atomic.h"
+
+/* Header include. */
+#include "publish_buffer_pool.h"
+
+/*-----------------------------------------------------------*/
+
+/* The command context handed to the agent is the buffer itself */
+struct MQTTAgentCommandContext
+{
+    MQTTPublishInfo_t xPublishInfo;
+    PublishBufferCallback_t xCallback;
+    void * pvCallbackCtx;
+    BaseType_t xLent;
+    char pcTopic[ MQTT_PUBLISH_BUFFER_TOPIC_LEN + 1 ];
+    uint8_t pucPayload[ MQTT_PUBLISH_BUFFER_PAYLOAD_LEN ];
+};
+
+struct PublishBuffer
+{
+    struct MQTTAgentCommandContext xCtx;
+};
+
+static PublishBuffer_t * pxBuffers = NULL;
+static QueueHandle_t xFreeQueue = NULL;
+
+static uint32_t volatile ulInUse = 0;
+static uint32_t volatile ulHighWater = 0;
+static uint32_t volatile ulExhausted = 0;
+static uint32_t volatile ulSubmitted = 0;
+static uint32_t volatile ulCompleted = 0;
+static uint32_t volatile ulFailed = 0;
+
+/*-----------------------------------------------------------*/
+
+static void prvAtomicMax( uint32_t volatile * pulMax,
+                          uint32_t ulValue )
+{
+    uint32_t ulCurrent = *pulMax;
+
+    while( ( ulValue > ulCurrent ) &&
+           ( Atomic_CompareAndSwap_u32( pulMax, ulValue, ulCurrent ) != ATOMIC_COMPARE_AND_SWAP_SUCCESS ) )
+    {
+        ulCurrent = *pulMax;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvIsPoolBuffer( const PublishBuffer_t * pxBuffer )
+{
+    return( ( pxBuffers != NULL ) &&
+            ( pxBuffer >= pxBuffers ) &&
+            ( pxBuffer < &( pxBuffers[ MQTT_PUBLISH_BUFFER_COUNT ] ) ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReleaseBuffer( PublishBuffer_t * pxBuffer )
+{
+    configASSERT( prvIsPoolBuffer( pxBuffer ) );
+    configASSERT( pxBuffer->xCtx.xLent == pdTRUE );
+
+    pxBuffer->xCtx.xLent = pdFALSE;
+    pxBuffer->xCtx.xCallback = NULL;
+    pxBuffer->xCtx.pvCallbackCtx = NULL;
+
+    ( void ) Atomic_Decrement_u32( &ulInUse );
+
+    /* The queue is as long as the pool so this can not fail */
+    ( void ) xQueueSendToBack( xFreeQueue, &pxBuffer, 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPublishComplete( MQTTAgentCommandContext_t * pxCommandContext,
+                                MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    PublishBuffer_t * pxBuffer = ( PublishBuffer_t * ) pxCommandContext;
+
+    configASSERT( pxBuffer != NULL );
+    configASSERT( pxReturnInfo != NULL );
+
+    if( pxReturnInfo->returnCode == MQTTSuccess )
+    {
+        ( void ) Atomic_Increment_u32( &ulCompleted );
+    }
+    else
+    {
+        ( void ) Atomic_Increment_u32( &ulFailed );
+        LogWarn( "Publish to %.*s failed: %s.",
+                 pxBuffer->xCtx.xPublishInfo.topicNameLength,
+                 pxBuffer->xCtx.pcTopic,
+                 MQTT_Status_strerror( pxReturnInfo->returnCode ) );
+    }
+
+    if( pxBuffer->xCtx.xCallback != NULL )
+    {
+        pxBuffer->xCtx.xCallback( pxBuffer->xCtx.pvCallbackCtx, pxReturnInfo->returnCode );
+    }
+
+    prvReleaseBuffer( pxBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+bool MqttAgent_InitPublishBufferPool( void )
+{
+    bool xSuccess = true;
+
+    if( xFreeQueue == NULL )
+    {
+        xFreeQueue = xQueueCreate( MQTT_PUBLISH_BUFFER_COUNT, sizeof( PublishBuffer_t * ) );
+        pxBuffers = pvPortMalloc( MQTT_PUBLISH_BUFFER_COUNT * sizeof( PublishBuffer_t ) );
+
+        if( ( xFreeQueue == NULL ) ||
+            ( pxBuffers == NULL ) )
+        {
+            LogError( "Failed to allocate %lu publish buffers.", ( unsigned long ) MQTT_PUBLISH_BUFFER_COUNT );
+
+            if( xFreeQueue != NULL )
+            {
+                vQueueDelete( xFreeQueue );
+                xFreeQueue = NULL;
+            }
+
+            vPortFree( pxBuffers );
+            pxBuffers = NULL;
+            xSuccess = false;
+        }
+        else
+        {
+            for( uint32_t ulIdx = 0; ulIdx < MQTT_PUBLISH_BUFFER_COUNT; ulIdx++ )
+            {
+                PublishBuffer_t * pxBuffer = &( pxBuffers[ ulIdx ] );
+
+                ( void ) memset( pxBuffer, 0, sizeof( PublishBuffer_t ) );
+                ( void ) xQueueSendToBack( xFreeQueue, &pxBuffer, 0 );
+            }
+        }
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+PublishBuffer_t * MqttAgent_BorrowPublishBuffer( TickType_t xTimeout )
+{
+    PublishBuffer_t * pxBuffer = NULL;
+
+    configASSERT( xFreeQueue != NULL );
+
+    if( xQueueReceive( xFreeQueue, &pxBuffer, xTimeout ) == pdTRUE )
+    {
+        configASSERT( pxBuffer->xCtx.xLent == pdFALSE );
+        pxBuffer->xCtx.xLent = pdTRUE;
+
+        prvAtomicMax( &ulHighWater, Atomic_Increment_u32( &ulInUse ) + 1UL );
+    }
+    else
+    {
+        pxBuffer = NULL;
+        ( void ) Atomic_Increment_u32( &ulExhausted );
+    }
+
+    return pxBuffer;
+}
+
+/*-----------------------------------------------------------*/
+
+uint8_t * MqttAgent_PublishBufferPayload( PublishBuffer_t * pxBuffer,
+                                          size_t * puxCapacity )
+{
+    configASSERT( prvIsPoolBuffer( pxBuffer ) );
+    configASSERT( pxBuffer->xCtx.xLent == pdTRUE );
+
+    if( puxCapacity != NULL )
+    {
+        *puxCapacity = sizeof( pxBuffer->xCtx.pucPayload );
+    }
+
+    return pxBuffer->xCtx.pucPayload;
+}
+
+/*-----------------------------------------------------------*/
+
+MQTTStatus_t MqttAgent_PublishBuffer( MQTTAgentHandle_t xAgentHandle,
+                                      PublishBuffer_t * pxBuffer,
+                                      const char * pcTopic,
+                                      size_t uxTopicLen,
+                                      size_t uxPayloadLen,
+                                      MQTTQoS_t xQoS,
+                                      PublishBufferCallback_t xCallback,
+                                      void * pvCallbackCtx )
+{
+    MQTTStatus_t xStatus = MQTTSuccess;
+
+    configASSERT( prvIsPoolBuffer( pxBuffer ) );
+    configASSERT( pxBuffer->xCtx.xLent == pdTRUE );
+
+    if( ( pcTopic == NULL ) ||
+        ( uxTopicLen == 0 ) ||
+        ( uxTopicLen > MQTT_PUBLISH_BUFFER_TOPIC_LEN ) ||
+        ( uxPayloadLen > MQTT_PUBLISH_BUFFER_PAYLOAD_LEN ) )
+    {
+        LogError( "Invalid publish: topic length %lu, payload length %lu.",
+                  ( unsigned long ) uxTopicLen, ( unsigned long ) uxPayloadLen );
+        xStatus = MQTTBadParameter;
+    }
+    else
+    {
+        MQTTAgentCommandInfo_t xCommandInfo = { 0 };
+
+        /* Never block, the caller has already been given a buffer */
+        xCommandInfo.cmdCompleteCallback = prvPublishComplete;
+        xCommandInfo.pCmdCompleteCallbackContext = &( pxBuffer->xCtx );
+        xCommandInfo.blockTimeMs = 0;
+
+        ( void ) memcpy( pxBuffer->xCtx.pcTopic, pcTopic, uxTopicLen );
+        pxBuffer->xCtx.pcTopic[ uxTopicLen ] = '\0';
+
+        ( void ) memset( &( pxBuffer->xCtx.xPublishInfo ), 0, sizeof( MQTTPublishInfo_t ) );
+        pxBuffer->xCtx.xPublishInfo.qos = xQoS;
+        pxBuffer->xCtx.xPublishInfo.pTopicName = pxBuffer->xCtx.pcTopic;
+        pxBuffer->xCtx.xPublishInfo.topicNameLength = ( uint16_t ) uxTopicLen;
+        pxBuffer->xCtx.xPublishInfo.pPayload = pxBuffer->xCtx.pucPayload;
+        pxBuffer->xCtx.xPublishInfo.payloadLength = uxPayloadLen;
+
+        pxBuffer->xCtx.xCallback = xCallback;
+        pxBuffer->xCtx.pvCallbackCtx = pvCallbackCtx;
+
+        xStatus = MQTTAgent_Publish( xAgentHandle,
+                                     &( pxBuffer->xCtx.xPublishInfo ),
+                                     &xCommandInfo );
+    }
+
+    if( xStatus == MQTTSuccess )
+    {
+        ( void ) Atomic_Increment_u32( &ulSubmitted );
+    }
+    else
+    {
+        ( void ) Atomic_Increment_u32( &ulFailed );
+        prvReleaseBuffer( pxBuffer );
+    }
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgent_ReturnPublishBuffer( PublishBuffer_t * pxBuffer )
+{
+    prvReleaseBuffer( pxBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+void MqttAgent_GetPublishBufferStats( PublishBufferPoolStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    pxStats->ulSize = ( pxBuffers != NULL ) ? MQTT_PUBLISH_BUFFER_COUNT : 0U;
+    pxStats->ulInUse = ulInUse;
+    pxStats->ulHighWater = ulHighWater;
+    pxStats->ulExhausted = ulExhausted;
+    pxStats->ulSubmitted = ulSubmitted;
+    pxStats->ulCompleted = ulCompleted;
+    pxStats->ulFailed = ulFailed;
+}
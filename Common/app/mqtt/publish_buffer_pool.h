@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file publish_buffer_pool.h
+ * @brief Pool of publish buffers lent to application tasks.
+ *
+ * MQTTAgent_Publish requires the topic and payload to stay valid until the
+ * publish completes, which otherwise forces each publishing task to block on
+ * completion or to keep a dedicated static buffer. Instead, a task borrows a
+ * buffer from this pool, serialises its payload directly into it and hands
+ * it to MqttAgent_PublishBuffer. The call does not block and ownership of the
+ * buffer passes to the MQTT agent, which returns it to the pool once the
+ * publish was sent (QoS0), acknowledged (QoS1) or cancelled. No copy of the
+ * payload is made.
+ */
+#ifndef PUBLISH_BUFFER_POOL_H
+#define PUBLISH_BUFFER_POOL_H
+
+#include "FreeRTOS.h"
+#include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of buffers in the pool */
+#ifndef MQTT_PUBLISH_BUFFER_COUNT
+#define MQTT_PUBLISH_BUFFER_COUNT          8U
+#endif
+
+/* Payload capacity of each buffer */
+#ifndef MQTT_PUBLISH_BUFFER_PAYLOAD_LEN
+#define MQTT_PUBLISH_BUFFER_PAYLOAD_LEN    1024U
+#endif
+
+/* Longest topic name, excluding the NUL terminator */
+#ifndef MQTT_PUBLISH_BUFFER_TOPIC_LEN
+#define MQTT_PUBLISH_BUFFER_TOPIC_LEN      128U
+#endif
+
+typedef struct PublishBuffer PublishBuffer_t;
+
+/**
+ * @brief Called from the MQTT agent task with the final status of a publish,
+ * just before the buffer is returned to the pool. Must not block.
+ */
+typedef void ( * PublishBufferCallback_t )( void * pvCtx,
+                                            MQTTStatus_t xStatus );
+
+typedef struct
+{
+    uint32_t ulSize;
+    uint32_t ulInUse;
+    uint32_t ulHighWater;  /* Most buffers lent at once */
+    uint32_t ulExhausted;  /* Borrow requests that timed out */
+    uint32_t ulSubmitted;  /* Publishes accepted by the agent */
+    uint32_t ulCompleted;  /* Publishes completed successfully */
+    uint32_t ulFailed;     /* Publishes rejected, failed or cancelled */
+} PublishBufferPoolStats_t;
+
+/**
+ * @brief Allocate the buffers. Called by the MQTT agent task before it
+ * signals that the agent is ready. Not thread safe.
+ *
+ * @return true if the pool is ready for use.
+ */
+bool MqttAgent_InitPublishBufferPool( void );
+
+/**
+ * @brief Borrow a buffer, waiting for up to xTimeout ticks for one to be
+ * returned if the pool is empty.
+ *
+ * @return The buffer, or NULL if none became available in time.
+ */
+PublishBuffer_t * MqttAgent_BorrowPublishBuffer( TickType_t xTimeout );
+
+/**
+ * @brief Return the payload area of a borrowed buffer.
+ *
+ * @param[out] puxCapacity Set to the number of bytes available, may be NULL.
+ */
+uint8_t * MqttAgent_PublishBufferPayload( PublishBuffer_t * pxBuffer,
+                                          size_t * puxCapacity );
+
+/**
+ * @brief Publish uxPayloadLen bytes of the buffer payload to pcTopic without
+ * blocking.
+ *
+ * The buffer is always consumed: on success it is owned by the MQTT agent
+ * until xCallback runs, on failure it has already been returned to the pool
+ * and xCallback is not called. The topic is copied into the buffer.
+ */
+MQTTStatus_t MqttAgent_PublishBuffer( MQTTAgentHandle_t xAgentHandle,
+                                      PublishBuffer_t * pxBuffer,
+                                      const char * pcTopic,
+                                      size_t uxTopicLen,
+                                      size_t uxPayloadLen,
+                                      MQTTQoS_t xQoS,
+                                      PublishBufferCallback_t xCallback,
+                                      void * pvCallbackCtx );
+
+/**
+ * @brief Give back a borrowed buffer that was not submitted.
+ */
+void MqttAgent_ReturnPublishBuffer( PublishBuffer_t * pxBuffer );
+
+void MqttAgent_GetPublishBufferStats( PublishBufferPoolStats_t * pxStats );
+
+#endif /* PUBLISH_BUFFER_POOL_H */
@@ -36,18 +36,24 @@
 #include "mqtt_agent_task.h"
 
 /**
- * @brief Maximum number of concurrent subscriptions.
+ * @brief Upper bounds for the mqtt_max_subs and mqtt_max_cbs KVStore keys,
+ * which set the number of concurrent subscriptions and registered callbacks.
  */
-#ifndef MQTT_AGENT_MAX_SUBSCRIPTIONS
-#define MQTT_AGENT_MAX_SUBSCRIPTIONS    10U
-#endif /* MQTT_AGENT_MAX_SUBSCRIPTIONS */
+#ifndef MQTT_AGENT_SUBSCRIPTIONS_LIMIT
+#define MQTT_AGENT_SUBSCRIPTIONS_LIMIT    256U
+#endif /* MQTT_AGENT_SUBSCRIPTIONS_LIMIT */
+
+#ifndef MQTT_AGENT_CALLBACKS_LIMIT
+#define MQTT_AGENT_CALLBACKS_LIMIT    256U
+#endif /* MQTT_AGENT_CALLBACKS_LIMIT */
 
 /**
- * @brief Maximum number of callbacks that may be registered.
+ * @brief Topic trie nodes reserved per subscription. AWS IoT topics have at
+ * most eight levels and filters sharing a prefix share its nodes.
  */
-#ifndef MQTT_AGENT_MAX_CALLBACKS
-#define MQTT_AGENT_MAX_CALLBACKS    10U
-#endif /* MQTT_AGENT_MAX_CALLBACKS */
+#ifndef MQTT_AGENT_TRIE_NODES_PER_SUB
+#define MQTT_AGENT_TRIE_NODES_PER_SUB    8U
+#endif /* MQTT_AGENT_TRIE_NODES_PER_SUB */
 
 /**
  * @brief Callback function called when receiving a publish.
@@ -58,6 +64,30 @@
 typedef void (* IncomingPubCallback_t )( void * pvIncomingPublishCallbackContext,
                                          MQTTPublishInfo_t * pxPublishInfo );
 
+/**
+ * @brief Callback function called with consecutive parts of the payload of a
+ * publish received in streaming mode.
+ *
+ * The payload is read from the TLS connection in chunks of at most
+ * MQTT_AGENT_NETWORK_BUFFER_SIZE bytes, so it may be larger than the network
+ * buffer. pxPublishInfo describes the whole publish: payloadLength is the
+ * total payload length and pPayload is NULL. The chunk with
+ * uxOffset + uxChunkLen == pxPublishInfo->payloadLength is the last one; an
+ * empty payload is reported with a single empty chunk. The callback runs in
+ * the MQTT agent task and must not block.
+ *
+ * @param[in] pvIncomingStreamCallbackContext The stream callback context.
+ * @param[in] pxPublishInfo Topic, QoS, flags and payload length of the publish.
+ * @param[in] uxOffset Offset of the chunk in the payload.
+ * @param[in] pvChunk Chunk data, valid for the duration of the call.
+ * @param[in] uxChunkLen Length of the chunk.
+ */
+typedef void (* IncomingStreamCallback_t )( void * pvIncomingStreamCallbackContext,
+                                            const MQTTPublishInfo_t * pxPublishInfo,
+                                            size_t uxOffset,
+                                            const void * pvChunk,
+                                            size_t uxChunkLen );
+
 /**
  * @brief An element in the list of subscriptions.
  *
@@ -73,6 +103,7 @@ typedef void (* IncomingPubCallback_t )( void * pvIncomingPublishCallbackContext
 typedef struct
 {
     IncomingPubCallback_t pxIncomingPublishCallback;
+    IncomingStreamCallback_t pxIncomingStreamCallback; /* Set instead of pxIncomingPublishCallback for streaming */
     void * pvIncomingPublishCallbackContext;
     TaskHandle_t xTaskHandle;
     MQTTSubscribeInfo_t * pxSubInfo;
@@ -108,4 +139,40 @@ MQTTStatus_t MqttAgent_UnSubscribeSync( MQTTAgentHandle_t xHandle,
                                         IncomingPubCallback_t pxCallback,
                                         void * pvCallbackCtx );
 
+/* @brief Add a streaming callback for a given topic filter. Subscribe if not already subscribed.
+ *
+ * QoS0 and QoS1 publishes matching the filter bypass the network buffer: the
+ * agent reads their payload straight from the TLS connection and passes it to
+ * the callback in chunks, acknowledging QoS1 publishes once the last chunk
+ * was delivered. Regular callbacks whose filter also matches such a publish
+ * are not called. QoS2 publishes are received into the network buffer and
+ * passed to the callback as a single chunk.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] pcTopicFilter Topic filter string to subscribe to.
+ * @param[in] xRequestedQoS Requested QoS for this subscription.
+ * @param[in] pxCallback Streaming callback function for the subscription.
+ * @param[in] pvCallbackCtx Context for the subscription callback.
+ * @return `MQTTSuccess` if the subscription was added successfully.
+ **/
+MQTTStatus_t MqttAgent_SubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                            const char * pcTopicFilter,
+                                            MQTTQoS_t xRequestedQoS,
+                                            IncomingStreamCallback_t pxCallback,
+                                            void * pvCallbackCtx );
+
+/* @brief Remove the specified streaming callback from the given topic filter.
+ * Unsubscribe from the specified topic is no other callback exist for the same filter.
+ *
+ * @param[in] xHandle Handle for the desired MQTT Agent Task instance.
+ * @param[in] pcTopicFilter Topic filter string to subscribe to.
+ * @param[in] pxCallback Streaming callback function for the subscription.
+ * @param[in] pvCallbackCtx Context for the subscription callback.
+ * @return `MQTTSuccess` if the subscription was successfully removed.
+ **/
+MQTTStatus_t MqttAgent_UnSubscribeStreamSync( MQTTAgentHandle_t xHandle,
+                                              const char * pcTopicFilter,
+                                              IncomingStreamCallback_t pxCallback,
+                                              void * pvCallbackCtx );
+
 #endif /* SUBSCRIPTION_MANAGER_H */
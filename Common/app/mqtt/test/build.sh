@@ -0,0 +1,60 @@
+#!/bin/bash
+#
+# Build and run the host tests of the MQTT modules with the host compiler.
+# Usage: build.sh [test name ...], all tests by default.
+
+SCRIPT_DIR=$(dirname "${0}")
+SCRIPT_DIR=$(realpath "${SCRIPT_DIR}")
+ROOT_DIR=$(realpath "${SCRIPT_DIR}/../../../..")
+OUT_DIR="${SCRIPT_DIR}/out"
+CC=${CC:-cc}
+
+CFLAGS=(-std=gnu11 -g -O1 -Wall -Wextra -Wno-unused-parameter -pthread
+        -fsanitize=address,undefined -DLFS_NO_DEBUG -DLFS_NO_WARN
+        -I"${SCRIPT_DIR}/host"
+        -I"${ROOT_DIR}/Common/app/mqtt"
+        -I"${ROOT_DIR}/Common/config"
+        -I"${ROOT_DIR}/Common/cli"
+        -I"${ROOT_DIR}/Common/kvstore"
+        -I"${ROOT_DIR}/Common/include"
+        -I"${ROOT_DIR}/Projects/b_u585i_iot02a_ntz/Inc"
+        -I"${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT/source/include"
+        -I"${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT/source/interface"
+        -I"${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT-Agent/source/include"
+        -I"${ROOT_DIR}/Middleware/FreeRTOS/backoffAlgorithm/source/include"
+        -I"${ROOT_DIR}/Middleware/ARM/littlefs")
+
+LFS_SRCS=("${ROOT_DIR}/Middleware/ARM/littlefs/lfs.c"
+          "${ROOT_DIR}/Middleware/ARM/littlefs/lfs_util.c")
+
+AGENT_SRCS=("${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT/source/core_mqtt.c"
+            "${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT/source/core_mqtt_serializer.c"
+            "${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT/source/core_mqtt_state.c"
+            "${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT-Agent/source/core_mqtt_agent.c"
+            "${ROOT_DIR}/Middleware/FreeRTOS/coreMQTT-Agent/source/core_mqtt_agent_command_functions.c"
+            "${ROOT_DIR}/Middleware/FreeRTOS/backoffAlgorithm/source/backoff_algorithm.c"
+            "${ROOT_DIR}/Common/app/mqtt/freertos_command_pool.c"
+            "${ROOT_DIR}/Common/app/mqtt/topic_trie.c")
+
+declare -A TEST_SRCS=(
+    [test_command_pool]=""
+    [test_mqtt_journal]="${LFS_SRCS[*]}"
+    [test_mqtt_stream]="${AGENT_SRCS[*]}"
+    [test_topic_trie]="${ROOT_DIR}/Common/app/mqtt/topic_trie.c"
+)
+
+TESTS=("$@")
+
+if test ${#TESTS[@]} -eq 0; then
+    TESTS=("${!TEST_SRCS[@]}")
+fi
+
+mkdir -p "${OUT_DIR}"
+
+for TEST in "${TESTS[@]}"; do
+    # shellcheck disable=SC2086
+    "${CC}" "${CFLAGS[@]}" -o "${OUT_DIR}/${TEST}" \
+        "${SCRIPT_DIR}/${TEST}.c" "${SCRIPT_DIR}/host/host_port.c" ${TEST_SRCS[${TEST}]} || exit 1
+
+    "${OUT_DIR}/${TEST}" || exit 1
+done
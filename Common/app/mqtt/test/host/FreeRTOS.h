@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file FreeRTOS.h
+ * @brief Minimal host stand-in for the FreeRTOS kernel, enough to run the
+ * MQTT modules in a single process. Ticks are milliseconds and advanced by
+ * the test through xHostTick.
+ */
+
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef long             BaseType_t;
+typedef unsigned long    UBaseType_t;
+typedef uint32_t         TickType_t;
+
+typedef struct HostQueue     * QueueHandle_t;
+typedef struct HostQueue     * SemaphoreHandle_t;
+typedef struct HostTask      * TaskHandle_t;
+
+#define pdFALSE                 ( ( BaseType_t ) 0 )
+#define pdTRUE                  ( ( BaseType_t ) 1 )
+#define pdFAIL                  ( pdFALSE )
+#define pdPASS                  ( pdTRUE )
+
+#define portMAX_DELAY           ( ( TickType_t ) 0xFFFFFFFFUL )
+#define configTICK_RATE_HZ      ( ( TickType_t ) 1000 )
+#define portTICK_PERIOD_MS      ( ( TickType_t ) 1 )
+#define pdMS_TO_TICKS( xMs )    ( ( TickType_t ) ( xMs ) )
+
+#define configASSERT( x )       assert( x )
+
+/* Non-fatal on the target, a test failure on the host */
+#define configASSERT_CONTINUE( x )    assert( x )
+
+#define taskENTER_CRITICAL()    vHostEnterCritical()
+#define taskEXIT_CRITICAL()     vHostExitCritical()
+
+void vHostEnterCritical( void );
+void vHostExitCritical( void );
+
+void * pvPortMalloc( size_t xSize );
+void vPortFree( void * pv );
+
+/* Current tick count, advanced by the test */
+extern volatile TickType_t xHostTick;
+
+#endif /* HOST_FREERTOS_H */
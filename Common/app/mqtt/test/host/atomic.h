@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file atomic.h
+ * @brief Host stand-in for the FreeRTOS atomic operations, implemented with
+ * the compiler's sequentially consistent builtins.
+ */
+
+#ifndef HOST_ATOMIC_H
+#define HOST_ATOMIC_H
+
+#include "FreeRTOS.h"
+
+#define ATOMIC_COMPARE_AND_SWAP_SUCCESS    0x1U
+#define ATOMIC_COMPARE_AND_SWAP_FAILURE    0x0U
+
+static inline uint32_t Atomic_CompareAndSwap_u32( uint32_t volatile * pulDestination,
+                                                  uint32_t ulExchange,
+                                                  uint32_t ulComparand )
+{
+    return __atomic_compare_exchange_n( pulDestination, &ulComparand, ulExchange, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) ?
+           ATOMIC_COMPARE_AND_SWAP_SUCCESS : ATOMIC_COMPARE_AND_SWAP_FAILURE;
+}
+
+static inline uint32_t Atomic_CompareAndSwapPointers_p32( void * volatile * ppvDestination,
+                                                          void * pvExchange,
+                                                          void * pvComparand )
+{
+    return __atomic_compare_exchange_n( ppvDestination, &pvComparand, pvExchange, false,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) ?
+           ATOMIC_COMPARE_AND_SWAP_SUCCESS : ATOMIC_COMPARE_AND_SWAP_FAILURE;
+}
+
+/* The arithmetic operations return the value before the update */
+static inline uint32_t Atomic_Add_u32( uint32_t volatile * pulAddend,
+                                       uint32_t ulCount )
+{
+    return __atomic_fetch_add( pulAddend, ulCount, __ATOMIC_SEQ_CST );
+}
+
+static inline uint32_t Atomic_Subtract_u32( uint32_t volatile * pulAddend,
+                                            uint32_t ulCount )
+{
+    return __atomic_fetch_sub( pulAddend, ulCount, __ATOMIC_SEQ_CST );
+}
+
+static inline uint32_t Atomic_Increment_u32( uint32_t volatile * pulAddend )
+{
+    return Atomic_Add_u32( pulAddend, 1U );
+}
+
+static inline uint32_t Atomic_Decrement_u32( uint32_t volatile * pulAddend )
+{
+    return Atomic_Subtract_u32( pulAddend, 1U );
+}
+
+#endif /* HOST_ATOMIC_H */
@@ -0,0 +1,540 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file host_port.c
+ * @brief Host implementation of the kernel calls declared in the FreeRTOS.h,
+ * task.h, queue.h, semphr.h and event_groups.h stand-ins of this directory. Every pthread
+ * counts as a task; critical sections take one process wide lock.
+ */
+
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "event_groups.h"
+
+#define HOST_TLS_SLOTS       8
+#define HOST_NOTIFY_SLOTS    4
+
+struct HostQueue
+{
+    uint8_t * pucItems;
+    size_t uxItemSize;
+    UBaseType_t uxLength;
+    UBaseType_t uxHead;
+    UBaseType_t uxCount;
+    bool xIsMutex;
+    TaskHandle_t xHolder;
+};
+
+struct HostTask
+{
+    void * pvTls[ HOST_TLS_SLOTS ];
+    uint32_t pulNotify[ HOST_NOTIFY_SLOTS ];
+};
+
+struct HostEventGroup
+{
+    EventBits_t uxBits;
+};
+
+volatile TickType_t xHostTick = 0;
+
+static pthread_mutex_t xCriticalLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static __thread struct HostTask xCurrentTask;
+
+/*-----------------------------------------------------------*/
+
+void vHostEnterCritical( void )
+{
+    ( void ) pthread_mutex_lock( &xCriticalLock );
+}
+
+/*-----------------------------------------------------------*/
+
+void vHostExitCritical( void )
+{
+    ( void ) pthread_mutex_unlock( &xCriticalLock );
+}
+
+/*-----------------------------------------------------------*/
+
+void * pvPortMalloc( size_t xSize )
+{
+    return malloc( xSize );
+}
+
+/*-----------------------------------------------------------*/
+
+void vPortFree( void * pv )
+{
+    free( pv );
+}
+
+/*-----------------------------------------------------------*/
+
+void vLoggingPrintf( const char * const pcLogLevel,
+                     const char * const pcFileName,
+                     const unsigned long ulLineNumber,
+                     const char * const pcFormat,
+                     ... )
+{
+    va_list xArgs;
+
+    if( getenv( "HOST_TEST_VERBOSE" ) != NULL )
+    {
+        ( void ) printf( "%s %s:%lu ", pcLogLevel, pcFileName, ulLineNumber );
+
+        va_start( xArgs, pcFormat );
+        ( void ) vprintf( pcFormat, xArgs );
+        va_end( xArgs );
+
+        ( void ) printf( "\n" );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+TickType_t xTaskGetTickCount( void )
+{
+    return xHostTick;
+}
+
+/*-----------------------------------------------------------*/
+
+TaskHandle_t xTaskGetCurrentTaskHandle( void )
+{
+    return &xCurrentTask;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTaskDelay( TickType_t xTicksToDelay )
+{
+    xHostTick += xTicksToDelay;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTaskDelete( TaskHandle_t xTaskToDelete )
+{
+    ( void ) xTaskToDelete;
+}
+
+/*-----------------------------------------------------------*/
+
+char * pcTaskGetName( TaskHandle_t xTaskToQuery )
+{
+    static char pcName[] = "host";
+
+    ( void ) xTaskToQuery;
+
+    return pcName;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTaskSetTimeOutState( TimeOut_t * pxTimeOut )
+{
+    pxTimeOut->xTimeOnEntering = xHostTick;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskCheckForTimeOut( TimeOut_t * pxTimeOut,
+                                 TickType_t * pxTicksToWait )
+{
+    BaseType_t xTimedOut = pdFALSE;
+    TickType_t xElapsed = xHostTick - pxTimeOut->xTimeOnEntering;
+
+    if( *pxTicksToWait == portMAX_DELAY )
+    {
+        /* Never times out */
+    }
+    else if( xElapsed >= *pxTicksToWait )
+    {
+        *pxTicksToWait = 0;
+        xTimedOut = pdTRUE;
+    }
+    else
+    {
+        *pxTicksToWait -= xElapsed;
+        vTaskSetTimeOutState( pxTimeOut );
+    }
+
+    return xTimedOut;
+}
+
+/*-----------------------------------------------------------*/
+
+void * pvTaskGetThreadLocalStoragePointer( TaskHandle_t xTask,
+                                           BaseType_t xIndex )
+{
+    struct HostTask * pxTask = ( xTask != NULL ) ? xTask : &xCurrentTask;
+
+    configASSERT( ( xIndex >= 0 ) && ( xIndex < HOST_TLS_SLOTS ) );
+
+    return pxTask->pvTls[ xIndex ];
+}
+
+/*-----------------------------------------------------------*/
+
+void vTaskSetThreadLocalStoragePointer( TaskHandle_t xTask,
+                                        BaseType_t xIndex,
+                                        void * pvValue )
+{
+    struct HostTask * pxTask = ( xTask != NULL ) ? xTask : &xCurrentTask;
+
+    configASSERT( ( xIndex >= 0 ) && ( xIndex < HOST_TLS_SLOTS ) );
+
+    pxTask->pvTls[ xIndex ] = pvValue;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskNotifyIndexed( TaskHandle_t xTaskToNotify,
+                               UBaseType_t uxIndexToNotify,
+                               uint32_t ulValue,
+                               eNotifyAction eAction )
+{
+    configASSERT( xTaskToNotify != NULL );
+    configASSERT( uxIndexToNotify < HOST_NOTIFY_SLOTS );
+    configASSERT( ( eAction == eSetBits ) || ( eAction == eSetValueWithOverwrite ) );
+
+    vHostEnterCritical();
+
+    if( eAction == eSetBits )
+    {
+        xTaskToNotify->pulNotify[ uxIndexToNotify ] |= ulValue;
+    }
+    else
+    {
+        xTaskToNotify->pulNotify[ uxIndexToNotify ] = ulValue;
+    }
+
+    vHostExitCritical();
+
+    return pdPASS;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskNotifyWaitIndexed( UBaseType_t uxIndexToWaitOn,
+                                   uint32_t ulBitsToClearOnEntry,
+                                   uint32_t ulBitsToClearOnExit,
+                                   uint32_t * pulNotificationValue,
+                                   TickType_t xTicksToWait )
+{
+    uint32_t ulValue = 0;
+
+    ( void ) ulBitsToClearOnEntry;
+    ( void ) xTicksToWait;
+
+    configASSERT( uxIndexToWaitOn < HOST_NOTIFY_SLOTS );
+
+    vHostEnterCritical();
+    ulValue = xCurrentTask.pulNotify[ uxIndexToWaitOn ];
+    xCurrentTask.pulNotify[ uxIndexToWaitOn ] &= ~ulBitsToClearOnExit;
+    vHostExitCritical();
+
+    if( pulNotificationValue != NULL )
+    {
+        *pulNotificationValue = ulValue;
+    }
+
+    return ( ulValue != 0U ) ? pdPASS : pdFAIL;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTaskNotifyStateClearIndexed( TaskHandle_t xTask,
+                                         UBaseType_t uxIndexToClear )
+{
+    struct HostTask * pxTask = ( xTask != NULL ) ? xTask : &xCurrentTask;
+
+    configASSERT( uxIndexToClear < HOST_NOTIFY_SLOTS );
+
+    vHostEnterCritical();
+    pxTask->pulNotify[ uxIndexToClear ] = 0;
+    vHostExitCritical();
+
+    return pdPASS;
+}
+
+/*-----------------------------------------------------------*/
+
+QueueHandle_t xQueueCreate( UBaseType_t uxQueueLength,
+                            UBaseType_t uxItemSize )
+{
+    struct HostQueue * pxQueue = calloc( 1, sizeof( struct HostQueue ) );
+
+    if( pxQueue != NULL )
+    {
+        pxQueue->uxItemSize = uxItemSize;
+        pxQueue->uxLength = uxQueueLength;
+        pxQueue->pucItems = calloc( uxQueueLength, ( uxItemSize > 0 ) ? uxItemSize : 1U );
+
+        if( pxQueue->pucItems == NULL )
+        {
+            free( pxQueue );
+            pxQueue = NULL;
+        }
+    }
+
+    return pxQueue;
+}
+
+/*-----------------------------------------------------------*/
+
+void vQueueDelete( QueueHandle_t xQueue )
+{
+    free( xQueue->pucItems );
+    free( xQueue );
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xQueueSendToBack( QueueHandle_t xQueue,
+                             const void * pvItemToQueue,
+                             TickType_t xTicksToWait )
+{
+    BaseType_t xResult = pdFAIL;
+
+    ( void ) xTicksToWait;
+
+    vHostEnterCritical();
+
+    if( xQueue->uxCount < xQueue->uxLength )
+    {
+        UBaseType_t uxTail = ( xQueue->uxHead + xQueue->uxCount ) % xQueue->uxLength;
+
+        if( xQueue->uxItemSize > 0 )
+        {
+            ( void ) memcpy( &( xQueue->pucItems[ uxTail * xQueue->uxItemSize ] ), pvItemToQueue, xQueue->uxItemSize );
+        }
+
+        xQueue->uxCount++;
+        xResult = pdPASS;
+    }
+
+    vHostExitCritical();
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xQueueReceive( QueueHandle_t xQueue,
+                          void * pvBuffer,
+                          TickType_t xTicksToWait )
+{
+    BaseType_t xResult = pdFAIL;
+
+    ( void ) xTicksToWait;
+
+    vHostEnterCritical();
+
+    if( xQueue->uxCount > 0 )
+    {
+        if( xQueue->uxItemSize > 0 )
+        {
+            ( void ) memcpy( pvBuffer, &( xQueue->pucItems[ xQueue->uxHead * xQueue->uxItemSize ] ), xQueue->uxItemSize );
+        }
+
+        xQueue->uxHead = ( xQueue->uxHead + 1U ) % xQueue->uxLength;
+        xQueue->uxCount--;
+        xResult = pdPASS;
+    }
+
+    vHostExitCritical();
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxQueueMessagesWaiting( QueueHandle_t xQueue )
+{
+    return xQueue->uxCount;
+}
+
+/*-----------------------------------------------------------*/
+
+SemaphoreHandle_t xSemaphoreCreateMutex( void )
+{
+    SemaphoreHandle_t xMutex = xSemaphoreCreateCounting( 1U, 1U );
+
+    if( xMutex != NULL )
+    {
+        xMutex->xIsMutex = true;
+    }
+
+    return xMutex;
+}
+
+/*-----------------------------------------------------------*/
+
+SemaphoreHandle_t xSemaphoreCreateCounting( UBaseType_t uxMaxCount,
+                                            UBaseType_t uxInitialCount )
+{
+    SemaphoreHandle_t xSemaphore = xQueueCreate( uxMaxCount, 0U );
+
+    if( xSemaphore != NULL )
+    {
+        xSemaphore->uxCount = uxInitialCount;
+    }
+
+    return xSemaphore;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xSemaphoreTake( SemaphoreHandle_t xSemaphore,
+                           TickType_t xTicksToWait )
+{
+    BaseType_t xResult = xQueueReceive( xSemaphore, NULL, xTicksToWait );
+
+    if( ( xResult == pdPASS ) && xSemaphore->xIsMutex )
+    {
+        xSemaphore->xHolder = &xCurrentTask;
+    }
+    /* Nothing blocks on the host, let the thread that will give run instead */
+    else if( ( xResult == pdFAIL ) && ( xTicksToWait > 0U ) )
+    {
+        ( void ) sched_yield();
+    }
+    else
+    {
+        /* Empty */
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xSemaphoreGive( SemaphoreHandle_t xSemaphore )
+{
+    if( xSemaphore->xIsMutex )
+    {
+        xSemaphore->xHolder = NULL;
+    }
+
+    return xQueueSendToBack( xSemaphore, NULL, 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+UBaseType_t uxSemaphoreGetCount( SemaphoreHandle_t xSemaphore )
+{
+    return uxQueueMessagesWaiting( xSemaphore );
+}
+
+/*-----------------------------------------------------------*/
+
+TaskHandle_t xSemaphoreGetMutexHolder( SemaphoreHandle_t xMutex )
+{
+    return xMutex->xHolder;
+}
+
+/*-----------------------------------------------------------*/
+
+EventGroupHandle_t xEventGroupCreate( void )
+{
+    return calloc( 1, sizeof( struct HostEventGroup ) );
+}
+
+/*-----------------------------------------------------------*/
+
+EventBits_t xEventGroupWaitBits( EventGroupHandle_t xEventGroup,
+                                 const EventBits_t uxBitsToWaitFor,
+                                 const BaseType_t xClearOnExit,
+                                 const BaseType_t xWaitForAllBits,
+                                 TickType_t xTicksToWait )
+{
+    EventBits_t uxBits = 0;
+
+    ( void ) xWaitForAllBits;
+    ( void ) xTicksToWait;
+
+    vHostEnterCritical();
+    uxBits = xEventGroup->uxBits;
+
+    if( xClearOnExit == pdTRUE )
+    {
+        xEventGroup->uxBits &= ~uxBitsToWaitFor;
+    }
+
+    vHostExitCritical();
+
+    return uxBits;
+}
+
+/*-----------------------------------------------------------*/
+
+EventBits_t xEventGroupSetBits( EventGroupHandle_t xEventGroup,
+                                const EventBits_t uxBitsToSet )
+{
+    EventBits_t uxBits = 0;
+
+    vHostEnterCritical();
+    xEventGroup->uxBits |= uxBitsToSet;
+    uxBits = xEventGroup->uxBits;
+    vHostExitCritical();
+
+    return uxBits;
+}
+
+/*-----------------------------------------------------------*/
+
+EventBits_t xEventGroupClearBits( EventGroupHandle_t xEventGroup,
+                                  const EventBits_t uxBitsToClear )
+{
+    EventBits_t uxBits = 0;
+
+    vHostEnterCritical();
+    uxBits = xEventGroup->uxBits;
+    xEventGroup->uxBits &= ~uxBitsToClear;
+    vHostExitCritical();
+
+    return uxBits;
+}
+
+/*-----------------------------------------------------------*/
+
+EventBits_t xEventGroupGetBits( EventGroupHandle_t xEventGroup )
+{
+    return xEventGroup->uxBits;
+}
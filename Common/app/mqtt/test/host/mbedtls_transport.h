@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file mbedtls_transport.h
+ * @brief Host stand-in for the TLS transport interface. Only the types and
+ * functions used by the MQTT modules are declared; each test provides the
+ * implementations it needs.
+ */
+
+#ifndef HOST_MBEDTLS_TRANSPORT_H
+#define HOST_MBEDTLS_TRANSPORT_H
+
+#include "FreeRTOS.h"
+#include "transport_interface.h"
+
+#define TLS_KEY_PRV_LABEL         "tls_key_priv"
+#define TLS_CERT_LABEL            "tls_cert"
+#define TLS_ROOT_CA_CERT_LABEL    "root_ca_cert"
+
+typedef enum TlsTransportStatus
+{
+    TLS_TRANSPORT_SUCCESS = 0,
+    TLS_TRANSPORT_UNKNOWN_ERROR = -1,
+    TLS_TRANSPORT_INVALID_PARAMETER = -2,
+    TLS_TRANSPORT_CONNECT_FAILURE = -7,
+} TlsTransportStatus_t;
+
+typedef void ( * GenericCallback_t )( void * );
+
+typedef struct
+{
+    const void * pvBase;
+    size_t uxLen;
+} TlsOutVector_t;
+
+typedef struct PkiObject
+{
+    const char * pcLabel;
+} PkiObject_t;
+
+PkiObject_t xPkiObjectFromLabel( const char * pcLabel );
+
+/* Declared by the lwIP port headers that the transport pulls in */
+UBaseType_t uxRand( void );
+
+NetworkContext_t * mbedtls_transport_allocate( void );
+void mbedtls_transport_free( NetworkContext_t * pxNetworkContext );
+TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkContext,
+                                                  const char ** ppcAlpnProtos,
+                                                  const PkiObject_t * pxPrivateKey,
+                                                  const PkiObject_t * pxClientCert,
+                                                  const PkiObject_t * pxRootCaCerts,
+                                                  const size_t uxNumRootCA );
+int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
+                                           GenericCallback_t pxCallback,
+                                           void * pvCtx );
+BaseType_t mbedtls_transport_recvpending( NetworkContext_t * pxNetworkContext );
+TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
+                                                const char * pcHostName,
+                                                uint16_t usPort,
+                                                uint32_t ulRecvTimeoutMs,
+                                                uint32_t ulSendTimeoutMs );
+void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext );
+int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
+                                void * pBuffer,
+                                size_t bytesToRecv );
+int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
+                                const void * pBuffer,
+                                size_t uxBytesToSend );
+int32_t mbedtls_transport_writev( NetworkContext_t * pxNetworkContext,
+                                  const TlsOutVector_t * pxVectors,
+                                  size_t uxVectorCount );
+
+#endif /* HOST_MBEDTLS_TRANSPORT_H */
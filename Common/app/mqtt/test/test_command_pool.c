@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_command_pool.c
+ * @brief Host stress test of the lock-free MQTT command pool.
+ *
+ * Every pthread counts as a task. Exclusive ownership of the structures is
+ * checked while many threads obtain and release them concurrently, and the
+ * free list tag is checked against the ABA interleaving it guards against.
+ * Build and run with build.sh in this directory.
+ */
+
+/* The module is included so that the tests can inspect and reset the free list */
+#include "freertos_command_pool.c"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define TEST_STRESS_POOL_SIZE     8U
+#define TEST_STRESS_THREADS       16U
+#define TEST_STRESS_ITERATIONS    50000U
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+static uint32_t ulPoolSizeKey = 0;
+
+/* Thread currently holding each structure, 0 when free */
+static uint32_t pulOwner[ TEST_STRESS_POOL_SIZE ];
+
+static volatile bool xTickerRun = false;
+
+/*-----------------------------------------------------------*/
+
+uint32_t KVStore_getUInt32( KVStoreKey_t xKey,
+                            BaseType_t * pxSuccess )
+{
+    configASSERT( xKey == CS_MQTT_CMD_POOL );
+
+    *pxSuccess = ( ulPoolSizeKey > 0U ) ? pdTRUE : pdFALSE;
+
+    return ulPoolSizeKey;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Drop the pool so that the next Agent_InitializePool starts from scratch */
+static void prvReset( uint32_t ulSizeKey )
+{
+    vPortFree( pxCommandPool );
+    vPortFree( pusNextFree );
+
+    if( xReleaseSemaphore != NULL )
+    {
+        vSemaphoreDelete( xReleaseSemaphore );
+    }
+
+    pxCommandPool = NULL;
+    pusNextFree = NULL;
+    xReleaseSemaphore = NULL;
+    uxCommandPoolSize = 0;
+    ulFreeHead = POOL_HEAD( 0UL, POOL_IDX_NONE );
+    ulWaitingTasks = 0;
+    ulInUse = 0;
+    ulHighWater = 0;
+    ulExhausted = 0;
+    ulWaits = 0;
+    ulWaitTimeouts = 0;
+    ulWaitMsTotal = 0;
+    ulWaitMsMax = 0;
+    xHostTick = 0;
+
+    ulPoolSizeKey = ulSizeKey;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Every structure must be on the free list exactly once */
+static void prvCheckFreeList( void )
+{
+    bool pxSeen[ MQTT_COMMAND_POOL_LIMIT ] = { false };
+    size_t uxCount = 0;
+
+    for( uint32_t ulIdx = POOL_HEAD_IDX( ulFreeHead );
+         ulIdx != POOL_IDX_NONE;
+         ulIdx = pusNextFree[ ulIdx ] )
+    {
+        TEST_ASSERT( ulIdx < uxCommandPoolSize );
+        TEST_ASSERT( !pxSeen[ ulIdx ] );
+        pxSeen[ ulIdx ] = true;
+        uxCount++;
+    }
+
+    TEST_ASSERT( uxCount == uxCommandPoolSize );
+    TEST_ASSERT( ulInUse == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+static void * prvTicker( void * pvArg )
+{
+    ( void ) pvArg;
+
+    while( xTickerRun )
+    {
+        vTaskDelay( 1U );
+        ( void ) usleep( 100U );
+    }
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static void * prvDelayedRelease( void * pvArg )
+{
+    ( void ) usleep( 20000U );
+    TEST_ASSERT( Agent_ReleaseCommand( ( MQTTAgentCommand_t * ) pvArg ) );
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestInitSize( void )
+{
+    AgentCommandPoolStats_t xStats;
+
+    prvReset( 0U );
+    TEST_ASSERT( Agent_InitializePool() );
+    Agent_GetPoolStats( &xStats );
+    TEST_ASSERT( xStats.ulSize == MQTT_COMMAND_CONTEXTS_POOL_SIZE );
+    prvCheckFreeList();
+
+    prvReset( MQTT_COMMAND_POOL_LIMIT + 1U );
+    TEST_ASSERT( Agent_InitializePool() );
+    Agent_GetPoolStats( &xStats );
+    TEST_ASSERT( xStats.ulSize == MQTT_COMMAND_POOL_LIMIT );
+    prvCheckFreeList();
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestExhaustion( void )
+{
+    MQTTAgentCommand_t * pxCommands[ 4 ];
+    MQTTAgentCommand_t xForeign;
+    AgentCommandPoolStats_t xStats;
+
+    prvReset( 4U );
+    TEST_ASSERT( Agent_InitializePool() );
+
+    for( size_t uxIdx = 0; uxIdx < 4U; uxIdx++ )
+    {
+        pxCommands[ uxIdx ] = Agent_GetCommand( 0U );
+        TEST_ASSERT( pxCommands[ uxIdx ] != NULL );
+        TEST_ASSERT( Agent_GetCommandIndex( pxCommands[ uxIdx ] ) < 4U );
+    }
+
+    TEST_ASSERT( Agent_GetCommand( 0U ) == NULL );
+
+    Agent_GetPoolStats( &xStats );
+    TEST_ASSERT( xStats.ulInUse == 4U );
+    TEST_ASSERT( xStats.ulHighWater == 4U );
+    TEST_ASSERT( xStats.ulExhausted == 1U );
+    TEST_ASSERT( xStats.ulWaits == 0U );
+
+    /* Structures that are not part of the pool are refused */
+    TEST_ASSERT( !Agent_ReleaseCommand( &xForeign ) );
+    TEST_ASSERT( !Agent_ReleaseCommand( &( pxCommandPool[ 4 ] ) ) );
+    TEST_ASSERT( Agent_GetCommandIndex( &xForeign ) == MQTT_COMMAND_POOL_LIMIT );
+
+    for( size_t uxIdx = 0; uxIdx < 4U; uxIdx++ )
+    {
+        TEST_ASSERT( Agent_ReleaseCommand( pxCommands[ uxIdx ] ) );
+    }
+
+    prvCheckFreeList();
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestWait( void )
+{
+    MQTTAgentCommand_t * pxCommand = NULL;
+    AgentCommandPoolStats_t xStats;
+    pthread_t xThread;
+
+    prvReset( 1U );
+    TEST_ASSERT( Agent_InitializePool() );
+
+    pxCommand = Agent_GetCommand( 0U );
+    TEST_ASSERT( pxCommand != NULL );
+
+    /* Times out once the ticks pass the block time */
+    xTickerRun = true;
+    TEST_ASSERT( pthread_create( &xThread, NULL, prvTicker, NULL ) == 0 );
+    TEST_ASSERT( Agent_GetCommand( 10U ) == NULL );
+    xTickerRun = false;
+    TEST_ASSERT( pthread_join( xThread, NULL ) == 0 );
+
+    Agent_GetPoolStats( &xStats );
+    TEST_ASSERT( xStats.ulWaits == 1U );
+    TEST_ASSERT( xStats.ulWaitTimeouts == 1U );
+    TEST_ASSERT( xStats.ulWaitMsMax >= 10U );
+
+    /* Wakes up when another task releases a structure, ticks stand still */
+    TEST_ASSERT( pthread_create( &xThread, NULL, prvDelayedRelease, pxCommand ) == 0 );
+    TEST_ASSERT( Agent_GetCommand( 10U ) == pxCommand );
+    TEST_ASSERT( pthread_join( xThread, NULL ) == 0 );
+
+    Agent_GetPoolStats( &xStats );
+    TEST_ASSERT( xStats.ulWaits == 2U );
+    TEST_ASSERT( xStats.ulWaitTimeouts == 1U );
+    TEST_ASSERT( ulWaitingTasks == 0U );
+
+    TEST_ASSERT( Agent_ReleaseCommand( pxCommand ) );
+    prvCheckFreeList();
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * A task reads the head and the next index, then is preempted while others
+ * pop the head, pop the next entry and push the head back. The head index is
+ * the same again, so without the tag the stale compare-and-swap would succeed
+ * and hand out the entry that is still in use.
+ */
+static void prvTestAba( void )
+{
+    MQTTAgentCommand_t * pxFirst = NULL;
+    MQTTAgentCommand_t * pxSecond = NULL;
+    uint32_t ulStaleHead = 0;
+    uint32_t ulStaleNewHead = 0;
+
+    prvReset( 3U );
+    TEST_ASSERT( Agent_InitializePool() );
+
+    ulStaleHead = ulFreeHead;
+    ulStaleNewHead = POOL_HEAD( POOL_HEAD_TAG( ulStaleHead ) + 1UL, pusNextFree[ POOL_HEAD_IDX( ulStaleHead ) ] );
+
+    pxFirst = Agent_GetCommand( 0U );
+    pxSecond = Agent_GetCommand( 0U );
+    TEST_ASSERT( ( pxFirst != NULL ) && ( pxSecond != NULL ) );
+    TEST_ASSERT( Agent_ReleaseCommand( pxFirst ) );
+
+    TEST_ASSERT( POOL_HEAD_IDX( ulFreeHead ) == POOL_HEAD_IDX( ulStaleHead ) );
+    TEST_ASSERT( POOL_HEAD_IDX( ulStaleNewHead ) == Agent_GetCommandIndex( pxSecond ) );
+    TEST_ASSERT( Atomic_CompareAndSwap_u32( &ulFreeHead, ulStaleNewHead, ulStaleHead ) == ATOMIC_COMPARE_AND_SWAP_FAILURE );
+
+    TEST_ASSERT( Agent_ReleaseCommand( pxSecond ) );
+    prvCheckFreeList();
+}
+
+/*-----------------------------------------------------------*/
+
+static void * prvStressWorker( void * pvArg )
+{
+    uint32_t ulId = ( uint32_t ) ( uintptr_t ) pvArg;
+
+    for( uint32_t ulIter = 0; ulIter < TEST_STRESS_ITERATIONS; ulIter++ )
+    {
+        /* Mix polling and blocking requests */
+        MQTTAgentCommand_t * pxCommand = Agent_GetCommand( ( ulIter & 1U ) ? 1000U : 0U );
+
+        if( pxCommand != NULL )
+        {
+            size_t uxIdx = Agent_GetCommandIndex( pxCommand );
+
+            TEST_ASSERT( uxIdx < TEST_STRESS_POOL_SIZE );
+            TEST_ASSERT( __atomic_exchange_n( &( pulOwner[ uxIdx ] ), ulId, __ATOMIC_SEQ_CST ) == 0U );
+
+            for( volatile uint32_t ulSpin = 0; ulSpin < ( ulIter % 7U ); ulSpin++ )
+            {
+            }
+
+            TEST_ASSERT( __atomic_exchange_n( &( pulOwner[ uxIdx ] ), 0U, __ATOMIC_SEQ_CST ) == ulId );
+            TEST_ASSERT( Agent_ReleaseCommand( pxCommand ) );
+        }
+        else
+        {
+            /* Only requests that do not block may come back empty */
+            TEST_ASSERT( ( ulIter & 1U ) == 0U );
+        }
+    }
+
+    return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestStress( void )
+{
+    pthread_t pxThreads[ TEST_STRESS_THREADS ];
+    AgentCommandPoolStats_t xStats;
+
+    prvReset( TEST_STRESS_POOL_SIZE );
+    TEST_ASSERT( Agent_InitializePool() );
+
+    for( uintptr_t uxThread = 0; uxThread < TEST_STRESS_THREADS; uxThread++ )
+    {
+        TEST_ASSERT( pthread_create( &( pxThreads[ uxThread ] ), NULL, prvStressWorker, ( void * ) ( uxThread + 1U ) ) == 0 );
+    }
+
+    for( size_t uxThread = 0; uxThread < TEST_STRESS_THREADS; uxThread++ )
+    {
+        TEST_ASSERT( pthread_join( pxThreads[ uxThread ], NULL ) == 0 );
+    }
+
+    Agent_GetPoolStats( &xStats );
+    TEST_ASSERT( xStats.ulHighWater <= TEST_STRESS_POOL_SIZE );
+    TEST_ASSERT( xStats.ulWaitTimeouts == 0U );
+    TEST_ASSERT( ulWaitingTasks == 0U );
+    prvCheckFreeList();
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvTestInitSize();
+    prvTestExhaustion();
+    prvTestWait();
+    prvTestAba();
+    prvTestStress();
+    prvReset( 0U );
+
+    ( void ) printf( "test_command_pool: OK\n" );
+
+    return 0;
+}
@@ -0,0 +1,589 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_mqtt_journal.c
+ * @brief Host test of the MQTT journal on a RAM backed littlefs volume.
+ *
+ * A reset is simulated by unmounting the volume and clearing the journal
+ * state, so recovery runs against exactly what reached the block device.
+ * Build and run with build.sh in this directory.
+ */
+
+/* The module is included so that the tests can clear its state on reset */
+#include "mqtt_journal.c"
+
+#include <stdio.h>
+
+#define TEST_BLOCK_SIZE       4096U
+#define TEST_BLOCK_COUNT      64U
+#define TEST_MAX_REPLAYS      64U
+#define TEST_PAYLOAD_LEN      500U
+#define TEST_NAME_LEN         6U /* "msg" and three digits, the rest is filler */
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+struct PublishBuffer
+{
+    uint8_t pucPayload[ MQTT_PUBLISH_BUFFER_PAYLOAD_LEN ];
+};
+
+/* Publishes submitted by the journal replay, in order */
+typedef struct
+{
+    uint32_t ulId; /* Journal id of the new record */
+    char pcPayload[ 16 ];
+} TestReplay_t;
+
+static uint8_t pucFlash[ TEST_BLOCK_SIZE * TEST_BLOCK_COUNT ];
+static bool xFailProgram = false;
+static bool xConnected = false;
+static bool xBufferLent = false;
+static struct PublishBuffer xBuffer;
+static TestReplay_t pxReplays[ TEST_MAX_REPLAYS ];
+static size_t uxReplays = 0;
+static lfs_t xLfs;
+
+/*-----------------------------------------------------------*/
+
+static int prvFlashRead( const struct lfs_config * pxCfg,
+                         lfs_block_t xBlock,
+                         lfs_off_t xOff,
+                         void * pvBuffer,
+                         lfs_size_t xSize )
+{
+    ( void ) pxCfg;
+    ( void ) memcpy( pvBuffer, &( pucFlash[ ( xBlock * TEST_BLOCK_SIZE ) + xOff ] ), xSize );
+
+    return LFS_ERR_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvFlashProgram( const struct lfs_config * pxCfg,
+                            lfs_block_t xBlock,
+                            lfs_off_t xOff,
+                            const void * pvBuffer,
+                            lfs_size_t xSize )
+{
+    int lResult = LFS_ERR_IO;
+
+    ( void ) pxCfg;
+
+    if( xFailProgram == false )
+    {
+        ( void ) memcpy( &( pucFlash[ ( xBlock * TEST_BLOCK_SIZE ) + xOff ] ), pvBuffer, xSize );
+        lResult = LFS_ERR_OK;
+    }
+
+    return lResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvFlashErase( const struct lfs_config * pxCfg,
+                          lfs_block_t xBlock )
+{
+    ( void ) pxCfg;
+    ( void ) memset( &( pucFlash[ xBlock * TEST_BLOCK_SIZE ] ), 0xFF, TEST_BLOCK_SIZE );
+
+    return LFS_ERR_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvFlashSync( const struct lfs_config * pxCfg )
+{
+    ( void ) pxCfg;
+
+    return LFS_ERR_OK;
+}
+
+/*-----------------------------------------------------------*/
+
+static const struct lfs_config xLfsConfig =
+{
+    .read           = prvFlashRead,
+    .prog           = prvFlashProgram,
+    .erase          = prvFlashErase,
+    .sync           = prvFlashSync,
+    .read_size      = 16,
+    .prog_size      = 16,
+    .block_size     = TEST_BLOCK_SIZE,
+    .block_count    = TEST_BLOCK_COUNT,
+    .block_cycles   = 500,
+    .cache_size     = 256,
+    .lookahead_size = 16,
+};
+
+/*-----------------------------------------------------------*/
+
+/* Dependencies of the journal, standing in for KVStore and the MQTT agent */
+
+uint32_t KVStore_getUInt32( KVStoreKey_t xKey,
+                            BaseType_t * pxSuccess )
+{
+    ( void ) pxSuccess;
+
+    return ( xKey == CS_MQTT_JOURNAL ) ? 1U : 0U;
+}
+
+bool xIsMqttAgentConnected( void )
+{
+    return xConnected;
+}
+
+PublishBuffer_t * MqttAgent_BorrowPublishBuffer( TickType_t xTimeout )
+{
+    PublishBuffer_t * pxBuffer = NULL;
+
+    ( void ) xTimeout;
+
+    if( xBufferLent == false )
+    {
+        xBufferLent = true;
+        pxBuffer = &xBuffer;
+    }
+
+    return pxBuffer;
+}
+
+uint8_t * MqttAgent_PublishBufferPayload( PublishBuffer_t * pxBuffer,
+                                          size_t * puxCapacity )
+{
+    *puxCapacity = sizeof( pxBuffer->pucPayload );
+
+    return pxBuffer->pucPayload;
+}
+
+/* Journals the publish again, as the agent does for a windowed publish */
+MQTTStatus_t MqttAgent_PublishBuffer( MQTTAgentHandle_t xAgentHandle,
+                                      PublishBuffer_t * pxBuffer,
+                                      const char * pcTopic,
+                                      size_t uxTopicLen,
+                                      size_t uxPayloadLen,
+                                      MQTTQoS_t xQoS,
+                                      PublishBufferCallback_t xCallback,
+                                      void * pvCallbackCtx )
+{
+    MQTTPublishInfo_t xPublishInfo = { 0 };
+
+    ( void ) xAgentHandle;
+    ( void ) xCallback;
+    ( void ) pvCallbackCtx;
+
+    TEST_ASSERT( uxReplays < TEST_MAX_REPLAYS );
+
+    xPublishInfo.qos = xQoS;
+    xPublishInfo.pTopicName = pcTopic;
+    xPublishInfo.topicNameLength = ( uint16_t ) uxTopicLen;
+    xPublishInfo.pPayload = pxBuffer->pucPayload;
+    xPublishInfo.payloadLength = uxPayloadLen;
+
+    pxReplays[ uxReplays ].ulId = ulMqttJournal_Append( &xPublishInfo );
+    ( void ) snprintf( pxReplays[ uxReplays ].pcPayload, sizeof( pxReplays[ uxReplays ].pcPayload ),
+                       "%.*s", ( int ) TEST_NAME_LEN, ( const char * ) pxBuffer->pucPayload );
+    uxReplays++;
+
+    xBufferLent = false;
+
+    return MQTTSuccess;
+}
+
+void MqttAgent_ReturnPublishBuffer( PublishBuffer_t * pxBuffer )
+{
+    ( void ) pxBuffer;
+
+    xBufferLent = false;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Unmount the volume and drop the RAM state of the journal */
+static void prvPowerOff( void )
+{
+    if( xJournal.xMutex != NULL )
+    {
+        TEST_ASSERT( lfs_unmount( &xLfs ) == LFS_ERR_OK );
+
+        vQueueDelete( xJournal.xTombstones );
+        vQueueDelete( xJournal.xMutex );
+    }
+
+    ( void ) memset( &xJournal, 0, sizeof( xJournal ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvFormat( void )
+{
+    prvPowerOff();
+    ( void ) memset( pucFlash, 0xFF, sizeof( pucFlash ) );
+
+    TEST_ASSERT( lfs_format( &xLfs, &xLfsConfig ) == LFS_ERR_OK );
+    TEST_ASSERT( lfs_mount( &xLfs, &xLfsConfig ) == LFS_ERR_OK );
+    TEST_ASSERT( xMqttJournal_Init( &xLfs ) == pdTRUE );
+
+    xConnected = false;
+    uxReplays = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Lose everything that was not committed to flash and recover */
+static void prvReset( void )
+{
+    prvPowerOff();
+
+    TEST_ASSERT( lfs_mount( &xLfs, &xLfsConfig ) == LFS_ERR_OK );
+    TEST_ASSERT( xMqttJournal_Init( &xLfs ) == pdTRUE );
+
+    xConnected = false;
+    uxReplays = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Write the queued tombstones, then let the batch age and commit it */
+static void prvFlush( void )
+{
+    vMqttJournal_Service( NULL );
+
+    xHostTick += MQTT_JOURNAL_FLUSH_MS;
+    vMqttJournal_Service( NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvAppend( const char * pcTopic,
+                           uint32_t ulNumber,
+                           size_t uxPayloadLen )
+{
+    static char pcPayload[ MQTT_JOURNAL_MAX_PAYLOAD_LEN ];
+    MQTTPublishInfo_t xPublishInfo = { 0 };
+    uint32_t ulId = 0;
+
+    ( void ) memset( pcPayload, 'x', sizeof( pcPayload ) );
+    ( void ) snprintf( pcPayload, sizeof( pcPayload ), "msg%03lu", ( unsigned long ) ulNumber );
+
+    xPublishInfo.qos = MQTTQoS1;
+    xPublishInfo.pTopicName = pcTopic;
+    xPublishInfo.topicNameLength = ( uint16_t ) strlen( pcTopic );
+    xPublishInfo.pPayload = pcPayload;
+    xPublishInfo.payloadLength = uxPayloadLen;
+
+    ulId = ulMqttJournal_Append( &xPublishInfo );
+    xHostTick += 10U;
+
+    return ulId;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReplayAll( void )
+{
+    xConnected = true;
+    vMqttJournal_Service( ( MQTTAgentHandle_t ) &xBuffer );
+    xConnected = false;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvCountSegments( void )
+{
+    lfs_dir_t xDir;
+    struct lfs_info xInfo;
+    size_t uxCount = 0;
+
+    TEST_ASSERT( lfs_dir_open( &xLfs, &xDir, MQTT_JOURNAL_DIR ) == LFS_ERR_OK );
+
+    while( lfs_dir_read( &xLfs, &xDir, &xInfo ) > 0 )
+    {
+        if( xInfo.type == LFS_TYPE_REG )
+        {
+            TEST_ASSERT( xInfo.size <= MQTT_JOURNAL_SEGMENT_LEN );
+            uxCount++;
+        }
+    }
+
+    ( void ) lfs_dir_close( &xLfs, &xDir );
+
+    return uxCount;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestFilter( void )
+{
+    MQTTPublishInfo_t xPublishInfo = { 0 };
+
+    prvFormat();
+
+    xPublishInfo.qos = MQTTQoS1;
+    xPublishInfo.pTopicName = "$aws/things/t/shadow/update";
+    xPublishInfo.topicNameLength = ( uint16_t ) strlen( xPublishInfo.pTopicName );
+    TEST_ASSERT( ulMqttJournal_Append( &xPublishInfo ) == 0 );
+
+    xPublishInfo.qos = MQTTQoS0;
+    xPublishInfo.pTopicName = "dev/t";
+    xPublishInfo.topicNameLength = 5;
+    TEST_ASSERT( ulMqttJournal_Append( &xPublishInfo ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Publishes without a tombstone come back in submission order */
+static void prvTestRecoveryOrder( void )
+{
+    uint32_t pulIds[ 16 ];
+    MqttJournalStats_t xStats;
+
+    prvFormat();
+
+    /* No more publishes in flight than the agent window allows */
+    static_assert( 16U <= MQTT_AGENT_WINDOW_LIMIT );
+
+    for( uint32_t ulIdx = 0; ulIdx < 16U; ulIdx++ )
+    {
+        pulIds[ ulIdx ] = prvAppend( "dev/t", ulIdx, 32U );
+        TEST_ASSERT( pulIds[ ulIdx ] != 0 );
+    }
+
+    for( uint32_t ulIdx = 0; ulIdx < 16U; ulIdx += 2U )
+    {
+        vMqttJournal_Remove( pulIds[ ulIdx ] );
+    }
+
+    prvFlush();
+
+    /* Still in the batch when the device resets */
+    ( void ) prvAppend( "dev/t", 99U, 32U );
+
+    prvReset();
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulLive == 8U );
+
+    prvReplayAll();
+
+    TEST_ASSERT( uxReplays == 8U );
+
+    for( size_t uxIdx = 0; uxIdx < uxReplays; uxIdx++ )
+    {
+        char pcExpected[ 16 ];
+
+        ( void ) snprintf( pcExpected, sizeof( pcExpected ), "msg%03lu", ( unsigned long ) ( ( 2U * uxIdx ) + 1U ) );
+        TEST_ASSERT( strcmp( pxReplays[ uxIdx ].pcPayload, pcExpected ) == 0 );
+        TEST_ASSERT( pxReplays[ uxIdx ].ulId != 0 );
+    }
+
+    /* A reset before the replayed publishes complete sends them again */
+    prvFlush();
+    prvReset();
+    prvReplayAll();
+    TEST_ASSERT( uxReplays == 8U );
+    TEST_ASSERT( strcmp( pxReplays[ 0 ].pcPayload, "msg001" ) == 0 );
+
+    for( size_t uxIdx = 0; uxIdx < uxReplays; uxIdx++ )
+    {
+        vMqttJournal_Remove( pxReplays[ uxIdx ].ulId );
+    }
+
+    prvFlush();
+    prvReset();
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulLive == 0U );
+    prvReplayAll();
+    TEST_ASSERT( uxReplays == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Publishes spread over several segments, which are removed once complete */
+static void prvTestSegmentRollover( void )
+{
+    MqttJournalStats_t xStats;
+
+    prvFormat();
+
+    /* All but three publishes are acknowledged right away */
+    for( uint32_t ulIdx = 0; ulIdx < 48U; ulIdx++ )
+    {
+        uint32_t ulId = prvAppend( "dev/t", ulIdx, TEST_PAYLOAD_LEN );
+
+        if( ( ulIdx != 3U ) && ( ulIdx != 24U ) && ( ulIdx != 47U ) )
+        {
+            vMqttJournal_Remove( ulId );
+        }
+    }
+
+    prvFlush();
+
+    /* 48 records of over 500 bytes do not fit in two segments. The first
+     * one is kept for msg003. */
+    TEST_ASSERT( xJournal.pxSegments[ xJournal.uxHead ].ulSeq == 0U );
+    TEST_ASSERT( prvCountSegments() >= 3U );
+
+    prvReset();
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulLive == 3U );
+
+    prvReplayAll();
+
+    TEST_ASSERT( uxReplays == 3U );
+    TEST_ASSERT( strcmp( pxReplays[ 0 ].pcPayload, "msg003" ) == 0 );
+    TEST_ASSERT( strcmp( pxReplays[ 1 ].pcPayload, "msg024" ) == 0 );
+    TEST_ASSERT( strcmp( pxReplays[ 2 ].pcPayload, "msg047" ) == 0 );
+
+    for( size_t uxIdx = 0; uxIdx < uxReplays; uxIdx++ )
+    {
+        vMqttJournal_Remove( pxReplays[ uxIdx ].ulId );
+    }
+
+    prvFlush();
+
+    /* Only the tail is left once every publish has completed */
+    TEST_ASSERT( prvCountSegments() <= 1U );
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulLive == 0U );
+    TEST_ASSERT( xStats.ulLost == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+/* The oldest segment is given up once the chain is full */
+static void prvTestEviction( void )
+{
+    MqttJournalStats_t xStats;
+    uint32_t ulCount = MQTT_JOURNAL_MAX_SEGMENTS * ( MQTT_JOURNAL_SEGMENT_LEN / TEST_PAYLOAD_LEN );
+
+    prvFormat();
+
+    for( uint32_t ulIdx = 0; ulIdx < ulCount; ulIdx++ )
+    {
+        ( void ) prvAppend( "dev/t", ulIdx, TEST_PAYLOAD_LEN );
+    }
+
+    prvFlush();
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulLost > 0U );
+    TEST_ASSERT( ( xStats.ulLive + xStats.ulLost ) == ulCount );
+    TEST_ASSERT( prvCountSegments() <= MQTT_JOURNAL_MAX_SEGMENTS );
+
+    prvReset();
+
+    /* The most recent publishes survive */
+    prvReplayAll();
+    TEST_ASSERT( uxReplays > 0U );
+    TEST_ASSERT( atoi( &( pxReplays[ uxReplays - 1U ].pcPayload[ 3 ] ) ) == ( int ) ( ulCount - 1U ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/* A batch that fails to commit is kept and written by a later service call */
+static void prvTestCommitRetry( void )
+{
+    MqttJournalStats_t xStats;
+
+    prvFormat();
+
+    ( void ) prvAppend( "dev/t", 1U, 32U );
+
+    xFailProgram = true;
+    prvFlush();
+    xFailProgram = false;
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulCommits == 0U );
+
+    prvFlush();
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulCommits == 1U );
+    TEST_ASSERT( xStats.ulUncommitted == 0U );
+
+    prvReset();
+    prvReplayAll();
+    TEST_ASSERT( uxReplays == 1U );
+    TEST_ASSERT( strcmp( pxReplays[ 0 ].pcPayload, "msg001" ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Completions are never dropped while the journal is not serviced */
+static void prvTestTombstoneBound( void )
+{
+    uint32_t pulIds[ MQTT_AGENT_WINDOW_LIMIT ];
+    MqttJournalStats_t xStats;
+
+    prvFormat();
+
+    for( uint32_t ulRound = 0; ulRound < 4U; ulRound++ )
+    {
+        for( uint32_t ulIdx = 0; ulIdx < MQTT_AGENT_WINDOW_LIMIT; ulIdx++ )
+        {
+            pulIds[ ulIdx ] = prvAppend( "dev/t", ulIdx, 32U );
+        }
+
+        for( uint32_t ulIdx = 0; ulIdx < MQTT_AGENT_WINDOW_LIMIT; ulIdx++ )
+        {
+            vMqttJournal_Remove( pulIds[ ulIdx ] );
+        }
+    }
+
+    prvFlush();
+
+    vMqttJournal_GetStats( &xStats );
+    TEST_ASSERT( xStats.ulTombstonesDropped == 0U );
+    TEST_ASSERT( xStats.ulLive == 0U );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvTestFilter();
+    prvTestRecoveryOrder();
+    prvTestSegmentRollover();
+    prvTestEviction();
+    prvTestCommitRetry();
+    prvTestTombstoneBound();
+    prvPowerOff();
+
+    ( void ) printf( "test_mqtt_journal: OK\n" );
+
+    return 0;
+}
@@ -0,0 +1,648 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_mqtt_stream.c
+ * @brief Host test of the framing done by the agent's transport recv, which
+ * streams publishes for stream callbacks and replays every other packet to
+ * coreMQTT.
+ *
+ * A scripted wire mixes streamed and replayed packets. It is released to the
+ * agent in steps, and each read returns at most a given number of bytes.
+ * coreMQTT is emulated by reading packets the way MQTT_ProcessLoop does: the
+ * type byte, the remaining length one byte at a time, then the rest. A
+ * process loop only runs on a socket event or when the agent was notified,
+ * as on the target, so data left behind without a notification stalls the
+ * test. Build and run with build.sh in this directory.
+ */
+
+/* The module is included so that the tests can drive its static recv path */
+#include "mqtt_agent_task.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_WIRE_LEN          ( 256U * 1024U )
+#define TEST_BUFFER_LEN        256U
+#define TEST_MAX_PACKETS       64U
+#define TEST_MAX_STREAMS       TEST_MAX_PACKETS
+#define TEST_ROUNDS            200U
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+/* A publish expected at the stream callback */
+typedef struct
+{
+    const char * pcTopic;
+    uint8_t ucSeed;
+    size_t uxLen;
+} TestStream_t;
+
+/* Bytes of the remote end, released up to uxWireGate */
+static uint8_t pucWire[ TEST_WIRE_LEN ];
+static size_t uxWireLen = 0;
+static size_t uxWirePos = 0;
+static size_t uxWireGate = 0;
+static size_t uxReadMax = 0;
+
+/* Bytes sent by the agent, only PUBACKs of streamed publishes */
+static uint8_t pucSent[ 4U * TEST_MAX_PACKETS ];
+static size_t uxSentLen = 0;
+static uint8_t pucExpectedSent[ 4U * TEST_MAX_PACKETS ];
+static size_t uxExpectedSentLen = 0;
+
+/* Packets that must reach coreMQTT unchanged */
+static uint8_t pucReplayed[ TEST_WIRE_LEN ];
+static size_t uxReplayedLen = 0;
+static uint8_t pucExpectedReplay[ TEST_WIRE_LEN ];
+static size_t uxExpectedReplayLen = 0;
+
+static TestStream_t pxStreams[ TEST_MAX_STREAMS ];
+static size_t uxStreams = 0;
+static size_t uxStreamsDone = 0;
+static size_t uxStreamOffset = 0;
+
+/* Emulated coreMQTT read of the current packet */
+static int lCoreStage = 0;
+static size_t uxCoreLeft = 0;
+static size_t uxCoreMultiplier = 1;
+
+static uint8_t pucNetworkBuffer[ TEST_BUFFER_LEN ];
+static SubCallbackElement_t pxCallbacks[ 2 ];
+static MQTTSubscribeInfo_t pxSubInfo[ 2 ];
+static MQTTAgentTaskCtx_t xCtx;
+
+EventGroupHandle_t xSystemEvents = NULL;
+
+/*-----------------------------------------------------------*/
+
+/* Only the recv path is exercised, the rest of the agent is never called */
+uint32_t KVStore_getUInt32( KVStoreKey_t xKey,
+                            BaseType_t * pxSuccess )
+{
+    TEST_ASSERT( false );
+    return 0;
+}
+
+char * KVStore_getStringHeap( KVStoreKey_t xKey,
+                              size_t * pxLength )
+{
+    TEST_ASSERT( false );
+    return NULL;
+}
+
+const char * kvKeyToString( KVStoreKey_t xKey )
+{
+    return "";
+}
+
+bool MqttAgent_InitPublishBufferPool( void )
+{
+    TEST_ASSERT( false );
+    return false;
+}
+
+uint32_t ulMqttJournal_Append( const MQTTPublishInfo_t * pxPublishInfo )
+{
+    TEST_ASSERT( false );
+    return 0;
+}
+
+void vMqttJournal_Remove( uint32_t ulId )
+{
+    TEST_ASSERT( false );
+}
+
+UBaseType_t uxRand( void )
+{
+    return ( UBaseType_t ) rand();
+}
+
+PkiObject_t xPkiObjectFromLabel( const char * pcLabel )
+{
+    PkiObject_t xObject = { .pcLabel = pcLabel };
+
+    return xObject;
+}
+
+NetworkContext_t * mbedtls_transport_allocate( void )
+{
+    TEST_ASSERT( false );
+    return NULL;
+}
+
+void mbedtls_transport_free( NetworkContext_t * pxNetworkContext )
+{
+    TEST_ASSERT( false );
+}
+
+TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkContext,
+                                                  const char ** ppcAlpnProtos,
+                                                  const PkiObject_t * pxPrivateKey,
+                                                  const PkiObject_t * pxClientCert,
+                                                  const PkiObject_t * pxRootCaCerts,
+                                                  const size_t uxNumRootCA )
+{
+    TEST_ASSERT( false );
+    return TLS_TRANSPORT_UNKNOWN_ERROR;
+}
+
+int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
+                                           GenericCallback_t pxCallback,
+                                           void * pvCtx )
+{
+    TEST_ASSERT( false );
+    return -1;
+}
+
+TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
+                                                const char * pcHostName,
+                                                uint16_t usPort,
+                                                uint32_t ulRecvTimeoutMs,
+                                                uint32_t ulSendTimeoutMs )
+{
+    TEST_ASSERT( false );
+    return TLS_TRANSPORT_CONNECT_FAILURE;
+}
+
+void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext )
+{
+    TEST_ASSERT( false );
+}
+
+int32_t mbedtls_transport_writev( NetworkContext_t * pxNetworkContext,
+                                  const TlsOutVector_t * pxVectors,
+                                  size_t uxVectorCount )
+{
+    TEST_ASSERT( false );
+    return -1;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Unlike the TLS transport, the fake never signals the agent by itself, so
+ * only the notifications sent by the agent keep the reads going.
+ */
+int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
+                                void * pBuffer,
+                                size_t bytesToRecv )
+{
+    size_t uxLen = uxWireGate - uxWirePos;
+
+    TEST_ASSERT( bytesToRecv > 0U );
+
+    uxLen = ( uxLen < bytesToRecv ) ? uxLen : bytesToRecv;
+    uxLen = ( uxLen < uxReadMax ) ? uxLen : uxReadMax;
+
+    ( void ) memcpy( pBuffer, &( pucWire[ uxWirePos ] ), uxLen );
+    uxWirePos += uxLen;
+
+    return ( int32_t ) uxLen;
+}
+
+BaseType_t mbedtls_transport_recvpending( NetworkContext_t * pxNetworkContext )
+{
+    return ( uxWirePos < uxWireGate ) ? pdTRUE : pdFALSE;
+}
+
+int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
+                                const void * pBuffer,
+                                size_t uxBytesToSend )
+{
+    TEST_ASSERT( uxSentLen + uxBytesToSend <= sizeof( pucSent ) );
+
+    ( void ) memcpy( &( pucSent[ uxSentLen ] ), pBuffer, uxBytesToSend );
+    uxSentLen += uxBytesToSend;
+
+    return ( int32_t ) uxBytesToSend;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint8_t prvPayloadByte( uint8_t ucSeed,
+                               size_t uxOffset )
+{
+    return ( uint8_t ) ( ucSeed + ( uxOffset * 7U ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvStreamCallback( void * pvCtx,
+                               const MQTTPublishInfo_t * pxPublishInfo,
+                               size_t uxOffset,
+                               const void * pvChunk,
+                               size_t uxChunkLen )
+{
+    const uint8_t * pucChunk = ( const uint8_t * ) pvChunk;
+    const TestStream_t * pxStream = &( pxStreams[ uxStreamsDone ] );
+
+    TEST_ASSERT( uxStreamsDone < uxStreams );
+    TEST_ASSERT( pxPublishInfo->topicNameLength == strlen( pxStream->pcTopic ) );
+    TEST_ASSERT( memcmp( pxPublishInfo->pTopicName, pxStream->pcTopic, pxPublishInfo->topicNameLength ) == 0 );
+    TEST_ASSERT( pxPublishInfo->payloadLength == pxStream->uxLen );
+    TEST_ASSERT( uxOffset == uxStreamOffset );
+    TEST_ASSERT( uxOffset + uxChunkLen <= pxStream->uxLen );
+    TEST_ASSERT( uxChunkLen <= TEST_BUFFER_LEN );
+
+    for( size_t uxIdx = 0; uxIdx < uxChunkLen; uxIdx++ )
+    {
+        TEST_ASSERT( pucChunk[ uxIdx ] == prvPayloadByte( pxStream->ucSeed, uxOffset + uxIdx ) );
+    }
+
+    uxStreamOffset += uxChunkLen;
+
+    if( uxStreamOffset == pxStream->uxLen )
+    {
+        uxStreamsDone++;
+        uxStreamOffset = 0;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAddPacket( const uint8_t * pucHeader,
+                          size_t uxHeaderLen,
+                          uint8_t ucSeed,
+                          size_t uxPayloadLen,
+                          bool xStreamed )
+{
+    TEST_ASSERT( uxWireLen + uxHeaderLen + uxPayloadLen <= TEST_WIRE_LEN );
+
+    ( void ) memcpy( &( pucWire[ uxWireLen ] ), pucHeader, uxHeaderLen );
+
+    for( size_t uxIdx = 0; uxIdx < uxPayloadLen; uxIdx++ )
+    {
+        pucWire[ uxWireLen + uxHeaderLen + uxIdx ] = prvPayloadByte( ucSeed, uxIdx );
+    }
+
+    if( !xStreamed )
+    {
+        ( void ) memcpy( &( pucExpectedReplay[ uxExpectedReplayLen ] ), &( pucWire[ uxWireLen ] ), uxHeaderLen + uxPayloadLen );
+        uxExpectedReplayLen += uxHeaderLen + uxPayloadLen;
+    }
+
+    uxWireLen += uxHeaderLen + uxPayloadLen;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAddPublish( const char * pcTopic,
+                           MQTTQoS_t xQoS,
+                           uint16_t usPacketId,
+                           size_t uxPayloadLen,
+                           bool xStreamed )
+{
+    uint8_t pucHeader[ RECV_HEADER_MAX + 64U ];
+    size_t uxTopicLen = strlen( pcTopic );
+    size_t uxRemaining = 2U + uxTopicLen + ( ( xQoS > MQTTQoS0 ) ? 2U : 0U ) + uxPayloadLen;
+    size_t uxLen = 0;
+    uint8_t ucSeed = ( uint8_t ) rand();
+
+    TEST_ASSERT( uxTopicLen + 16U <= sizeof( pucHeader ) );
+
+    pucHeader[ uxLen++ ] = ( uint8_t ) ( MQTT_PACKET_TYPE_PUBLISH | ( ( uint8_t ) xQoS << 1 ) );
+
+    do
+    {
+        pucHeader[ uxLen ] = ( uint8_t ) ( uxRemaining & 0x7FU );
+        uxRemaining >>= 7;
+        pucHeader[ uxLen ] |= ( uxRemaining > 0U ) ? 0x80U : 0x00U;
+        uxLen++;
+    } while( uxRemaining > 0U );
+
+    pucHeader[ uxLen++ ] = ( uint8_t ) ( uxTopicLen >> 8 );
+    pucHeader[ uxLen++ ] = ( uint8_t ) uxTopicLen;
+    ( void ) memcpy( &( pucHeader[ uxLen ] ), pcTopic, uxTopicLen );
+    uxLen += uxTopicLen;
+
+    if( xQoS > MQTTQoS0 )
+    {
+        pucHeader[ uxLen++ ] = ( uint8_t ) ( usPacketId >> 8 );
+        pucHeader[ uxLen++ ] = ( uint8_t ) usPacketId;
+    }
+
+    prvAddPacket( pucHeader, uxLen, ucSeed, uxPayloadLen, xStreamed );
+
+    if( xStreamed )
+    {
+        TEST_ASSERT( uxStreams < TEST_MAX_STREAMS );
+        pxStreams[ uxStreams ].pcTopic = pcTopic;
+        pxStreams[ uxStreams ].ucSeed = ucSeed;
+        pxStreams[ uxStreams ].uxLen = uxPayloadLen;
+        uxStreams++;
+
+        if( xQoS == MQTTQoS1 )
+        {
+            pucExpectedSent[ uxExpectedSentLen++ ] = MQTT_PACKET_TYPE_PUBACK;
+            pucExpectedSent[ uxExpectedSentLen++ ] = 2U;
+            pucExpectedSent[ uxExpectedSentLen++ ] = ( uint8_t ) ( usPacketId >> 8 );
+            pucExpectedSent[ uxExpectedSentLen++ ] = ( uint8_t ) usPacketId;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAddPingResp( void )
+{
+    const uint8_t pucPingResp[] = { MQTT_PACKET_TYPE_PINGRESP, 0U };
+
+    prvAddPacket( pucPingResp, sizeof( pucPingResp ), 0U, 0U, false );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Read the next replayed packet like coreMQTT does, false once no data is left */
+static bool prvCoreMqttRead( void )
+{
+    bool xProgress = true;
+    uint8_t ucByte = 0;
+    int32_t lResult = 0;
+
+    while( xProgress && ( lCoreStage < 3 ) )
+    {
+        if( lCoreStage == 0 )
+        {
+            lResult = prvTransportRecv( NULL, &ucByte, 1U );
+            TEST_ASSERT( lResult >= 0 );
+
+            if( lResult == 1 )
+            {
+                pucReplayed[ uxReplayedLen++ ] = ucByte;
+                uxCoreLeft = 0;
+                uxCoreMultiplier = 1;
+                lCoreStage = 1;
+            }
+        }
+        else if( lCoreStage == 1 )
+        {
+            /* The agent buffers the whole fixed header before replaying it */
+            lResult = prvTransportRecv( NULL, &ucByte, 1U );
+            TEST_ASSERT( lResult == 1 );
+
+            pucReplayed[ uxReplayedLen++ ] = ucByte;
+            uxCoreLeft += ( ucByte & 0x7FU ) * uxCoreMultiplier;
+            uxCoreMultiplier *= 128U;
+            lCoreStage = ( ( ucByte & 0x80U ) != 0U ) ? 1 : 2;
+        }
+        else if( uxCoreLeft > 0U )
+        {
+            lResult = prvTransportRecv( NULL, &( pucReplayed[ uxReplayedLen ] ), uxCoreLeft );
+            TEST_ASSERT( lResult >= 0 );
+
+            uxReplayedLen += ( size_t ) lResult;
+            uxCoreLeft -= ( size_t ) lResult;
+        }
+        else
+        {
+            lCoreStage = 3;
+        }
+
+        xProgress = ( lResult > 0 ) || ( lCoreStage == 3 );
+    }
+
+    if( lCoreStage == 3 )
+    {
+        lCoreStage = 0;
+    }
+
+    return xProgress;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvTakeRecvNotification( void )
+{
+    uint32_t ulNotifyValue = 0;
+
+    ( void ) xTaskNotifyWaitIndexed( MQTT_AGENT_NOTIFY_IDX, 0x0, 0xFFFFFFFF, &ulNotifyValue, 0 );
+
+    return ( ulNotifyValue & MQTT_AGENT_NOTIFY_FLAG_SOCKET_RECV ) != 0U;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Release the wire in steps, each step being one socket event */
+static void prvRun( size_t uxStep )
+{
+    do
+    {
+        bool xRun = true;
+
+        uxWireGate = ( ( uxWireGate + uxStep ) < uxWireLen ) ? ( uxWireGate + uxStep ) : uxWireLen;
+
+        while( xRun )
+        {
+            while( prvCoreMqttRead() )
+            {
+            }
+
+            xRun = prvTakeRecvNotification();
+        }
+    } while( uxWireGate < uxWireLen );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSetUp( bool xUseTrie )
+{
+    vTopicTrie_Free( &( xCtx.xSubMgrCtx.xTopicTrie ) );
+
+    if( xCtx.xSubMgrCtx.xMutex != NULL )
+    {
+        vSemaphoreDelete( xCtx.xSubMgrCtx.xMutex );
+    }
+
+    memset( &xCtx, 0, sizeof( xCtx ) );
+    xDefaultInstanceHandle = ( MQTTAgentHandle_t ) &xCtx;
+
+    xCtx.xNetworkFixedBuffer.pBuffer = pucNetworkBuffer;
+    xCtx.xNetworkFixedBuffer.size = sizeof( pucNetworkBuffer );
+    xCtx.xAgentMessageCtx.xAgentTaskHandle = xTaskGetCurrentTaskHandle();
+
+    pxSubInfo[ 0 ].pTopicFilter = "ota/+/data";
+    pxSubInfo[ 0 ].topicFilterLength = ( uint16_t ) strlen( pxSubInfo[ 0 ].pTopicFilter );
+    pxCallbacks[ 0 ].pxSubInfo = &( pxSubInfo[ 0 ] );
+    pxCallbacks[ 0 ].pxIncomingStreamCallback = prvStreamCallback;
+
+    /* Matched by topic but delivered whole by coreMQTT */
+    pxSubInfo[ 1 ].pTopicFilter = "cmd/#";
+    pxSubInfo[ 1 ].topicFilterLength = ( uint16_t ) strlen( pxSubInfo[ 1 ].pTopicFilter );
+    pxCallbacks[ 1 ].pxSubInfo = &( pxSubInfo[ 1 ] );
+
+    xCtx.xSubMgrCtx.pxCallbacks = pxCallbacks;
+    xCtx.xSubMgrCtx.uxMaxCallbacks = 2;
+    xCtx.xSubMgrCtx.uxCallbackCount = 2;
+    xCtx.xSubMgrCtx.uxStreamCallbackCount = 1;
+    xCtx.xSubMgrCtx.xMutex = xSemaphoreCreateMutex();
+    TEST_ASSERT( xCtx.xSubMgrCtx.xMutex != NULL );
+
+    if( xUseTrie )
+    {
+        TEST_ASSERT( xTopicTrie_Init( &( xCtx.xSubMgrCtx.xTopicTrie ), 16U, 2U ) );
+        prvRebuildTopicTrie( &( xCtx.xSubMgrCtx ) );
+        TEST_ASSERT( xCtx.xSubMgrCtx.xTopicTrieValid );
+    }
+
+    uxWireLen = 0;
+    uxWirePos = 0;
+    uxWireGate = 0;
+    uxSentLen = 0;
+    uxExpectedSentLen = 0;
+    uxReplayedLen = 0;
+    uxExpectedReplayLen = 0;
+    uxStreams = 0;
+    uxStreamsDone = 0;
+    uxStreamOffset = 0;
+    lCoreStage = 0;
+
+    ( void ) xTaskNotifyStateClearIndexed( NULL, MQTT_AGENT_NOTIFY_IDX );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvCheckDone( void )
+{
+    TEST_ASSERT( uxWirePos == uxWireLen );
+    TEST_ASSERT( lCoreStage == 0 );
+    TEST_ASSERT( xCtx.xRecvState == RECV_HEADER );
+    TEST_ASSERT( uxStreamsDone == uxStreams );
+    TEST_ASSERT( uxStreamOffset == 0U );
+    TEST_ASSERT( xCtx.xAgentMessageCtx.xMetrics.ulPublishesStreamed == uxStreams );
+    TEST_ASSERT( uxReplayedLen == uxExpectedReplayLen );
+    TEST_ASSERT( memcmp( pucReplayed, pucExpectedReplay, uxReplayedLen ) == 0 );
+    TEST_ASSERT( uxSentLen == uxExpectedSentLen );
+    TEST_ASSERT( memcmp( pucSent, pucExpectedSent, uxSentLen ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Streamed publishes arriving in one socket event with the packets after
+ * them. The agent reports no data at the end of each stream, so the rest is
+ * only read because the agent notifies itself.
+ */
+static void prvTestBackToBack( void )
+{
+    prvSetUp( false );
+
+    prvAddPublish( "ota/a/data", MQTTQoS1, 1U, 3U * TEST_BUFFER_LEN, true );
+    prvAddPublish( "ota/b/data", MQTTQoS0, 0U, 10U, true );
+    prvAddPingResp();
+    prvAddPublish( "ota/c/data", MQTTQoS0, 0U, 0U, true );
+
+    uxReadMax = TEST_WIRE_LEN;
+    prvRun( uxWireLen );
+    prvCheckDone();
+
+    /* Nothing left to read, no spurious wakeup */
+    TEST_ASSERT( !prvTakeRecvNotification() );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestRandomWire( bool xUseTrie )
+{
+    static char pcLongTopic[ MQTT_AGENT_STREAM_TOPIC_MAX + 16U ];
+
+    /* Matches the stream filter but is too long to be buffered */
+    memset( pcLongTopic, 'x', sizeof( pcLongTopic ) - 1U );
+    memcpy( pcLongTopic, "ota/", 4U );
+    memcpy( &( pcLongTopic[ sizeof( pcLongTopic ) - 6U ] ), "/data", 6U );
+
+    srand( 1 );
+
+    for( size_t uxRound = 0; uxRound < TEST_ROUNDS; uxRound++ )
+    {
+        size_t uxPackets = 1U + ( size_t ) rand() % TEST_MAX_PACKETS;
+
+        prvSetUp( xUseTrie );
+
+        for( size_t uxPacket = 0; uxPacket < uxPackets; uxPacket++ )
+        {
+            uint16_t usPacketId = ( uint16_t ) ( 1U + uxPacket );
+
+            switch( rand() % 7 )
+            {
+                case 0:
+                    prvAddPublish( "ota/a/data", MQTTQoS0, 0U, ( size_t ) rand() % 3000U, true );
+                    break;
+
+                case 1:
+                    prvAddPublish( "ota/b/data", MQTTQoS1, usPacketId, ( size_t ) rand() % 3000U, true );
+                    break;
+
+                case 2:
+                    /* QoS2 goes through coreMQTT even on a stream topic */
+                    prvAddPublish( "ota/a/data", MQTTQoS2, usPacketId, ( size_t ) rand() % 200U, false );
+                    break;
+
+                case 3:
+                    prvAddPublish( "cmd/reboot", MQTTQoS1, usPacketId, ( size_t ) rand() % 200U, false );
+                    break;
+
+                case 4:
+                    prvAddPublish( "ota/a/other", MQTTQoS0, 0U, ( size_t ) rand() % 200U, false );
+                    break;
+
+                case 5:
+                    prvAddPublish( pcLongTopic, MQTTQoS0, 0U, ( size_t ) rand() % 200U, false );
+                    break;
+
+                default:
+                    prvAddPingResp();
+                    break;
+            }
+        }
+
+        uxReadMax = 1U + ( size_t ) rand() % ( 2U * TEST_BUFFER_LEN );
+        prvRun( 1U + ( size_t ) rand() % 4096U );
+        prvCheckDone();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvTestBackToBack();
+    prvTestRandomWire( false );
+    prvTestRandomWire( true );
+
+    vTopicTrie_Free( &( xCtx.xSubMgrCtx.xTopicTrie ) );
+    vSemaphoreDelete( xCtx.xSubMgrCtx.xMutex );
+
+    ( void ) printf( "test_mqtt_stream: OK\n" );
+
+    return 0;
+}
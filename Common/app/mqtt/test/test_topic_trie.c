@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_topic_trie.c
+ * @brief Host test checking that the topic trie and the single filter matcher
+ * used by the linear fallback agree with each other and with the MQTT rules.
+ *
+ * Build and run with build.sh in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FreeRTOS.h"
+#include "topic_trie.h"
+
+#define TEST_MAX_FILTERS    40U
+#define TEST_MAX_NODES      400U
+#define TEST_NAME_LEN       64U
+#define TEST_ROUNDS         2000U
+#define TEST_TOPICS         50U
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+typedef struct
+{
+    const char * pcFilter;
+    const char * pcTopic;
+    bool xMatch;
+} TestCase_t;
+
+static const TestCase_t pxCases[] =
+{
+    { "a/b",     "a/b",          true  },
+    { "a/b",     "a/c",          false },
+    { "a/b",     "a/b/c",        false },
+    { "a/+",     "a/b",          true  },
+    { "a/+",     "a/",           true  },
+    { "a/+",     "a",            false },
+    { "a/+/c",   "a//c",         true  },
+    { "+/+",     "/a",           true  },
+    { "a/#",     "a",            true  },
+    { "a/#",     "a/b/c",        true  },
+    { "a/#",     "ab",           false },
+    { "#",       "a/b",          true  },
+    { "#",       "$SYS/a",       false },
+    { "+/a",     "$SYS/a",       false },
+    { "$SYS/#",  "$SYS/a",       true  },
+    { "$SYS/+",  "$SYS/a",       true  },
+    { "a/#/b",   "a/x/b",        false },
+    { "a+",      "a+",           false },
+    { "a/b#",    "a/b#",         false },
+    { "",        "a",            false },
+};
+
+/* Topic levels used to build random names, wildcards only in filters */
+static const char * const ppcLevels[] = { "a", "b", "$x", "", "c", "+", "#", "a+" };
+
+static uint32_t pulHits[ TEST_MAX_FILTERS ];
+
+/*-----------------------------------------------------------*/
+
+static void prvCountHit( void * pvCtx,
+                         uint16_t usValue )
+{
+    ( void ) pvCtx;
+
+    TEST_ASSERT( usValue < TEST_MAX_FILTERS );
+    pulHits[ usValue ]++;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Reference matcher written straight from the MQTT 3.1.1 rules, only used
+ * with well formed filters.
+ */
+static bool prvReferenceMatch( const char * pcFilter,
+                               const char * pcTopic )
+{
+    bool xMatch = false;
+    bool xDone = ( pcTopic[ 0 ] == '$' ) && ( ( pcFilter[ 0 ] == '+' ) || ( pcFilter[ 0 ] == '#' ) );
+
+    while( !xDone )
+    {
+        const char * pcTopicSep = strchr( pcTopic, '/' );
+        const char * pcFilterSep = strchr( pcFilter, '/' );
+        size_t uxTopicLen = ( pcTopicSep != NULL ) ? ( size_t ) ( pcTopicSep - pcTopic ) : strlen( pcTopic );
+        size_t uxFilterLen = ( pcFilterSep != NULL ) ? ( size_t ) ( pcFilterSep - pcFilter ) : strlen( pcFilter );
+
+        xDone = true;
+
+        if( pcFilter[ 0 ] == '#' )
+        {
+            xMatch = true;
+        }
+        else if( !( ( uxFilterLen == 1U ) && ( pcFilter[ 0 ] == '+' ) ) &&
+                 ( ( uxFilterLen != uxTopicLen ) || ( memcmp( pcTopic, pcFilter, uxTopicLen ) != 0 ) ) )
+        {
+            xMatch = false;
+        }
+        else if( ( pcTopicSep == NULL ) && ( pcFilterSep == NULL ) )
+        {
+            xMatch = true;
+        }
+        else if( pcTopicSep == NULL )
+        {
+            /* "a/#" also matches "a" */
+            xMatch = ( strcmp( pcFilterSep + 1, "#" ) == 0 );
+        }
+        else if( pcFilterSep != NULL )
+        {
+            pcTopic = pcTopicSep + 1;
+            pcFilter = pcFilterSep + 1;
+            xDone = false;
+        }
+        else
+        {
+            /* Empty */
+        }
+    }
+
+    return xMatch;
+}
+
+/*-----------------------------------------------------------*/
+
+static bool prvIsWellFormed( const char * pcFilter )
+{
+    const char * pcHash = strchr( pcFilter, '#' );
+
+    return ( pcFilter[ 0 ] != '\0' ) &&
+           ( strstr( pcFilter, "a+" ) == NULL ) &&
+           ( ( pcHash == NULL ) || ( pcHash[ 1 ] == '\0' ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvRandomName( char * pcName,
+                           bool xWildcards )
+{
+    size_t uxLevels = 1U + ( size_t ) ( rand() % 4 );
+    size_t uxChoices = xWildcards ? 8U : 5U;
+
+    pcName[ 0 ] = '\0';
+
+    for( size_t uxLevel = 0; uxLevel < uxLevels; uxLevel++ )
+    {
+        ( void ) strcat( pcName, ppcLevels[ ( size_t ) rand() % uxChoices ] );
+
+        if( uxLevel + 1U < uxLevels )
+        {
+            ( void ) strcat( pcName, "/" );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestFixedCases( void )
+{
+    TopicTrie_t xTrie;
+
+    TEST_ASSERT( xTopicTrie_Init( &xTrie, TEST_MAX_NODES, TEST_MAX_FILTERS ) );
+
+    for( size_t uxCase = 0; uxCase < sizeof( pxCases ) / sizeof( pxCases[ 0 ] ); uxCase++ )
+    {
+        const TestCase_t * pxCase = &( pxCases[ uxCase ] );
+        uint16_t usFilterLen = ( uint16_t ) strlen( pxCase->pcFilter );
+        uint16_t usTopicLen = ( uint16_t ) strlen( pxCase->pcTopic );
+        size_t uxMatches = 0U;
+
+        vTopicTrie_Clear( &xTrie );
+
+        if( xTopicTrie_Insert( &xTrie, pxCase->pcFilter, usFilterLen, 0U ) )
+        {
+            uxMatches = uxTopicTrie_Match( &xTrie, pxCase->pcTopic, usTopicLen, prvCountHit, NULL );
+        }
+
+        if( ( xTopicTrie_MatchFilter( pxCase->pcFilter, usFilterLen, pxCase->pcTopic, usTopicLen ) != pxCase->xMatch ) ||
+            ( ( uxMatches == 1U ) != pxCase->xMatch ) )
+        {
+            ( void ) printf( "filter \"%s\" topic \"%s\" expected %d\n",
+                             pxCase->pcFilter, pxCase->pcTopic, pxCase->xMatch );
+            TEST_ASSERT( false );
+        }
+    }
+
+    vTopicTrie_Free( &xTrie );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Random filter sets, including malformed filters that the trie rejects, are
+ * matched against random topics with the trie, with the single filter matcher
+ * and, for well formed filters, with the reference matcher.
+ */
+static void prvTestEquivalence( void )
+{
+    static char ppcFilters[ TEST_MAX_FILTERS ][ TEST_NAME_LEN ];
+
+    srand( 1 );
+
+    for( size_t uxRound = 0; uxRound < TEST_ROUNDS; uxRound++ )
+    {
+        TopicTrie_t xTrie;
+        size_t uxFilters = 1U + ( size_t ) rand() % TEST_MAX_FILTERS;
+
+        TEST_ASSERT( xTopicTrie_Init( &xTrie, TEST_MAX_NODES, TEST_MAX_FILTERS ) );
+
+        for( size_t uxFilter = 0; uxFilter < uxFilters; uxFilter++ )
+        {
+            char * pcFilter = ppcFilters[ uxFilter ];
+
+            prvRandomName( pcFilter, true );
+
+            TEST_ASSERT( xTopicTrie_Insert( &xTrie, pcFilter, ( uint16_t ) strlen( pcFilter ),
+                                            ( uint16_t ) uxFilter ) == prvIsWellFormed( pcFilter ) );
+        }
+
+        for( size_t uxTopic = 0; uxTopic < TEST_TOPICS; uxTopic++ )
+        {
+            char pcTopic[ TEST_NAME_LEN ];
+            uint16_t usTopicLen;
+
+            do
+            {
+                prvRandomName( pcTopic, false );
+                usTopicLen = ( uint16_t ) strlen( pcTopic );
+            } while( usTopicLen == 0U );
+
+            memset( pulHits, 0, sizeof( pulHits ) );
+            ( void ) uxTopicTrie_Match( &xTrie, pcTopic, usTopicLen, prvCountHit, NULL );
+
+            for( size_t uxFilter = 0; uxFilter < uxFilters; uxFilter++ )
+            {
+                const char * pcFilter = ppcFilters[ uxFilter ];
+                bool xMatch = xTopicTrie_MatchFilter( pcFilter, ( uint16_t ) strlen( pcFilter ), pcTopic, usTopicLen );
+                bool xExpected = prvIsWellFormed( pcFilter ) && prvReferenceMatch( pcFilter, pcTopic );
+
+                if( ( xMatch != xExpected ) || ( pulHits[ uxFilter ] != ( xExpected ? 1U : 0U ) ) )
+                {
+                    ( void ) printf( "filter \"%s\" topic \"%s\": reference %d, matcher %d, trie %u\n",
+                                     pcFilter, pcTopic, xExpected, xMatch, ( unsigned ) pulHits[ uxFilter ] );
+                    TEST_ASSERT( false );
+                }
+            }
+        }
+
+        vTopicTrie_Free( &xTrie );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvTestFixedCases();
+    prvTestEquivalence();
+
+    ( void ) printf( "test_topic_trie: OK\n" );
+
+    return 0;
+}
@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file topic_trie.c
+ * @brief Precompiled topic filter trie used to dispatch incoming publishes.
+ */
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+
+#include "topic_trie.h"
+
+/* Node 0 is the root and does not hold a topic level */
+#define TOPIC_TRIE_ROOT    0U
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvNewNode( TopicTrie_t * pxTrie,
+                            const char * pcLevel,
+                            uint16_t usLevelLen )
+{
+    uint16_t usNode = TOPIC_TRIE_NONE;
+
+    if( pxTrie->usNodeCount < pxTrie->usMaxNodes )
+    {
+        TopicTrieNode_t * pxNode = NULL;
+
+        usNode = pxTrie->usNodeCount++;
+        pxNode = &( pxTrie->pxNodes[ usNode ] );
+
+        pxNode->pcLevel = pcLevel;
+        pxNode->usLevelLen = usLevelLen;
+        pxNode->usChild = TOPIC_TRIE_NONE;
+        pxNode->usSibling = TOPIC_TRIE_NONE;
+        pxNode->usPlusChild = TOPIC_TRIE_NONE;
+        pxNode->usHashChild = TOPIC_TRIE_NONE;
+        pxNode->usValue = TOPIC_TRIE_NONE;
+    }
+
+    return usNode;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvGetLiteralChild( TopicTrie_t * pxTrie,
+                                    uint16_t usParent,
+                                    const char * pcLevel,
+                                    uint16_t usLevelLen )
+{
+    uint16_t usNode = pxTrie->pxNodes[ usParent ].usChild;
+
+    while( ( usNode != TOPIC_TRIE_NONE ) &&
+           ( ( pxTrie->pxNodes[ usNode ].usLevelLen != usLevelLen ) ||
+             ( memcmp( pxTrie->pxNodes[ usNode ].pcLevel, pcLevel, usLevelLen ) != 0 ) ) )
+    {
+        usNode = pxTrie->pxNodes[ usNode ].usSibling;
+    }
+
+    if( usNode == TOPIC_TRIE_NONE )
+    {
+        usNode = prvNewNode( pxTrie, pcLevel, usLevelLen );
+
+        if( usNode != TOPIC_TRIE_NONE )
+        {
+            pxTrie->pxNodes[ usNode ].usSibling = pxTrie->pxNodes[ usParent ].usChild;
+            pxTrie->pxNodes[ usParent ].usChild = usNode;
+        }
+    }
+
+    return usNode;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvGetWildcardChild( TopicTrie_t * pxTrie,
+                                     uint16_t * pusChild,
+                                     const char * pcLevel )
+{
+    if( *pusChild == TOPIC_TRIE_NONE )
+    {
+        *pusChild = prvNewNode( pxTrie, pcLevel, 1U );
+    }
+
+    return *pusChild;
+}
+
+/*-----------------------------------------------------------*/
+
+bool xTopicTrie_Init( TopicTrie_t * pxTrie,
+                      uint16_t usMaxNodes,
+                      uint16_t usMaxValues )
+{
+    bool xSuccess = false;
+
+    configASSERT( pxTrie );
+
+    memset( pxTrie, 0, sizeof( TopicTrie_t ) );
+
+    if( ( usMaxNodes > 1U ) && ( usMaxNodes < TOPIC_TRIE_NONE ) &&
+        ( usMaxValues > 0U ) && ( usMaxValues < TOPIC_TRIE_NONE ) )
+    {
+        pxTrie->pxNodes = pvPortMalloc( sizeof( TopicTrieNode_t ) * usMaxNodes );
+        pxTrie->pusValueNext = pvPortMalloc( sizeof( uint16_t ) * usMaxValues );
+    }
+
+    if( ( pxTrie->pxNodes != NULL ) &&
+        ( pxTrie->pusValueNext != NULL ) )
+    {
+        pxTrie->usMaxNodes = usMaxNodes;
+        pxTrie->usMaxValues = usMaxValues;
+        vTopicTrie_Clear( pxTrie );
+        xSuccess = true;
+    }
+    else
+    {
+        vTopicTrie_Free( pxTrie );
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTopicTrie_Free( TopicTrie_t * pxTrie )
+{
+    configASSERT( pxTrie );
+
+    vPortFree( pxTrie->pxNodes );
+    vPortFree( pxTrie->pusValueNext );
+
+    memset( pxTrie, 0, sizeof( TopicTrie_t ) );
+}
+
+/*-----------------------------------------------------------*/
+
+void vTopicTrie_Clear( TopicTrie_t * pxTrie )
+{
+    configASSERT( pxTrie );
+
+    pxTrie->usNodeCount = 0U;
+
+    if( pxTrie->pxNodes != NULL )
+    {
+        ( void ) prvNewNode( pxTrie, NULL, 0U );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+bool xTopicTrie_Insert( TopicTrie_t * pxTrie,
+                        const char * pcFilter,
+                        uint16_t usFilterLen,
+                        uint16_t usValue )
+{
+    bool xSuccess = false;
+    uint16_t usNode = TOPIC_TRIE_ROOT;
+    size_t uxPos = 0U;
+
+    configASSERT( pxTrie );
+
+    if( ( pxTrie->usNodeCount > 0U ) &&
+        ( pcFilter != NULL ) &&
+        ( usFilterLen > 0U ) &&
+        ( usValue < pxTrie->usMaxValues ) )
+    {
+        xSuccess = true;
+    }
+
+    /* Walk the filter one level at a time, creating nodes as needed */
+    while( xSuccess && ( uxPos <= usFilterLen ) )
+    {
+        const char * pcLevel = &( pcFilter[ uxPos ] );
+        const char * pcSep = memchr( pcLevel, '/', usFilterLen - uxPos );
+        uint16_t usLevelLen = ( uint16_t ) ( ( pcSep != NULL ) ? ( size_t ) ( pcSep - pcLevel ) : ( usFilterLen - uxPos ) );
+        TopicTrieNode_t * pxNode = &( pxTrie->pxNodes[ usNode ] );
+
+        if( ( usLevelLen == 1U ) && ( pcLevel[ 0 ] == '#' ) )
+        {
+            /* '#' must be the last level of the filter */
+            if( pcSep == NULL )
+            {
+                usNode = prvGetWildcardChild( pxTrie, &( pxNode->usHashChild ), pcLevel );
+            }
+            else
+            {
+                usNode = TOPIC_TRIE_NONE;
+            }
+        }
+        else if( ( usLevelLen == 1U ) && ( pcLevel[ 0 ] == '+' ) )
+        {
+            usNode = prvGetWildcardChild( pxTrie, &( pxNode->usPlusChild ), pcLevel );
+        }
+        else if( ( memchr( pcLevel, '+', usLevelLen ) != NULL ) ||
+                 ( memchr( pcLevel, '#', usLevelLen ) != NULL ) )
+        {
+            /* Wildcards must occupy an entire level */
+            usNode = TOPIC_TRIE_NONE;
+        }
+        else
+        {
+            usNode = prvGetLiteralChild( pxTrie, usNode, pcLevel, usLevelLen );
+        }
+
+        xSuccess = ( usNode != TOPIC_TRIE_NONE );
+        uxPos += usLevelLen + 1U;
+    }
+
+    if( xSuccess )
+    {
+        pxTrie->pusValueNext[ usValue ] = pxTrie->pxNodes[ usNode ].usValue;
+        pxTrie->pxNodes[ usNode ].usValue = usValue;
+    }
+
+    return xSuccess;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvDispatchValues( const TopicTrie_t * pxTrie,
+                                 uint16_t usNode,
+                                 TopicTrieMatchCallback_t xCallback,
+                                 void * pvCtx )
+{
+    size_t uxMatches = 0U;
+
+    for( uint16_t usValue = pxTrie->pxNodes[ usNode ].usValue;
+         usValue != TOPIC_TRIE_NONE;
+         usValue = pxTrie->pusValueNext[ usValue ] )
+    {
+        xCallback( pvCtx, usValue );
+        uxMatches++;
+    }
+
+    return uxMatches;
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Match the remainder of the topic, starting at uxPos, against the subtree
+ * at usNode. uxPos is past the end of the topic once every level has been
+ * consumed. Recursion only follows existing nodes, so the depth is bounded by
+ * the deepest filter in the trie.
+ */
+static size_t prvMatchNode( const TopicTrie_t * pxTrie,
+                            uint16_t usNode,
+                            const char * pcTopic,
+                            size_t uxTopicLen,
+                            size_t uxPos,
+                            TopicTrieMatchCallback_t xCallback,
+                            void * pvCtx )
+{
+    const TopicTrieNode_t * pxNode = &( pxTrie->pxNodes[ usNode ] );
+    size_t uxMatches = 0U;
+
+    /* Topics starting with '$' do not match filters starting with a wildcard */
+    bool xWildcardsAllowed = ( usNode != TOPIC_TRIE_ROOT ) || ( pcTopic[ 0 ] != '$' );
+
+    /* '#' matches the remaining levels, including none at all */
+    if( xWildcardsAllowed && ( pxNode->usHashChild != TOPIC_TRIE_NONE ) )
+    {
+        uxMatches += prvDispatchValues( pxTrie, pxNode->usHashChild, xCallback, pvCtx );
+    }
+
+    if( uxPos > uxTopicLen )
+    {
+        uxMatches += prvDispatchValues( pxTrie, usNode, xCallback, pvCtx );
+    }
+    else
+    {
+        const char * pcLevel = &( pcTopic[ uxPos ] );
+        const char * pcSep = memchr( pcLevel, '/', uxTopicLen - uxPos );
+        size_t uxLevelLen = ( pcSep != NULL ) ? ( size_t ) ( pcSep - pcLevel ) : ( uxTopicLen - uxPos );
+        uint16_t usChild = pxNode->usChild;
+
+        if( xWildcardsAllowed && ( pxNode->usPlusChild != TOPIC_TRIE_NONE ) )
+        {
+            uxMatches += prvMatchNode( pxTrie, pxNode->usPlusChild, pcTopic, uxTopicLen,
+                                       uxPos + uxLevelLen + 1U, xCallback, pvCtx );
+        }
+
+        while( usChild != TOPIC_TRIE_NONE )
+        {
+            const TopicTrieNode_t * pxChild = &( pxTrie->pxNodes[ usChild ] );
+
+            if( ( pxChild->usLevelLen == uxLevelLen ) &&
+                ( memcmp( pxChild->pcLevel, pcLevel, uxLevelLen ) == 0 ) )
+            {
+                uxMatches += prvMatchNode( pxTrie, usChild, pcTopic, uxTopicLen,
+                                           uxPos + uxLevelLen + 1U, xCallback, pvCtx );
+                break;
+            }
+
+            usChild = pxChild->usSibling;
+        }
+    }
+
+    return uxMatches;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxTopicTrie_Match( const TopicTrie_t * pxTrie,
+                          const char * pcTopic,
+                          uint16_t usTopicLen,
+                          TopicTrieMatchCallback_t xCallback,
+                          void * pvCtx )
+{
+    size_t uxMatches = 0U;
+
+    configASSERT( pxTrie );
+    configASSERT( xCallback );
+
+    if( ( pxTrie->usNodeCount > 0U ) &&
+        ( pcTopic != NULL ) &&
+        ( usTopicLen > 0U ) )
+    {
+        uxMatches = prvMatchNode( pxTrie, TOPIC_TRIE_ROOT, pcTopic, usTopicLen, 0U, xCallback, pvCtx );
+    }
+
+    return uxMatches;
+}
+
+/*-----------------------------------------------------------*/
+
+bool xTopicTrie_MatchFilter( const char * pcFilter,
+                             uint16_t usFilterLen,
+                             const char * pcTopic,
+                             uint16_t usTopicLen )
+{
+    bool xMatch = false;
+    bool xDone = true;
+    size_t uxFilterPos = 0U;
+    size_t uxTopicPos = 0U;
+
+    if( ( pcFilter != NULL ) &&
+        ( usFilterLen > 0U ) &&
+        ( pcTopic != NULL ) &&
+        ( usTopicLen > 0U ) )
+    {
+        /* Topics starting with '$' do not match filters starting with a wildcard */
+        xDone = ( pcTopic[ 0 ] == '$' ) && ( ( pcFilter[ 0 ] == '+' ) || ( pcFilter[ 0 ] == '#' ) );
+    }
+
+    /* Walk both names one level at a time, as prvMatchNode does for the trie */
+    while( !xDone )
+    {
+        const char * pcLevel = &( pcFilter[ uxFilterPos ] );
+        const char * pcSep = memchr( pcLevel, '/', usFilterLen - uxFilterPos );
+        size_t uxLevelLen = ( pcSep != NULL ) ? ( size_t ) ( pcSep - pcLevel ) : ( usFilterLen - uxFilterPos );
+
+        if( ( uxLevelLen == 1U ) && ( pcLevel[ 0 ] == '#' ) )
+        {
+            /* '#' matches the remaining levels, including none at all */
+            xMatch = ( pcSep == NULL );
+            xDone = true;
+        }
+        else if( uxTopicPos > usTopicLen )
+        {
+            xDone = true;
+        }
+        else
+        {
+            const char * pcTopicLevel = &( pcTopic[ uxTopicPos ] );
+            const char * pcTopicSep = memchr( pcTopicLevel, '/', usTopicLen - uxTopicPos );
+            size_t uxTopicLevelLen = ( pcTopicSep != NULL ) ? ( size_t ) ( pcTopicSep - pcTopicLevel ) : ( usTopicLen - uxTopicPos );
+
+            if( ( uxLevelLen == 1U ) && ( pcLevel[ 0 ] == '+' ) )
+            {
+                xDone = false;
+            }
+            else if( ( memchr( pcLevel, '+', uxLevelLen ) != NULL ) ||
+                     ( memchr( pcLevel, '#', uxLevelLen ) != NULL ) )
+            {
+                /* Wildcards must occupy an entire level */
+                xDone = true;
+            }
+            else
+            {
+                xDone = ( uxLevelLen != uxTopicLevelLen ) ||
+                        ( memcmp( pcLevel, pcTopicLevel, uxLevelLen ) != 0 );
+            }
+
+            uxFilterPos += uxLevelLen + 1U;
+            uxTopicPos += uxTopicLevelLen + 1U;
+
+            if( !xDone && ( uxFilterPos > usFilterLen ) )
+            {
+                xMatch = ( uxTopicPos > usTopicLen );
+                xDone = true;
+            }
+        }
+    }
+
+    return xMatch;
+}
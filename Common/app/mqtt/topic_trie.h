@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file topic_trie.h
+ * @brief Precompiled topic filter trie used to dispatch incoming publishes.
+ *
+ * Each node of the trie holds one topic level of a filter. Literal levels are
+ * kept in a sibling list while the '+' and '#' wildcards have dedicated child
+ * slots, so matching a topic name visits at most the nodes along the paths
+ * that can still match and its cost grows with the topic depth rather than
+ * with the number of registered filters.
+ *
+ * Values are small integers (e.g. callback indices) attached to the node that
+ * terminates a filter. The trie does not copy the filter strings, they must
+ * stay valid until the trie is cleared.
+ */
+#ifndef TOPIC_TRIE_H
+#define TOPIC_TRIE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOPIC_TRIE_NONE    UINT16_MAX
+
+typedef struct TopicTrieNode
+{
+    const char * pcLevel;
+    uint16_t usLevelLen;
+    uint16_t usChild;     /* First literal child */
+    uint16_t usSibling;   /* Next literal node on the same level */
+    uint16_t usPlusChild; /* '+' child */
+    uint16_t usHashChild; /* '#' child */
+    uint16_t usValue;     /* First value of a filter ending at this node */
+} TopicTrieNode_t;
+
+typedef struct TopicTrie
+{
+    TopicTrieNode_t * pxNodes;
+    uint16_t * pusValueNext;
+    uint16_t usMaxNodes;
+    uint16_t usMaxValues;
+    uint16_t usNodeCount;
+} TopicTrie_t;
+
+/**
+ * @brief Called once for each value attached to a filter matching the topic.
+ */
+typedef void ( * TopicTrieMatchCallback_t )( void * pvCtx,
+                                             uint16_t usValue );
+
+/**
+ * @brief Allocate a trie with room for usMaxNodes topic levels and values in
+ * the range [0, usMaxValues).
+ */
+bool xTopicTrie_Init( TopicTrie_t * pxTrie,
+                      uint16_t usMaxNodes,
+                      uint16_t usMaxValues );
+
+void vTopicTrie_Free( TopicTrie_t * pxTrie );
+
+/**
+ * @brief Remove all filters while keeping the allocated storage.
+ */
+void vTopicTrie_Clear( TopicTrie_t * pxTrie );
+
+/**
+ * @brief Attach usValue to pcFilter. Each value may only be inserted once
+ * between calls to vTopicTrie_Clear.
+ *
+ * @return false if the filter is malformed or the trie is out of nodes.
+ */
+bool xTopicTrie_Insert( TopicTrie_t * pxTrie,
+                        const char * pcFilter,
+                        uint16_t usFilterLen,
+                        uint16_t usValue );
+
+/**
+ * @brief Call xCallback for each value attached to a filter matching the
+ * topic name, following the MQTT rules including the exclusion of topics
+ * starting with '$' from filters beginning with a wildcard.
+ *
+ * @return The number of values matched.
+ */
+size_t uxTopicTrie_Match( const TopicTrie_t * pxTrie,
+                          const char * pcTopic,
+                          uint16_t usTopicLen,
+                          TopicTrieMatchCallback_t xCallback,
+                          void * pvCtx );
+
+/**
+ * @brief Match a topic name against a single filter using the same rules as
+ * uxTopicTrie_Match. Malformed filters match nothing.
+ */
+bool xTopicTrie_MatchFilter( const char * pcFilter,
+                             uint16_t usFilterLen,
+                             const char * pcTopic,
+                             uint16_t usTopicLen );
+
+#endif /* TOPIC_TRIE_H */
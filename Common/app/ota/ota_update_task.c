@@ -396,16 +396,23 @@ void vOTAUpdateTask( void * pvParam );
  * @brief Callback invoked for firmware image chunks received from MQTT broker.
  *
  * Function gets invoked for the firmware image blocks received on OTA data stream topic.
- * The function is registered with MQTT agent's subscription manger along with the
- * topic filter for data stream. For each packet received, the
- * function fetches a free event buffer from the pool and queues the firmware image chunk for
- * OTA agent task processing.
+ * The function is registered with MQTT agent's subscription manger as a stream callback
+ * along with the topic filter for data stream, so a block does not have to fit in the
+ * MQTT network buffer. On the first chunk of a block the function fetches a free event
+ * buffer from the pool, copies each chunk into it and queues the block for OTA agent
+ * task processing once the last chunk arrived.
  *
  * @param[in] pxSubscriptionContext Context which is passed unmodified from the MQTT agent.
  * @param[in] pPublishInfo Pointer to the structure containing the details of the MQTT packet.
+ * @param[in] uxOffset Offset of the chunk in the block.
+ * @param[in] pvChunk Chunk of the block.
+ * @param[in] uxChunkLen Length of the chunk.
  */
 static void prvProcessIncomingData( void * pxSubscriptionContext,
-                                    MQTTPublishInfo_t * pPublishInfo );
+                                    const MQTTPublishInfo_t * pPublishInfo,
+                                    size_t uxOffset,
+                                    const void * pvChunk,
+                                    size_t uxChunkLen );
 
 /**
  * @brief Callback invoked for job control messages from MQTT broker.
@@ -532,6 +539,8 @@ static OtaEventData_t * prvOTAEventBufferGet( OtaEventBufferPool_t * pxBufferPoo
 /*-----------------------------------------------------------*/
 static void prvOTAAgentTask( void * pvParam )
 {
+    ( void ) xMqttAgent_SetCommandLane( MQTT_AGENT_LANE_BULK );
+
     OTA_EventProcessingTask( pvParam );
     vTaskDelete( NULL );
 }
@@ -676,57 +685,79 @@ static void otaAppCallback( OtaJobEvent_t event,
 /*-----------------------------------------------------------*/
 
 static void prvProcessIncomingData( void * pxContext,
-                                    MQTTPublishInfo_t * pPublishInfo )
+                                    const MQTTPublishInfo_t * pPublishInfo,
+                                    size_t uxOffset,
+                                    const void * pvChunk,
+                                    size_t uxChunkLen )
 {
+    /* Block being assembled. Chunks arrive in order from the MQTT agent task. */
+    static OtaEventData_t * pxBlock = NULL;
     BaseType_t isMatch = pdFALSE;
-    OtaEventData_t * pData;
     OtaEventMsg_t eventMsg = { 0 };
 
     ( void ) pxContext;
 
     configASSERT( pPublishInfo != NULL );
 
-
-    isMatch = prvMatchClientIdentifierInTopic( pPublishInfo->pTopicName,
-                                               pPublishInfo->topicNameLength,
-                                               pcThingName,
-                                               uxThingNameLength );
-
-    if( isMatch == pdTRUE )
+    if( uxOffset == 0 )
     {
-        if( pPublishInfo->payloadLength <= OTA_DATA_BLOCK_SIZE )
+        /* A block left incomplete by a dropped connection is discarded */
+        if( pxBlock != NULL )
         {
-            LogDebug( ( "Received OTA image block, size %d.\n\n", pPublishInfo->payloadLength ) );
-
-            pData = prvOTAEventBufferGet( &xAppStaticBuffer.eventBufferPool );
+            prvOTAEventBufferFree( &xAppStaticBuffer.eventBufferPool, pxBlock );
+            pxBlock = NULL;
+        }
 
-            if( pData != NULL )
-            {
-                memcpy( pData->data, pPublishInfo->pPayload, pPublishInfo->payloadLength );
-                pData->dataLength = pPublishInfo->payloadLength;
-                eventMsg.eventId = OtaAgentEventReceivedFileBlock;
-                eventMsg.pEventData = pData;
+        isMatch = prvMatchClientIdentifierInTopic( pPublishInfo->pTopicName,
+                                                   pPublishInfo->topicNameLength,
+                                                   pcThingName,
+                                                   uxThingNameLength );
 
-                /* Send job document received event. */
-                OTA_SignalEvent( &eventMsg );
-            }
-            else
-            {
-                LogError( ( "Error: No OTA data buffers available.\r\n" ) );
-            }
+        if( isMatch != pdTRUE )
+        {
+            LogWarn( ( "Received data block on an unsolicited topic, thing name does not match. topic: %.*s ",
+                       pPublishInfo->topicNameLength,
+                       pPublishInfo->pTopicName ) );
         }
-        else
+        else if( pPublishInfo->payloadLength > OTA_DATA_BLOCK_SIZE )
         {
             LogError( ( "Received OTA data block of size (%d) larger than maximum size(%d) defined. ",
                         pPublishInfo->payloadLength,
                         OTA_DATA_BLOCK_SIZE ) );
         }
+        else
+        {
+            LogDebug( ( "Received OTA image block, size %d.\n\n", pPublishInfo->payloadLength ) );
+
+            pxBlock = prvOTAEventBufferGet( &xAppStaticBuffer.eventBufferPool );
+
+            if( pxBlock == NULL )
+            {
+                LogError( ( "Error: No OTA data buffers available.\r\n" ) );
+            }
+        }
     }
-    else
+
+    /* Chunks of a dropped block are ignored */
+    if( pxBlock != NULL )
     {
-        LogWarn( ( "Received data block on an unsolicited topic, thing name does not match. topic: %.*s ",
-                   pPublishInfo->topicNameLength,
-                   pPublishInfo->pTopicName ) );
+        configASSERT( ( uxOffset + uxChunkLen ) <= OTA_DATA_BLOCK_SIZE );
+
+        if( uxChunkLen > 0 )
+        {
+            ( void ) memcpy( &( pxBlock->data[ uxOffset ] ), pvChunk, uxChunkLen );
+        }
+
+        if( ( uxOffset + uxChunkLen ) == pPublishInfo->payloadLength )
+        {
+            pxBlock->dataLength = pPublishInfo->payloadLength;
+            eventMsg.eventId = OtaAgentEventReceivedFileBlock;
+            eventMsg.pEventData = pxBlock;
+            pxBlock = NULL;
+
+            /* Send job document received event. */
+            OTA_SignalEvent( &eventMsg );
+        }
     }
 }
 
@@ -805,21 +836,23 @@ static IncomingPubCallback_t prvGetPublishCallbackFromTopic( const char * pcTopi
         xCallback = prvProcessIncomingJobMessage;
     }
 
-    if( xIsMatch == false )
-    {
-        ( void ) MQTT_MatchTopic( pcTopicFilter,
-                                  usTopicFilterLength,
-                                  OTA_DATA_STREAM_TOPIC_FILTER,
-                                  OTA_DATA_STREAM_TOPIC_FILTER_LENGTH,
-                                  &xIsMatch );
+    return xCallback;
+}
 
-        if( xIsMatch == true )
-        {
-            xCallback = prvProcessIncomingData;
-        }
-    }
+/*-----------------------------------------------------------*/
 
-    return xCallback;
+static bool prvIsDataStreamTopic( const char * pcTopicFilter,
+                                  size_t usTopicFilterLength )
+{
+    bool xIsMatch = false;
+
+    ( void ) MQTT_MatchTopic( pcTopicFilter,
+                              usTopicFilterLength,
+                              OTA_DATA_STREAM_TOPIC_FILTER,
+                              OTA_DATA_STREAM_TOPIC_FILTER_LENGTH,
+                              &xIsMatch );
+
+    return xIsMatch;
 }
 
 /*-----------------------------------------------------------*/
@@ -879,27 +912,40 @@ static OtaMqttStatus_t prvMQTTSubscribe( const char * pTopicFilter,
     MQTTStatus_t mqttStatus;
     OtaMqttStatus_t otaRet = OtaMqttSuccess;
     IncomingPubCallback_t xPublishCallback;
+    bool xIsDataStream;
     MQTTAgentHandle_t xMQTTAgentHandle = NULL;
 
     configASSERT( pTopicFilter != NULL );
     configASSERT( topicFilterLength > 0 );
 
     xPublishCallback = prvGetPublishCallbackFromTopic( pTopicFilter, topicFilterLength );
+    xIsDataStream = prvIsDataStreamTopic( pTopicFilter, topicFilterLength );
 
     xMQTTAgentHandle = xGetMqttAgentHandle();
 
     if( ( xMQTTAgentHandle == NULL ) ||
-        ( xPublishCallback == NULL ) )
+        ( ( xPublishCallback == NULL ) && !xIsDataStream ) )
     {
         otaRet = OtaMqttSubscribeFailed;
     }
     else
     {
-        mqttStatus = MqttAgent_SubscribeSync( xMQTTAgentHandle,
-                                              pTopicFilter,
-                                              ucQoS,
-                                              xPublishCallback,
-                                              NULL );
+        if( xIsDataStream )
+        {
+            mqttStatus = MqttAgent_SubscribeStreamSync( xMQTTAgentHandle,
+                                                        pTopicFilter,
+                                                        ucQoS,
+                                                        prvProcessIncomingData,
+                                                        NULL );
+        }
+        else
+        {
+            mqttStatus = MqttAgent_SubscribeSync( xMQTTAgentHandle,
+                                                  pTopicFilter,
+                                                  ucQoS,
+                                                  xPublishCallback,
+                                                  NULL );
+        }
 
         if( mqttStatus != MQTTSuccess )
         {
@@ -1004,26 +1050,38 @@ static OtaMqttStatus_t prvMQTTUnsubscribe( const char * pTopicFilter,
     MQTTStatus_t mqttStatus;
     OtaMqttStatus_t otaRet = OtaMqttSuccess;
     IncomingPubCallback_t xPublishCallback;
+    bool xIsDataStream;
     MQTTAgentHandle_t xMQTTAgentHandle = NULL;
 
     configASSERT( pTopicFilter != NULL );
     configASSERT( topicFilterLength > 0 );
 
     xPublishCallback = prvGetPublishCallbackFromTopic( pTopicFilter, topicFilterLength );
+    xIsDataStream = prvIsDataStreamTopic( pTopicFilter, topicFilterLength );
 
     xMQTTAgentHandle = xGetMqttAgentHandle();
 
     if( ( xMQTTAgentHandle == NULL ) ||
-        ( xPublishCallback == NULL ) )
+        ( ( xPublishCallback == NULL ) && !xIsDataStream ) )
     {
         otaRet = OtaMqttUnsubscribeFailed;
     }
     else
     {
-        mqttStatus = MqttAgent_UnSubscribeSync( xMQTTAgentHandle,
-                                                pTopicFilter,
-                                                xPublishCallback,
-                                                NULL );
+        if( xIsDataStream )
+        {
+            mqttStatus = MqttAgent_UnSubscribeStreamSync( xMQTTAgentHandle,
+                                                          pTopicFilter,
+                                                          prvProcessIncomingData,
+                                                          NULL );
+        }
+        else
+        {
+            mqttStatus = MqttAgent_UnSubscribeSync( xMQTTAgentHandle,
+                                                    pTopicFilter,
+                                                    xPublishCallback,
+                                                    NULL );
+        }
 
         if( mqttStatus != MQTTSuccess )
         {
@@ -1210,6 +1268,7 @@ void vOTAUpdateTask( void * pvParam )
         {
             LogInfo( "MQTT Agent is connected. Resuming..." );
             xMQTTAgentHandle = xGetMqttAgentHandle();
+            ( void ) xMqttAgent_SetCommandLane( MQTT_AGENT_LANE_BULK );
         }
         else
         {
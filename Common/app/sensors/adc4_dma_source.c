@@ -0,0 +1,635 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file adc4_dma_source.c
+ * @brief Timer triggered, DMA backed ADC4 acquisition.
+ *
+ * TIM15 TRGO triggers one (hardware oversampled) ADC4 sweep of the configured
+ * channel sequence per period. GPDMA1 channel 10 moves each result into a
+ * circular buffer. On each half and full transfer interrupt the completed half
+ * is appended to a software ring and the reading task is notified, so the
+ * consumer never polls the ADC.
+ *
+ * Samples are interleaved in sequence order: one frame holds one sample per
+ * configured channel. Frames are never split, neither by the reader nor when
+ * the oldest data is dropped on overrun.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_ERROR
+
+#include "logging.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "hw_defs.h"
+#include "sample_source.h"
+
+#include <string.h>
+#include <assert.h>
+
+/* Conversion trigger rate. TIM15 runs from PCLK2 (160 MHz). TIM6 is the HAL time base. */
+#define ADC4_TIM15_PRESCALER         ( 16000U - 1U )     /* 10 kHz tick */
+#define ADC4_SAMPLE_RATE_HZ         ( 100U )
+#define ADC4_TIM15_PERIOD            ( ( 10000U / ADC4_SAMPLE_RATE_HZ ) - 1U )
+
+/* Number of frames in each half of the DMA circular buffer */
+#define ADC4_DMA_FRAMES_PER_HALF    ( 8U )
+#define ADC4_DMA_BUF_MAX_LEN        ( 2U * ADC4_DMA_FRAMES_PER_HALF * SAMPLE_SOURCE_MAX_CHANNELS )
+
+/* The soil moisture task drains the ring once per publish period */
+#define ADC4_RING_DRAIN_PERIOD_MS   ( 3000U )
+
+/* Number of samples in the software ring, enough for one drain period of the
+ * longest sequence. Must be a power of 2. */
+#define ADC4_RING_LEN               ( 4096U )
+
+/* Task notification index used to wake up the reader */
+#define ADC4_NOTIFY_IDX             ( 2U )
+
+static_assert( ( ADC4_RING_LEN & ( ADC4_RING_LEN - 1 ) ) == 0 );
+static_assert( ADC4_RING_LEN >= ( 2U * ADC4_DMA_FRAMES_PER_HALF * SAMPLE_SOURCE_MAX_CHANNELS ) );
+static_assert( ADC4_RING_LEN >= ( ( ( ADC4_SAMPLE_RATE_HZ * ADC4_RING_DRAIN_PERIOD_MS ) / 1000U ) * SAMPLE_SOURCE_MAX_CHANNELS ) );
+
+typedef struct
+{
+    uint32_t ulAdcInput;
+    uint32_t ulGpioPin;
+    GPIO_TypeDef * pxGpioPort;
+} Adc4InputPin_t;
+
+/* ADC4 inputs which may be used for probes and the pin each one is bonded to */
+static const Adc4InputPin_t xAdc4InputPins[] =
+{
+    { 1, GPIO_PIN_0,  GPIOC },
+    { 2, GPIO_PIN_1,  GPIOC },
+    { 3, GPIO_PIN_2,  GPIOC },
+    { 4, GPIO_PIN_3,  GPIOC },
+    { 5, GPIO_PIN_14, GPIOF },
+};
+
+static const uint32_t ulAdc4Ranks[ SAMPLE_SOURCE_MAX_CHANNELS ] =
+{
+    ADC4_REGULAR_RANK_1,
+    ADC4_REGULAR_RANK_2,
+    ADC4_REGULAR_RANK_3,
+    ADC4_REGULAR_RANK_4,
+    ADC4_REGULAR_RANK_5,
+    ADC4_REGULAR_RANK_6,
+    ADC4_REGULAR_RANK_7,
+    ADC4_REGULAR_RANK_8,
+};
+
+typedef struct
+{
+    uint16_t pusRing[ ADC4_RING_LEN ];
+    uint32_t pulAdcInputs[ SAMPLE_SOURCE_MAX_CHANNELS ];
+    size_t uxNumInputs;
+    size_t uxDmaBufLen;
+    volatile uint32_t ulHead;
+    volatile uint32_t ulTail;
+    TaskHandle_t xReaderTask;
+    BaseType_t xRunning;
+} Adc4DmaSourceCtx_t;
+
+ADC_HandleTypeDef hadc4;
+
+static TIM_HandleTypeDef xHndlTim15;
+static DMA_HandleTypeDef xHndlGpdmaCh10;
+static DMA_NodeTypeDef xAdc4DmaNode;
+static DMA_QListTypeDef xAdc4DmaQueue;
+
+static uint16_t pusDmaBuffer[ ADC4_DMA_BUF_MAX_LEN ] __attribute__( ( aligned( 4 ) ) );
+
+static Adc4DmaSourceCtx_t xSourceCtx =
+{
+    .pulAdcInputs = { 1 },
+    .uxNumInputs  = 1,
+};
+
+static BaseType_t prvAdc4Start( SampleSource_t * pxSource );
+static void prvAdc4Stop( SampleSource_t * pxSource );
+static size_t prvAdc4Read( SampleSource_t * pxSource,
+                           uint16_t * pusSamples,
+                           size_t uxMaxSamples,
+                           TickType_t xTimeout );
+
+static SampleSource_t xAdc4DmaSource =
+{
+    .xStart     = prvAdc4Start,
+    .vStop      = prvAdc4Stop,
+    .uxRead     = prvAdc4Read,
+    .uxChannels = 1,
+    .ulOverruns = 0,
+    .pvCtx      = &xSourceCtx,
+};
+
+/*-----------------------------------------------------------*/
+
+static const Adc4InputPin_t * prvLookupInputPin( uint32_t ulAdcInput )
+{
+    const Adc4InputPin_t * pxPin = NULL;
+
+    for( size_t uxIdx = 0; uxIdx < ( sizeof( xAdc4InputPins ) / sizeof( xAdc4InputPins[ 0 ] ) ); uxIdx++ )
+    {
+        if( xAdc4InputPins[ uxIdx ].ulAdcInput == ulAdcInput )
+        {
+            pxPin = &( xAdc4InputPins[ uxIdx ] );
+            break;
+        }
+    }
+
+    return pxPin;
+}
+
+/*-----------------------------------------------------------*/
+
+static HAL_StatusTypeDef prvInitTim15( void )
+{
+    HAL_StatusTypeDef xResult = HAL_OK;
+    TIM_MasterConfigTypeDef xMasterConfig = { 0 };
+
+    __HAL_RCC_TIM15_CLK_ENABLE();
+
+    xHndlTim15.Instance = TIM15;
+    xHndlTim15.Init.Prescaler = ADC4_TIM15_PRESCALER;
+    xHndlTim15.Init.CounterMode = TIM_COUNTERMODE_UP;
+    xHndlTim15.Init.Period = ADC4_TIM15_PERIOD;
+    xHndlTim15.Init.AutoReloadPreload = TIM_AUTORELOAD_PRELOAD_DISABLE;
+
+    xResult = HAL_TIM_Base_Init( &xHndlTim15 );
+
+    if( xResult == HAL_OK )
+    {
+        xMasterConfig.MasterOutputTrigger = TIM_TRGO_UPDATE;
+        xMasterConfig.MasterSlaveMode = TIM_MASTERSLAVEMODE_DISABLE;
+        xResult = HAL_TIMEx_MasterConfigSynchronization( &xHndlTim15, &xMasterConfig );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static HAL_StatusTypeDef prvInitDma( void )
+{
+    HAL_StatusTypeDef xResult = HAL_OK;
+
+    DMA_NodeConfTypeDef xNodeConfig =
+    {
+        .NodeType                            = DMA_GPDMA_LINEAR_NODE,
+        .Init                                =
+        {
+            .Request                         = GPDMA1_REQUEST_ADC4,
+            .BlkHWRequest                    = DMA_BREQ_SINGLE_BURST,
+            .Direction                       = DMA_PERIPH_TO_MEMORY,
+            .SrcInc                          = DMA_SINC_FIXED,
+            .DestInc                         = DMA_DINC_INCREMENTED,
+            .SrcDataWidth                    = DMA_SRC_DATAWIDTH_HALFWORD,
+            .DestDataWidth                   = DMA_DEST_DATAWIDTH_HALFWORD,
+            .SrcBurstLength                  = 1,
+            .DestBurstLength                 = 1,
+            .TransferAllocatedPort           = DMA_SRC_ALLOCATED_PORT0 | DMA_DEST_ALLOCATED_PORT1,
+            .TransferEventMode               = DMA_TCEM_BLOCK_TRANSFER,
+            .Mode                            = DMA_NORMAL,
+        },
+        .TriggerConfig.TriggerPolarity       = DMA_TRIG_POLARITY_MASKED,
+        .DataHandlingConfig.DataExchange     = DMA_EXCHANGE_NONE,
+        .DataHandlingConfig.DataAlignment    = DMA_DATA_RIGHTALIGN_ZEROPADDED,
+        .SrcAddress                          = 0, /* Filled in by HAL_ADC_Start_DMA */
+        .DstAddress                          = 0,
+        .DataSize                            = 0,
+    };
+
+    __HAL_RCC_GPDMA1_CLK_ENABLE();
+
+    xResult = HAL_DMAEx_List_BuildNode( &xNodeConfig, &xAdc4DmaNode );
+
+    if( xResult == HAL_OK )
+    {
+        xResult = HAL_DMAEx_List_InsertNode_Tail( &xAdc4DmaQueue, &xAdc4DmaNode );
+    }
+
+    if( xResult == HAL_OK )
+    {
+        xResult = HAL_DMAEx_List_SetCircularMode( &xAdc4DmaQueue );
+    }
+
+    if( xResult == HAL_OK )
+    {
+        xHndlGpdmaCh10.Instance = GPDMA1_Channel10;
+        xHndlGpdmaCh10.InitLinkedList.Priority = DMA_LOW_PRIORITY_MID_WEIGHT;
+        xHndlGpdmaCh10.InitLinkedList.LinkStepMode = DMA_LSM_FULL_EXECUTION;
+        xHndlGpdmaCh10.InitLinkedList.LinkAllocatedPort = DMA_LINK_ALLOCATED_PORT1;
+        xHndlGpdmaCh10.InitLinkedList.TransferEventMode = DMA_TCEM_BLOCK_TRANSFER;
+        xHndlGpdmaCh10.InitLinkedList.LinkedListMode = DMA_LINKEDLIST_CIRCULAR;
+
+        xResult = HAL_DMAEx_List_Init( &xHndlGpdmaCh10 );
+    }
+
+    if( xResult == HAL_OK )
+    {
+        xResult = HAL_DMAEx_List_LinkQ( &xHndlGpdmaCh10, &xAdc4DmaQueue );
+    }
+
+    if( xResult == HAL_OK )
+    {
+        __HAL_LINKDMA( &hadc4, DMA_Handle, xHndlGpdmaCh10 );
+
+        xResult = HAL_DMA_ConfigChannelAttributes( &xHndlGpdmaCh10, DMA_CHANNEL_NPRIV );
+    }
+
+    if( xResult == HAL_OK )
+    {
+        pxHndlGpdmaCh10 = &xHndlGpdmaCh10;
+
+        HAL_NVIC_SetPriority( GPDMA1_Channel10_IRQn, 5, 0 );
+        HAL_NVIC_EnableIRQ( GPDMA1_Channel10_IRQn );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief ADC4 Initialization Function
+ */
+static HAL_StatusTypeDef prvInitAdc4( void )
+{
+    HAL_StatusTypeDef xResult = HAL_OK;
+    ADC_ChannelConfTypeDef sConfig = { 0 };
+
+    hadc4.Instance = ADC4;
+    hadc4.Init.ClockPrescaler = ADC_CLOCK_ASYNC_DIV1;
+    hadc4.Init.Resolution = ADC_RESOLUTION_12B;
+    hadc4.Init.DataAlign = ADC_DATAALIGN_RIGHT;
+    hadc4.Init.ScanConvMode = ( xSourceCtx.uxNumInputs > 1 ) ? ADC4_SCAN_ENABLE : ADC4_SCAN_DISABLE;
+    hadc4.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
+    hadc4.Init.LowPowerAutoPowerOff = ADC_LOW_POWER_NONE;
+    hadc4.Init.LowPowerAutoWait = DISABLE;
+    hadc4.Init.ContinuousConvMode = DISABLE;
+    hadc4.Init.NbrOfConversion = xSourceCtx.uxNumInputs;
+    hadc4.Init.ExternalTrigConv = ADC4_EXTERNALTRIG_T15_TRGO;
+    hadc4.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_RISING;
+    hadc4.Init.DMAContinuousRequests = ENABLE;
+    hadc4.Init.TriggerFrequencyMode = ADC_TRIGGER_FREQ_LOW;
+    hadc4.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
+    hadc4.Init.SamplingTimeCommon1 = ADC4_SAMPLETIME_19CYCLES_5;
+    hadc4.Init.SamplingTimeCommon2 = ADC4_SAMPLETIME_1CYCLE_5;
+    hadc4.Init.OversamplingMode = ENABLE;
+    hadc4.Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_8;
+    hadc4.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_4;
+    hadc4.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
+
+    xResult = HAL_ADC_Init( &hadc4 );
+
+    for( size_t uxIdx = 0; ( xResult == HAL_OK ) && ( uxIdx < xSourceCtx.uxNumInputs ); uxIdx++ )
+    {
+        sConfig.Channel = __HAL_ADC_DECIMAL_NB_TO_CHANNEL( xSourceCtx.pulAdcInputs[ uxIdx ] );
+        sConfig.Rank = ulAdc4Ranks[ uxIdx ];
+        sConfig.SamplingTime = ADC4_SAMPLINGTIME_COMMON_1;
+        sConfig.OffsetNumber = ADC_OFFSET_NONE;
+        sConfig.Offset = 0;
+
+        xResult = HAL_ADC_ConfigChannel( &hadc4, &sConfig );
+    }
+
+    if( xResult == HAL_OK )
+    {
+        xResult = HAL_ADCEx_Calibration_Start( &hadc4, ADC_CALIB_OFFSET, ADC_SINGLE_ENDED );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Called from the DMA ISR with the half of the DMA buffer which was just filled */
+static void prvPushBlockFromISR( const uint16_t * pusBlock,
+                                 size_t uxLen )
+{
+    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    uint32_t ulHead = xSourceCtx.ulHead;
+
+    for( size_t uxIdx = 0; uxIdx < uxLen; uxIdx++ )
+    {
+        xSourceCtx.pusRing[ ulHead & ( ADC4_RING_LEN - 1 ) ] = pusBlock[ uxIdx ];
+        ulHead++;
+    }
+
+    /* Drop the oldest whole frames if the reader fell behind */
+    if( ( ulHead - xSourceCtx.ulTail ) > ADC4_RING_LEN )
+    {
+        uint32_t ulExcess = ( ulHead - xSourceCtx.ulTail ) - ADC4_RING_LEN;
+
+        ulExcess += ( xSourceCtx.uxNumInputs - ( ulExcess % xSourceCtx.uxNumInputs ) ) % xSourceCtx.uxNumInputs;
+
+        xAdc4DmaSource.ulOverruns += ulExcess;
+        xSourceCtx.ulTail += ulExcess;
+    }
+
+    xSourceCtx.ulHead = ulHead;
+
+    if( xSourceCtx.xReaderTask != NULL )
+    {
+        vTaskNotifyGiveIndexedFromISR( xSourceCtx.xReaderTask,
+                                       ADC4_NOTIFY_IDX,
+                                       &xHigherPriorityTaskWoken );
+    }
+
+    portYIELD_FROM_ISR( xHigherPriorityTaskWoken );
+}
+
+/*-----------------------------------------------------------*/
+
+void HAL_ADC_ConvHalfCpltCallback( ADC_HandleTypeDef * hadc )
+{
+    if( hadc->Instance == ADC4 )
+    {
+        prvPushBlockFromISR( &( pusDmaBuffer[ 0 ] ), xSourceCtx.uxDmaBufLen / 2 );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void HAL_ADC_ConvCpltCallback( ADC_HandleTypeDef * hadc )
+{
+    if( hadc->Instance == ADC4 )
+    {
+        prvPushBlockFromISR( &( pusDmaBuffer[ xSourceCtx.uxDmaBufLen / 2 ] ), xSourceCtx.uxDmaBufLen / 2 );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvAdc4Start( SampleSource_t * pxSource )
+{
+    HAL_StatusTypeDef xResult = HAL_OK;
+    Adc4DmaSourceCtx_t * pxCtx = ( Adc4DmaSourceCtx_t * ) pxSource->pvCtx;
+
+    configASSERT( pxCtx != NULL );
+
+    if( pxCtx->xRunning == pdFALSE )
+    {
+        pxCtx->xReaderTask = xTaskGetCurrentTaskHandle();
+        pxCtx->ulHead = 0;
+        pxCtx->ulTail = 0;
+        pxCtx->uxDmaBufLen = 2U * ADC4_DMA_FRAMES_PER_HALF * pxCtx->uxNumInputs;
+
+        xResult = prvInitAdc4();
+
+        /* The linked-list queue is built once. HAL_ADC_Start_DMA fills in the
+         * node and restarts the transfer on every start. */
+        if( ( xResult == HAL_OK ) &&
+            ( pxHndlGpdmaCh10 == NULL ) )
+        {
+            xResult = prvInitDma();
+        }
+
+        if( xResult == HAL_OK )
+        {
+            xResult = prvInitTim15();
+        }
+
+        if( xResult == HAL_OK )
+        {
+            xResult = HAL_ADC_Start_DMA( &hadc4, ( const uint32_t * ) pusDmaBuffer, pxCtx->uxDmaBufLen );
+        }
+
+        if( xResult == HAL_OK )
+        {
+            xResult = HAL_TIM_Base_Start( &xHndlTim15 );
+        }
+
+        if( xResult == HAL_OK )
+        {
+            pxCtx->xRunning = pdTRUE;
+        }
+        else
+        {
+            LogError( "Failed to start ADC4 DMA acquisition: %d.", xResult );
+        }
+    }
+
+    return( xResult == HAL_OK ? pdTRUE : pdFALSE );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvAdc4Stop( SampleSource_t * pxSource )
+{
+    Adc4DmaSourceCtx_t * pxCtx = ( Adc4DmaSourceCtx_t * ) pxSource->pvCtx;
+
+    if( pxCtx->xRunning == pdTRUE )
+    {
+        ( void ) HAL_TIM_Base_Stop( &xHndlTim15 );
+        ( void ) HAL_ADC_Stop_DMA( &hadc4 );
+        pxCtx->xRunning = pdFALSE;
+        pxCtx->xReaderTask = NULL;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvAdc4Read( SampleSource_t * pxSource,
+                           uint16_t * pusSamples,
+                           size_t uxMaxSamples,
+                           TickType_t xTimeout )
+{
+    Adc4DmaSourceCtx_t * pxCtx = ( Adc4DmaSourceCtx_t * ) pxSource->pvCtx;
+    size_t uxCopied = 0;
+    size_t uxAvailable = 0;
+    uint32_t ulTail = 0;
+
+    configASSERT( pusSamples != NULL );
+
+    /* Only hand out whole frames */
+    uxMaxSamples -= uxMaxSamples % pxCtx->uxNumInputs;
+
+    if( pxCtx->ulHead == pxCtx->ulTail )
+    {
+        ( void ) ulTaskNotifyTakeIndexed( ADC4_NOTIFY_IDX, pdTRUE, xTimeout );
+    }
+
+    /* The ISR moves the head, and the tail on overrun */
+    taskENTER_CRITICAL();
+    {
+        ulTail = pxCtx->ulTail;
+        uxAvailable = ( size_t ) ( pxCtx->ulHead - ulTail );
+    }
+    taskEXIT_CRITICAL();
+
+    while( ( uxCopied < uxAvailable ) && ( uxCopied < uxMaxSamples ) )
+    {
+        pusSamples[ uxCopied ] = pxCtx->pusRing[ ( ulTail + uxCopied ) & ( ADC4_RING_LEN - 1 ) ];
+        uxCopied++;
+    }
+
+    taskENTER_CRITICAL();
+    {
+        /* Frames the ISR gave up on while they were copied may have been
+         * overwritten, so they are dropped from the copy as well */
+        uint32_t ulDropped = pxCtx->ulTail - ulTail;
+
+        if( ulDropped >= uxCopied )
+        {
+            uxCopied = 0;
+        }
+        else if( ulDropped > 0 )
+        {
+            uxCopied -= ulDropped;
+            ( void ) memmove( pusSamples, &( pusSamples[ ulDropped ] ), uxCopied * sizeof( uint16_t ) );
+        }
+        else
+        {
+            /* Empty */
+        }
+
+        pxCtx->ulTail = ulTail + ulDropped + ( uint32_t ) uxCopied;
+    }
+    taskEXIT_CRITICAL();
+
+    return uxCopied;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xAdc4DmaSourceSetChannels( const uint32_t * pulAdcInputs,
+                                      size_t uxNumInputs )
+{
+    BaseType_t xResult = pdTRUE;
+
+    configASSERT( pulAdcInputs != NULL );
+
+    if( xSourceCtx.xRunning == pdTRUE )
+    {
+        LogError( "Cannot change the ADC4 sequence while sampling." );
+        xResult = pdFALSE;
+    }
+    else if( ( uxNumInputs == 0 ) || ( uxNumInputs > SAMPLE_SOURCE_MAX_CHANNELS ) )
+    {
+        LogError( "Invalid number of ADC4 inputs: %u.", uxNumInputs );
+        xResult = pdFALSE;
+    }
+    else
+    {
+        for( size_t uxIdx = 0; uxIdx < uxNumInputs; uxIdx++ )
+        {
+            if( prvLookupInputPin( pulAdcInputs[ uxIdx ] ) == NULL )
+            {
+                LogError( "ADC4 input %lu is not bonded to a usable pin.", pulAdcInputs[ uxIdx ] );
+                xResult = pdFALSE;
+            }
+        }
+    }
+
+    if( xResult == pdTRUE )
+    {
+        ( void ) memcpy( xSourceCtx.pulAdcInputs, pulAdcInputs, uxNumInputs * sizeof( uint32_t ) );
+        xSourceCtx.uxNumInputs = uxNumInputs;
+        xAdc4DmaSource.uxChannels = uxNumInputs;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+SampleSource_t * pxAdc4DmaSourceGet( void )
+{
+    return &xAdc4DmaSource;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief ADC MSP Initialization
+ * @param hadc: ADC handle pointer
+ */
+void HAL_ADC_MspInit( ADC_HandleTypeDef * hadc )
+{
+    GPIO_InitTypeDef GPIO_InitStruct = { 0 };
+    RCC_PeriphCLKInitTypeDef PeriphClkInit = { 0 };
+
+    if( hadc->Instance == ADC4 )
+    {
+        PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_ADCDAC;
+        PeriphClkInit.AdcDacClockSelection = RCC_ADCDACCLKSOURCE_HSI;
+
+        if( HAL_RCCEx_PeriphCLKConfig( &PeriphClkInit ) != HAL_OK )
+        {
+            __BKPT( 0 );
+        }
+
+        /* Peripheral clock enable */
+        __HAL_RCC_ADC4_CLK_ENABLE();
+
+        __HAL_RCC_GPIOC_CLK_ENABLE();
+        __HAL_RCC_GPIOF_CLK_ENABLE();
+
+        for( size_t uxIdx = 0; uxIdx < xSourceCtx.uxNumInputs; uxIdx++ )
+        {
+            const Adc4InputPin_t * pxPin = prvLookupInputPin( xSourceCtx.pulAdcInputs[ uxIdx ] );
+
+            configASSERT( pxPin != NULL );
+
+            GPIO_InitStruct.Pin = pxPin->ulGpioPin;
+            GPIO_InitStruct.Mode = GPIO_MODE_ANALOG;
+            GPIO_InitStruct.Pull = GPIO_NOPULL;
+            HAL_GPIO_Init( pxPin->pxGpioPort, &GPIO_InitStruct );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief ADC MSP De-Initialization
+ * @param hadc: ADC handle pointer
+ */
+void HAL_ADC_MspDeInit( ADC_HandleTypeDef * hadc )
+{
+    if( hadc->Instance == ADC4 )
+    {
+        /* Peripheral clock disable */
+        __HAL_RCC_ADC4_CLK_DISABLE();
+
+        for( size_t uxIdx = 0; uxIdx < xSourceCtx.uxNumInputs; uxIdx++ )
+        {
+            const Adc4InputPin_t * pxPin = prvLookupInputPin( xSourceCtx.pulAdcInputs[ uxIdx ] );
+
+            if( pxPin != NULL )
+            {
+                HAL_GPIO_DeInit( pxPin->pxGpioPort, pxPin->ulGpioPin );
+            }
+        }
+
+        HAL_NVIC_DisableIRQ( GPDMA1_Channel10_IRQn );
+    }
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file moisture_probes.c
+ * @brief Soil moisture probe set configuration and calibration.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_ERROR
+
+#include "logging.h"
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "kvstore.h"
+#include "moisture_probes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MOIST_PROBES_KV_STR_LEN     ( 128 )
+
+/* The stored string, including the terminator, must be shorter than a KVStore
+ * value. That is less than every point of every probe as "65535=10000," so a
+ * full set of curves is rejected by xMoistProbes_WriteCurves. */
+#define MOIST_PROBES_CAL_STR_LEN    ( KVSTORE_VAL_MAX_LEN - 1 )
+
+static volatile uint32_t ulCalibrationVersion = 0;
+static volatile uint16_t pusLastReadings[ MOIST_PROBES_MAX ];
+static volatile uint32_t ulLastReadingsValid = 0;
+
+/*-----------------------------------------------------------*/
+
+/* Parse the next unsigned number in a separated list, advancing *ppcCursor */
+static BaseType_t prvNextNumber( const char ** ppcCursor,
+                                 uint32_t * pulValue )
+{
+    BaseType_t xResult = pdFALSE;
+    const char * pcCursor = *ppcCursor;
+    char * pcEnd = NULL;
+
+    while( ( *pcCursor == ' ' ) || ( *pcCursor == ',' ) || ( *pcCursor == ':' ) )
+    {
+        pcCursor++;
+    }
+
+    if( *pcCursor != '\0' )
+    {
+        *pulValue = ( uint32_t ) strtoul( pcCursor, &pcEnd, 10 );
+
+        if( pcEnd != pcCursor )
+        {
+            pcCursor = pcEnd;
+            xResult = pdTRUE;
+        }
+    }
+
+    *ppcCursor = pcCursor;
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xMoistCal_AddPoint( MoistCalCurve_t * pxCurve,
+                               uint16_t usReading,
+                               uint16_t usMoisture )
+{
+    BaseType_t xResult = pdFALSE;
+    size_t uxIdx = 0;
+
+    configASSERT( pxCurve != NULL );
+
+    if( usMoisture <= MOIST_MOISTURE_MAX )
+    {
+        /* Find the first point at or above the new reading */
+        while( ( uxIdx < pxCurve->uxNumPoints ) &&
+               ( ( pxCurve->xPoints[ uxIdx ].usReading + MOIST_CAL_MIN_SPACING ) <= usReading ) )
+        {
+            uxIdx++;
+        }
+
+        if( ( uxIdx < pxCurve->uxNumPoints ) &&
+            ( pxCurve->xPoints[ uxIdx ].usReading < ( usReading + MOIST_CAL_MIN_SPACING ) ) )
+        {
+            /* Too close to an existing point to give a usable slope */
+            pxCurve->xPoints[ uxIdx ].usReading = usReading;
+            pxCurve->xPoints[ uxIdx ].usMoisture = usMoisture;
+            xResult = pdTRUE;
+        }
+        else if( pxCurve->uxNumPoints < MOIST_CAL_MAX_POINTS )
+        {
+            ( void ) memmove( &( pxCurve->xPoints[ uxIdx + 1 ] ),
+                              &( pxCurve->xPoints[ uxIdx ] ),
+                              ( pxCurve->uxNumPoints - uxIdx ) * sizeof( MoistCalPoint_t ) );
+
+            pxCurve->xPoints[ uxIdx ].usReading = usReading;
+            pxCurve->xPoints[ uxIdx ].usMoisture = usMoisture;
+            pxCurve->uxNumPoints++;
+            xResult = pdTRUE;
+        }
+        else
+        {
+            xResult = pdFALSE;
+        }
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Parse "<reading>=<moisture>,..." up to the next ';', returning the rest */
+static const char * prvParseCurve( const char * pcCursor,
+                                   MoistCalCurve_t * pxCurve )
+{
+    while( ( *pcCursor != '\0' ) && ( *pcCursor != ';' ) )
+    {
+        char * pcEnd = NULL;
+        uint32_t ulReading = 0;
+        uint32_t ulMoisture = 0;
+        BaseType_t xValid = pdFALSE;
+
+        ulReading = ( uint32_t ) strtoul( pcCursor, &pcEnd, 10 );
+
+        if( ( pcEnd != pcCursor ) && ( *pcEnd == '=' ) )
+        {
+            const char * pcValue = &( pcEnd[ 1 ] );
+
+            ulMoisture = ( uint32_t ) strtoul( pcValue, &pcEnd, 10 );
+
+            xValid = ( ( pcEnd != pcValue ) &&
+                       ( ulReading <= UINT16_MAX ) &&
+                       ( ulMoisture <= MOIST_MOISTURE_MAX ) ) ? pdTRUE : pdFALSE;
+        }
+
+        if( ( xValid == pdFALSE ) ||
+            ( xMoistCal_AddPoint( pxCurve, ( uint16_t ) ulReading, ( uint16_t ) ulMoisture ) == pdFALSE ) )
+        {
+            LogError( "Ignoring invalid calibration point." );
+        }
+
+        /* Skip to the start of the next point */
+        while( ( *pcCursor != '\0' ) && ( *pcCursor != ';' ) && ( *pcCursor != ',' ) )
+        {
+            pcCursor++;
+        }
+
+        if( *pcCursor == ',' )
+        {
+            pcCursor++;
+        }
+    }
+
+    return pcCursor;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Parse the older "dry:wet,dry:wet" form, one pair per probe */
+static size_t prvParseLegacyCurves( const char * pcCursor,
+                                    MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ] )
+{
+    size_t uxNumCurves = 0;
+    uint32_t ulDry = 0;
+    uint32_t ulWet = 0;
+
+    while( ( uxNumCurves < MOIST_PROBES_MAX ) &&
+           ( prvNextNumber( &pcCursor, &ulDry ) == pdTRUE ) &&
+           ( prvNextNumber( &pcCursor, &ulWet ) == pdTRUE ) )
+    {
+        if( ( ulDry == ulWet ) || ( ulDry > UINT16_MAX ) || ( ulWet > UINT16_MAX ) )
+        {
+            LogError( "Ignoring invalid calibration for probe %u.", uxNumCurves );
+        }
+        else
+        {
+            ( void ) xMoistCal_AddPoint( &( pxCurves[ uxNumCurves ] ), ( uint16_t ) ulDry, 0 );
+            ( void ) xMoistCal_AddPoint( &( pxCurves[ uxNumCurves ] ), ( uint16_t ) ulWet, MOIST_MOISTURE_MAX );
+        }
+
+        uxNumCurves++;
+    }
+
+    return uxNumCurves;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxMoistProbes_ReadCurves( MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ] )
+{
+    char pcKvBuffer[ MOIST_PROBES_CAL_STR_LEN ] = { 0 };
+    const char * pcCursor = pcKvBuffer;
+    size_t uxNumCurves = 0;
+
+    configASSERT( pxCurves != NULL );
+
+    ( void ) memset( pxCurves, 0, MOIST_PROBES_MAX * sizeof( MoistCalCurve_t ) );
+
+    ( void ) KVStore_getString( CS_MOIST_CAL, pcKvBuffer, MOIST_PROBES_CAL_STR_LEN );
+
+    if( strchr( pcKvBuffer, '=' ) == NULL )
+    {
+        uxNumCurves = prvParseLegacyCurves( pcKvBuffer, pxCurves );
+    }
+    else
+    {
+        while( ( *pcCursor != '\0' ) && ( uxNumCurves < MOIST_PROBES_MAX ) )
+        {
+            pcCursor = prvParseCurve( pcCursor, &( pxCurves[ uxNumCurves ] ) );
+            uxNumCurves++;
+
+            if( *pcCursor == ';' )
+            {
+                pcCursor++;
+            }
+        }
+    }
+
+    return uxNumCurves;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xMoistProbes_WriteCurves( const MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ],
+                                     size_t uxNumCurves )
+{
+    char pcKvBuffer[ MOIST_PROBES_CAL_STR_LEN ] = { 0 };
+    BaseType_t xResult = pdTRUE;
+    size_t uxLen = 0;
+
+    configASSERT( pxCurves != NULL );
+    configASSERT( uxNumCurves <= MOIST_PROBES_MAX );
+
+    for( size_t uxProbe = 0; ( uxProbe < uxNumCurves ) && ( xResult == pdTRUE ); uxProbe++ )
+    {
+        for( size_t uxIdx = 0; ( uxIdx < pxCurves[ uxProbe ].uxNumPoints ) && ( xResult == pdTRUE ); uxIdx++ )
+        {
+            int lWritten = snprintf( &( pcKvBuffer[ uxLen ] ), MOIST_PROBES_CAL_STR_LEN - uxLen,
+                                     "%s%u=%u",
+                                     ( uxIdx > 0 ) ? "," : "",
+                                     pxCurves[ uxProbe ].xPoints[ uxIdx ].usReading,
+                                     pxCurves[ uxProbe ].xPoints[ uxIdx ].usMoisture );
+
+            if( ( lWritten > 0 ) && ( ( size_t ) lWritten < ( MOIST_PROBES_CAL_STR_LEN - uxLen ) ) )
+            {
+                uxLen += ( size_t ) lWritten;
+            }
+            else
+            {
+                xResult = pdFALSE;
+            }
+        }
+
+        /* Probes without points keep their position in the list */
+        if( ( uxProbe + 1 < uxNumCurves ) && ( xResult == pdTRUE ) )
+        {
+            if( ( uxLen + 1 ) < MOIST_PROBES_CAL_STR_LEN )
+            {
+                pcKvBuffer[ uxLen ] = ';';
+                uxLen++;
+            }
+            else
+            {
+                xResult = pdFALSE;
+            }
+        }
+    }
+
+    if( xResult == pdFALSE )
+    {
+        LogError( "Calibration curves do not fit in %u bytes.", ( unsigned int ) MOIST_PROBES_CAL_STR_LEN );
+    }
+    else
+    {
+        xResult = KVStore_setString( CS_MOIST_CAL, pcKvBuffer );
+    }
+
+    if( xResult == pdTRUE )
+    {
+        xResult = KVStore_xCommitChanges();
+    }
+
+    if( xResult == pdTRUE )
+    {
+        ulCalibrationVersion++;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvComputeSlopes( MoistProbe_t * pxProbe )
+{
+    const MoistCalCurve_t * pxCurve = &( pxProbe->xCurve );
+
+    for( size_t uxIdx = 0; ( uxIdx + 1 ) < pxCurve->uxNumPoints; uxIdx++ )
+    {
+        int32_t lRise = ( int32_t ) pxCurve->xPoints[ uxIdx + 1 ].usMoisture - ( int32_t ) pxCurve->xPoints[ uxIdx ].usMoisture;
+        int32_t lRun = ( int32_t ) pxCurve->xPoints[ uxIdx + 1 ].usReading - ( int32_t ) pxCurve->xPoints[ uxIdx ].usReading;
+
+        /* Points are sorted and at least MOIST_CAL_MIN_SPACING apart */
+        configASSERT( lRun > 0 );
+
+        pxProbe->plSlopes[ uxIdx ] = ( lRise * ( 1L << MOIST_CAL_SLOPE_FRAC_BITS ) ) / lRun;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vMoistProbes_LoadCalibration( MoistProbeSet_t * pxProbeSet )
+{
+    MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ];
+
+    configASSERT( pxProbeSet != NULL );
+
+    ( void ) uxMoistProbes_ReadCurves( pxCurves );
+
+    for( size_t uxIdx = 0; uxIdx < pxProbeSet->uxNumProbes; uxIdx++ )
+    {
+        MoistProbe_t * pxProbe = &( pxProbeSet->xProbes[ uxIdx ] );
+
+        if( pxCurves[ uxIdx ].uxNumPoints >= 2 )
+        {
+            pxProbe->xCurve = pxCurves[ uxIdx ];
+        }
+        else
+        {
+            ( void ) memset( &( pxProbe->xCurve ), 0, sizeof( MoistCalCurve_t ) );
+            ( void ) xMoistCal_AddPoint( &( pxProbe->xCurve ), MOIST_PROBE_DRY_READING_DFLT, 0 );
+            ( void ) xMoistCal_AddPoint( &( pxProbe->xCurve ), MOIST_PROBE_WET_READING_DFLT, MOIST_MOISTURE_MAX );
+        }
+
+        prvComputeSlopes( pxProbe );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xMoistProbes_Load( MoistProbeSet_t * pxProbeSet )
+{
+    char pcKvBuffer[ MOIST_PROBES_KV_STR_LEN ] = { 0 };
+    const char * pcCursor = NULL;
+    uint32_t ulValue = 0;
+
+    configASSERT( pxProbeSet != NULL );
+
+    ( void ) memset( pxProbeSet, 0, sizeof( MoistProbeSet_t ) );
+
+    ( void ) KVStore_getString( CS_MOIST_CHANNELS, pcKvBuffer, MOIST_PROBES_KV_STR_LEN );
+
+    pcCursor = pcKvBuffer;
+
+    while( prvNextNumber( &pcCursor, &ulValue ) == pdTRUE )
+    {
+        if( pxProbeSet->uxNumProbes >= MOIST_PROBES_MAX )
+        {
+            LogError( "Too many soil moisture probes configured, max is %u.", MOIST_PROBES_MAX );
+            break;
+        }
+
+        pxProbeSet->xProbes[ pxProbeSet->uxNumProbes ].ulAdcInput = ulValue;
+        pxProbeSet->uxNumProbes++;
+    }
+
+    vMoistProbes_LoadCalibration( pxProbeSet );
+
+    return( pxProbeSet->uxNumProbes > 0 ? pdTRUE : pdFALSE );
+}
+
+/*-----------------------------------------------------------*/
+
+uint16_t usMoistProbes_ToMoisture( const MoistProbe_t * pxProbe,
+                                   uint16_t usReading )
+{
+    const MoistCalCurve_t * pxCurve = NULL;
+    size_t uxLast = 0;
+    int32_t lMoisture = 0;
+
+    configASSERT( pxProbe != NULL );
+    configASSERT( pxProbe->xCurve.uxNumPoints >= 2 );
+
+    pxCurve = &( pxProbe->xCurve );
+    uxLast = pxCurve->uxNumPoints - 1;
+
+    if( usReading <= pxCurve->xPoints[ 0 ].usReading )
+    {
+        lMoisture = pxCurve->xPoints[ 0 ].usMoisture;
+    }
+    else if( usReading >= pxCurve->xPoints[ uxLast ].usReading )
+    {
+        lMoisture = pxCurve->xPoints[ uxLast ].usMoisture;
+    }
+    else
+    {
+        size_t uxIdx = 0;
+        int32_t lOffset = 0;
+
+        while( usReading >= pxCurve->xPoints[ uxIdx + 1 ].usReading )
+        {
+            uxIdx++;
+        }
+
+        /* The offset is shorter than the segment, so the product fits in 32 bits */
+        lOffset = ( int32_t ) usReading - ( int32_t ) pxCurve->xPoints[ uxIdx ].usReading;
+        lMoisture = ( int32_t ) pxCurve->xPoints[ uxIdx ].usMoisture +
+                    ( ( lOffset * pxProbe->plSlopes[ uxIdx ] + ( 1L << ( MOIST_CAL_SLOPE_FRAC_BITS - 1 ) ) ) >> MOIST_CAL_SLOPE_FRAC_BITS );
+    }
+
+    if( lMoisture < 0 )
+    {
+        lMoisture = 0;
+    }
+
+    if( lMoisture > ( int32_t ) MOIST_MOISTURE_MAX )
+    {
+        lMoisture = MOIST_MOISTURE_MAX;
+    }
+
+    return ( uint16_t ) lMoisture;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulMoistProbes_CalibrationVersion( void )
+{
+    return ulCalibrationVersion;
+}
+
+/*-----------------------------------------------------------*/
+
+void vMoistProbes_SetLastReading( size_t uxProbe,
+                                  uint16_t usReading )
+{
+    if( uxProbe < MOIST_PROBES_MAX )
+    {
+        pusLastReadings[ uxProbe ] = usReading;
+
+        taskENTER_CRITICAL();
+        {
+            ulLastReadingsValid |= ( 1UL << uxProbe );
+        }
+        taskEXIT_CRITICAL();
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xMoistProbes_GetLastReading( size_t uxProbe,
+                                        uint16_t * pusReading )
+{
+    BaseType_t xResult = pdFALSE;
+
+    configASSERT( pusReading != NULL );
+
+    if( ( uxProbe < MOIST_PROBES_MAX ) &&
+        ( ( ulLastReadingsValid & ( 1UL << uxProbe ) ) != 0 ) )
+    {
+        *pusReading = pusLastReadings[ uxProbe ];
+        xResult = pdTRUE;
+    }
+
+    return xResult;
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file sample_filter.c
+ * @brief Decimating median + IIR filter for raw ADC samples.
+ */
+
+#include "FreeRTOS.h"
+
+#include "sample_filter.h"
+
+#include <string.h>
+
+/*-----------------------------------------------------------*/
+
+void vSampleFilter_Init( SampleFilter_t * pxFilter,
+                         uint8_t ucIirShift )
+{
+    configASSERT( pxFilter != NULL );
+    configASSERT( ucIirShift < 16 );
+
+    ( void ) memset( pxFilter, 0, sizeof( SampleFilter_t ) );
+
+    pxFilter->ucIirShift = ucIirShift;
+    pxFilter->xPrimed = pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint16_t prvMedian( uint16_t * pusWindow,
+                           size_t uxLen )
+{
+    /* Insertion sort in place, the window is small and discarded afterwards. */
+    for( size_t i = 1; i < uxLen; i++ )
+    {
+        uint16_t usKey = pusWindow[ i ];
+        size_t j = i;
+
+        while( ( j > 0 ) && ( pusWindow[ j - 1 ] > usKey ) )
+        {
+            pusWindow[ j ] = pusWindow[ j - 1 ];
+            j--;
+        }
+
+        pusWindow[ j ] = usKey;
+    }
+
+    return pusWindow[ uxLen / 2 ];
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xSampleFilter_Push( SampleFilter_t * pxFilter,
+                               uint16_t usSample,
+                               uint16_t * pusOut )
+{
+    BaseType_t xOutputReady = pdFALSE;
+
+    configASSERT( pxFilter != NULL );
+
+    pxFilter->pusWindow[ pxFilter->uxWindowFill ] = usSample;
+    pxFilter->uxWindowFill++;
+
+    if( pxFilter->uxWindowFill >= SAMPLE_FILTER_MEDIAN_LEN )
+    {
+        int32_t lMedian = ( int32_t ) prvMedian( pxFilter->pusWindow, SAMPLE_FILTER_MEDIAN_LEN );
+
+        lMedian <<= SAMPLE_FILTER_FRAC_BITS;
+
+        if( pxFilter->xPrimed == pdFALSE )
+        {
+            /* Seed the accumulator so the output does not ramp up from zero */
+            pxFilter->lIirState = lMedian;
+            pxFilter->xPrimed = pdTRUE;
+        }
+        else
+        {
+            pxFilter->lIirState += ( lMedian - pxFilter->lIirState ) >> pxFilter->ucIirShift;
+        }
+
+        pxFilter->uxWindowFill = 0;
+        pxFilter->ulOutputCount++;
+        xOutputReady = pdTRUE;
+
+        if( pusOut != NULL )
+        {
+            *pusOut = usSampleFilter_Value( pxFilter );
+        }
+    }
+
+    return xOutputReady;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxSampleFilter_PushBlock( SampleFilter_t * pxFilter,
+                                 const uint16_t * pusSamples,
+                                 size_t uxNumSamples,
+                                 uint16_t * pusOut )
+{
+    size_t uxOutputs = 0;
+
+    configASSERT( pusSamples != NULL || uxNumSamples == 0 );
+
+    for( size_t uxIdx = 0; uxIdx < uxNumSamples; uxIdx++ )
+    {
+        if( xSampleFilter_Push( pxFilter, pusSamples[ uxIdx ], pusOut ) == pdTRUE )
+        {
+            uxOutputs++;
+        }
+    }
+
+    return uxOutputs;
+}
+
+/*-----------------------------------------------------------*/
+
+uint16_t usSampleFilter_Value( const SampleFilter_t * pxFilter )
+{
+    int32_t lRounded = 0;
+
+    configASSERT( pxFilter != NULL );
+
+    lRounded = pxFilter->lIirState + ( 1 << ( SAMPLE_FILTER_FRAC_BITS - 1 ) );
+
+    return ( uint16_t ) ( lRounded >> SAMPLE_FILTER_FRAC_BITS );
+}
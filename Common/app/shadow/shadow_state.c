@@ -0,0 +1,405 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file shadow_state.c
+ * @brief Table driven device shadow state with reported/desired diffing.
+ */
+
+#include "logging_levels.h"
+
+#define LOG_LEVEL    LOG_INFO
+
+#include "logging.h"
+
+#include "FreeRTOS.h"
+
+#include "json_extract.h"
+#include "json_writer.h"
+#include "shadow_state.h"
+
+#include <string.h>
+
+/* Number of digits in the client token */
+#define SHADOW_STATE_TOKEN_DIGITS    ( 6U )
+
+/*-----------------------------------------------------------*/
+
+/* Values are compared by fingerprint so the state does not hold copies of strings */
+static uint32_t prvFingerprint( const ShadowProperty_t * pxProp,
+                                const ShadowValue_t * pxValue )
+{
+    uint32_t ulHash = 2166136261UL;
+
+    if( pxProp->xType == SHADOW_PROP_STRING )
+    {
+        for( const char * pcChar = pxValue->pcValue; *pcChar != '\0'; pcChar++ )
+        {
+            ulHash = ( ulHash ^ ( uint8_t ) *pcChar ) * 16777619UL;
+        }
+    }
+    else
+    {
+        ulHash = pxValue->ulValue;
+    }
+
+    return ulHash;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadProperty( const ShadowProperty_t * pxProp,
+                                   ShadowValue_t * pxValue )
+{
+    BaseType_t xResult = pdFALSE;
+
+    ( void ) memset( pxValue, 0, sizeof( ShadowValue_t ) );
+
+    xResult = pxProp->pxRead( pxProp, pxValue );
+
+    if( pxProp->xType == SHADOW_PROP_BOOL )
+    {
+        pxValue->ulValue = ( pxValue->ulValue != 0 ) ? 1U : 0U;
+    }
+
+    pxValue->pcValue[ SHADOW_STATE_MAX_STR_LEN - 1 ] = '\0';
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvSameGroup( const char * pcGroupA,
+                                const char * pcGroupB )
+{
+    BaseType_t xSame = pdFALSE;
+
+    if( ( pcGroupA == NULL ) || ( pcGroupB == NULL ) )
+    {
+        xSame = ( pcGroupA == pcGroupB ) ? pdTRUE : pdFALSE;
+    }
+    else
+    {
+        xSame = ( strcmp( pcGroupA, pcGroupB ) == 0 ) ? pdTRUE : pdFALSE;
+    }
+
+    return xSame;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Convert an extracted value. Strings must fit the value buffer.
+ */
+static BaseType_t prvToShadowValue( const ShadowProperty_t * pxProp,
+                                    const JsonExtractValue_t * pxExtracted,
+                                    ShadowValue_t * pxValue )
+{
+    BaseType_t xResult = pdTRUE;
+
+    ( void ) memset( pxValue, 0, sizeof( ShadowValue_t ) );
+
+    if( pxProp->xType != SHADOW_PROP_STRING )
+    {
+        pxValue->ulValue = pxExtracted->ulValue;
+    }
+    else if( pxExtracted->uxValueLen < SHADOW_STATE_MAX_STR_LEN )
+    {
+        ( void ) memcpy( pxValue->pcValue, pxExtracted->pcValue, pxExtracted->uxValueLen );
+    }
+    else
+    {
+        xResult = pdFALSE;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vShadowState_Init( ShadowState_t * pxState,
+                        const ShadowProperty_t * pxProps,
+                        size_t uxNumProps )
+{
+    configASSERT( pxState != NULL );
+    configASSERT( pxProps != NULL );
+    configASSERT( uxNumProps <= SHADOW_STATE_MAX_PROPERTIES );
+
+    ( void ) memset( pxState, 0, sizeof( ShadowState_t ) );
+
+    pxState->pxProps = pxProps;
+    pxState->uxNumProps = uxNumProps;
+
+    for( size_t uxIdx = 0; uxIdx < uxNumProps; uxIdx++ )
+    {
+        configASSERT( pxProps[ uxIdx ].pcName != NULL );
+        configASSERT( pxProps[ uxIdx ].pxRead != NULL );
+
+        pxState->pxKeys[ uxIdx ].pcObject = pxProps[ uxIdx ].pcGroup;
+        pxState->pxKeys[ uxIdx ].pcKey = pxProps[ uxIdx ].pcName;
+
+        switch( pxProps[ uxIdx ].xType )
+        {
+            case SHADOW_PROP_BOOL:
+                pxState->pxKeys[ uxIdx ].xType = JSON_EXTRACT_BOOL;
+                break;
+
+            case SHADOW_PROP_UINT:
+                pxState->pxKeys[ uxIdx ].xType = JSON_EXTRACT_UINT;
+                break;
+
+            default:
+                pxState->pxKeys[ uxIdx ].xType = JSON_EXTRACT_STRING;
+                break;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vShadowState_Invalidate( ShadowState_t * pxState )
+{
+    configASSERT( pxState != NULL );
+
+    pxState->ulReportedMask = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulShadowState_GetDirty( ShadowState_t * pxState )
+{
+    uint32_t ulDirty = 0;
+
+    configASSERT( pxState != NULL );
+
+    for( size_t uxIdx = 0; uxIdx < pxState->uxNumProps; uxIdx++ )
+    {
+        const ShadowProperty_t * pxProp = &( pxState->pxProps[ uxIdx ] );
+        const uint32_t ulBit = 1UL << uxIdx;
+        ShadowValue_t xValue;
+
+        if( prvReadProperty( pxProp, &xValue ) == pdFALSE )
+        {
+            /* Nothing to report */
+        }
+        else if( ( ( pxState->ulReportedMask & ulBit ) == 0 ) ||
+                 ( pxState->pulReported[ uxIdx ] != prvFingerprint( pxProp, &xValue ) ) )
+        {
+            ulDirty |= ulBit;
+        }
+        else
+        {
+            /* Unchanged */
+        }
+    }
+
+    return ulDirty;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxShadowState_FormatReport( ShadowState_t * pxState,
+                                   uint32_t ulMask,
+                                   uint32_t ulClientToken,
+                                   char * pcBuffer,
+                                   size_t uxBufferLen )
+{
+    JsonWriter_t xWriter;
+    const char * pcOpenGroup = NULL;
+    size_t uxDocumentLen = 0;
+
+    configASSERT( pxState != NULL );
+    configASSERT( pcBuffer != NULL );
+
+    pxState->ulInFlightMask = 0;
+
+    vJsonWriter_Init( &xWriter, pcBuffer, uxBufferLen );
+
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_BeginObject( &xWriter, "state" );
+    vJsonWriter_BeginObject( &xWriter, "reported" );
+
+    for( size_t uxIdx = 0; uxIdx < pxState->uxNumProps; uxIdx++ )
+    {
+        const ShadowProperty_t * pxProp = &( pxState->pxProps[ uxIdx ] );
+        const uint32_t ulBit = 1UL << uxIdx;
+        ShadowValue_t xValue;
+
+        if( ( ( ulMask & ulBit ) != 0 ) &&
+            ( prvReadProperty( pxProp, &xValue ) == pdTRUE ) )
+        {
+            if( prvSameGroup( pcOpenGroup, pxProp->pcGroup ) == pdFALSE )
+            {
+                if( pcOpenGroup != NULL )
+                {
+                    vJsonWriter_EndObject( &xWriter );
+                }
+
+                if( pxProp->pcGroup != NULL )
+                {
+                    vJsonWriter_BeginObject( &xWriter, pxProp->pcGroup );
+                }
+
+                pcOpenGroup = pxProp->pcGroup;
+            }
+
+            if( pxProp->xType == SHADOW_PROP_STRING )
+            {
+                vJsonWriter_String( &xWriter, pxProp->pcName, xValue.pcValue );
+            }
+            else
+            {
+                vJsonWriter_UInt( &xWriter, pxProp->pcName, xValue.ulValue );
+            }
+
+            pxState->pulInFlight[ uxIdx ] = prvFingerprint( pxProp, &xValue );
+            pxState->ulInFlightMask |= ulBit;
+        }
+    }
+
+    if( pcOpenGroup != NULL )
+    {
+        vJsonWriter_EndObject( &xWriter );
+    }
+
+    vJsonWriter_EndObject( &xWriter );
+    vJsonWriter_EndObject( &xWriter );
+    vJsonWriter_UIntString( &xWriter, "clientToken", ulClientToken, SHADOW_STATE_TOKEN_DIGITS );
+    vJsonWriter_EndObject( &xWriter );
+
+    uxDocumentLen = uxJsonWriter_Finish( &xWriter );
+
+    if( uxDocumentLen == 0 )
+    {
+        LogError( "Shadow report does not fit in %lu bytes.", ( unsigned long ) uxBufferLen );
+        pxState->ulInFlightMask = 0;
+    }
+
+    return uxDocumentLen;
+}
+
+/*-----------------------------------------------------------*/
+
+void vShadowState_ReportDone( ShadowState_t * pxState,
+                              BaseType_t xAccepted )
+{
+    configASSERT( pxState != NULL );
+
+    if( xAccepted == pdTRUE )
+    {
+        for( size_t uxIdx = 0; uxIdx < pxState->uxNumProps; uxIdx++ )
+        {
+            if( ( pxState->ulInFlightMask & ( 1UL << uxIdx ) ) != 0 )
+            {
+                pxState->pulReported[ uxIdx ] = pxState->pulInFlight[ uxIdx ];
+            }
+        }
+
+        pxState->ulReportedMask |= pxState->ulInFlightMask;
+    }
+
+    pxState->ulInFlightMask = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void vShadowState_SetReported( ShadowState_t * pxState,
+                               const char * pcReported,
+                               size_t uxReportedLen )
+{
+    JsonExtractValue_t pxValues[ SHADOW_STATE_MAX_PROPERTIES ];
+    uint32_t ulFound = 0;
+
+    configASSERT( pxState != NULL );
+
+    pxState->ulReportedMask = 0;
+
+    if( pcReported != NULL )
+    {
+        ulFound = ulJsonExtract_Validated( pcReported, uxReportedLen,
+                                           pxState->pxKeys, pxState->uxNumProps, pxValues );
+    }
+
+    for( size_t uxIdx = 0; uxIdx < pxState->uxNumProps; uxIdx++ )
+    {
+        const ShadowProperty_t * pxProp = &( pxState->pxProps[ uxIdx ] );
+        ShadowValue_t xValue;
+
+        /* Values missing or not matching the property type stay unknown and are reported again */
+        if( ( ( ulFound & ( 1UL << uxIdx ) ) != 0 ) &&
+            ( prvToShadowValue( pxProp, &( pxValues[ uxIdx ] ), &xValue ) == pdTRUE ) )
+        {
+            pxState->pulReported[ uxIdx ] = prvFingerprint( pxProp, &xValue );
+            pxState->ulReportedMask |= 1UL << uxIdx;
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxShadowState_ApplyDesired( const ShadowState_t * pxState,
+                                   const char * pcDesired,
+                                   size_t uxDesiredLen )
+{
+    JsonExtractValue_t pxValues[ SHADOW_STATE_MAX_PROPERTIES ];
+    uint32_t ulFound = 0;
+    size_t uxApplied = 0;
+
+    configASSERT( pxState != NULL );
+
+    if( pcDesired != NULL )
+    {
+        ulFound = ulJsonExtract_Validated( pcDesired, uxDesiredLen,
+                                           pxState->pxKeys, pxState->uxNumProps, pxValues );
+    }
+
+    for( size_t uxIdx = 0; ( uxIdx < pxState->uxNumProps ) && ( pcDesired != NULL ); uxIdx++ )
+    {
+        const ShadowProperty_t * pxProp = &( pxState->pxProps[ uxIdx ] );
+        ShadowValue_t xValue;
+
+        if( ( pxProp->pxApply == NULL ) ||
+            ( pxValues[ uxIdx ].pcValue == NULL ) )
+        {
+            /* Read only or not part of this document */
+        }
+        else if( ( ( ulFound & ( 1UL << uxIdx ) ) == 0 ) ||
+                 ( prvToShadowValue( pxProp, &( pxValues[ uxIdx ] ), &xValue ) == pdFALSE ) )
+        {
+            LogError( "Ignoring invalid desired value for %s: %.*s", pxProp->pcName,
+                      ( int ) pxValues[ uxIdx ].uxValueLen, pxValues[ uxIdx ].pcValue );
+        }
+        else if( pxProp->pxApply( pxProp, &xValue ) == pdTRUE )
+        {
+            uxApplied++;
+        }
+        else
+        {
+            LogWarn( "Desired value for %s was not applied.", pxProp->pcName );
+        }
+    }
+
+    return uxApplied;
+}
@@ -25,24 +25,30 @@
  */
 
 /*
- * Demo for showing how to use the Device Shadow library's API. This version
- * of the Device Shadow API provides macros and helper functions for assembling MQTT topics
+ * Keeps the device shadow in sync with the device. This version of the Device
+ * Shadow API provides macros and helper functions for assembling MQTT topics
  * strings, and for determining whether an incoming MQTT message is related to the
  * device shadow.
  *
- * This example assumes there is a powerOn state in the device shadow. It does the
- * following operations:
- * 1. Assemble strings for the MQTT topics of device shadow, by using macros defined by the Device Shadow library.
+ * The shadow properties are listed in xShadowProperties and tracked by the
+ * shadow state engine. With shadowCONFIG_ZONE_SHADOWS the powerOn state of each
+ * irrigation zone lives in a named shadow of its own. The task does the following
+ * operations for every shadow document:
+ * 1. Assemble strings for the MQTT topics of the shadow.
  * 2. Subscribe to those MQTT topics using the MQTT Agent.
  * 3. Register callbacks for incoming shadow topic publishes with the subsciption_manager.
- * 3. Publish to report the current state of powerOn.
- * 5. Check if powerOn has been changed and send an update if so.
- * 6. If a publish to update reported state was sent, wait until either prvIncomingPublishUpdateAcceptedCallback
- *    or prvIncomingPublishUpdateRejectedCallback handle the response.
- * 7. Wait until time for next check and repeat from step 5.
+ * 4. On every connection, request the whole document on /get.
+ *    prvIncomingPublishGetAcceptedCallback applies the desired state and records
+ *    the reported state in one pass, so the relay is corrected without waiting
+ *    for a delta.
+ * 5. Publish a report containing the properties that differ from the reported state.
+ * 6. Wait until a property may have changed, e.g. a valve opened or a delta was applied.
+ * 7. Publish a report containing only the properties that changed and wait until either
+ *    prvIncomingPublishUpdateAcceptedCallback or prvIncomingPublishRejectedCallback
+ *    handle the response. Repeat from step 6.
  *
  * Meanwhile, when prvIncomingPublishUpdateDeltaCallback receives changes to the shadow state,
- * it will apply them on the device.
+ * it will apply them on the device through the property handlers.
  */
 
 #include "logging_levels.h"
@@ -60,6 +66,7 @@
 /* Kernel includes. */
 #include "FreeRTOS.h"
 #include "task.h"
+#include "atomic.h"
 #include "sys_evt.h"
 
 /* MQTT library includes. */
@@ -67,69 +74,85 @@
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
+#include "publish_buffer_pool.h"
 
 /* JSON library includes. */
 #include "core_json.h"
+#include "json_writer.h"
 
 /* Shadow API header. */
 #include "shadow.h"
 
 #include "kvstore.h"
+#include "irrigation_ctrl.h"
+#include "shadow_state.h"
+#include "json_extract.h"
+#include "ota_appversion32.h"
 
 #include "hw_defs.h"
 
 /**
- * @brief Format string representing a Shadow document with a "reported" state.
+ * @brief Shadow document with a "reported" state, built by uxShadowState_FormatReport.
  *
  * The real json document will look like this:
  * {
  *   "state": {
  *     "reported": {
- *       "powerOn": 1
+ *       "powerOn": 1,
+ *       "irrigation": {
+ *         "mode": 2
+ *       }
  *     }
  *   },
  *   "clientToken": "021909"
  * }
  *
+ * Only properties that changed since the last accepted report are included.
  * Note the client token, which is optional. The token is used to identify the
  * response to an update. The client token must be unique at any given time,
  * but may be reused once the update is completed. For this demo, a timestamp
  * is used for a client token.
  */
 
-// MICHAEL - added GPIOOn
-#define shadowexampleSHADOW_REPORTED_JSON \
-    "{"                                   \
-    "\"state\":{"                         \
-    "\"reported\":{"                      \
-    "\"powerOn\":%1u"                     \
-    "}"                                   \
-    "},"                                  \
-    "\"clientToken\":\"%06lu\""           \
-    "}"
+/**
+ * @brief Time in ms between rescans of the properties. Settings changed from
+ * the CLI do not raise an event. A rescan only publishes if something changed.
+ */
+#define shadowMS_BETWEEN_RESCANS                       ( 60000U )
 
 /**
- * @brief The expected size of #SHADOW_REPORTED_JSON.
- *
- * Since all of the format specifiers in #SHADOW_REPORTED_JSON include a length,
- * its actual size can be calculated at compile time from the difference between
- * the lengths of the format strings and their formatted output. We must subtract 2
- * from the length as according the following formula:
- * 1. The length of the format string "%1u" is 3.
- * 2. The length of the format string "%06lu" is 5.
- * 3. The formatted length in case 1. is 1 ( for the state of powerOn ).
- * 4. The formatted length in case 2. is 6 ( for the clientToken length ).
- * 5. Thus the additional size of our format is 2 = 3 + 5 - 1 - 6 + 1 (termination character).
- *
- * Custom applications may calculate the length of the JSON document with the same method.
+ * @brief Time in ms between checks of the MQTT connection while idle. A
+ * reconnect triggers a /get of every shadow document.
  */
-// MICHAEL - changed to 5
-#define shadowexampleSHADOW_REPORTED_JSON_LENGTH       ( sizeof( shadowexampleSHADOW_REPORTED_JSON ) - 2 )
+#define shadowMS_CONNECTION_POLL                       ( 1000U )
 
 /**
- * @brief Time in ms to wait between checking for updates to report.
+ * @brief Number of irrigation zones mirrored in the named shadows "zone0",
+ * "zone1", ... Each one holds the powerOn state of its zone, which keeps the
+ * update documents small. With 0 the powerOn state of zone 0 is part of the
+ * classic shadow.
  */
-#define shadowMS_BETWEEN_REPORTS                       ( 15000U )
+#ifndef shadowCONFIG_ZONE_SHADOWS
+#define shadowCONFIG_ZONE_SHADOWS                      ( 0 )
+#endif
+
+#if shadowCONFIG_ZONE_SHADOWS > IRRIGATION_MAX_ZONES
+#error "shadowCONFIG_ZONE_SHADOWS exceeds IRRIGATION_MAX_ZONES"
+#endif
+
+/* The classic shadow followed by the zone shadows */
+#define shadowNUM_DOCUMENTS                            ( 1 + shadowCONFIG_ZONE_SHADOWS )
+
+/* Longest shadow name, "zone" and up to three digits */
+#define shadowMAX_SHADOW_NAME_LEN                      ( 8 )
+
+/**
+ * @brief Task notification bits. ACCEPTED and REJECTED answer both /update
+ * and /get requests, only one request is outstanding at a time.
+ */
+#define shadowEVT_CHANGED                              ( 1U << 0 )
+#define shadowEVT_ACCEPTED                             ( 1U << 1 )
+#define shadowEVT_REJECTED                             ( 1U << 2 )
 
 /**
  * @brief This demo uses task notifications to signal tasks from MQTT callback
@@ -146,11 +169,9 @@
 #define shadowexampleMAX_COMMAND_SEND_BLOCK_TIME_MS    ( 60 * 1000 )
 
 /**
- * @brief An invalid value for the powerOn state. This is used to set the last
- * reported state to a value that will not match the current state. As we only
- * set the powerOn state to 0 or 1, any other value will suffice.
+ * @brief Irrigation zone whose valve is reported and requested as powerOn.
  */
-#define shadowexampleINVALID_POWERON_STATE             ( 2 )
+#define shadowexampleIRRIGATION_ZONE                   ( 0 )
 
 /**
  * @brief Defines structure passed to callbacks and local functions.
@@ -159,27 +180,31 @@ typedef struct MQTTAgentCommandContext
 {
     char * pcDeviceName;
     uint8_t ucDeviceNameLen;
+
+    /**
+     * @brief Name of a named shadow, or NULL for the classic shadow.
+     */
+    const char * pcShadowName;
+
     char * pcTopicUpdate;
     uint16_t usTopicUpdateLen;
     char * pcTopicUpdateDelta;
-    uint16_t usTopicUpdateDeltaLen;
     char * pcTopicUpdateAccepted;
-    uint16_t usTopicUpdateAcceptedLen;
     char * pcTopicUpdateRejected;
-    uint16_t usTopicUpdateRejectedLen;
-    char * pcTopicDelete;
-    uint16_t usTopicDeleteLen;
+    char * pcTopicGet;
+    uint16_t usTopicGetLen;
+    char * pcTopicGetAccepted;
+    char * pcTopicGetRejected;
 
     /**
-     * @brief The simulated device current power on state.
+     * @brief Last accepted value of each property of this shadow.
      */
-    uint32_t ulCurrentPowerOnState;
+    ShadowState_t xState;
 
     /**
-     * @brief The last reported state. It is initialized to an invalid value so that
-     * an update is initially sent.
+     * @brief Latest document version received on /update/delta or /get/accepted.
      */
-    uint32_t ulReportedPowerOnState;
+    uint32_t ulVersion;
 
     /**
      * @brief Match the received clientToken with the one sent in a device shadow
@@ -197,6 +222,50 @@ typedef struct MQTTAgentCommandContext
 
 extern MQTTAgentContext_t xGlobalMqttAgentContext;
 
+/* Notified from the valve hook, which has no context */
+static TaskHandle_t xShadowTaskHandle = NULL;
+
+/* Notification bits received while waiting for other ones */
+static uint32_t ulPendingEvents = 0;
+
+/* KVStore keys set from desired values in the agent callbacks, written to
+ * flash by the shadow task */
+static uint32_t pulUncommittedKeys[ ( CS_NUM_KEYS + 31 ) / 32 ];
+
+static ShadowDeviceCtx_t xShadowDocs[ shadowNUM_DOCUMENTS ];
+
+#if shadowCONFIG_ZONE_SHADOWS > 0
+    static ShadowProperty_t xZoneProperties[ shadowCONFIG_ZONE_SHADOWS ];
+    static char pcZoneShadowNames[ shadowCONFIG_ZONE_SHADOWS ][ shadowMAX_SHADOW_NAME_LEN ];
+#endif
+
+/**
+ * @brief Members of the shadow response documents. Every callback extracts
+ * the whole table in one pass over its payload.
+ */
+typedef enum
+{
+    shadowKEY_CLIENT_TOKEN = 0,
+    shadowKEY_VERSION,
+    shadowKEY_CODE,
+    shadowKEY_STATE,
+    shadowKEY_DESIRED,
+    shadowKEY_REPORTED,
+    shadowNUM_RESPONSE_KEYS
+} ShadowResponseKey_t;
+
+#define shadowKEY_BIT( xKey )    ( 1UL << ( xKey ) )
+
+static const JsonExtractKey_t xResponseKeys[ shadowNUM_RESPONSE_KEYS ] =
+{
+    { NULL,    "clientToken", JSON_EXTRACT_DIGITS }, /* shadowKEY_CLIENT_TOKEN */
+    { NULL,    "version",     JSON_EXTRACT_UINT   }, /* shadowKEY_VERSION */
+    { NULL,    "code",        JSON_EXTRACT_UINT   }, /* shadowKEY_CODE, /rejected only */
+    { NULL,    "state",       JSON_EXTRACT_ANY    }, /* shadowKEY_STATE, the desired values of a delta */
+    { "state", "desired",     JSON_EXTRACT_ANY    }, /* shadowKEY_DESIRED, /get/accepted only */
+    { "state", "reported",    JSON_EXTRACT_ANY    }, /* shadowKEY_REPORTED, /get/accepted only */
+};
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -205,7 +274,7 @@ extern MQTTAgentContext_t xGlobalMqttAgentContext;
  * @return true if the subscribe is successful;
  * false otherwise.
  */
-static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx );
+static bool prvSubscribeToShadowTopics( ShadowDeviceCtx_t * pxCtx );
 
 /**
  * @brief The callback to execute when there is an incoming publish on the
@@ -228,32 +297,42 @@ static void prvIncomingPublishUpdateAcceptedCallback( void * pvCtx,
 /**
  * @brief The callback to execute when there is an incoming publish on the
  * topic for rejected requests. It verifies the document is valid and is being waited on.
- * If so it notifies the task to inform completion of the update request.
+ * If so it notifies the task to inform completion of the update or get request.
  */
-static void prvIncomingPublishUpdateRejectedCallback( void * pvCtx,
-                                                      MQTTPublishInfo_t * pxPublishInfo );
+static void prvIncomingPublishRejectedCallback( void * pvCtx,
+                                                MQTTPublishInfo_t * pxPublishInfo );
 
 /**
- * @brief Entry point of shadow demo.
+ * @brief The callback to execute when there is an incoming publish on the
+ * topic for accepted get requests. It takes the reported state as the last
+ * accepted one and applies the desired state, then notifies the task.
+ */
+static void prvIncomingPublishGetAcceptedCallback( void * pvCtx,
+                                                   MQTTPublishInfo_t * pxPublishInfo );
+
+/**
+ * @brief Entry point of the shadow task.
  *
- * This main function demonstrates how to use the macros provided by the
- * Device Shadow library to assemble strings for the MQTT topics defined
- * by AWS IoT Device Shadow. It uses these macros for topics to subscribe
- * to:
- * - SHADOW_TOPIC_STRING_UPDATE_DELTA for "$aws/things/thingName/shadow/update/delta"
- * - SHADOW_TOPIC_STRING_UPDATE_ACCEPTED for "$aws/things/thingName/shadow/update/accepted"
- * - SHADOW_TOPIC_STRING_UPDATE_REJECTED for "$aws/things/thingName/shadow/update/rejected"
+ * For every shadow document it subscribes to:
+ * - "$aws/things/thingName/shadow/update/delta"
+ * - "$aws/things/thingName/shadow/update/accepted"
+ * - "$aws/things/thingName/shadow/update/rejected"
+ * - "$aws/things/thingName/shadow/get/accepted"
+ * - "$aws/things/thingName/shadow/get/rejected"
  *
- * It also uses these macros for topics to publish to:
- * - SHADOW_TOPIC_STIRNG_DELETE for "$aws/things/thingName/shadow/delete"
- * - SHADOW_TOPIC_STRING_UPDATE for "$aws/things/thingName/shadow/update"
+ * and publishes to:
+ * - "$aws/things/thingName/shadow/update"
+ * - "$aws/things/thingName/shadow/get"
+ *
+ * Named shadows use "$aws/things/thingName/shadow/name/shadowName/..." instead.
  */
 void vShadowDeviceTask( void * pvParameters );
 
-static bool prvInitializeCtx( ShadowDeviceCtx_t * pxCtx )
+/**
+ * @brief Read the thing name from KVStore into pxCtx.
+ */
+static bool prvGetThingName( ShadowDeviceCtx_t * pxCtx )
 {
-    bool xSuccess = true;
-
     configASSERT( pxCtx );
 
     pxCtx->pcDeviceName = NULL;
@@ -275,117 +354,386 @@ static bool prvInitializeCtx( ShadowDeviceCtx_t * pxCtx )
         }
     }
 
-    if( ( pxCtx->pcDeviceName != NULL ) &&
-        ( pxCtx->ucDeviceNameLen > 0 ) )
-    {
-        ShadowStatus_t xStatus = SHADOW_SUCCESS;
+    return( ( pxCtx->pcDeviceName != NULL ) &&
+            ( pxCtx->ucDeviceNameLen > 0 ) );
+}
 
-        pxCtx->usTopicUpdateLen = SHADOW_TOPIC_LENGTH_UPDATE( pxCtx->ucDeviceNameLen );
-        pxCtx->pcTopicUpdate = pvPortMalloc( pxCtx->usTopicUpdateLen );
+/*-----------------------------------------------------------*/
 
-        xStatus |= Shadow_GetTopicString( ShadowTopicStringTypeUpdate,
-                                          pxCtx->pcDeviceName,
-                                          pxCtx->ucDeviceNameLen,
-                                          pxCtx->pcTopicUpdate,
-                                          pxCtx->usTopicUpdateLen,
-                                          &( pxCtx->usTopicUpdateLen ) );
+/**
+ * @brief Allocate the NUL terminated topic of pcOperation, e.g. "update/delta",
+ * for the shadow of pxCtx.
+ */
+static char * prvBuildTopic( const ShadowDeviceCtx_t * pxCtx,
+                             const char * pcOperation,
+                             uint16_t * pusTopicLen )
+{
+    char * pcTopic = NULL;
+    int lTopicLen = 0;
 
-        pxCtx->usTopicUpdateDeltaLen = SHADOW_TOPIC_LENGTH_UPDATE_DELTA( pxCtx->ucDeviceNameLen );
-        pxCtx->pcTopicUpdateDelta = pvPortMalloc( pxCtx->usTopicUpdateDeltaLen );
+    if( pxCtx->pcShadowName == NULL )
+    {
+        lTopicLen = snprintf( NULL, 0, SHADOW_PREFIX "%.*s/shadow/%s",
+                              ( int ) pxCtx->ucDeviceNameLen, pxCtx->pcDeviceName, pcOperation );
+    }
+    else
+    {
+        lTopicLen = snprintf( NULL, 0, SHADOW_PREFIX "%.*s/shadow/name/%s/%s",
+                              ( int ) pxCtx->ucDeviceNameLen, pxCtx->pcDeviceName, pxCtx->pcShadowName, pcOperation );
+    }
 
-        xStatus |= Shadow_GetTopicString( ShadowTopicStringTypeUpdateDelta,
-                                          pxCtx->pcDeviceName,
-                                          pxCtx->ucDeviceNameLen,
-                                          pxCtx->pcTopicUpdateDelta,
-                                          pxCtx->usTopicUpdateDeltaLen,
-                                          &( pxCtx->usTopicUpdateDeltaLen ) );
+    if( ( lTopicLen > 0 ) && ( lTopicLen < UINT16_MAX ) )
+    {
+        pcTopic = pvPortMalloc( ( size_t ) lTopicLen + 1 );
+    }
 
-        pxCtx->usTopicUpdateAcceptedLen = SHADOW_TOPIC_LENGTH_UPDATE_ACCEPTED( pxCtx->ucDeviceNameLen );
-        pxCtx->pcTopicUpdateAccepted = pvPortMalloc( pxCtx->usTopicUpdateAcceptedLen );
+    if( pcTopic != NULL )
+    {
+        if( pxCtx->pcShadowName == NULL )
+        {
+            ( void ) snprintf( pcTopic, ( size_t ) lTopicLen + 1, SHADOW_PREFIX "%.*s/shadow/%s",
+                               ( int ) pxCtx->ucDeviceNameLen, pxCtx->pcDeviceName, pcOperation );
+        }
+        else
+        {
+            ( void ) snprintf( pcTopic, ( size_t ) lTopicLen + 1, SHADOW_PREFIX "%.*s/shadow/name/%s/%s",
+                               ( int ) pxCtx->ucDeviceNameLen, pxCtx->pcDeviceName, pxCtx->pcShadowName, pcOperation );
+        }
 
-        xStatus |= Shadow_GetTopicString( ShadowTopicStringTypeUpdateAccepted,
-                                          pxCtx->pcDeviceName,
-                                          pxCtx->ucDeviceNameLen,
-                                          pxCtx->pcTopicUpdateAccepted,
-                                          pxCtx->usTopicUpdateAcceptedLen,
-                                          &( pxCtx->usTopicUpdateAcceptedLen ) );
+        if( pusTopicLen != NULL )
+        {
+            *pusTopicLen = ( uint16_t ) lTopicLen;
+        }
+    }
 
-        pxCtx->usTopicUpdateRejectedLen = SHADOW_TOPIC_LENGTH_UPDATE_REJECTED( pxCtx->ucDeviceNameLen );
-        pxCtx->pcTopicUpdateRejected = pvPortMalloc( pxCtx->usTopicUpdateRejectedLen );
+    return pcTopic;
+}
 
-        xStatus |= Shadow_GetTopicString( ShadowTopicStringTypeUpdateRejected,
-                                          pxCtx->pcDeviceName,
-                                          pxCtx->ucDeviceNameLen,
-                                          pxCtx->pcTopicUpdateRejected,
-                                          pxCtx->usTopicUpdateRejectedLen,
-                                          &( pxCtx->usTopicUpdateRejectedLen ) );
+/*-----------------------------------------------------------*/
 
+static bool prvInitializeCtx( ShadowDeviceCtx_t * pxCtx,
+                              const char * pcShadowName,
+                              const ShadowProperty_t * pxProps,
+                              size_t uxNumProps )
+{
+    configASSERT( pxCtx );
+    configASSERT( pxCtx->pcDeviceName );
+
+    pxCtx->pcShadowName = pcShadowName;
+    pxCtx->xShadowDeviceTaskHandle = xShadowTaskHandle;
+    pxCtx->xAgentHandle = xGetMqttAgentHandle();
+
+    vShadowState_Init( &( pxCtx->xState ), pxProps, uxNumProps );
+
+    pxCtx->pcTopicUpdate = prvBuildTopic( pxCtx, "update", &( pxCtx->usTopicUpdateLen ) );
+    pxCtx->pcTopicUpdateDelta = prvBuildTopic( pxCtx, "update/delta", NULL );
+    pxCtx->pcTopicUpdateAccepted = prvBuildTopic( pxCtx, "update/accepted", NULL );
+    pxCtx->pcTopicUpdateRejected = prvBuildTopic( pxCtx, "update/rejected", NULL );
+    pxCtx->pcTopicGet = prvBuildTopic( pxCtx, "get", &( pxCtx->usTopicGetLen ) );
+    pxCtx->pcTopicGetAccepted = prvBuildTopic( pxCtx, "get/accepted", NULL );
+    pxCtx->pcTopicGetRejected = prvBuildTopic( pxCtx, "get/rejected", NULL );
+
+    return( ( pxCtx->pcTopicUpdate != NULL ) &&
+            ( pxCtx->pcTopicUpdateDelta != NULL ) &&
+            ( pxCtx->pcTopicUpdateAccepted != NULL ) &&
+            ( pxCtx->pcTopicUpdateRejected != NULL ) &&
+            ( pxCtx->pcTopicGet != NULL ) &&
+            ( pxCtx->pcTopicGetAccepted != NULL ) &&
+            ( pxCtx->pcTopicGetRejected != NULL ) );
+}
 
-        pxCtx->usTopicDeleteLen = SHADOW_TOPIC_LENGTH_DELETE( pxCtx->ucDeviceNameLen );
-        pxCtx->pcTopicDelete = pvPortMalloc( pxCtx->usTopicDeleteLen );
+/*-----------------------------------------------------------*/
 
-        xStatus |= Shadow_GetTopicString( ShadowTopicStringTypeDelete,
-                                          pxCtx->pcDeviceName,
-                                          pxCtx->ucDeviceNameLen,
-                                          pxCtx->pcTopicDelete,
-                                          pxCtx->usTopicDeleteLen,
-                                          &( pxCtx->usTopicDeleteLen ) );
+static bool prvSubscribeToShadowTopics( ShadowDeviceCtx_t * pxCtx )
+{
+    MQTTStatus_t xStatus = MQTTSuccess;
 
-        xSuccess &= ( xStatus == SHADOW_SUCCESS );
+    const struct
+    {
+        const char * pcTopic;
+        IncomingPubCallback_t pxCallback;
     }
-    else
+    xSubscriptions[] =
     {
-        xSuccess = false;
+        { pxCtx->pcTopicUpdateDelta,    prvIncomingPublishUpdateDeltaCallback    },
+        { pxCtx->pcTopicUpdateAccepted, prvIncomingPublishUpdateAcceptedCallback },
+        { pxCtx->pcTopicUpdateRejected, prvIncomingPublishRejectedCallback       },
+        { pxCtx->pcTopicGetAccepted,    prvIncomingPublishGetAcceptedCallback    },
+        { pxCtx->pcTopicGetRejected,    prvIncomingPublishRejectedCallback       },
+    };
+
+    for( size_t uxIdx = 0;
+         ( uxIdx < ( sizeof( xSubscriptions ) / sizeof( xSubscriptions[ 0 ] ) ) ) && ( xStatus == MQTTSuccess );
+         uxIdx++ )
+    {
+        xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
+                                           xSubscriptions[ uxIdx ].pcTopic,
+                                           MQTTQoS1,
+                                           xSubscriptions[ uxIdx ].pxCallback,
+                                           pxCtx );
+
+        if( xStatus != MQTTSuccess )
+        {
+            LogError( "Failed to subscribe to topic: %s", xSubscriptions[ uxIdx ].pcTopic );
+        }
     }
 
-    return xSuccess;
+    return( xStatus == MQTTSuccess );
 }
 
 /*-----------------------------------------------------------*/
 
-static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx )
+static BaseType_t prvReadValve( const ShadowProperty_t * pxProp,
+                                ShadowValue_t * pxValue )
 {
-    MQTTStatus_t xStatus = MQTTSuccess;
+    pxValue->ulValue = ( xIrrigation_IsValveOn( pxIrrigation_GetZone( pxProp->ulArg ) ) == pdTRUE ) ? 1U : 0U;
 
-    xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
-                                       pxCtx->pcTopicUpdateDelta,
-                                       MQTTQoS1,
-                                       prvIncomingPublishUpdateDeltaCallback,
-                                       pxCtx );
+    return pdTRUE;
+}
 
-    if( xStatus != MQTTSuccess )
+/*-----------------------------------------------------------*/
+
+/* The irrigation controller decides when the valve actually opens. The
+ * reported powerOn state follows the valve. */
+static BaseType_t prvApplyValve( const ShadowProperty_t * pxProp,
+                                 const ShadowValue_t * pxValue )
+{
+    LogInfo( "Setting irrigation request of zone %lu to %lu.",
+             ( unsigned long ) pxProp->ulArg, ( unsigned long ) pxValue->ulValue );
+
+    vIrrigation_SetManualRequest( pxIrrigation_GetZone( pxProp->ulArg ),
+                                  ( pxValue->ulValue != 0 ) ? pdTRUE : pdFALSE );
+
+    return pdTRUE;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadKvUInt( const ShadowProperty_t * pxProp,
+                                 ShadowValue_t * pxValue )
+{
+    pxValue->ulValue = KVStore_getUInt32( ( KVStoreKey_t ) pxProp->ulArg, NULL );
+
+    return pdTRUE;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Committed once per document by the caller */
+static void prvMarkUncommitted( KVStoreKey_t xKey )
+{
+    ( void ) Atomic_OR_u32( &( pulUncommittedKeys[ xKey / 32 ] ), 1UL << ( xKey % 32 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvApplyKvUInt( const ShadowProperty_t * pxProp,
+                                  const ShadowValue_t * pxValue )
+{
+    BaseType_t xResult = pdFALSE;
+
+    LogInfo( "Setting %s to %lu.", kvKeyToString( ( KVStoreKey_t ) pxProp->ulArg ), ( unsigned long ) pxValue->ulValue );
+
+    xResult = KVStore_setUInt32( ( KVStoreKey_t ) pxProp->ulArg, pxValue->ulValue );
+
+    if( xResult == pdTRUE )
     {
-        LogError( "Failed to subscribe to topic: %s", pxCtx->pcTopicUpdateDelta );
+        prvMarkUncommitted( ( KVStoreKey_t ) pxProp->ulArg );
     }
-    else
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadKvString( const ShadowProperty_t * pxProp,
+                                   ShadowValue_t * pxValue )
+{
+    ( void ) KVStore_getString( ( KVStoreKey_t ) pxProp->ulArg, pxValue->pcValue, SHADOW_STATE_MAX_STR_LEN );
+
+    return pdTRUE;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvApplyKvString( const ShadowProperty_t * pxProp,
+                                    const ShadowValue_t * pxValue )
+{
+    BaseType_t xResult = pdFALSE;
+
+    LogInfo( "Setting %s to %s.", kvKeyToString( ( KVStoreKey_t ) pxProp->ulArg ), pxValue->pcValue );
+
+    xResult = KVStore_setString( ( KVStoreKey_t ) pxProp->ulArg, pxValue->pcValue );
+
+    if( xResult == pdTRUE )
     {
-        xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
-                                           pxCtx->pcTopicUpdateAccepted,
-                                           MQTTQoS1,
-                                           prvIncomingPublishUpdateAcceptedCallback,
-                                           pxCtx );
+        prvMarkUncommitted( ( KVStoreKey_t ) pxProp->ulArg );
+    }
 
-        if( xStatus != MQTTSuccess )
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadFirmwareVersion( const ShadowProperty_t * pxProp,
+                                          ShadowValue_t * pxValue )
+{
+    ( void ) pxProp;
+
+    ( void ) snprintf( pxValue->pcValue, SHADOW_STATE_MAX_STR_LEN, "%u.%u.%u",
+                       ( unsigned int ) appFirmwareVersion.u.x.major,
+                       ( unsigned int ) appFirmwareVersion.u.x.minor,
+                       ( unsigned int ) appFirmwareVersion.u.x.build );
+
+    return pdTRUE;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Properties mirrored in the device shadow.
+ *
+ * The settings under "telemetry" and "irrigation" map one to one onto
+ * KVStore keys, e.g.
+ * { "state": { "telemetry": { "heartbeatMs": 600000 }, "irrigation": { "mode": 1 } } }.
+ * Percentages are given in hundredths and PID gains in thousandths. The
+ * sensor publish tasks and the irrigation controller reload them on their
+ * next cycle.
+ */
+#define shadowKV_UINT( pcGroup, pcName, xKey )      { pcGroup, pcName, SHADOW_PROP_UINT, prvReadKvUInt, prvApplyKvUInt, ( uint32_t ) xKey }
+#define shadowKV_STRING( pcGroup, pcName, xKey )    { pcGroup, pcName, SHADOW_PROP_STRING, prvReadKvString, prvApplyKvString, ( uint32_t ) xKey }
+
+static const ShadowProperty_t xShadowProperties[] =
+{
+#if shadowCONFIG_ZONE_SHADOWS == 0
+    { NULL, "powerOn", SHADOW_PROP_BOOL, prvReadValve, prvApplyValve, shadowexampleIRRIGATION_ZONE },
+#endif
+    shadowKV_UINT( "telemetry", "minIntervalMs", CS_RPT_MIN_INTERVAL_MS ),
+    shadowKV_UINT( "telemetry", "heartbeatMs", CS_RPT_HEARTBEAT_MS ),
+    shadowKV_UINT( "telemetry", "relDeadband", CS_RPT_REL_DEADBAND ),
+    shadowKV_UINT( "telemetry", "soilDeadband", CS_SOIL_DEADBAND ),
+    shadowKV_UINT( "telemetry", "envDeadband", CS_ENV_DEADBAND ),
+    shadowKV_UINT( "telemetry", "motionDeadband", CS_MOTION_DEADBAND ),
+    shadowKV_UINT( "irrigation", "mode", CS_IRR_MODE ),
+    shadowKV_STRING( "irrigation", "setpoints", CS_IRR_SETPOINTS ),
+    shadowKV_UINT( "irrigation", "hysteresis", CS_IRR_HYSTERESIS ),
+    shadowKV_UINT( "irrigation", "minOnMs", CS_IRR_MIN_ON_MS ),
+    shadowKV_UINT( "irrigation", "minOffMs", CS_IRR_MIN_OFF_MS ),
+    shadowKV_UINT( "irrigation", "maxRunMs", CS_IRR_MAX_RUN_MS ),
+    shadowKV_UINT( "irrigation", "kp", CS_IRR_KP ),
+    shadowKV_UINT( "irrigation", "ki", CS_IRR_KI ),
+    shadowKV_UINT( "irrigation", "kd", CS_IRR_KD ),
+    shadowKV_UINT( "irrigation", "windowMs", CS_IRR_WINDOW_MS ),
+    { "firmware", "version", SHADOW_PROP_STRING, prvReadFirmwareVersion, NULL, 0 },
+};
+
+/*-----------------------------------------------------------*/
+
+static void prvValveHook( size_t uxZone,
+                          BaseType_t xValveOn )
+{
+    TaskHandle_t xTaskHandle = xShadowTaskHandle;
+
+    ( void ) uxZone;
+    ( void ) xValveOn;
+
+    if( xTaskHandle != NULL )
+    {
+        ( void ) xTaskNotify( xTaskHandle, shadowEVT_CHANGED, eSetBits );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait until one of the events in ulEvents arrives or xTimeout expires.
+ * Other events are kept for a later call.
+ *
+ * @return The events in ulEvents that arrived.
+ */
+static uint32_t prvWaitForEvents( uint32_t ulEvents,
+                                  TickType_t xTimeout )
+{
+    TimeOut_t xTimeOut;
+    uint32_t ulReceived = 0;
+
+    vTaskSetTimeOutState( &xTimeOut );
+
+    do
+    {
+        if( xTaskNotifyWait( 0, UINT32_MAX, &ulReceived, xTimeout ) == pdTRUE )
         {
-            LogError( "Failed to subscribe to topic: %s", pxCtx->pcTopicUpdateAccepted );
+            ulPendingEvents |= ulReceived;
         }
+    } while( ( ( ulPendingEvents & ulEvents ) == 0 ) &&
+             ( xTaskCheckForTimeOut( &xTimeOut, &xTimeout ) == pdFALSE ) );
+
+    ulReceived = ulPendingEvents & ulEvents;
+    ulPendingEvents &= ~ulEvents;
+
+    return ulReceived;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Extract the members used from any shadow response in one pass.
+ *
+ * @return Mask of the members found, indexed by ShadowResponseKey_t.
+ */
+static uint32_t prvParseResponse( const MQTTPublishInfo_t * pxPublishInfo,
+                                  JsonExtractValue_t * pxValues )
+{
+    uint32_t ulFound = 0;
+
+    if( xJsonExtract( ( const char * ) pxPublishInfo->pPayload,
+                      pxPublishInfo->payloadLength,
+                      xResponseKeys,
+                      shadowNUM_RESPONSE_KEYS,
+                      pxValues,
+                      &ulFound ) != JSONSuccess )
+    {
+        LogError( "Invalid JSON document received!" );
     }
 
-    if( xStatus == MQTTSuccess )
+    return ulFound;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check that a response carries the client token the task is waiting for.
+ */
+static bool prvIsAwaitedResponse( const ShadowDeviceCtx_t * pxCtx,
+                                  uint32_t ulFound,
+                                  const JsonExtractValue_t * pxValues,
+                                  const char * pcTopicName )
+{
+    bool xAwaited = false;
+
+    ( void ) pcTopicName; /* Only used for logging */
+
+    if( ( ulFound & shadowKEY_BIT( shadowKEY_CLIENT_TOKEN ) ) == 0 )
     {
-        xStatus = MqttAgent_SubscribeSync( pxCtx->xAgentHandle,
-                                           pxCtx->pcTopicUpdateRejected,
-                                           MQTTQoS1,
-                                           prvIncomingPublishUpdateRejectedCallback,
-                                           pxCtx );
+        LogDebug( "Ignoring publish on %s with no clientToken field.", pcTopicName );
+    }
 
-        if( xStatus != MQTTSuccess )
-        {
-            LogError( "Failed to subscribe to topic: %s", pxCtx->pcTopicUpdateRejected );
-        }
+    /* If we are waiting for a response, ulClientToken will be the token for the response
+     * we are waiting for, else it will be 0. The received token may not match if the response is
+     * not for us or if it is is a response that arrived after we timed out
+     * waiting for it.
+     */
+    else if( pxValues[ shadowKEY_CLIENT_TOKEN ].ulValue != pxCtx->ulClientToken )
+    {
+        LogDebug( "Ignoring publish on %s with clientToken %lu.", pcTopicName,
+                  ( unsigned long ) pxValues[ shadowKEY_CLIENT_TOKEN ].ulValue );
+    }
+    else
+    {
+        xAwaited = true;
     }
 
-    return( xStatus == MQTTSuccess );
+    return xAwaited;
 }
 
 /*-----------------------------------------------------------*/
@@ -393,15 +741,13 @@ static bool prvSubscribeToShadowUpdateTopics( ShadowDeviceCtx_t * pxCtx )
 static void prvIncomingPublishUpdateDeltaCallback( void * pvCtx,
                                                    MQTTPublishInfo_t * pxPublishInfo )
 {
-    static uint32_t ulCurrentVersion = 0; /* Remember the latest version number we've received */
+    JsonExtractValue_t pxValues[ shadowNUM_RESPONSE_KEYS ];
+    uint32_t ulFound = 0;
     uint32_t ulVersion = 0UL;
-    uint32_t ulNewState = 0UL;
-    char * pcOutValue = NULL;
-    uint32_t ulOutValueLength = 0UL;
-    JSONStatus_t result = JSONSuccess;
 
     ShadowDeviceCtx_t * pxCtx = ( ShadowDeviceCtx_t * ) pvCtx;
 
+    configASSERT( pvCtx != NULL );
     configASSERT( pxPublishInfo != NULL );
     configASSERT( pxPublishInfo->pPayload != NULL );
 
@@ -412,7 +758,10 @@ static void prvIncomingPublishUpdateDeltaCallback( void * pvCtx,
     /* The payload will look similar to this:
      * {
      *      "state": {
-     *          "powerOn": 1
+     *          "powerOn": 1,
+     *          "irrigation": {
+     *              "mode": 2
+     *          }
      *      },
      *      "metadata": {
      *          "powerOn": {
@@ -425,95 +774,41 @@ static void prvIncomingPublishUpdateDeltaCallback( void * pvCtx,
      *  }
      */
 
-    /* Make sure the payload is a valid json document. */
-    result = JSON_Validate( pxPublishInfo->pPayload,
-                            pxPublishInfo->payloadLength );
+    ulFound = prvParseResponse( pxPublishInfo, pxValues );
+    ulVersion = pxValues[ shadowKEY_VERSION ].ulValue;
 
-    if( result != JSONSuccess )
+    if( ( ulFound & shadowKEY_BIT( shadowKEY_VERSION ) ) == 0 )
     {
-        LogError( "Invalid JSON document received!" );
+        LogError( "Version field not found in JSON document!" );
+    }
+
+    /* Make sure the version is newer than the last one we received. */
+    else if( ulVersion <= pxCtx->ulVersion )
+    {
+        /* In this demo, we discard the incoming message
+         * if the version number is not newer than the latest
+         * that we've received before. Your application may use a
+         * different approach.
+         */
+        LogWarn( ( "Received unexpected delta update with version %u. Current version is %u",
+                   ( unsigned int ) ulVersion,
+                   ( unsigned int ) pxCtx->ulVersion ) );
     }
     else
     {
-        /* Obtain the version value. */
-        result = JSON_Search( ( char * ) pxPublishInfo->pPayload,
-                              pxPublishInfo->payloadLength,
-                              "version",
-                              sizeof( "version" ) - 1,
-                              &pcOutValue,
-                              ( size_t * ) &ulOutValueLength );
+        LogInfo( "Received delta update with version %lu.", ( unsigned long ) ulVersion );
 
-        if( result != JSONSuccess )
-        {
-            LogError( "Version field not found in JSON document!" );
-        }
-        else
-        {
-            /* Convert the extracted value to an unsigned integer value. */
-            ulVersion = ( uint32_t ) strtoul( pcOutValue, NULL, 10 );
+        /* Set received version as the current version. */
+        pxCtx->ulVersion = ulVersion;
 
-            /* Make sure the version is newer than the last one we received. */
-            if( ulVersion <= ulCurrentVersion )
-            {
-                /* In this demo, we discard the incoming message
-                 * if the version number is not newer than the latest
-                 * that we've received before. Your application may use a
-                 * different approach.
-                 */
-                LogWarn( ( "Received unexpected delta update with version %u. Current version is %u",
-                           ( unsigned int ) ulVersion,
-                           ( unsigned int ) ulCurrentVersion ) );
-            }
-            else
-            {
-                LogInfo( "Received delta update with version %.*s.",
-                         ulOutValueLength,
-                         pcOutValue );
-
-                /* Set received version as the current version. */
-                ulCurrentVersion = ulVersion;
-
-                /* Get powerOn state from json documents. */
-                result = JSON_Search( ( char * ) pxPublishInfo->pPayload,
-                                      pxPublishInfo->payloadLength,
-                                      "state.powerOn",
-                                      sizeof( "state.powerOn" ) - 1,
-                                      &pcOutValue,
-                                      ( size_t * ) &ulOutValueLength );
-
-                if( result != JSONSuccess )
-                {
-                    LogWarn( "powerOn field not found in JSON document!" );
-                }
-                else
-                {
-                    /* Convert the powerOn state value to an unsigned integer value. */
-                    ulNewState = ( uint32_t ) strtoul( pcOutValue, NULL, 10 );
-
-                    LogInfo( "Setting GPIO 6 state to %u.", ( unsigned int ) ulNewState );
-                    /* Set the new powerOn state. */
-                    pxCtx->ulCurrentPowerOnState = ulNewState;
-
-                    // MICHAEL - changed to GPIO7
-                    if(ulNewState == 0)
-                    {
-                        HAL_GPIO_WritePin( RELAY_1_GPIO_Port, RELAY_1_Pin, GPIO_PIN_RESET );/* Turn the GPIO ON */
-                    }
-                    else
-                    {
-                    	HAL_GPIO_WritePin( RELAY_1_GPIO_Port, RELAY_1_Pin, GPIO_PIN_SET );/* Turn the GPIO off */
-                    }
-
-//                    if( ulNewState == 1 )
-//                    {
-//                        HAL_GPIO_WritePin( LED_RED_GPIO_Port, LED_RED_Pin, GPIO_PIN_RESET ); /* Turn the LED ON */
-//                    }
-//                    else
-//                    {
-//                        HAL_GPIO_WritePin( LED_RED_GPIO_Port, LED_RED_Pin, GPIO_PIN_SET ); /* Turn the LED off */
-//                    }
-                }
-            }
+        if( ( ( ulFound & shadowKEY_BIT( shadowKEY_STATE ) ) != 0 ) &&
+            ( pxValues[ shadowKEY_STATE ].xJsonType == JSONObject ) &&
+            ( uxShadowState_ApplyDesired( &( pxCtx->xState ),
+                                          pxValues[ shadowKEY_STATE ].pcValue,
+                                          pxValues[ shadowKEY_STATE ].uxValueLen ) > 0 ) )
+        {
+            /* Commit and report the new values from the shadow task */
+            ( void ) xTaskNotify( pxCtx->xShadowDeviceTaskHandle, shadowEVT_CHANGED, eSetBits );
         }
     }
 }
@@ -523,10 +818,8 @@ static void prvIncomingPublishUpdateDeltaCallback( void * pvCtx,
 static void prvIncomingPublishUpdateAcceptedCallback( void * pvCtx,
                                                       MQTTPublishInfo_t * pxPublishInfo )
 {
-    char * pcOutValue = NULL;
-    uint32_t ulOutValueLength = 0UL;
-    uint32_t ulReceivedToken = 0UL;
-    JSONStatus_t result = JSONSuccess;
+    JsonExtractValue_t pxValues[ shadowNUM_RESPONSE_KEYS ];
+    uint32_t ulFound = 0;
 
     ShadowDeviceCtx_t * pxCtx = ( ShadowDeviceCtx_t * ) pvCtx;
 
@@ -561,81 +854,93 @@ static void prvIncomingPublishUpdateAcceptedCallback( void * pvCtx,
      *  }
      */
 
-    /* Make sure the payload is a valid json document. */
-    result = JSON_Validate( pxPublishInfo->pPayload,
-                            pxPublishInfo->payloadLength );
+    ulFound = prvParseResponse( pxPublishInfo, pxValues );
 
-    if( result != JSONSuccess )
+    if( prvIsAwaitedResponse( pxCtx, ulFound, pxValues, "/update/accepted" ) == true )
     {
-        LogError( "Invalid JSON document received!" );
-    }
-    else
-    {
-        /* Get clientToken from json documents. */
-        result = JSON_Search( ( char * ) pxPublishInfo->pPayload,
-                              pxPublishInfo->payloadLength,
-                              "clientToken",
-                              sizeof( "clientToken" ) - 1,
-                              &pcOutValue,
-                              ( size_t * ) &ulOutValueLength );
-    }
+        LogInfo( "Received accepted response for update with token %lu. ", ( unsigned long ) pxCtx->ulClientToken );
 
-    if( result != JSONSuccess )
-    {
-        LogDebug( "Ignoring publish on /update/accepted with no clientToken field." );
+        /* Wake up the shadow task which is waiting for this response. */
+        ( void ) xTaskNotify( pxCtx->xShadowDeviceTaskHandle, shadowEVT_ACCEPTED, eSetBits );
     }
-    else
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvIncomingPublishGetAcceptedCallback( void * pvCtx,
+                                                   MQTTPublishInfo_t * pxPublishInfo )
+{
+    JsonExtractValue_t pxValues[ shadowNUM_RESPONSE_KEYS ];
+    uint32_t ulFound = 0;
+
+    ShadowDeviceCtx_t * pxCtx = ( ShadowDeviceCtx_t * ) pvCtx;
+
+    configASSERT( pvCtx != NULL );
+    configASSERT( pxPublishInfo != NULL );
+    configASSERT( pxPublishInfo->pPayload != NULL );
+
+    LogDebug( "/get/accepted JSON payload: %.*s.",
+              pxPublishInfo->payloadLength,
+              ( const char * ) pxPublishInfo->pPayload );
+
+    /* The payload will look similar to this:
+     *  {
+     *      "state": {
+     *          "desired": {
+     *             "powerOn": 1
+     *          },
+     *          "reported": {
+     *             "powerOn": 0
+     *          },
+     *          "delta": {
+     *             "powerOn": 1
+     *          }
+     *      },
+     *      "metadata": { ... },
+     *      "version": 14698,
+     *      "timestamp": 1596573647,
+     *      "clientToken": "022485"
+     *  }
+     *
+     * The whole desired state is applied rather than the delta, the device
+     * may have lost state that is still reported, e.g. the valve after a reboot.
+     */
+
+    ulFound = prvParseResponse( pxPublishInfo, pxValues );
+
+    if( prvIsAwaitedResponse( pxCtx, ulFound, pxValues, "/get/accepted" ) == true )
     {
-        /* Convert the code to an unsigned integer value. */
-        ulReceivedToken = ( uint32_t ) strtoul( pcOutValue, NULL, 10 );
+        LogInfo( "Received shadow document for get with token %lu.", ( unsigned long ) pxCtx->ulClientToken );
 
-        /* If we are waiting for a response, ulClientToken will be the token for the response
-         * we are waiting for, else it will be 0. ulReceivedToken may not match if the response is
-         * not for us or if it is is a response that arrived after we timed out
-         * waiting for it.
-         */
-        if( ulReceivedToken != pxCtx->ulClientToken )
+        if( ( ulFound & shadowKEY_BIT( shadowKEY_VERSION ) ) != 0 )
         {
-            LogDebug( "Ignoring publish on /update/accepted with clientToken %lu.", ( unsigned long ) ulReceivedToken );
+            /* Deltas up to this version are contained in the document */
+            pxCtx->ulVersion = pxValues[ shadowKEY_VERSION ].ulValue;
         }
-        else
-        {
-            LogInfo( "Received accepted response for update with token %lu. ", ( unsigned long ) pxCtx->ulClientToken );
 
-            /*  Obtain the accepted state from the response and update our last sent state. */
-            result = JSON_Search( ( char * ) pxPublishInfo->pPayload,
-                                  pxPublishInfo->payloadLength,
-                                  "state.reported.powerOn",
-                                  sizeof( "state.reported.powerOn" ) - 1,
-                                  &pcOutValue,
-                                  ( size_t * ) &ulOutValueLength );
+        /* The task is blocked waiting for this response, so the state may
+         * be updated from here. */
+        vShadowState_SetReported( &( pxCtx->xState ),
+                                  pxValues[ shadowKEY_REPORTED ].pcValue,
+                                  pxValues[ shadowKEY_REPORTED ].uxValueLen );
 
-            if( result != JSONSuccess )
-            {
-                LogError( "powerOn field not found in JSON document!" );
-            }
-            else
-            {
-                /* Convert the powerOn state value to an unsigned integer value and
-                 * save the new last reported value*/
-                pxCtx->ulReportedPowerOnState = ( uint32_t ) strtoul( pcOutValue, NULL, 10 );
-            }
+        /* Committed by the shadow task after the sync */
+        ( void ) uxShadowState_ApplyDesired( &( pxCtx->xState ),
+                                             pxValues[ shadowKEY_DESIRED ].pcValue,
+                                             pxValues[ shadowKEY_DESIRED ].uxValueLen );
 
-            /* Wake up the shadow task which is waiting for this response. */
-            xTaskNotifyGive( pxCtx->xShadowDeviceTaskHandle );
-        }
+        /* Wake up the shadow task which is waiting for this response. */
+        ( void ) xTaskNotify( pxCtx->xShadowDeviceTaskHandle, shadowEVT_ACCEPTED, eSetBits );
     }
 }
 
 /*-----------------------------------------------------------*/
 
-static void prvIncomingPublishUpdateRejectedCallback( void * pvCtx,
-                                                      MQTTPublishInfo_t * pxPublishInfo )
+static void prvIncomingPublishRejectedCallback( void * pvCtx,
+                                                MQTTPublishInfo_t * pxPublishInfo )
 {
-    JSONStatus_t result = JSONSuccess;
-    char * pcOutValue = NULL;
-    uint32_t ulOutValueLength = 0UL;
-    uint32_t ulReceivedToken = 0UL;
+    JsonExtractValue_t pxValues[ shadowNUM_RESPONSE_KEYS ];
+    uint32_t ulFound = 0;
 
     ShadowDeviceCtx_t * pxCtx = ( ShadowDeviceCtx_t * ) pvCtx;
 
@@ -643,7 +948,7 @@ static void prvIncomingPublishUpdateRejectedCallback( void * pvCtx,
     configASSERT( pxPublishInfo != NULL );
     configASSERT( pxPublishInfo->pPayload != NULL );
 
-    LogDebug( "/update/rejected json payload: %.*s.",
+    LogDebug( "Rejected json payload: %.*s.",
               pxPublishInfo->payloadLength,
               ( const char * ) pxPublishInfo->pPayload );
 
@@ -656,186 +961,374 @@ static void prvIncomingPublishUpdateRejectedCallback( void * pvCtx,
      * }
      */
 
-    /* Make sure the payload is a valid json document. */
-    result = JSON_Validate( pxPublishInfo->pPayload,
-                            pxPublishInfo->payloadLength );
+    ulFound = prvParseResponse( pxPublishInfo, pxValues );
 
-    if( result != JSONSuccess )
+    if( prvIsAwaitedResponse( pxCtx, ulFound, pxValues, "rejected" ) == true )
     {
-        LogError( "Invalid JSON document received!" );
+        if( ( ulFound & shadowKEY_BIT( shadowKEY_CODE ) ) == 0 )
+        {
+            LogWarn( "Received rejected response for request with token %lu and no error code.", ( unsigned long ) pxCtx->ulClientToken );
+        }
+        else
+        {
+            LogWarn( "Received rejected response for request with token %lu and error code %lu.", ( unsigned long ) pxCtx->ulClientToken,
+                     ( unsigned long ) pxValues[ shadowKEY_CODE ].ulValue );
+        }
+
+        /* Wake up the shadow task which is waiting for this response. */
+        ( void ) xTaskNotify( pxCtx->xShadowDeviceTaskHandle, shadowEVT_REJECTED, eSetBits );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Serialise the properties in ulDirty into a borrowed publish buffer and
+ * hand it to the MQTT agent, which owns the buffer until the publish completes.
+ */
+static MQTTStatus_t prvPublishReportedState( ShadowDeviceCtx_t * pxCtx,
+                                             uint32_t ulDirty )
+{
+    MQTTStatus_t xStatus = MQTTNoMemory;
+    PublishBuffer_t * pxBuffer = NULL;
+    char * pcUpdateDocument = NULL;
+    size_t uxCapacity = 0;
+    size_t uxDocumentLen = 0;
+
+    pxBuffer = MqttAgent_BorrowPublishBuffer( pdMS_TO_TICKS( shadowexampleMAX_COMMAND_SEND_BLOCK_TIME_MS ) );
+
+    if( pxBuffer == NULL )
+    {
+        LogError( "Timed out waiting for a publish buffer." );
     }
     else
     {
-        /* Get clientToken from json documents. */
-        result = JSON_Search( ( char * ) pxPublishInfo->pPayload,
-                              pxPublishInfo->payloadLength,
-                              "clientToken",
-                              sizeof( "clientToken" ) - 1,
-                              &pcOutValue,
-                              ( size_t * ) &ulOutValueLength );
+        pcUpdateDocument = ( char * ) MqttAgent_PublishBufferPayload( pxBuffer, &uxCapacity );
+
+        uxDocumentLen = uxShadowState_FormatReport( &( pxCtx->xState ),
+                                                    ulDirty,
+                                                    pxCtx->ulClientToken,
+                                                    pcUpdateDocument,
+                                                    uxCapacity );
+
+        if( uxDocumentLen == 0 )
+        {
+            MqttAgent_ReturnPublishBuffer( pxBuffer );
+        }
+        else
+        {
+            LogInfo( "Publishing to /update with following client token %lu.", ( long unsigned ) pxCtx->ulClientToken );
+            LogDebug( "Publish content: %.*s", ( int ) uxDocumentLen, pcUpdateDocument );
+
+            xStatus = MqttAgent_PublishBuffer( pxCtx->xAgentHandle,
+                                               pxBuffer,
+                                               pxCtx->pcTopicUpdate,
+                                               pxCtx->usTopicUpdateLen,
+                                               uxDocumentLen,
+                                               MQTTQoS1,
+                                               NULL,
+                                               NULL );
+        }
     }
 
-    if( result != JSONSuccess )
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Create a new client token for the accepted and rejected callbacks.
+ * 0 means no request is outstanding.
+ */
+static uint32_t prvNewClientToken( void )
+{
+    return ( ( uint32_t ) xTaskGetTickCount() % 999999UL ) + 1UL;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Wait for the response to the request with pxCtx->ulClientToken.
+ *
+ * @return shadowEVT_ACCEPTED, shadowEVT_REJECTED or 0 on timeout.
+ */
+static uint32_t prvWaitForResponse( ShadowDeviceCtx_t * pxCtx )
+{
+    /* When the Device shadow service receives the request it will publish a
+     * response to the accepted or rejected topic */
+    uint32_t ulResponse = prvWaitForEvents( shadowEVT_ACCEPTED | shadowEVT_REJECTED,
+                                            pdMS_TO_TICKS( shadow_SIGNAL_TIMEOUT ) );
+
+    ( void ) pxCtx; /* Only used for logging */
+
+    LogDebug( "Response 0x%lx for client token %lu.", ( unsigned long ) ulResponse, ( unsigned long ) pxCtx->ulClientToken );
+
+    return ulResponse;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Request the whole shadow document. The /get/accepted callback
+ * applies the desired state and records the reported one. Without a response
+ * every property is reported again.
+ */
+static void prvSyncShadow( ShadowDeviceCtx_t * pxCtx )
+{
+    PublishBuffer_t * pxBuffer = NULL;
+    char * pcRequest = NULL;
+    size_t uxCapacity = 0;
+    int lRequestLen = 0;
+    uint32_t ulResponse = 0;
+
+    vShadowState_Invalidate( &( pxCtx->xState ) );
+
+    /* Drop responses that arrived after an earlier request timed out */
+    ( void ) prvWaitForEvents( shadowEVT_ACCEPTED | shadowEVT_REJECTED, 0 );
+
+    pxCtx->ulClientToken = prvNewClientToken();
+
+    pxBuffer = MqttAgent_BorrowPublishBuffer( pdMS_TO_TICKS( shadowexampleMAX_COMMAND_SEND_BLOCK_TIME_MS ) );
+
+    if( pxBuffer == NULL )
     {
-        LogDebug( "Ignoring publish on /update/rejected with clientToken %lu.", ( unsigned long ) ulReceivedToken );
+        LogError( "Timed out waiting for a publish buffer." );
     }
     else
     {
-        /* Convert the code to an unsigned integer value. */
-        ulReceivedToken = ( uint32_t ) strtoul( pcOutValue, NULL, 10 );
-
-        /* If we are waiting for a response, ulClientToken will be the token for the response
-         * we are waiting for, else it will be 0. ulReceivedToken may not match if the response is
-         * not for us or if it is is a response that arrived after we timed out
-         * waiting for it.
-         */
-        if( ulReceivedToken != pxCtx->ulClientToken )
+        pcRequest = ( char * ) MqttAgent_PublishBufferPayload( pxBuffer, &uxCapacity );
+
+        lRequestLen = snprintf( pcRequest, uxCapacity, "{\"clientToken\":\"%06lu\"}", ( unsigned long ) pxCtx->ulClientToken );
+
+        LogInfo( "Requesting shadow %s with client token %lu.",
+                 ( pxCtx->pcShadowName != NULL ) ? pxCtx->pcShadowName : "classic",
+                 ( unsigned long ) pxCtx->ulClientToken );
+
+        if( MqttAgent_PublishBuffer( pxCtx->xAgentHandle,
+                                     pxBuffer,
+                                     pxCtx->pcTopicGet,
+                                     pxCtx->usTopicGetLen,
+                                     ( size_t ) lRequestLen,
+                                     MQTTQoS1,
+                                     NULL,
+                                     NULL ) != MQTTSuccess )
         {
-            LogDebug( "Ignoring publish on /update/rejected with clientToken %lu.", ( unsigned long ) ulReceivedToken );
+            LogError( "Failed to publish get request to shadow." );
         }
         else
         {
-            /*  Obtain the error code. */
-            result = JSON_Search( ( char * ) pxPublishInfo->pPayload,
-                                  pxPublishInfo->payloadLength,
-                                  "code",
-                                  sizeof( "code" ) - 1,
-                                  &pcOutValue,
-                                  ( size_t * ) &ulOutValueLength );
-
-            if( result != JSONSuccess )
-            {
-                LogWarn( "Received rejected response for update with token %lu and no error code.", ( unsigned long ) pxCtx->ulClientToken );
-            }
-            else
+            ulResponse = prvWaitForResponse( pxCtx );
+        }
+    }
+
+    if( ulResponse == 0 )
+    {
+        LogError( "No shadow document received, reporting every property." );
+    }
+    else if( ( ulResponse & shadowEVT_REJECTED ) != 0 )
+    {
+        /* E.g. a named shadow that does not exist yet; the first report creates it */
+        LogInfo( "Shadow get rejected, reporting every property." );
+    }
+    else
+    {
+        /* Applied by prvIncomingPublishGetAcceptedCallback */
+    }
+
+    /* Clear the client token */
+    pxCtx->ulClientToken = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Report the properties in ulDirty and wait for the response.
+ */
+static void prvReportChanges( ShadowDeviceCtx_t * pxCtx,
+                              uint32_t ulDirty )
+{
+    uint32_t ulResponse = 0;
+
+    /* Drop responses that arrived after an earlier request timed out */
+    ( void ) prvWaitForEvents( shadowEVT_ACCEPTED | shadowEVT_REJECTED, 0 );
+
+    pxCtx->ulClientToken = prvNewClientToken();
+
+    /* Generate the update report directly in a publish buffer. The agent
+     * returns the buffer to the pool once the report is acknowledged, we
+     * only wait for the response on the accepted or rejected topics. */
+    if( prvPublishReportedState( pxCtx, ulDirty ) != MQTTSuccess )
+    {
+        LogError( "Failed to publish report to shadow." );
+    }
+    else
+    {
+        ulResponse = prvWaitForResponse( pxCtx );
+
+        if( ulResponse == 0 )
+        {
+            /* The properties stay dirty, so they are sent again with the next report */
+            LogError( "Timed out waiting for response to report." );
+        }
+    }
+
+    vShadowState_ReportDone( &( pxCtx->xState ),
+                             ( ( ulResponse & shadowEVT_ACCEPTED ) != 0 ) ? pdTRUE : pdFALSE );
+
+    /* Clear the client token */
+    pxCtx->ulClientToken = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Write the KVStore keys changed by desired values to flash. Other
+ * pending changes, e.g. from the CLI, are left for "conf commit".
+ */
+static void prvCommitDesiredSettings( void )
+{
+    for( size_t uxWord = 0; uxWord < ( sizeof( pulUncommittedKeys ) / sizeof( pulUncommittedKeys[ 0 ] ) ); uxWord++ )
+    {
+        /* Take the marks, keys set from now on are committed next time */
+        uint32_t ulKeys = Atomic_AND_u32( &( pulUncommittedKeys[ uxWord ] ), 0UL );
+
+        for( uint32_t ulBit = 0; ulKeys != 0; ulBit++, ulKeys >>= 1 )
+        {
+            KVStoreKey_t xKey = ( KVStoreKey_t ) ( ( uxWord * 32 ) + ulBit );
+
+            if( ( ( ulKeys & 1UL ) != 0 ) &&
+                ( KVStore_xCommitKey( xKey ) != pdTRUE ) )
             {
-                LogWarn( "Received rejected response for update with token %lu and error code %.*s.", ( unsigned long ) pxCtx->ulClientToken,
-                         ulOutValueLength,
-                         pcOutValue );
+                LogError( "Failed to commit %s.", kvKeyToString( xKey ) );
             }
-
-            /* Wake up the shadow task which is waiting for this response. */
-            xTaskNotifyGive( pxCtx->xShadowDeviceTaskHandle );
         }
     }
 }
 
 /*-----------------------------------------------------------*/
 
+/**
+ * @brief Set up the classic shadow and the zone shadows.
+ */
+static bool prvInitializeDocuments( void )
+{
+    bool xStatus = prvGetThingName( &( xShadowDocs[ 0 ] ) );
+
+    if( xStatus == true )
+    {
+        xStatus = prvInitializeCtx( &( xShadowDocs[ 0 ] ),
+                                    NULL,
+                                    xShadowProperties,
+                                    sizeof( xShadowProperties ) / sizeof( xShadowProperties[ 0 ] ) );
+    }
+
+    #if shadowCONFIG_ZONE_SHADOWS > 0
+        for( size_t uxZone = 0; ( uxZone < shadowCONFIG_ZONE_SHADOWS ) && ( xStatus == true ); uxZone++ )
+        {
+            ShadowDeviceCtx_t * pxCtx = &( xShadowDocs[ 1 + uxZone ] );
+
+            xZoneProperties[ uxZone ] = ( ShadowProperty_t ) {
+                NULL, "powerOn", SHADOW_PROP_BOOL, prvReadValve, prvApplyValve, ( uint32_t ) uxZone
+            };
+
+            ( void ) snprintf( pcZoneShadowNames[ uxZone ], shadowMAX_SHADOW_NAME_LEN, "zone%u", ( unsigned int ) uxZone );
+
+            pxCtx->pcDeviceName = xShadowDocs[ 0 ].pcDeviceName;
+            pxCtx->ucDeviceNameLen = xShadowDocs[ 0 ].ucDeviceNameLen;
+
+            xStatus = prvInitializeCtx( pxCtx, pcZoneShadowNames[ uxZone ], &( xZoneProperties[ uxZone ] ), 1 );
+        }
+    #endif /* shadowCONFIG_ZONE_SHADOWS > 0 */
+
+    return xStatus;
+}
+
+/*-----------------------------------------------------------*/
+
 void vShadowDeviceTask( void * pvParameters )
 {
     bool xStatus = true;
-    uint32_t ulNotificationValue;
-    static MQTTPublishInfo_t xPublishInfo = { 0 };
-    MQTTAgentCommandInfo_t xCommandParams = { 0 };
-    MQTTStatus_t xCommandAdded;
-    ShadowDeviceCtx_t xShadowCtx = { 0 };
-
-    /* A buffer containing the update document. It has static duration to prevent
-     * it from being placed on the call stack. */
-    static char pcUpdateDocument[ shadowexampleSHADOW_REPORTED_JSON_LENGTH + 1 ] = { 0 };
+    bool xSyncNeeded = true;
+    bool xRescan = true;
+    TimeOut_t xRescanTimeOut;
+    TickType_t xRescanTicks = 0;
 
     /* Remove compiler warnings about unused parameters. */
     ( void ) pvParameters;
 
     /* Record the handle of this task so that the callbacks can send a notification to this task. */
-    xShadowCtx.xShadowDeviceTaskHandle = xTaskGetCurrentTaskHandle();
+    xShadowTaskHandle = xTaskGetCurrentTaskHandle();
+
+    /* Shadow reports carry relay state, keep them ahead of bulk traffic */
+    ( void ) xMqttAgent_SetCommandLane( MQTT_AGENT_LANE_CONTROL );
 
     /* Wait for MqttAgent to be ready. */
     vSleepUntilMQTTAgentReady();
 
-    xShadowCtx.xAgentHandle = xGetMqttAgentHandle();
-
-    xStatus = prvInitializeCtx( &xShadowCtx );
-
-    /* Set up the MQTTAgentCommandInfo_t for the demo loop.
-     * We do not need a completion callback here since for publishes, we expect to get a
-     * response on the appropriate topics for accepted or rejected reports, and for pings
-     * we do not care about the completion. */
-    xCommandParams.blockTimeMs = shadowexampleMAX_COMMAND_SEND_BLOCK_TIME_MS;
-    xCommandParams.cmdCompleteCallback = NULL;
-
-    /* Set up MQTTPublishInfo_t for the update reports. */
-    xPublishInfo.qos = MQTTQoS1;
-    xPublishInfo.pTopicName = xShadowCtx.pcTopicUpdate;
-    xPublishInfo.topicNameLength = xShadowCtx.usTopicUpdateLen;
-    xPublishInfo.pPayload = pcUpdateDocument;
-    xPublishInfo.payloadLength = ( shadowexampleSHADOW_REPORTED_JSON_LENGTH + 1 );
+    xStatus = prvInitializeDocuments();
 
     /* Wait for first mqtt connection */
-    ( void ) xEventGroupWaitBits( xSystemEvents,
-                                  EVT_MASK_MQTT_CONNECTED,
-                                  pdFALSE,
-                                  pdTRUE,
-                                  portMAX_DELAY );
+    vSleepUntilMQTTAgentConnected();
 
-    if( xStatus == true )
+    for( size_t uxDoc = 0; ( uxDoc < shadowNUM_DOCUMENTS ) && ( xStatus == true ); uxDoc++ )
     {
         /* Subscribe to Shadow topics. */
-        xStatus = prvSubscribeToShadowUpdateTopics( &xShadowCtx );
+        xStatus = prvSubscribeToShadowTopics( &( xShadowDocs[ uxDoc ] ) );
     }
 
     if( xStatus == true )
     {
+        vIrrigation_SetValveHook( prvValveHook );
+
         for( ; ; )
         {
-            if( xShadowCtx.ulCurrentPowerOnState == xShadowCtx.ulReportedPowerOnState )
+            if( xIsMqttAgentConnected() == false )
             {
-                LogDebug( "No change in powerOn state since last report. Current state is %u.", xShadowCtx.ulCurrentPowerOnState );
+                LogInfo( "Waiting for the MQTT connection." );
+                vSleepUntilMQTTAgentConnected();
+                xSyncNeeded = true;
             }
-            else
-            {
-                LogInfo( "PowerOn state is now %u. Sending new report.", ( unsigned int ) xShadowCtx.ulCurrentPowerOnState );
 
-                /* Create a new client token and save it for use in the update accepted and rejected callbacks. */
-                xShadowCtx.ulClientToken = ( xTaskGetTickCount() % 1000000 );
-
-                /* Generate update report. */
-                ( void ) memset( pcUpdateDocument,
-                                 0x00,
-                                 sizeof( pcUpdateDocument ) );
-
-                snprintf( pcUpdateDocument,
-                          shadowexampleSHADOW_REPORTED_JSON_LENGTH + 1,
-                          shadowexampleSHADOW_REPORTED_JSON,
-                          ( unsigned int ) xShadowCtx.ulCurrentPowerOnState,
-                          ( long unsigned ) xShadowCtx.ulClientToken );
+            if( xSyncNeeded == true )
+            {
+                /* The desired state may have changed while offline, and the
+                 * device may have lost its state across a reboot */
+                for( size_t uxDoc = 0; uxDoc < shadowNUM_DOCUMENTS; uxDoc++ )
+                {
+                    prvSyncShadow( &( xShadowDocs[ uxDoc ] ) );
+                }
 
-                /* Send update. */
-                LogInfo( "Publishing to /update with following client token %lu.", ( long unsigned ) xShadowCtx.ulClientToken );
-                LogDebug( "Publish content: %.*s", shadowexampleSHADOW_REPORTED_JSON_LENGTH, pcUpdateDocument );
+                xSyncNeeded = false;
+                xRescan = true;
+            }
 
-                xCommandAdded = MQTTAgent_Publish( xShadowCtx.xAgentHandle,
-                                                   &xPublishInfo,
-                                                   &xCommandParams );
+            if( xRescan == true )
+            {
+                prvCommitDesiredSettings();
 
-                if( xCommandAdded != MQTTSuccess )
-                {
-                    LogError( "Failed to publish report to shadow." );
-                }
-                else
+                for( size_t uxDoc = 0; uxDoc < shadowNUM_DOCUMENTS; uxDoc++ )
                 {
-                    /* Wait for the response to our report. When the Device shadow service receives the request it will
-                     * publish a response to  the /update/accepted or update/rejected */
-                    ulNotificationValue = ulTaskNotifyTake( pdFALSE, pdMS_TO_TICKS( shadow_SIGNAL_TIMEOUT ) );
+                    uint32_t ulDirty = ulShadowState_GetDirty( &( xShadowDocs[ uxDoc ].xState ) );
 
-                    if( ulNotificationValue == 0 )
+                    if( ulDirty == 0 )
+                    {
+                        LogDebug( "No change in shadow properties since last report." );
+                    }
+                    else
                     {
-                        LogError( "Timed out waiting for response to report." );
+                        LogInfo( "Shadow properties changed (mask 0x%08lx). Sending new report.", ( unsigned long ) ulDirty );
 
-                        /* If we time out waiting for a response and then the report is accepted, the
-                         * state may be out of sync. Set the reported state as to ensure we resend the
-                         * report. */
-                        xShadowCtx.ulReportedPowerOnState = shadowexampleINVALID_POWERON_STATE;
+                        prvReportChanges( &( xShadowDocs[ uxDoc ] ), ulDirty );
                     }
                 }
 
-                /* Clear the client token */
-                xShadowCtx.ulClientToken = 0;
+                vTaskSetTimeOutState( &xRescanTimeOut );
+                xRescanTicks = pdMS_TO_TICKS( shadowMS_BETWEEN_RESCANS );
             }
 
-            LogDebug( "Sleeping until next update check." );
-            vTaskDelay( pdMS_TO_TICKS( shadowMS_BETWEEN_REPORTS ) );
+            LogDebug( "Sleeping until a property changes." );
+            xRescan = ( prvWaitForEvents( shadowEVT_CHANGED, pdMS_TO_TICKS( shadowMS_CONNECTION_POLL ) ) != 0 ) ||
+                      ( xTaskCheckForTimeOut( &xRescanTimeOut, &xRescanTicks ) == pdTRUE );
         }
     }
     else
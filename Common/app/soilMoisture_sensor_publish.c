@@ -24,11 +24,6 @@
  *
  */
 
-// MICHAEL - clock library
-#include <time.h>
-#include <unistd.h>
-#include <math.h>
-
 #include "logging_levels.h"
 /* define LOG_LEVEL here if you want to modify the logging level from the default */
 
@@ -50,18 +45,24 @@
 /* MQTT library includes. */
 #include "core_mqtt.h"
 #include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
 #include "sys_evt.h"
 
 /* Subscription manager header include. */
 #include "subscription_manager.h"
 
-#define moistureReport_JSON \
-    "{"                     \
-    "\"SoilMoisture\":%.2f," \
-	"\"ADC_Reading\":%1u"   \
-    "}"
-
 /* Sensor includes */
+#include "sample_source.h"
+#include "sample_filter.h"
+#include "moisture_probes.h"
+#include "irrigation_ctrl.h"
+
+#include "telemetry_format.h"
+#include "telemetry_publisher.h"
+#include "json_writer.h"
+
+#include "cbor.h"
+
 
 /*
  */
@@ -69,224 +70,298 @@
 #define MQTT_PUBLISH_TIME_BETWEEN_MS         ( 3000 )
 #define MQTT_PUBLISH_TOPIC                   "SoilMoisture_sensor_data"
 #define MQTT_PUBLICH_TOPIC_STR_LEN           ( 256 )
-#define MQTT_PUBLISH_BLOCK_TIME_MS           ( 1000 )
-#define MQTT_PUBLISH_NOTIFICATION_WAIT_MS    ( 1000 )
 
-#define MQTT_NOTIFY_IDX                      ( 1 )
 #define MQTT_PUBLISH_QOS                     ( MQTTQoS0 )
 
-ADC_HandleTypeDef hadc4;
+/* Raw samples drained from the ADC4 sample source per read, whole frames only */
+#define SENSOR_READ_CHUNK_LEN                ( 8 * MOIST_PROBES_MAX )
+#define SENSOR_READ_TIMEOUT_MS               ( 500 )
+
+/* Arena holding samples waiting to be published as one batch */
+#define TELEMETRY_BATCH_ARENA_LEN            ( 2048 )
+
+/* Irrigation zone driven by RELAY_1 */
+#define SOIL_IRRIGATION_ZONE                 ( 0 )
+
+/* IIR time constant of 2^4 decimated samples */
+#define SENSOR_FILTER_IIR_SHIFT              ( 4 )
 
-#define adc_handler hadc4
+/* The report policy and the irrigation controller take moisture in percent */
+#define MOISTURE_TO_PERCENT( ulMoisture )    ( ( float ) ( ulMoisture ) * ( 1.0f / ( float ) MOIST_MOISTURE_SCALE ) )
 
-const float MOIST_SESNOR_HIGH_MOISTURE = 1000.0;
-const float MOIST_SESNOR_LOW_MOISTURE  = 1750.0;
 /*-----------------------------------------------------------*/
 
-/**
- * @brief Defines the structure to use as the command callback context in this
- * demo.
- */
-struct MQTTAgentCommandContext
-{
-    MQTTStatus_t xReturnStatus;
-    TaskHandle_t xTaskToNotify;
-};
+/* Moisture is reported with the same scale used on the wire */
+#if MOIST_MOISTURE_SCALE != TELEMETRY_FIXED_POINT_SCALE
+#error "MOIST_MOISTURE_SCALE must match TELEMETRY_FIXED_POINT_SCALE"
+#endif
 
 typedef struct
 {
-	float SoilMoisture;
-	int16_t ADC_Reading;
+    uint16_t SoilMoisture; /* Hundredths of a percent */
+    uint16_t ADC_Reading;
 } MoistSensorData_t;
 
-static void MX_ADC4_Init(void);
+typedef struct
+{
+    size_t uxNumProbes;
+    MoistSensorData_t xProbes[ MOIST_PROBES_MAX ];
+} MoistSensorReport_t;
+
+static MoistProbeSet_t xProbeSet;
+static uint32_t ulCalibrationVersion = 0;
+static uint32_t ulLastOverruns = 0;
+static SampleFilter_t xMoistFilters[ MOIST_PROBES_MAX ];
+static SampleSource_t * pxMoistSource = NULL;
+static char pcBatchArena[ TELEMETRY_BATCH_ARENA_LEN ];
 /*-----------------------------------------------------------*/
 
-static void prvPublishCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
-                                       MQTTAgentReturnInfo_t * pxReturnInfo )
+static BaseType_t xInitSensors( void )
 {
-    configASSERT( pxCommandContext != NULL );
-    configASSERT( pxReturnInfo != NULL );
+    BaseType_t xResult = pdFALSE;
+    uint32_t pulAdcInputs[ MOIST_PROBES_MAX ] = { 0 };
+
+    ulCalibrationVersion = ulMoistProbes_CalibrationVersion();
+    xResult = xMoistProbes_Load( &xProbeSet );
+
+    if( xResult == pdTRUE )
+    {
+        for( size_t uxIdx = 0; uxIdx < xProbeSet.uxNumProbes; uxIdx++ )
+        {
+            vSampleFilter_Init( &( xMoistFilters[ uxIdx ] ), SENSOR_FILTER_IIR_SHIFT );
+            pulAdcInputs[ uxIdx ] = xProbeSet.xProbes[ uxIdx ].ulAdcInput;
+        }
+
+        pxMoistSource = pxAdc4DmaSourceGet();
 
-    pxCommandContext->xReturnStatus = pxReturnInfo->returnCode;
+        configASSERT( pxMoistSource != NULL );
 
-    if( pxCommandContext->xTaskToNotify != NULL )
+        /* All probes are converted in a single ADC sequence */
+        xResult = xAdc4DmaSourceSetChannels( pulAdcInputs, xProbeSet.uxNumProbes );
+    }
+
+    if( xResult == pdTRUE )
     {
-        /* Send the context's ulNotificationValue as the notification value so
-         * the receiving task can check the value it set in the context matches
-         * the value it receives in the notification. */
-        ( void ) xTaskNotifyGiveIndexed( pxCommandContext->xTaskToNotify,
-                                         MQTT_NOTIFY_IDX );
+        /* Sampling runs in the background from here on */
+        xResult = pxMoistSource->xStart( pxMoistSource );
     }
+
+    return xResult;
 }
 
 /*-----------------------------------------------------------*/
 
-static BaseType_t prvPublishAndWaitForAck( MQTTAgentHandle_t xAgentHandle,
-                                           const char * pcTopic,
-                                           const void * pvPublishData,
-                                           size_t xPublishDataLen )
+/*
+ * Drain every raw frame accumulated since the last call through the per probe
+ * filters. Blocks until at least one frame is available rather than spinning
+ * on the ADC.
+ */
+static BaseType_t xUpdateSensorData( MoistSensorReport_t * pxReport )
 {
-    BaseType_t xResult = pdFALSE;
-    MQTTStatus_t xStatus;
-
-    configASSERT( pcTopic != NULL );
-    configASSERT( pvPublishData != NULL );
-    configASSERT( xPublishDataLen > 0 );
+    uint16_t pusSamples[ SENSOR_READ_CHUNK_LEN ];
+    size_t uxNumProbes = xProbeSet.uxNumProbes;
+    size_t uxSamplesRead = 0;
+    size_t uxTotalRead = 0;
 
-    MQTTPublishInfo_t xPublishInfo =
+    do
     {
-        .qos             = MQTT_PUBLISH_QOS,
-        .retain          = 0,
-        .dup             = 0,
-        .pTopicName      = pcTopic,
-        .topicNameLength = strlen( pcTopic ),
-        .pPayload        = pvPublishData,
-        .payloadLength   = xPublishDataLen
-    };
-
-    MQTTAgentCommandContext_t xCommandContext =
-    {
-        .xTaskToNotify = xTaskGetCurrentTaskHandle(),
-        .xReturnStatus = MQTTIllegalState,
-    };
+        uxSamplesRead = pxMoistSource->uxRead( pxMoistSource,
+                                               pusSamples,
+                                               SENSOR_READ_CHUNK_LEN,
+                                               ( uxTotalRead == 0 ) ? pdMS_TO_TICKS( SENSOR_READ_TIMEOUT_MS ) : 0 );
 
-    MQTTAgentCommandInfo_t xCommandParams =
-    {
-        .blockTimeMs                 = MQTT_PUBLISH_BLOCK_TIME_MS,
-        .cmdCompleteCallback         = prvPublishCommandCallback,
-        .pCmdCompleteCallbackContext = &xCommandContext,
-    };
+        /* Samples are interleaved in probe order */
+        for( size_t uxIdx = 0; uxIdx < uxSamplesRead; uxIdx++ )
+        {
+            ( void ) xSampleFilter_Push( &( xMoistFilters[ uxIdx % uxNumProbes ] ), pusSamples[ uxIdx ], NULL );
+        }
 
-    /* Clear the notification index */
-    xTaskNotifyStateClearIndexed( NULL, MQTT_NOTIFY_IDX );
+        uxTotalRead += uxSamplesRead;
+    }
+    while( uxSamplesRead == ( SENSOR_READ_CHUNK_LEN - ( SENSOR_READ_CHUNK_LEN % uxNumProbes ) ) );
+
+    if( ( uxTotalRead == 0 ) || ( xMoistFilters[ uxNumProbes - 1 ].ulOutputCount == 0 ) )
+    {
+        return pdFALSE;
+    }
 
+    if( ulMoistProbes_CalibrationVersion() != ulCalibrationVersion )
+    {
+        /* Points were captured from the CLI */
+        ulCalibrationVersion = ulMoistProbes_CalibrationVersion();
+        vMoistProbes_LoadCalibration( &xProbeSet );
+    }
 
-    xStatus = MQTTAgent_Publish( xAgentHandle,
-                                 &xPublishInfo,
-                                 &xCommandParams );
+    pxReport->uxNumProbes = uxNumProbes;
 
-    if( xStatus == MQTTSuccess )
+    for( size_t uxIdx = 0; uxIdx < uxNumProbes; uxIdx++ )
     {
-        xResult = ulTaskNotifyTakeIndexed( MQTT_NOTIFY_IDX,
-                                           pdTRUE,
-                                           pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
+        uint16_t usFiltered = usSampleFilter_Value( &( xMoistFilters[ uxIdx ] ) );
 
-        if( xResult == 0 )
-        {
-            LogError( "Timed out while waiting for publish ACK or Sent event. xTimeout = %d",
-                      pdMS_TO_TICKS( MQTT_PUBLISH_NOTIFICATION_WAIT_MS ) );
-            xResult = pdFALSE;
-        }
-        else if( xCommandContext.xReturnStatus != MQTTSuccess )
-        {
-            LogError( "MQTT Agent returned error code: %d during publish operation.",
-                      xCommandContext.xReturnStatus );
-            xResult = pdFALSE;
-        }
+        vMoistProbes_SetLastReading( uxIdx, usFiltered );
+
+        pxReport->xProbes[ uxIdx ].ADC_Reading = usFiltered;
+        pxReport->xProbes[ uxIdx ].SoilMoisture = usMoistProbes_ToMoisture( &( xProbeSet.xProbes[ uxIdx ] ), usFiltered );
     }
-    else
+
+    if( pxMoistSource->ulOverruns != ulLastOverruns )
     {
-        LogError( "MQTTAgent_Publish returned error code: %d.",
-                  xStatus );
+        LogWarn( "ADC4 sample source dropped %lu samples, %lu in total.",
+                 pxMoistSource->ulOverruns - ulLastOverruns,
+                 pxMoistSource->ulOverruns );
+        ulLastOverruns = pxMoistSource->ulOverruns;
     }
 
-    return xResult;
-}
-
-static BaseType_t xIsMqttConnected( void )
-{
-    /* Wait for MQTT to be connected */
-    EventBits_t uxEvents = xEventGroupWaitBits( xSystemEvents,
-                                                EVT_MASK_MQTT_CONNECTED,
-                                                pdFALSE,
-                                                pdTRUE,
-                                                0 );
-
-    return( ( uxEvents & EVT_MASK_MQTT_CONNECTED ) == EVT_MASK_MQTT_CONNECTED );
+    return pdTRUE;
 }
 
 /*-----------------------------------------------------------*/
 
-static BaseType_t xInitSensors( void )
+/*
+ * Step the irrigation controller with the mean moisture of all probes and
+ * drive the relay. pxReport is NULL when no valid reading is available.
+ */
+static void prvRunIrrigation( const MoistSensorReport_t * pxReport )
 {
-    int32_t lBspError = HAL_OK;
+    IrrigationZone_t * pxZone = pxIrrigation_GetZone( SOIL_IRRIGATION_ZONE );
+    IrrigationConfig_t xConfig;
+    const float * pfMoisture = NULL;
+    uint32_t ulMoistureSum = 0;
+    uint32_t ulNumProbes = 0;
+    float fMoistureMean = 0.0f;
+    BaseType_t xValveOn = pdFALSE;
+
+    /* Pick up changes made from the CLI or the device shadow */
+    vIrrigation_LoadConfig( &xConfig, SOIL_IRRIGATION_ZONE );
+    vIrrigation_SetConfig( pxZone, &xConfig );
+
+    if( ( pxReport != NULL ) && ( pxReport->uxNumProbes > 0 ) )
+    {
+        for( size_t uxIdx = 0; uxIdx < pxReport->uxNumProbes; uxIdx++ )
+        {
+            ulMoistureSum += pxReport->xProbes[ uxIdx ].SoilMoisture;
+        }
 
-    /* You can init the ADC here */
-    MX_ADC4_Init();
+        /* Rounded mean in hundredths, converted once for the controller */
+        ulNumProbes = ( uint32_t ) pxReport->uxNumProbes;
+        fMoistureMean = MOISTURE_TO_PERCENT( ( ulMoistureSum + ( ulNumProbes / 2U ) ) / ulNumProbes );
+        pfMoisture = &fMoistureMean;
+    }
 
-    /* Perform ADC calibration */
-    // MICHAEL - fix undefined reference
-    lBspError = HAL_ADCEx_Calibration_Start(&adc_handler, ADC_CALIB_OFFSET, ADC_SINGLE_ENDED);
+    xValveOn = xIrrigation_Step( pxZone, pfMoisture, TICKS_TO_MS( xTaskGetTickCount() ) );
 
-    return( lBspError == HAL_OK ? pdTRUE : pdFALSE );
+    HAL_GPIO_WritePin( RELAY_1_GPIO_Port, RELAY_1_Pin, ( xValveOn == pdTRUE ) ? GPIO_PIN_SET : GPIO_PIN_RESET );
 }
 
-static BaseType_t xUpdateSensorData(MoistSensorData_t *pxData)
+/*-----------------------------------------------------------*/
+
+/*
+ * One report holds an array with one entry per probe:
+ * {"probes":[{"ch":1,"SoilMoisture":42.17,"ADC_Reading":2048},...]}
+ */
+static int prvFormatReport( char * pcBuffer,
+                            size_t uxBufferLen,
+                            const MoistSensorReport_t * pxReport )
 {
-	/* supply Vdda (unit: mV).                                                  */
-#define VDDA_APPLI                       (3300UL)
+    JsonWriter_t xWriter;
+    int lWritten = 0;
 
-	uint16_t uhADCxConvertedData;
-	//uint16_t uhADCxConvertedData_Voltage_mVolt;
+    vJsonWriter_Init( &xWriter, pcBuffer, uxBufferLen );
+
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_BeginArray( &xWriter, "probes" );
+
+    for( size_t uxIdx = 0; uxIdx < pxReport->uxNumProbes; uxIdx++ )
+    {
+        vJsonWriter_BeginObject( &xWriter, NULL );
+        vJsonWriter_UInt( &xWriter, "ch", xProbeSet.xProbes[ uxIdx ].ulAdcInput );
+        vJsonWriter_Fixed( &xWriter, "SoilMoisture", pxReport->xProbes[ uxIdx ].SoilMoisture, 2 );
+        vJsonWriter_UInt( &xWriter, "ADC_Reading", pxReport->xProbes[ uxIdx ].ADC_Reading );
+        vJsonWriter_EndObject( &xWriter );
+    }
 
-	int32_t lBspError = HAL_OK;
+    vJsonWriter_EndArray( &xWriter );
+    vJsonWriter_EndObject( &xWriter );
 
-	/* Start ADC group regular conversion */
+    lWritten = ( int ) uxJsonWriter_Finish( &xWriter );
 
-	// MICHAEL - fix undefined reference
-	lBspError = HAL_ADC_Start(&adc_handler);
+    if( lWritten == 0 )
+    {
+        /* Report as truncated, like snprintf */
+        lWritten = ( int ) uxBufferLen;
+    }
 
-	if (lBspError == HAL_OK)
-	{
+    return lWritten;
+}
 
-		/* Wait for ADC end of conversion */
-		// MICHAEL - fix
-		while (HAL_ADC_PollForConversion(&adc_handler, 0xFFFFFFFF) != HAL_OK)
-		{
-			// Do nothing
-		}
+/*-----------------------------------------------------------*/
 
-		/* Retrieve ADC conversion data */
-		// MICHAEL - fix
-		uhADCxConvertedData = HAL_ADC_GetValue(&adc_handler) & 0xFFFFFFFE;
+/*
+ * CBOR equivalent of prvFormatReport:
+ * { TLM_KEY_PROBES: [ { TLM_KEY_CHANNEL: ch, TLM_KEY_MOISTURE: percent * 100, TLM_KEY_RAW: reading }, ... ] }
+ */
+static int prvEncodeReportCbor( uint8_t * pucBuffer,
+                                size_t uxBufferLen,
+                                const MoistSensorReport_t * pxReport )
+{
+    CborEncoder xEncoder;
+    CborEncoder xMapEncoder;
+    CborEncoder xArrayEncoder;
+    CborError xError = CborNoError;
+    int lWritten = 0;
 
-		pxData->ADC_Reading = uhADCxConvertedData;
+    cbor_encoder_init( &xEncoder, pucBuffer, uxBufferLen, 0 );
 
-		pxData->SoilMoisture = (100 * (MOIST_SESNOR_LOW_MOISTURE - (float)uhADCxConvertedData))/(MOIST_SESNOR_LOW_MOISTURE - MOIST_SESNOR_HIGH_MOISTURE);
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, 1 );
+    xError |= cbor_encode_uint( &xMapEncoder, TLM_KEY_PROBES );
+    xError |= cbor_encoder_create_array( &xMapEncoder, &xArrayEncoder, pxReport->uxNumProbes );
 
-		if(pxData->SoilMoisture < 0)
-		{
-			pxData->SoilMoisture = 0;
-		}
+    for( size_t uxIdx = 0; uxIdx < pxReport->uxNumProbes; uxIdx++ )
+    {
+        CborEncoder xProbeEncoder;
+
+        xError |= cbor_encoder_create_map( &xArrayEncoder, &xProbeEncoder, 3 );
+        xError |= cbor_encode_uint( &xProbeEncoder, TLM_KEY_CHANNEL );
+        xError |= cbor_encode_uint( &xProbeEncoder, xProbeSet.xProbes[ uxIdx ].ulAdcInput );
+        xError |= cbor_encode_uint( &xProbeEncoder, TLM_KEY_MOISTURE );
+        xError |= cbor_encode_int( &xProbeEncoder, pxReport->xProbes[ uxIdx ].SoilMoisture );
+        xError |= cbor_encode_uint( &xProbeEncoder, TLM_KEY_RAW );
+        xError |= cbor_encode_uint( &xProbeEncoder, pxReport->xProbes[ uxIdx ].ADC_Reading );
+        xError |= cbor_encoder_close_container( &xArrayEncoder, &xProbeEncoder );
+    }
 
-		if(pxData->SoilMoisture > 100)
-		{
-			pxData->SoilMoisture = 100;
-		}
+    xError |= cbor_encoder_close_container( &xMapEncoder, &xArrayEncoder );
+    xError |= cbor_encoder_close_container( &xEncoder, &xMapEncoder );
 
-		if(pxData->SoilMoisture > 70)
-		{
-            HAL_GPIO_WritePin( RELAY_1_GPIO_Port, RELAY_1_Pin, GPIO_PIN_RESET );/* Turn the GPIO off */
-		}
-	}
+    if( xError == CborNoError )
+    {
+        lWritten = ( int ) cbor_encoder_get_buffer_size( &xEncoder, pucBuffer );
+    }
+    else if( ( xError & ~CborErrorOutOfMemory ) == CborNoError )
+    {
+        /* Report as truncated, like snprintf */
+        lWritten = ( int ) ( uxBufferLen + cbor_encoder_get_extra_bytes_needed( &xEncoder ) );
+    }
+    else
+    {
+        lWritten = -1;
+    }
 
-	return (lBspError == HAL_OK ? pdTRUE : pdFALSE);
+    return lWritten;
 }
 
 /*-----------------------------------------------------------*/
 
-extern UBaseType_t uxRand( void );
-
 void vSoilMoistureSensorPublishTask( void * pvParameters )
 {
     BaseType_t xResult = pdFALSE;
     BaseType_t xExitFlag = pdFALSE;
     char payloadBuf[ MQTT_PUBLISH_MAX_LEN ];
-    MQTTAgentHandle_t xAgentHandle = NULL;
     char pcTopicString[ MQTT_PUBLICH_TOPIC_STR_LEN ] = { 0 };
     size_t xTopicLen = 0;
-    float saved_SoilMoisture = -1;
+    TelemetryStream_t xStream;
+    TelemetryFormat_t xFormat = xTelemetryFormat_Get();
+    IrrigationConfig_t xIrrigationConfig;
 
     ( void ) pvParameters;
 
@@ -305,54 +380,66 @@ void vSoilMoistureSensorPublishTask( void * pvParameters )
         ( void ) KVStore_getString( CS_CORE_THING_NAME, &( pcTopicString[ xTopicLen ] ), MQTT_PUBLICH_TOPIC_STR_LEN - xTopicLen );
 
         xTopicLen = strlcat( pcTopicString, "/"MQTT_PUBLISH_TOPIC, MQTT_PUBLICH_TOPIC_STR_LEN );
+        xTopicLen = uxTelemetryFormat_AppendTopicSuffix( pcTopicString, MQTT_PUBLICH_TOPIC_STR_LEN, xFormat );
     }
 
-    xAgentHandle = xGetMqttAgentHandle();
+    vIrrigation_LoadConfig( &xIrrigationConfig, SOIL_IRRIGATION_ZONE );
+    vIrrigation_Init( pxIrrigation_GetZone( SOIL_IRRIGATION_ZONE ), &xIrrigationConfig );
+
+    vTelemetryStream_Init( &xStream, "soil moisture", pcTopicString, MQTT_PUBLISH_QOS, CS_SOIL_DEADBAND,
+                           xProbeSet.uxNumProbes, pcBatchArena, TELEMETRY_BATCH_ARENA_LEN, xFormat );
 
     while( xExitFlag == pdFALSE )
     {
         TickType_t xTicksToWait = pdMS_TO_TICKS( MQTT_PUBLISH_TIME_BETWEEN_MS );
         TimeOut_t xTimeOut;
+        float pfMoisture[ MOIST_PROBES_MAX ];
 
         vTaskSetTimeOutState( &xTimeOut );
 
-        MoistSensorData_t xMoistData;
-        xResult = xUpdateSensorData( &xMoistData );
+        /* Pick up changes made from the CLI or the device shadow */
+        vTelemetryStream_LoadConfig( &xStream );
+
+        MoistSensorReport_t xMoistReport;
+        xResult = xUpdateSensorData( &xMoistReport );
+
+        for( size_t uxIdx = 0; ( xResult == pdTRUE ) && ( uxIdx < xMoistReport.uxNumProbes ); uxIdx++ )
+        {
+            pfMoisture[ uxIdx ] = MOISTURE_TO_PERCENT( xMoistReport.xProbes[ uxIdx ].SoilMoisture );
+        }
+
+        /* Irrigation runs locally every sample period, whether or not we are connected */
+        prvRunIrrigation( ( xResult == pdTRUE ) ? &xMoistReport : NULL );
 
-    	if( xResult != pdTRUE )
+        if( xResult != pdTRUE )
         {
             LogError( "Error while reading moist data." );
         }
-        else if(( xIsMqttConnected() == pdTRUE ) /*&& (saved_SoilMoisture != xMoistData.SoilMoisture)*/)
+        else if( xTelemetryStream_ShouldReport( &xStream, pfMoisture ) == pdTRUE )
         {
             int bytesWritten = 0;
 
-            saved_SoilMoisture = xMoistData.SoilMoisture;
-
-            /* Write to */
-            bytesWritten = snprintf( payloadBuf,
-                                     MQTT_PUBLISH_MAX_LEN,
-									 moistureReport_JSON,
-                                     xMoistData.SoilMoisture,
-									 xMoistData.ADC_Reading);
-
-            if( bytesWritten < MQTT_PUBLISH_MAX_LEN )
+            /* One sample covers every probe */
+            if( xFormat == TELEMETRY_FORMAT_CBOR )
             {
+                bytesWritten = prvEncodeReportCbor( ( uint8_t * ) payloadBuf,
+                                                    MQTT_PUBLISH_MAX_LEN,
+                                                    &xMoistReport );
+            }
+            else
+            {
+                bytesWritten = prvFormatReport( payloadBuf,
+                                                MQTT_PUBLISH_MAX_LEN,
+                                                &xMoistReport );
+            }
 
-            	// MICHAEL - execution time
-            	double time_spent = 0.0;
-            	clock_t begin = clock( );
-
-                xResult = prvPublishAndWaitForAck( xAgentHandle,
-                                                   pcTopicString,
-                                                   payloadBuf,
-                                                   bytesWritten );
-
-                // MICHAEL - execution time
-                clock_t end = clock( );
-                time_spent = ( double ) ( end - begin ) * 1000.0 / CLOCKS_PER_SEC;
-                //LogError( "Execution time: %f", time_spent );
-
+            if( ( bytesWritten > 0 ) && ( bytesWritten < MQTT_PUBLISH_MAX_LEN ) )
+            {
+                if( ( xTelemetryStream_Add( &xStream, payloadBuf, ( size_t ) bytesWritten, pfMoisture ) == pdTRUE ) &&
+                    ( xFormat == TELEMETRY_FORMAT_JSON ) )
+                {
+                    LogDebug( "%.*s", bytesWritten, payloadBuf );
+                }
             }
             else if( bytesWritten > 0 )
             {
@@ -360,15 +447,12 @@ void vSoilMoistureSensorPublishTask( void * pvParameters )
             }
             else
             {
-                LogError( "Printf call failed." );
-            }
-
-            if( xResult == pdTRUE )
-            {
-                LogDebug( payloadBuf );
+                LogError( "Failed to encode report." );
             }
         }
 
+        vTelemetryStream_FlushIfDue( &xStream );
+
         /* Adjust remaining tick count */
         if( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdFALSE )
         {
@@ -378,144 +462,3 @@ void vSoilMoistureSensorPublishTask( void * pvParameters )
     }
 }
 
-
-/**
-  * @brief ADC4 Initialization Function
-  * @param None
-  * @retval None
-  */
-static void MX_ADC4_Init(void)
-{
-
-  /* USER CODE BEGIN ADC4_Init 0 */
-
-  /* USER CODE END ADC4_Init 0 */
-
-  ADC_ChannelConfTypeDef sConfig = {0};
-
-  /* USER CODE BEGIN ADC4_Init 1 */
-
-  /* USER CODE END ADC4_Init 1 */
-
-  /** Common config
-  */
-  hadc4.Instance = ADC4;
-  hadc4.Init.ClockPrescaler = ADC_CLOCK_ASYNC_DIV1;
-  hadc4.Init.Resolution = ADC_RESOLUTION_12B;
-  hadc4.Init.DataAlign = ADC_DATAALIGN_RIGHT;
-  hadc4.Init.ScanConvMode = ADC4_SCAN_DISABLE;
-  hadc4.Init.EOCSelection = ADC_EOC_SINGLE_CONV;
-  hadc4.Init.LowPowerAutoPowerOff = ADC_LOW_POWER_NONE;
-  hadc4.Init.LowPowerAutoWait = DISABLE;
-  hadc4.Init.ContinuousConvMode = DISABLE;
-  hadc4.Init.NbrOfConversion = 1;
-  hadc4.Init.ExternalTrigConv = ADC_SOFTWARE_START;
-  hadc4.Init.ExternalTrigConvEdge = ADC_EXTERNALTRIGCONVEDGE_NONE;
-  hadc4.Init.DMAContinuousRequests = DISABLE;
-  hadc4.Init.TriggerFrequencyMode = ADC_TRIGGER_FREQ_LOW;
-  hadc4.Init.Overrun = ADC_OVR_DATA_OVERWRITTEN;
-  hadc4.Init.SamplingTimeCommon1 = ADC4_SAMPLETIME_19CYCLES_5;
-  hadc4.Init.SamplingTimeCommon2 = ADC4_SAMPLETIME_1CYCLE_5;
-  hadc4.Init.OversamplingMode = ENABLE;
-  hadc4.Init.Oversampling.Ratio = ADC_OVERSAMPLING_RATIO_8;
-  hadc4.Init.Oversampling.RightBitShift = ADC_RIGHTBITSHIFT_4;
-  hadc4.Init.Oversampling.TriggeredMode = ADC_TRIGGEREDMODE_SINGLE_TRIGGER;
-
-  // MICHAEL - fix
-  if(HAL_ADC_Init(&hadc4) != HAL_OK)
-  {
-	  __BKPT(0);
-  }
-
-  /** Configure Regular Channel
-  */
-  sConfig.Channel = ADC_CHANNEL_1;
-  sConfig.Rank = ADC4_REGULAR_RANK_1;
-  sConfig.SamplingTime = ADC4_SAMPLINGTIME_COMMON_1;
-  sConfig.OffsetNumber = ADC_OFFSET_NONE;
-  sConfig.Offset = 0;
-
-  // MICHAEL - fix
-  if(HAL_ADC_ConfigChannel(&hadc4, &sConfig) != HAL_OK)
-  {
-    __BKPT(0);
-  }
-  /* USER CODE BEGIN ADC4_Init 2 */
-
-  /* USER CODE END ADC4_Init 2 */
-
-}
-
-/**
-* @brief ADC MSP Initialization
-* This function configures the hardware resources used in this example
-* @param hadc: ADC handle pointer
-* @retval None
-*/
-void HAL_ADC_MspInit(ADC_HandleTypeDef* hadc)
-{
-  GPIO_InitTypeDef GPIO_InitStruct = {0};
-  RCC_PeriphCLKInitTypeDef PeriphClkInit = {0};
-  if(hadc->Instance==ADC4)
-  {
-  /* USER CODE BEGIN ADC4_MspInit 0 */
-
-  /* USER CODE END ADC4_MspInit 0 */
-
-  /** Initializes the peripherals clock
-  */
-    PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_ADCDAC;
-    PeriphClkInit.AdcDacClockSelection = RCC_ADCDACCLKSOURCE_HSI;
-    if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
-    {
-      __BKPT(0);
-    }
-
-    /* Peripheral clock enable */
-    __HAL_RCC_ADC4_CLK_ENABLE();
-
-    __HAL_RCC_GPIOC_CLK_ENABLE();
-    /**ADC4 GPIO Configuration
-    PC0     ------> ADC4_IN1
-    */
-    GPIO_InitStruct.Pin = GPIO_PIN_0;
-    GPIO_InitStruct.Mode = GPIO_MODE_ANALOG;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
-
-  /* USER CODE BEGIN ADC4_MspInit 1 */
-
-  /* USER CODE END ADC4_MspInit 1 */
-  }
-
-}
-
-/**
-* @brief ADC MSP De-Initialization
-* This function freeze the hardware resources used in this example
-* @param hadc: ADC handle pointer
-* @retval None
-*/
-void HAL_ADC_MspDeInit(ADC_HandleTypeDef* hadc)
-{
-  if(hadc->Instance==ADC4)
-  {
-  /* USER CODE BEGIN ADC4_MspDeInit 0 */
-
-  /* USER CODE END ADC4_MspDeInit 0 */
-    /* Peripheral clock disable */
-    __HAL_RCC_ADC4_CLK_DISABLE();
-
-    /**ADC4 GPIO Configuration
-    PC0     ------> ADC4_IN1
-    */
-    HAL_GPIO_DeInit(GPIOC, GPIO_PIN_0);
-
-  /* USER CODE BEGIN ADC4_MspDeInit 1 */
-
-  /* USER CODE END ADC4_MspDeInit 1 */
-  }
-
-}
-
-
@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file json_extract.c
+ * @brief Extract several values from a JSON document in a single pass.
+ */
+
+#include "FreeRTOS.h"
+
+#include "json_extract.h"
+
+#include <string.h>
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Check whether pcName is segment uxDepth of the path of pxKey.
+ *
+ * @param[out] pxLast pdTRUE if the segment is the key itself rather than an
+ * enclosing object.
+ */
+static BaseType_t prvMatchSegment( const JsonExtractKey_t * pxKey,
+                                   size_t uxDepth,
+                                   const char * pcName,
+                                   size_t uxNameLen,
+                                   BaseType_t * pxLast )
+{
+    const char * pcSegment = pxKey->pcObject;
+    size_t uxSegmentLen = 0;
+    size_t uxSegment = 0;
+
+    *pxLast = pdFALSE;
+
+    /* Skip the leading segments of the object path */
+    while( ( pcSegment != NULL ) && ( uxSegment < uxDepth ) )
+    {
+        pcSegment = strchr( pcSegment, '.' );
+
+        if( pcSegment != NULL )
+        {
+            pcSegment++;
+        }
+
+        uxSegment++;
+    }
+
+    if( pcSegment != NULL )
+    {
+        const char * pcDot = strchr( pcSegment, '.' );
+
+        uxSegmentLen = ( pcDot != NULL ) ? ( size_t ) ( pcDot - pcSegment ) : strlen( pcSegment );
+    }
+    else if( uxSegment == uxDepth )
+    {
+        /* The object path is exhausted, the key follows */
+        pcSegment = pxKey->pcKey;
+        uxSegmentLen = strlen( pcSegment );
+        *pxLast = pdTRUE;
+    }
+    else
+    {
+        /* Deeper than the key */
+    }
+
+    return( ( pcSegment != NULL ) &&
+            ( uxSegmentLen == uxNameLen ) &&
+            ( strncmp( pcSegment, pcName, uxNameLen ) == 0 ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Parse an unsigned decimal without relying on a terminator after the value */
+static BaseType_t prvParseUInt( const char * pcValue,
+                                size_t uxValueLen,
+                                uint32_t * pulValue )
+{
+    BaseType_t xResult = ( uxValueLen > 0 ) ? pdTRUE : pdFALSE;
+    uint32_t ulValue = 0;
+
+    for( size_t uxIdx = 0; ( uxIdx < uxValueLen ) && ( xResult == pdTRUE ); uxIdx++ )
+    {
+        uint32_t ulDigit = ( uint32_t ) ( pcValue[ uxIdx ] - '0' );
+
+        if( ( ulDigit > 9U ) ||
+            ( ulValue > ( ( UINT32_MAX - ulDigit ) / 10U ) ) )
+        {
+            xResult = pdFALSE;
+        }
+        else
+        {
+            ulValue = ( ulValue * 10U ) + ulDigit;
+        }
+    }
+
+    *pulValue = ulValue;
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvConvert( JsonExtractType_t xType,
+                              JsonExtractValue_t * pxValue )
+{
+    BaseType_t xResult = pdFALSE;
+
+    switch( xType )
+    {
+        case JSON_EXTRACT_UINT:
+
+            if( pxValue->xJsonType == JSONNumber )
+            {
+                xResult = prvParseUInt( pxValue->pcValue, pxValue->uxValueLen, &( pxValue->ulValue ) );
+            }
+
+            break;
+
+        case JSON_EXTRACT_DIGITS:
+
+            if( pxValue->xJsonType == JSONString )
+            {
+                xResult = prvParseUInt( pxValue->pcValue, pxValue->uxValueLen, &( pxValue->ulValue ) );
+            }
+
+            break;
+
+        case JSON_EXTRACT_BOOL:
+
+            if( ( pxValue->xJsonType == JSONTrue ) || ( pxValue->xJsonType == JSONFalse ) )
+            {
+                pxValue->ulValue = ( pxValue->xJsonType == JSONTrue ) ? 1U : 0U;
+                xResult = pdTRUE;
+            }
+            else if( pxValue->xJsonType == JSONNumber )
+            {
+                xResult = prvParseUInt( pxValue->pcValue, pxValue->uxValueLen, &( pxValue->ulValue ) );
+                pxValue->ulValue = ( pxValue->ulValue != 0 ) ? 1U : 0U;
+            }
+            else
+            {
+                /* Wrong type */
+            }
+
+            break;
+
+        case JSON_EXTRACT_STRING:
+            xResult = ( pxValue->xJsonType == JSONString ) ? pdTRUE : pdFALSE;
+            break;
+
+        case JSON_EXTRACT_ANY:
+            xResult = pdTRUE;
+            break;
+
+        default:
+            break;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+/**
+ * @brief Resolve the keys in ulPending, whose paths lead through this object
+ * at uxDepth. The recursion is bounded by JSON_EXTRACT_MAX_DEPTH.
+ */
+static uint32_t prvExtractObject( const char * pcObject,
+                                  size_t uxObjectLen,
+                                  size_t uxDepth,
+                                  uint32_t ulPending,
+                                  const JsonExtractKey_t * pxKeys,
+                                  size_t uxNumKeys,
+                                  JsonExtractValue_t * pxValues )
+{
+    uint32_t ulFound = 0;
+    size_t uxStart = 0;
+    size_t uxNext = 0;
+    JSONPair_t xPair = { 0 };
+
+    while( ( ulPending != 0 ) &&
+           ( JSON_Iterate( pcObject, uxObjectLen, &uxStart, &uxNext, &xPair ) == JSONSuccess ) )
+    {
+        uint32_t ulChildren = 0;
+
+        for( size_t uxIdx = 0; ( uxIdx < uxNumKeys ) && ( xPair.key != NULL ); uxIdx++ )
+        {
+            const uint32_t ulBit = 1UL << uxIdx;
+            BaseType_t xLast = pdFALSE;
+
+            if( ( ( ulPending & ulBit ) != 0 ) &&
+                ( prvMatchSegment( &( pxKeys[ uxIdx ] ), uxDepth, xPair.key, xPair.keyLength, &xLast ) == pdTRUE ) )
+            {
+                /* The first match wins, as with JSON_Search */
+                ulPending &= ~ulBit;
+
+                if( xLast == pdTRUE )
+                {
+                    pxValues[ uxIdx ].pcValue = xPair.value;
+                    pxValues[ uxIdx ].uxValueLen = xPair.valueLength;
+                    pxValues[ uxIdx ].xJsonType = xPair.jsonType;
+
+                    if( prvConvert( pxKeys[ uxIdx ].xType, &( pxValues[ uxIdx ] ) ) == pdTRUE )
+                    {
+                        ulFound |= ulBit;
+                    }
+                }
+                else if( xPair.jsonType == JSONObject )
+                {
+                    ulChildren |= ulBit;
+                }
+                else
+                {
+                    /* The key cannot be below a value that is not an object */
+                }
+            }
+        }
+
+        if( ulChildren != 0 )
+        {
+            ulFound |= prvExtractObject( xPair.value, xPair.valueLength, uxDepth + 1, ulChildren,
+                                         pxKeys, uxNumKeys, pxValues );
+        }
+    }
+
+    return ulFound;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t ulJsonExtract_Validated( const char * pcObject,
+                                  size_t uxObjectLen,
+                                  const JsonExtractKey_t * pxKeys,
+                                  size_t uxNumKeys,
+                                  JsonExtractValue_t * pxValues )
+{
+    uint32_t ulPending = 0;
+
+    configASSERT( pcObject != NULL );
+    configASSERT( pxKeys != NULL );
+    configASSERT( pxValues != NULL );
+    configASSERT( uxNumKeys <= JSON_EXTRACT_MAX_KEYS );
+
+    for( size_t uxIdx = 0; uxIdx < uxNumKeys; uxIdx++ )
+    {
+        const char * pcObjectPath = pxKeys[ uxIdx ].pcObject;
+        size_t uxSegments = 1; /* The key */
+
+        configASSERT( pxKeys[ uxIdx ].pcKey != NULL );
+
+        while( pcObjectPath != NULL )
+        {
+            uxSegments++;
+            pcObjectPath = strchr( pcObjectPath, '.' );
+            pcObjectPath = ( pcObjectPath != NULL ) ? ( pcObjectPath + 1 ) : NULL;
+        }
+
+        /* Bounds the recursion */
+        configASSERT( uxSegments <= JSON_EXTRACT_MAX_DEPTH );
+
+        ( void ) memset( &( pxValues[ uxIdx ] ), 0, sizeof( JsonExtractValue_t ) );
+        ulPending |= 1UL << uxIdx;
+    }
+
+    return prvExtractObject( pcObject, uxObjectLen, 0, ulPending, pxKeys, uxNumKeys, pxValues );
+}
+
+/*-----------------------------------------------------------*/
+
+JSONStatus_t xJsonExtract( const char * pcDocument,
+                           size_t uxDocumentLen,
+                           const JsonExtractKey_t * pxKeys,
+                           size_t uxNumKeys,
+                           JsonExtractValue_t * pxValues,
+                           uint32_t * pulFound )
+{
+    JSONStatus_t xStatus = JSONSuccess;
+
+    configASSERT( pulFound != NULL );
+
+    *pulFound = 0;
+
+    xStatus = JSON_Validate( pcDocument, uxDocumentLen );
+
+    if( xStatus == JSONSuccess )
+    {
+        *pulFound = ulJsonExtract_Validated( pcDocument, uxDocumentLen, pxKeys, uxNumKeys, pxValues );
+    }
+    else
+    {
+        /* Leave the values defined */
+        for( size_t uxIdx = 0; uxIdx < uxNumKeys; uxIdx++ )
+        {
+            ( void ) memset( &( pxValues[ uxIdx ] ), 0, sizeof( JsonExtractValue_t ) );
+        }
+    }
+
+    return xStatus;
+}
@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file json_writer.c
+ * @brief Small streaming JSON writer for building MQTT payloads in place.
+ */
+
+#include "FreeRTOS.h"
+
+#include "json_writer.h"
+
+#include <string.h>
+
+/* Enough for "-4294967295" */
+#define JSON_WRITER_NUM_BUF_LEN    ( 12U )
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_Init( JsonWriter_t * pxWriter,
+                       char * pcBuffer,
+                       size_t uxBufferLen )
+{
+    configASSERT( pxWriter != NULL );
+    configASSERT( pcBuffer != NULL );
+    configASSERT( uxBufferLen > 0 );
+
+    ( void ) memset( pxWriter, 0, sizeof( JsonWriter_t ) );
+
+    pxWriter->pcBuffer = pcBuffer;
+    pxWriter->uxBufferLen = uxBufferLen;
+    pxWriter->xOverflow = pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPutBytes( JsonWriter_t * pxWriter,
+                         const char * pcBytes,
+                         size_t uxLen )
+{
+    /* Always keep room for the NUL terminator */
+    if( ( pxWriter->xOverflow == pdFALSE ) &&
+        ( uxLen < ( pxWriter->uxBufferLen - pxWriter->uxLength ) ) )
+    {
+        ( void ) memcpy( &( pxWriter->pcBuffer[ pxWriter->uxLength ] ), pcBytes, uxLen );
+        pxWriter->uxLength += uxLen;
+    }
+    else
+    {
+        pxWriter->xOverflow = pdTRUE;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPutChar( JsonWriter_t * pxWriter,
+                        char cChar )
+{
+    prvPutBytes( pxWriter, &cChar, 1 );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Format ulValue right aligned into the end of pcBuf, returns a pointer to the first digit */
+static char * prvFormatUInt( char * pcBuf,
+                             uint32_t ulValue,
+                             uint8_t ucMinDigits )
+{
+    char * pcDigit = &( pcBuf[ JSON_WRITER_NUM_BUF_LEN ] );
+    uint8_t ucDigits = 0;
+
+    do
+    {
+        pcDigit--;
+        *pcDigit = ( char ) ( '0' + ( ulValue % 10U ) );
+        ulValue /= 10U;
+        ucDigits++;
+    }
+    while( ( ( ulValue > 0 ) || ( ucDigits < ucMinDigits ) ) &&
+           ( ucDigits < ( JSON_WRITER_NUM_BUF_LEN - 1 ) ) );
+
+    return pcDigit;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPutUInt( JsonWriter_t * pxWriter,
+                        uint32_t ulValue,
+                        uint8_t ucMinDigits )
+{
+    char pcBuf[ JSON_WRITER_NUM_BUF_LEN ];
+    char * pcStart = prvFormatUInt( pcBuf, ulValue, ucMinDigits );
+
+    prvPutBytes( pxWriter, pcStart, ( size_t ) ( &( pcBuf[ JSON_WRITER_NUM_BUF_LEN ] ) - pcStart ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Emit the separator and key which precede every value */
+static void prvBeginValue( JsonWriter_t * pxWriter,
+                           const char * pcKey )
+{
+    configASSERT( pxWriter != NULL );
+
+    if( pxWriter->pucMemberCount[ pxWriter->ucDepth ] > 0 )
+    {
+        prvPutChar( pxWriter, ',' );
+    }
+
+    if( pxWriter->pucMemberCount[ pxWriter->ucDepth ] < UINT8_MAX )
+    {
+        pxWriter->pucMemberCount[ pxWriter->ucDepth ]++;
+    }
+
+    if( pcKey != NULL )
+    {
+        prvPutChar( pxWriter, '"' );
+        prvPutBytes( pxWriter, pcKey, strlen( pcKey ) );
+        prvPutBytes( pxWriter, "\":", 2 );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvOpen( JsonWriter_t * pxWriter,
+                     const char * pcKey,
+                     char cOpen )
+{
+    configASSERT( pxWriter != NULL );
+
+    /* Check the limit first so a rejected level leaves no key or bracket behind */
+    if( pxWriter->ucDepth < JSON_WRITER_MAX_DEPTH )
+    {
+        prvBeginValue( pxWriter, pcKey );
+        prvPutChar( pxWriter, cOpen );
+
+        pxWriter->ucDepth++;
+        pxWriter->pucMemberCount[ pxWriter->ucDepth ] = 0;
+    }
+    else
+    {
+        pxWriter->xOverflow = pdTRUE;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvClose( JsonWriter_t * pxWriter,
+                      char cClose )
+{
+    configASSERT( pxWriter != NULL );
+
+    if( pxWriter->ucDepth > 0 )
+    {
+        pxWriter->ucDepth--;
+        prvPutChar( pxWriter, cClose );
+    }
+    else
+    {
+        pxWriter->xOverflow = pdTRUE;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_BeginObject( JsonWriter_t * pxWriter,
+                              const char * pcKey )
+{
+    prvOpen( pxWriter, pcKey, '{' );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_EndObject( JsonWriter_t * pxWriter )
+{
+    prvClose( pxWriter, '}' );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_BeginArray( JsonWriter_t * pxWriter,
+                             const char * pcKey )
+{
+    prvOpen( pxWriter, pcKey, '[' );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_EndArray( JsonWriter_t * pxWriter )
+{
+    prvClose( pxWriter, ']' );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_Int( JsonWriter_t * pxWriter,
+                      const char * pcKey,
+                      int32_t lValue )
+{
+    prvBeginValue( pxWriter, pcKey );
+
+    if( lValue < 0 )
+    {
+        prvPutChar( pxWriter, '-' );
+        prvPutUInt( pxWriter, ( uint32_t ) ( -( int64_t ) lValue ), 1 );
+    }
+    else
+    {
+        prvPutUInt( pxWriter, ( uint32_t ) lValue, 1 );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_UInt( JsonWriter_t * pxWriter,
+                       const char * pcKey,
+                       uint32_t ulValue )
+{
+    prvBeginValue( pxWriter, pcKey );
+    prvPutUInt( pxWriter, ulValue, 1 );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_Fixed( JsonWriter_t * pxWriter,
+                        const char * pcKey,
+                        int32_t lValue,
+                        uint8_t ucDecimals )
+{
+    uint32_t ulMagnitude = 0;
+    uint32_t ulDivisor = 1;
+
+    configASSERT( ucDecimals < 10 );
+
+    prvBeginValue( pxWriter, pcKey );
+
+    if( lValue < 0 )
+    {
+        prvPutChar( pxWriter, '-' );
+        ulMagnitude = ( uint32_t ) ( -( int64_t ) lValue );
+    }
+    else
+    {
+        ulMagnitude = ( uint32_t ) lValue;
+    }
+
+    for( uint8_t ucIdx = 0; ucIdx < ucDecimals; ucIdx++ )
+    {
+        ulDivisor *= 10U;
+    }
+
+    prvPutUInt( pxWriter, ulMagnitude / ulDivisor, 1 );
+
+    if( ucDecimals > 0 )
+    {
+        prvPutChar( pxWriter, '.' );
+        prvPutUInt( pxWriter, ulMagnitude % ulDivisor, ucDecimals );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_UIntString( JsonWriter_t * pxWriter,
+                             const char * pcKey,
+                             uint32_t ulValue,
+                             uint8_t ucMinDigits )
+{
+    prvBeginValue( pxWriter, pcKey );
+    prvPutChar( pxWriter, '"' );
+    prvPutUInt( pxWriter, ulValue, ucMinDigits );
+    prvPutChar( pxWriter, '"' );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_String( JsonWriter_t * pxWriter,
+                         const char * pcKey,
+                         const char * pcValue )
+{
+    static const char pcHexDigits[] = "0123456789abcdef";
+
+    configASSERT( pcValue != NULL );
+
+    prvBeginValue( pxWriter, pcKey );
+    prvPutChar( pxWriter, '"' );
+
+    for( const char * pcChar = pcValue; *pcChar != '\0'; pcChar++ )
+    {
+        uint8_t ucChar = ( uint8_t ) *pcChar;
+
+        if( ( ucChar == '"' ) || ( ucChar == '\\' ) )
+        {
+            prvPutChar( pxWriter, '\\' );
+            prvPutChar( pxWriter, ( char ) ucChar );
+        }
+        else if( ucChar < 0x20U )
+        {
+            char pcEscape[ 6 ] = { '\\', 'u', '0', '0', pcHexDigits[ ucChar >> 4 ], pcHexDigits[ ucChar & 0xFU ] };
+
+            prvPutBytes( pxWriter, pcEscape, sizeof( pcEscape ) );
+        }
+        else
+        {
+            prvPutChar( pxWriter, ( char ) ucChar );
+        }
+    }
+
+    prvPutChar( pxWriter, '"' );
+}
+
+/*-----------------------------------------------------------*/
+
+void vJsonWriter_Raw( JsonWriter_t * pxWriter,
+                      const char * pcKey,
+                      const char * pcJson,
+                      size_t uxJsonLen )
+{
+    configASSERT( pcJson != NULL );
+
+    prvBeginValue( pxWriter, pcKey );
+    prvPutBytes( pxWriter, pcJson, uxJsonLen );
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxJsonWriter_Finish( JsonWriter_t * pxWriter )
+{
+    size_t uxLength = 0;
+
+    configASSERT( pxWriter != NULL );
+
+    if( ( pxWriter->xOverflow == pdFALSE ) && ( pxWriter->ucDepth == 0 ) )
+    {
+        /* prvPutBytes always leaves room for the terminator */
+        pxWriter->pcBuffer[ pxWriter->uxLength ] = '\0';
+        uxLength = pxWriter->uxLength;
+    }
+
+    return uxLength;
+}
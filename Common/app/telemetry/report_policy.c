@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file report_policy.c
+ * @brief Report-on-change policy for periodic sensor telemetry.
+ */
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "report_policy.h"
+
+#include <math.h>
+#include <string.h>
+
+/*-----------------------------------------------------------*/
+
+void vReportPolicy_Init( ReportPolicy_t * pxPolicy,
+                         const ReportPolicyConfig_t * pxConfig,
+                         size_t uxNumValues )
+{
+    configASSERT( pxPolicy != NULL );
+    configASSERT( pxConfig != NULL );
+    configASSERT( uxNumValues <= REPORT_POLICY_MAX_VALUES );
+
+    ( void ) memset( pxPolicy, 0, sizeof( ReportPolicy_t ) );
+
+    pxPolicy->xConfig = *pxConfig;
+    pxPolicy->uxNumValues = uxNumValues;
+    pxPolicy->xHasReported = pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+void vReportPolicy_SetConfig( ReportPolicy_t * pxPolicy,
+                              const ReportPolicyConfig_t * pxConfig )
+{
+    configASSERT( pxPolicy != NULL );
+    configASSERT( pxConfig != NULL );
+
+    pxPolicy->xConfig = *pxConfig;
+}
+
+/*-----------------------------------------------------------*/
+
+void vReportPolicy_LoadConfig( ReportPolicyConfig_t * pxConfig,
+                               KVStoreKey_t xAbsDeadbandKey )
+{
+    configASSERT( pxConfig != NULL );
+
+    pxConfig->fAbsDeadband = ( float ) KVStore_getUInt32( xAbsDeadbandKey, NULL ) / 1000.0f;
+    pxConfig->fRelDeadband = ( float ) KVStore_getUInt32( CS_RPT_REL_DEADBAND, NULL ) / 1000.0f;
+    pxConfig->ulMinIntervalMs = KVStore_getUInt32( CS_RPT_MIN_INTERVAL_MS, NULL );
+    pxConfig->ulMaxSilenceMs = KVStore_getUInt32( CS_RPT_HEARTBEAT_MS, NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvIsOutsideDeadband( const ReportPolicyConfig_t * pxConfig,
+                                        float fLast,
+                                        float fCurrent )
+{
+    BaseType_t xOutside = pdFALSE;
+    float fDelta = fabsf( fCurrent - fLast );
+
+    if( ( pxConfig->fAbsDeadband <= 0.0f ) && ( pxConfig->fRelDeadband <= 0.0f ) )
+    {
+        xOutside = ( fDelta > 0.0f ) ? pdTRUE : pdFALSE;
+    }
+    else if( ( pxConfig->fAbsDeadband > 0.0f ) && ( fDelta > pxConfig->fAbsDeadband ) )
+    {
+        xOutside = pdTRUE;
+    }
+    else if( ( pxConfig->fRelDeadband > 0.0f ) && ( fDelta > ( pxConfig->fRelDeadband * fabsf( fLast ) ) ) )
+    {
+        xOutside = pdTRUE;
+    }
+    else
+    {
+        xOutside = pdFALSE;
+    }
+
+    return xOutside;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xReportPolicy_ShouldReport( ReportPolicy_t * pxPolicy,
+                                       const float * pfValues )
+{
+    BaseType_t xReport = pdFALSE;
+    uint64_t ullElapsedMs = 0;
+
+    configASSERT( pxPolicy != NULL );
+    configASSERT( pfValues != NULL );
+
+    /* Compare in milliseconds, pdMS_TO_TICKS overflows for intervals over ~71 minutes */
+    ullElapsedMs = ( ( uint64_t ) ( xTaskGetTickCount() - pxPolicy->xLastReportTick ) * 1000U ) / configTICK_RATE_HZ;
+
+    if( pxPolicy->xHasReported == pdFALSE )
+    {
+        xReport = pdTRUE;
+    }
+    else if( ( pxPolicy->xConfig.ulMaxSilenceMs > 0 ) &&
+             ( ullElapsedMs >= pxPolicy->xConfig.ulMaxSilenceMs ) )
+    {
+        xReport = pdTRUE;
+    }
+    else if( ullElapsedMs >= pxPolicy->xConfig.ulMinIntervalMs )
+    {
+        for( size_t uxIdx = 0; uxIdx < pxPolicy->uxNumValues; uxIdx++ )
+        {
+            if( prvIsOutsideDeadband( &( pxPolicy->xConfig ),
+                                      pxPolicy->pfLastReported[ uxIdx ],
+                                      pfValues[ uxIdx ] ) == pdTRUE )
+            {
+                xReport = pdTRUE;
+                break;
+            }
+        }
+    }
+    else
+    {
+        /* Rate limited */
+    }
+
+    if( xReport == pdFALSE )
+    {
+        pxPolicy->ulSuppressed++;
+    }
+
+    return xReport;
+}
+
+/*-----------------------------------------------------------*/
+
+void vReportPolicy_Reported( ReportPolicy_t * pxPolicy,
+                             const float * pfValues )
+{
+    configASSERT( pxPolicy != NULL );
+    configASSERT( pfValues != NULL );
+
+    ( void ) memcpy( pxPolicy->pfLastReported, pfValues, pxPolicy->uxNumValues * sizeof( float ) );
+
+    pxPolicy->xLastReportTick = xTaskGetTickCount();
+    pxPolicy->xHasReported = pdTRUE;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_batch.c
+ * @brief Accumulates timestamped telemetry samples into a single MQTT payload.
+ */
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "kvstore.h"
+#include "telemetry_batch.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define BATCH_HEADER     "{\"samples\":["
+
+/* Space kept free at the end of the arena for "],\"now\":4294967295}" */
+#define BATCH_TRAILER_MAX_LEN    ( 24U )
+
+/*
+ * CBOR framing is written by hand since tinycbor cannot leave a container open
+ * between calls. The batch is an indefinite length map holding an indefinite
+ * length array of samples, each a two entry map.
+ */
+#define CBOR_MAP_INDEFINITE      ( 0xBFU )
+#define CBOR_ARRAY_INDEFINITE    ( 0x9FU )
+#define CBOR_MAP_2               ( 0xA2U )
+#define CBOR_BREAK               ( 0xFFU )
+
+/* Longest encoding of a uint32_t: initial byte plus four bytes */
+#define CBOR_UINT32_MAX_LEN      ( 5U )
+
+/*-----------------------------------------------------------*/
+
+/* Encode an unsigned integer (major type 0), returns the number of bytes written */
+static size_t prvCborPutUInt( uint8_t * pucBuffer,
+                              uint32_t ulValue )
+{
+    size_t uxLen = 0;
+
+    if( ulValue < 24U )
+    {
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ulValue;
+    }
+    else if( ulValue <= UINT8_MAX )
+    {
+        pucBuffer[ uxLen++ ] = 0x18U;
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ulValue;
+    }
+    else if( ulValue <= UINT16_MAX )
+    {
+        pucBuffer[ uxLen++ ] = 0x19U;
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ( ulValue >> 8 );
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ulValue;
+    }
+    else
+    {
+        pucBuffer[ uxLen++ ] = 0x1AU;
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ( ulValue >> 24 );
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ( ulValue >> 16 );
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ( ulValue >> 8 );
+        pucBuffer[ uxLen++ ] = ( uint8_t ) ulValue;
+    }
+
+    return uxLen;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryBatch_Init( TelemetryBatch_t * pxBatch,
+                           char * pcArena,
+                           size_t uxArenaLen,
+                           TelemetryFormat_t xFormat )
+{
+    configASSERT( pxBatch != NULL );
+    configASSERT( pcArena != NULL );
+    configASSERT( uxArenaLen > ( sizeof( BATCH_HEADER ) + BATCH_TRAILER_MAX_LEN ) );
+
+    pxBatch->pcArena = pcArena;
+    pxBatch->uxArenaLen = uxArenaLen;
+    pxBatch->xFormat = xFormat;
+
+    vTelemetryBatch_LoadConfig( pxBatch );
+    vTelemetryBatch_Reset( pxBatch );
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryBatch_LoadConfig( TelemetryBatch_t * pxBatch )
+{
+    configASSERT( pxBatch != NULL );
+
+    pxBatch->ulMaxBytes = KVStore_getUInt32( CS_BATCH_MAX_BYTES, NULL );
+    pxBatch->ulMaxAgeMs = KVStore_getUInt32( CS_BATCH_MAX_AGE_MS, NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryBatch_Reset( TelemetryBatch_t * pxBatch )
+{
+    configASSERT( pxBatch != NULL );
+
+    if( pxBatch->xFormat == TELEMETRY_FORMAT_CBOR )
+    {
+        uint8_t * pucArena = ( uint8_t * ) pxBatch->pcArena;
+
+        pucArena[ 0 ] = CBOR_MAP_INDEFINITE;
+        pucArena[ 1 ] = TLM_KEY_SAMPLES;
+        pucArena[ 2 ] = CBOR_ARRAY_INDEFINITE;
+        pxBatch->uxUsed = 3;
+    }
+    else
+    {
+        ( void ) memcpy( pxBatch->pcArena, BATCH_HEADER, sizeof( BATCH_HEADER ) - 1 );
+
+        pxBatch->uxUsed = sizeof( BATCH_HEADER ) - 1;
+    }
+
+    pxBatch->uxSamples = 0;
+    pxBatch->xOldestTick = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetryBatch_Append( TelemetryBatch_t * pxBatch,
+                                   const char * pcSample,
+                                   size_t uxSampleLen )
+{
+    BaseType_t xResult = pdFALSE;
+    TickType_t xNow = xTaskGetTickCount();
+    size_t uxAvailable = 0;
+    int lWritten = 0;
+
+    configASSERT( pxBatch != NULL );
+    configASSERT( pcSample != NULL );
+
+    uxAvailable = pxBatch->uxArenaLen - pxBatch->uxUsed - BATCH_TRAILER_MAX_LEN;
+
+    if( pxBatch->xFormat == TELEMETRY_FORMAT_CBOR )
+    {
+        uint8_t pucEntryHeader[ 3 + CBOR_UINT32_MAX_LEN ];
+        size_t uxHeaderLen = 0;
+
+        pucEntryHeader[ uxHeaderLen++ ] = CBOR_MAP_2;
+        pucEntryHeader[ uxHeaderLen++ ] = TLM_KEY_TIME;
+        uxHeaderLen += prvCborPutUInt( &( pucEntryHeader[ uxHeaderLen ] ), TICKS_TO_MS( xNow ) );
+        pucEntryHeader[ uxHeaderLen++ ] = TLM_KEY_VALUE;
+
+        if( ( uxHeaderLen + uxSampleLen ) < uxAvailable )
+        {
+            ( void ) memcpy( &( pxBatch->pcArena[ pxBatch->uxUsed ] ), pucEntryHeader, uxHeaderLen );
+            ( void ) memcpy( &( pxBatch->pcArena[ pxBatch->uxUsed + uxHeaderLen ] ), pcSample, uxSampleLen );
+            lWritten = ( int ) ( uxHeaderLen + uxSampleLen );
+        }
+        else
+        {
+            lWritten = ( int ) uxAvailable;
+        }
+    }
+    else
+    {
+        lWritten = snprintf( &( pxBatch->pcArena[ pxBatch->uxUsed ] ),
+                             uxAvailable,
+                             "%s{\"t\":%lu,\"v\":%.*s}",
+                             ( pxBatch->uxSamples > 0 ) ? "," : "",
+                             ( unsigned long ) TICKS_TO_MS( xNow ),
+                             ( int ) uxSampleLen,
+                             pcSample );
+    }
+
+    if( ( lWritten > 0 ) && ( ( size_t ) lWritten < uxAvailable ) )
+    {
+        if( pxBatch->uxSamples == 0 )
+        {
+            pxBatch->xOldestTick = xNow;
+        }
+
+        pxBatch->uxUsed += ( size_t ) lWritten;
+        pxBatch->uxSamples++;
+        xResult = pdTRUE;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetryBatch_IsFlushDue( const TelemetryBatch_t * pxBatch )
+{
+    BaseType_t xFlush = pdFALSE;
+
+    configASSERT( pxBatch != NULL );
+
+    if( pxBatch->uxSamples == 0 )
+    {
+        xFlush = pdFALSE;
+    }
+    else if( pxBatch->uxUsed >= pxBatch->ulMaxBytes )
+    {
+        xFlush = pdTRUE;
+    }
+    else if( ( ( ( uint64_t ) ( xTaskGetTickCount() - pxBatch->xOldestTick ) * 1000U ) / configTICK_RATE_HZ ) >= pxBatch->ulMaxAgeMs )
+    {
+        xFlush = pdTRUE;
+    }
+    else
+    {
+        xFlush = pdFALSE;
+    }
+
+    return xFlush;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxTelemetryBatch_Finalize( TelemetryBatch_t * pxBatch,
+                                  const char ** ppcPayload )
+{
+    size_t uxLength = 0;
+    int lWritten = 0;
+
+    configASSERT( pxBatch != NULL );
+    configASSERT( ppcPayload != NULL );
+
+    if( pxBatch->uxSamples > 0 )
+    {
+        /* Written past uxUsed so the batch can be finalized again on retry */
+        if( pxBatch->xFormat == TELEMETRY_FORMAT_CBOR )
+        {
+            uint8_t * pucTrailer = ( uint8_t * ) &( pxBatch->pcArena[ pxBatch->uxUsed ] );
+
+            pucTrailer[ 0 ] = CBOR_BREAK;
+            pucTrailer[ 1 ] = TLM_KEY_NOW;
+            lWritten = 2 + ( int ) prvCborPutUInt( &( pucTrailer[ 2 ] ), TICKS_TO_MS( xTaskGetTickCount() ) );
+            pucTrailer[ lWritten++ ] = CBOR_BREAK;
+        }
+        else
+        {
+            lWritten = snprintf( &( pxBatch->pcArena[ pxBatch->uxUsed ] ),
+                                 pxBatch->uxArenaLen - pxBatch->uxUsed,
+                                 "],\"now\":%lu}",
+                                 ( unsigned long ) TICKS_TO_MS( xTaskGetTickCount() ) );
+        }
+
+        configASSERT( ( lWritten > 0 ) && ( ( size_t ) lWritten < BATCH_TRAILER_MAX_LEN ) );
+
+        uxLength = pxBatch->uxUsed + ( size_t ) lWritten;
+        *ppcPayload = pxBatch->pcArena;
+    }
+
+    return uxLength;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_format.c
+ * @brief Payload format selection for sensor telemetry.
+ */
+
+#include "FreeRTOS.h"
+
+#include "kvstore.h"
+#include "telemetry_format.h"
+
+#include <string.h>
+
+/*-----------------------------------------------------------*/
+
+TelemetryFormat_t xTelemetryFormat_Get( void )
+{
+    TelemetryFormat_t xFormat = TELEMETRY_FORMAT_JSON;
+
+    if( KVStore_getUInt32( CS_TELEMETRY_FORMAT, NULL ) == TELEMETRY_FORMAT_CBOR )
+    {
+        xFormat = TELEMETRY_FORMAT_CBOR;
+    }
+
+    return xFormat;
+}
+
+/*-----------------------------------------------------------*/
+
+size_t uxTelemetryFormat_AppendTopicSuffix( char * pcTopic,
+                                            size_t uxTopicBufLen,
+                                            TelemetryFormat_t xFormat )
+{
+    configASSERT( pcTopic != NULL );
+
+    if( xFormat == TELEMETRY_FORMAT_CBOR )
+    {
+        ( void ) strlcat( pcTopic, TELEMETRY_CBOR_TOPIC_SUFFIX, uxTopicBufLen );
+    }
+
+    return strnlen( pcTopic, uxTopicBufLen );
+}
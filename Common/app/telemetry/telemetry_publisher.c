@@ -0,0 +1,682 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_publisher.c
+ * @brief Shared asynchronous publisher for sensor telemetry.
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_ERROR
+#include "logging.h"
+
+/* Standard includes. */
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "semphr.h"
+#include "task.h"
+
+/* MQTT agent include. */
+#include "core_mqtt_agent.h"
+#include "mqtt_agent_task.h"
+
+#include "kvstore.h"
+#include "telemetry_publisher.h"
+#include "telemetry_spool.h"
+#include "mqtt_journal.h"
+
+#if KV_STORE_NVIMPL_LITTLEFS
+#include "fs/lfs_port.h"
+#endif
+
+/* Time to wait for space in the MQTT agent command queue */
+#define TELEMETRY_PUBLISHER_BLOCK_TIME_MS    ( 1000 )
+
+/* Lower bound on the spool_rate_ms setting */
+#define TELEMETRY_REPLAY_MIN_INTERVAL_MS     ( 100 )
+
+/* A spooled message that fails this many times in a row is dropped */
+#define TELEMETRY_REPLAY_MAX_ATTEMPTS        ( 5 )
+
+/**
+ * @brief A queued message. The NUL terminated topic and the payload are stored
+ * directly after the structure in the same allocation.
+ */
+struct MQTTAgentCommandContext
+{
+    MQTTPublishInfo_t xPublishInfo;
+    TelemetryPublishCallback_t xCallback;
+    void * pvCallbackCtx;
+    BaseType_t xFromSpool;
+};
+
+typedef struct MQTTAgentCommandContext TelemetryPublishJob_t;
+
+static QueueHandle_t xJobQueue = NULL;
+static SemaphoreHandle_t xInFlightSem = NULL;
+static TelemetryPublisherStats_t xStats = { 0 };
+
+/* Live messages that failed in flight, waiting to be written to the spool */
+static QueueHandle_t xFailedQueue = NULL;
+
+/* Set by the publisher task when a spooled message is handed to the agent and
+ * cleared by the agent task once it completes */
+static volatile BaseType_t xReplayInFlight = pdFALSE;
+static volatile MQTTStatus_t xReplayStatus = MQTTSuccess;
+static volatile BaseType_t xReplayDone = pdFALSE;
+
+/* Replay buffers, only used by the publisher task */
+static char pcReplayTopic[ TELEMETRY_SPOOL_MAX_TOPIC_LEN + 1 ];
+static uint8_t pucReplayPayload[ TELEMETRY_SPOOL_MAX_PAYLOAD_LEN ];
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetryPublisher_Init( void )
+{
+    if( xJobQueue == NULL )
+    {
+        xJobQueue = xQueueCreate( TELEMETRY_PUBLISHER_QUEUE_LEN, sizeof( TelemetryPublishJob_t * ) );
+    }
+
+    if( xInFlightSem == NULL )
+    {
+        xInFlightSem = xSemaphoreCreateCounting( TELEMETRY_PUBLISHER_MAX_INFLIGHT,
+                                                 TELEMETRY_PUBLISHER_MAX_INFLIGHT );
+    }
+
+    if( xFailedQueue == NULL )
+    {
+        xFailedQueue = xQueueCreate( TELEMETRY_PUBLISHER_MAX_INFLIGHT, sizeof( TelemetryPublishJob_t * ) );
+    }
+
+    return( ( xJobQueue != NULL ) &&
+            ( xInFlightSem != NULL ) &&
+            ( xFailedQueue != NULL ) ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+static TelemetryPublishJob_t * prvCreateJob( const char * pcTopic,
+                                             const void * pvPayload,
+                                             size_t uxPayloadLen,
+                                             MQTTQoS_t xQoS )
+{
+    TelemetryPublishJob_t * pxJob = NULL;
+    size_t uxTopicLen = strlen( pcTopic );
+
+    pxJob = pvPortMalloc( sizeof( TelemetryPublishJob_t ) + uxTopicLen + 1 + uxPayloadLen );
+
+    if( pxJob != NULL )
+    {
+        char * pcTopicCopy = ( char * ) &( pxJob[ 1 ] );
+        char * pcPayloadCopy = &( pcTopicCopy[ uxTopicLen + 1 ] );
+
+        ( void ) memcpy( pcTopicCopy, pcTopic, uxTopicLen + 1 );
+        ( void ) memcpy( pcPayloadCopy, pvPayload, uxPayloadLen );
+
+        ( void ) memset( pxJob, 0, sizeof( TelemetryPublishJob_t ) );
+        pxJob->xPublishInfo.qos = xQoS;
+        pxJob->xPublishInfo.pTopicName = pcTopicCopy;
+        pxJob->xPublishInfo.topicNameLength = ( uint16_t ) uxTopicLen;
+        pxJob->xPublishInfo.pPayload = pcPayloadCopy;
+        pxJob->xPublishInfo.payloadLength = uxPayloadLen;
+    }
+
+    return pxJob;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetryPublisher_Enqueue( const char * pcTopic,
+                                        const void * pvPayload,
+                                        size_t uxPayloadLen,
+                                        MQTTQoS_t xQoS,
+                                        TelemetryPublishCallback_t xCallback,
+                                        void * pvCallbackCtx )
+{
+    BaseType_t xResult = pdFALSE;
+    TelemetryPublishJob_t * pxJob = NULL;
+
+    configASSERT( pcTopic != NULL );
+    configASSERT( pvPayload != NULL );
+    configASSERT( uxPayloadLen > 0 );
+
+    if( xJobQueue != NULL )
+    {
+        pxJob = prvCreateJob( pcTopic, pvPayload, uxPayloadLen, xQoS );
+    }
+
+    if( pxJob != NULL )
+    {
+        pxJob->xCallback = xCallback;
+        pxJob->pvCallbackCtx = pvCallbackCtx;
+
+        xResult = xQueueSend( xJobQueue, &pxJob, 0 );
+
+        if( xResult != pdTRUE )
+        {
+            vPortFree( pxJob );
+        }
+    }
+
+    taskENTER_CRITICAL();
+    {
+        if( xResult == pdTRUE )
+        {
+            xStats.ulEnqueued++;
+        }
+        else
+        {
+            xStats.ulRejected++;
+        }
+    }
+    taskEXIT_CRITICAL();
+
+    if( xResult != pdTRUE )
+    {
+        LogWarn( "Telemetry publish queue full, message to %s rejected.", pcTopic );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryPublisher_GetStats( TelemetryPublisherStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxStats = xStats;
+    }
+    taskEXIT_CRITICAL();
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryStream_Init( TelemetryStream_t * pxStream,
+                            const char * pcName,
+                            const char * pcTopic,
+                            MQTTQoS_t xQoS,
+                            KVStoreKey_t xDeadbandKey,
+                            size_t uxNumValues,
+                            char * pcArena,
+                            size_t uxArenaLen,
+                            TelemetryFormat_t xFormat )
+{
+    ReportPolicyConfig_t xPolicyConfig;
+
+    configASSERT( pxStream != NULL );
+    configASSERT( pcName != NULL );
+    configASSERT( pcTopic != NULL );
+
+    pxStream->pcName = pcName;
+    pxStream->pcTopic = pcTopic;
+    pxStream->xQoS = xQoS;
+    pxStream->xDeadbandKey = xDeadbandKey;
+
+    vReportPolicy_LoadConfig( &xPolicyConfig, xDeadbandKey );
+    vReportPolicy_Init( &( pxStream->xPolicy ), &xPolicyConfig, uxNumValues );
+
+    vTelemetryBatch_Init( &( pxStream->xBatch ), pcArena, uxArenaLen, xFormat );
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryStream_LoadConfig( TelemetryStream_t * pxStream )
+{
+    ReportPolicyConfig_t xPolicyConfig;
+
+    configASSERT( pxStream != NULL );
+
+    vReportPolicy_LoadConfig( &xPolicyConfig, pxStream->xDeadbandKey );
+    vReportPolicy_SetConfig( &( pxStream->xPolicy ), &xPolicyConfig );
+    vTelemetryBatch_LoadConfig( &( pxStream->xBatch ) );
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetryStream_ShouldReport( TelemetryStream_t * pxStream,
+                                          const float * pfValues )
+{
+    configASSERT( pxStream != NULL );
+
+    return xReportPolicy_ShouldReport( &( pxStream->xPolicy ), pfValues );
+}
+
+/*-----------------------------------------------------------*/
+
+/* pvCtx is the stream name, which outlives the publish */
+static void prvStreamPublishComplete( void * pvCtx,
+                                      MQTTStatus_t xStatus,
+                                      const char * pcTopic,
+                                      const void * pvPayload,
+                                      size_t uxPayloadLen )
+{
+    ( void ) pcTopic;
+    ( void ) pvPayload;
+
+    if( xStatus == MQTTSuccess )
+    {
+        LogDebug( "Published batch of %u bytes.", uxPayloadLen );
+    }
+    else
+    {
+        LogError( "Failed to publish %u bytes of %s data.", uxPayloadLen, ( const char * ) pvCtx );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvStreamFlush( TelemetryStream_t * pxStream )
+{
+    BaseType_t xResult = pdFALSE;
+    const char * pcPayload = NULL;
+    size_t uxPayloadLen = 0;
+
+    uxPayloadLen = uxTelemetryBatch_Finalize( &( pxStream->xBatch ), &pcPayload );
+
+    if( uxPayloadLen > 0 )
+    {
+        if( xIsMqttAgentConnected() == true )
+        {
+            /* The publisher takes a copy, so the batch can be reused right away */
+            xResult = xTelemetryPublisher_Enqueue( pxStream->pcTopic,
+                                                   pcPayload,
+                                                   uxPayloadLen,
+                                                   pxStream->xQoS,
+                                                   prvStreamPublishComplete,
+                                                   ( void * ) pxStream->pcName );
+        }
+
+        if( xResult == pdFALSE )
+        {
+            /* Keep the batch on flash until it can be replayed */
+            xResult = xTelemetrySpool_Append( pxStream->pcTopic, pcPayload, uxPayloadLen, ( uint8_t ) pxStream->xQoS );
+        }
+
+        if( xResult == pdTRUE )
+        {
+            LogDebug( "Queued batch of %u samples, %u bytes.", pxStream->xBatch.uxSamples, uxPayloadLen );
+            vTelemetryBatch_Reset( &( pxStream->xBatch ) );
+        }
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetryStream_Add( TelemetryStream_t * pxStream,
+                                 const char * pcSample,
+                                 size_t uxSampleLen,
+                                 const float * pfValues )
+{
+    BaseType_t xResult = pdFALSE;
+
+    configASSERT( pxStream != NULL );
+    configASSERT( pcSample != NULL );
+
+    xResult = xTelemetryBatch_Append( &( pxStream->xBatch ), pcSample, uxSampleLen );
+
+    if( xResult == pdFALSE )
+    {
+        /* Batch is full, make room for the new sample */
+        if( prvStreamFlush( pxStream ) == pdFALSE )
+        {
+            LogError( "Discarding %u unpublished samples of %s data.", pxStream->xBatch.uxSamples, pxStream->pcName );
+            vTelemetryBatch_Reset( &( pxStream->xBatch ) );
+        }
+
+        xResult = xTelemetryBatch_Append( &( pxStream->xBatch ), pcSample, uxSampleLen );
+    }
+
+    if( xResult == pdTRUE )
+    {
+        vReportPolicy_Reported( &( pxStream->xPolicy ), pfValues );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryStream_FlushIfDue( TelemetryStream_t * pxStream )
+{
+    configASSERT( pxStream != NULL );
+
+    if( xTelemetryBatch_IsFlushDue( &( pxStream->xBatch ) ) == pdTRUE )
+    {
+        ( void ) prvStreamFlush( pxStream );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvCompleteJob( TelemetryPublishJob_t * pxJob,
+                            MQTTStatus_t xStatus )
+{
+    taskENTER_CRITICAL();
+    {
+        if( xStatus == MQTTSuccess )
+        {
+            xStats.ulPublished++;
+        }
+        else
+        {
+            xStats.ulFailed++;
+        }
+
+        xStats.ulInFlight--;
+    }
+    taskEXIT_CRITICAL();
+
+    if( xStatus != MQTTSuccess )
+    {
+        LogError( "Publish to %.*s failed with status %d.",
+                  pxJob->xPublishInfo.topicNameLength,
+                  pxJob->xPublishInfo.pTopicName,
+                  xStatus );
+    }
+
+    if( pxJob->xCallback != NULL )
+    {
+        pxJob->xCallback( pxJob->pvCallbackCtx,
+                          xStatus,
+                          pxJob->xPublishInfo.pTopicName,
+                          pxJob->xPublishInfo.pPayload,
+                          pxJob->xPublishInfo.payloadLength );
+    }
+
+    if( pxJob->xFromSpool == pdTRUE )
+    {
+        /* The publisher task removes it from the spool on success */
+        vPortFree( pxJob );
+        xReplayStatus = xStatus;
+        xReplayDone = pdTRUE;
+    }
+    else if( ( xStatus == MQTTSuccess ) ||
+             ( xQueueSend( xFailedQueue, &pxJob, 0 ) != pdTRUE ) )
+    {
+        vPortFree( pxJob );
+    }
+    else
+    {
+        /* Spooled by the publisher task, file IO does not belong in the agent task */
+    }
+
+    ( void ) xSemaphoreGive( xInFlightSem );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPublishCommandCallback( MQTTAgentCommandContext_t * pxCommandContext,
+                                       MQTTAgentReturnInfo_t * pxReturnInfo )
+{
+    configASSERT( pxCommandContext != NULL );
+    configASSERT( pxReturnInfo != NULL );
+
+    prvCompleteJob( pxCommandContext, pxReturnInfo->returnCode );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSpoolJob( TelemetryPublishJob_t * pxJob )
+{
+    if( pxJob->xFromSpool == pdTRUE )
+    {
+        /* Still at the head of the spool, replayed after the next interval */
+        xReplayInFlight = pdFALSE;
+    }
+    else if( xTelemetrySpool_Append( pxJob->xPublishInfo.pTopicName,
+                                     pxJob->xPublishInfo.pPayload,
+                                     pxJob->xPublishInfo.payloadLength,
+                                     ( uint8_t ) pxJob->xPublishInfo.qos ) == pdTRUE )
+    {
+        LogInfo( "Spooled %u bytes for %s.",
+                 pxJob->xPublishInfo.payloadLength,
+                 pxJob->xPublishInfo.pTopicName );
+    }
+    else
+    {
+        LogError( "Dropped %u bytes for %s, the spool is not available.",
+                  pxJob->xPublishInfo.payloadLength,
+                  pxJob->xPublishInfo.pTopicName );
+    }
+
+    vPortFree( pxJob );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Spool a message that was never handed to the agent */
+static void prvDeferJob( TelemetryPublishJob_t * pxJob )
+{
+    if( ( pxJob->xFromSpool == pdFALSE ) && ( pxJob->xCallback != NULL ) )
+    {
+        pxJob->xCallback( pxJob->pvCallbackCtx,
+                          MQTTSendFailed,
+                          pxJob->xPublishInfo.pTopicName,
+                          pxJob->xPublishInfo.pPayload,
+                          pxJob->xPublishInfo.payloadLength );
+    }
+
+    prvSpoolJob( pxJob );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Never blocks while the agent is offline: this task also spools failed
+ * messages and services the MQTT journal, which must keep running during an
+ * outage. A message that cannot be handed to the agent is spooled instead.
+ */
+static void prvSendJob( MQTTAgentHandle_t xAgentHandle,
+                        TelemetryPublishJob_t * pxJob )
+{
+    MQTTStatus_t xStatus;
+    bool xJournaled;
+
+    MQTTAgentCommandInfo_t xCommandParams =
+    {
+        .blockTimeMs                 = TELEMETRY_PUBLISHER_BLOCK_TIME_MS,
+        .cmdCompleteCallback         = prvPublishCommandCallback,
+        .pCmdCompleteCallbackContext = pxJob,
+    };
+
+    if( xIsMqttAgentConnected() == false )
+    {
+        prvDeferJob( pxJob );
+    }
+    /* Wait for a free slot in the in-flight window */
+    else if( xSemaphoreTake( xInFlightSem, pdMS_TO_TICKS( TELEMETRY_PUBLISHER_BLOCK_TIME_MS ) ) == pdFALSE )
+    {
+        LogWarn( "In-flight window full, spooling message for %s.", pxJob->xPublishInfo.pTopicName );
+
+        prvDeferJob( pxJob );
+    }
+    else
+    {
+        taskENTER_CRITICAL();
+        {
+            xStats.ulInFlight++;
+        }
+        taskEXIT_CRITICAL();
+
+        /* A spooled message stays in the spool until it is acknowledged, so
+         * a journal copy would only send it twice after a reset */
+        xJournaled = xMqttAgent_SetJournaling( pxJob->xFromSpool == pdFALSE );
+
+        xStatus = MQTTAgent_Publish( xAgentHandle,
+                                     &( pxJob->xPublishInfo ),
+                                     &xCommandParams );
+
+        ( void ) xMqttAgent_SetJournaling( xJournaled );
+
+        if( xStatus != MQTTSuccess )
+        {
+            /* The agent never saw the command, so complete it here */
+            prvCompleteJob( pxJob, xStatus );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvSpoolFailedJobs( void )
+{
+    TelemetryPublishJob_t * pxJob = NULL;
+
+    while( xQueueReceive( xFailedQueue, &pxJob, 0 ) == pdTRUE )
+    {
+        prvSpoolJob( pxJob );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static TickType_t prvReplayInterval( void )
+{
+    uint32_t ulIntervalMs = KVStore_getUInt32( CS_SPOOL_RATE_MS, NULL );
+
+    if( ulIntervalMs < TELEMETRY_REPLAY_MIN_INTERVAL_MS )
+    {
+        ulIntervalMs = TELEMETRY_REPLAY_MIN_INTERVAL_MS;
+    }
+
+    return pdMS_TO_TICKS( ulIntervalMs );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Hand at most one spooled message to the agent per replay interval, and only
+ * when no live message is waiting and the in-flight window has room to spare,
+ * so draining a backlog never delays new telemetry or other agent traffic.
+ */
+static void prvReplayFromSpool( MQTTAgentHandle_t xAgentHandle,
+                                TickType_t xInterval,
+                                TickType_t * pxLastReplay )
+{
+    static uint32_t ulAttempts = 0;
+
+    if( xReplayDone == pdTRUE )
+    {
+        if( xReplayStatus == MQTTSuccess )
+        {
+            vTelemetrySpool_Consume();
+            ulAttempts = 0;
+        }
+        else if( ++ulAttempts >= TELEMETRY_REPLAY_MAX_ATTEMPTS )
+        {
+            LogError( "Dropping spooled message after %lu failed attempts.", ulAttempts );
+            vTelemetrySpool_Consume();
+            ulAttempts = 0;
+        }
+        else
+        {
+            /* Left in the spool, retried after the next interval */
+        }
+
+        xReplayDone = pdFALSE;
+        xReplayInFlight = pdFALSE;
+    }
+
+    if( ( xReplayInFlight == pdFALSE ) &&
+        ( ( xTaskGetTickCount() - *pxLastReplay ) >= xInterval ) &&
+        ( xIsMqttAgentConnected() == true ) &&
+        ( uxQueueMessagesWaiting( xJobQueue ) == 0 ) &&
+        ( uxSemaphoreGetCount( xInFlightSem ) > 1 ) )
+    {
+        TelemetryPublishJob_t * pxJob = NULL;
+        size_t uxPayloadLen = 0;
+        uint8_t ucQoS = 0;
+
+        *pxLastReplay = xTaskGetTickCount();
+
+        if( xTelemetrySpool_Peek( pcReplayTopic, pucReplayPayload, &uxPayloadLen, &ucQoS ) == pdTRUE )
+        {
+            pxJob = prvCreateJob( pcReplayTopic, pucReplayPayload, uxPayloadLen, ( MQTTQoS_t ) ucQoS );
+        }
+
+        if( pxJob != NULL )
+        {
+            LogDebug( "Replaying %u spooled bytes to %s.", uxPayloadLen, pcReplayTopic );
+
+            pxJob->xFromSpool = pdTRUE;
+            xReplayInFlight = pdTRUE;
+
+            prvSendJob( xAgentHandle, pxJob );
+        }
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetryPublisherTask( void * pvParameters )
+{
+    MQTTAgentHandle_t xAgentHandle = NULL;
+    TickType_t xLastReplay = 0;
+
+    ( void ) pvParameters;
+
+    configASSERT( xJobQueue != NULL );
+    configASSERT( xInFlightSem != NULL );
+    configASSERT( xFailedQueue != NULL );
+
+    ( void ) xMqttAgent_SetCommandLane( MQTT_AGENT_LANE_BULK );
+
+#if KV_STORE_NVIMPL_LITTLEFS
+    ( void ) xTelemetrySpool_Init( pxGetDefaultFsCtx() );
+    ( void ) xMqttJournal_Init( pxGetDefaultFsCtx() );
+#endif
+
+    vSleepUntilMQTTAgentReady();
+
+    xAgentHandle = xGetMqttAgentHandle();
+
+    for( ; ; )
+    {
+        TelemetryPublishJob_t * pxJob = NULL;
+        TickType_t xInterval = prvReplayInterval();
+
+        /* Wake up at least once per replay interval to drain the spool */
+        if( xQueueReceive( xJobQueue, &pxJob, xInterval ) == pdTRUE )
+        {
+            prvSendJob( xAgentHandle, pxJob );
+        }
+
+        prvSpoolFailedJobs();
+
+        prvReplayFromSpool( xAgentHandle, xInterval, &xLastReplay );
+
+        /* This task owns filesystem access for the MQTT journal */
+        vMqttJournal_Service( xAgentHandle );
+    }
+}
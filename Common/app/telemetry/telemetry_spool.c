@@ -0,0 +1,705 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_spool.c
+ * @brief Persistent store-and-forward spool for telemetry on littlefs.
+ */
+
+#include "logging_levels.h"
+#define LOG_LEVEL    LOG_ERROR
+#include "logging.h"
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Kernel includes. */
+#include "FreeRTOS.h"
+#include "semphr.h"
+#include "task.h"
+
+#include "kvstore.h"
+#include "telemetry_spool.h"
+
+#if KV_STORE_NVIMPL_LITTLEFS
+
+#define SPOOL_RECORD_MAGIC       ( 0x5350U )
+
+#define SPOOL_CURSOR_PATH        TELEMETRY_SPOOL_DIR "/cursor"
+
+/* "/spool/" followed by eight hex digits */
+#define SPOOL_PATH_LEN           ( sizeof( TELEMETRY_SPOOL_DIR ) + 10U )
+
+#define SPOOL_SEQ_NAME_LEN       ( 8U )
+
+/* Never evict the segment currently being appended to */
+#define SPOOL_MIN_SEGMENTS       ( 2U )
+
+typedef struct
+{
+    uint16_t usMagic;
+    uint8_t ucTopicLen;
+    uint8_t ucQoS;
+    uint16_t usPayloadLen;
+    uint16_t usReserved;
+    uint32_t ulCrc;
+} SpoolRecordHeader_t;
+
+typedef struct
+{
+    uint32_t ulSeq;
+    uint32_t ulOffset;
+    uint32_t ulCrc;
+} SpoolCursor_t;
+
+typedef struct
+{
+    lfs_t * pxLfs;
+    SemaphoreHandle_t xMutex;
+    uint32_t ulHeadSeq;
+    uint32_t ulTailSeq;
+    size_t uxReadOffset;
+    size_t uxPeekLen;
+    size_t uxTailLen;
+    size_t uxTotalLen;
+    TelemetrySpoolStats_t xStats;
+} TelemetrySpool_t;
+
+static TelemetrySpool_t xSpool = { 0 };
+
+/*-----------------------------------------------------------*/
+
+static void prvSegmentPath( char * pcPath,
+                            uint32_t ulSeq )
+{
+    ( void ) snprintf( pcPath, SPOOL_PATH_LEN, TELEMETRY_SPOOL_DIR "/%08lx", ( unsigned long ) ulSeq );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint32_t prvRecordCrc( const SpoolRecordHeader_t * pxHeader,
+                              const char * pcTopic,
+                              const void * pvPayload )
+{
+    uint32_t ulCrc = 0xFFFFFFFFUL;
+
+    ulCrc = lfs_crc( ulCrc, pxHeader, offsetof( SpoolRecordHeader_t, ulCrc ) );
+    ulCrc = lfs_crc( ulCrc, pcTopic, pxHeader->ucTopicLen );
+    ulCrc = lfs_crc( ulCrc, pvPayload, pxHeader->usPayloadLen );
+
+    return ulCrc;
+}
+
+/*-----------------------------------------------------------*/
+
+static size_t prvSegmentSize( uint32_t ulSeq )
+{
+    char pcPath[ SPOOL_PATH_LEN ];
+    struct lfs_info xInfo = { 0 };
+    size_t uxSize = 0;
+
+    prvSegmentPath( pcPath, ulSeq );
+
+    if( lfs_stat( xSpool.pxLfs, pcPath, &xInfo ) == LFS_ERR_OK )
+    {
+        uxSize = xInfo.size;
+    }
+
+    return uxSize;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvWriteCursor( void )
+{
+    lfs_file_t xFile = { 0 };
+    SpoolCursor_t xCursor =
+    {
+        .ulSeq    = xSpool.ulHeadSeq,
+        .ulOffset = ( uint32_t ) xSpool.uxReadOffset,
+    };
+
+    xCursor.ulCrc = lfs_crc( 0xFFFFFFFFUL, &xCursor, offsetof( SpoolCursor_t, ulCrc ) );
+
+    if( lfs_file_open( xSpool.pxLfs, &xFile, SPOOL_CURSOR_PATH, LFS_O_WRONLY | LFS_O_TRUNC | LFS_O_CREAT ) == LFS_ERR_OK )
+    {
+        if( lfs_file_write( xSpool.pxLfs, &xFile, &xCursor, sizeof( xCursor ) ) != sizeof( xCursor ) )
+        {
+            LogError( "Failed to update the spool cursor." );
+        }
+
+        ( void ) lfs_file_close( xSpool.pxLfs, &xFile );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvReadCursor( void )
+{
+    lfs_file_t xFile = { 0 };
+    SpoolCursor_t xCursor = { 0 };
+
+    xSpool.uxReadOffset = 0;
+
+    if( lfs_file_open( xSpool.pxLfs, &xFile, SPOOL_CURSOR_PATH, LFS_O_RDONLY ) == LFS_ERR_OK )
+    {
+        /* A cursor for an already removed segment means the head starts at 0 */
+        if( ( lfs_file_read( xSpool.pxLfs, &xFile, &xCursor, sizeof( xCursor ) ) == sizeof( xCursor ) ) &&
+            ( xCursor.ulCrc == lfs_crc( 0xFFFFFFFFUL, &xCursor, offsetof( SpoolCursor_t, ulCrc ) ) ) &&
+            ( xCursor.ulSeq == xSpool.ulHeadSeq ) )
+        {
+            xSpool.uxReadOffset = xCursor.ulOffset;
+        }
+
+        ( void ) lfs_file_close( xSpool.pxLfs, &xFile );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Remove the oldest segment. If it is also the segment being appended to, a
+ * new one is started so head and tail stay ordered.
+ */
+static void prvDropHeadSegment( void )
+{
+    char pcPath[ SPOOL_PATH_LEN ];
+    size_t uxSize = prvSegmentSize( xSpool.ulHeadSeq );
+
+    prvSegmentPath( pcPath, xSpool.ulHeadSeq );
+    ( void ) lfs_remove( xSpool.pxLfs, pcPath );
+
+    xSpool.uxTotalLen = ( xSpool.uxTotalLen > uxSize ) ? ( xSpool.uxTotalLen - uxSize ) : 0;
+
+    if( xSpool.ulHeadSeq == xSpool.ulTailSeq )
+    {
+        xSpool.ulTailSeq++;
+        xSpool.uxTailLen = 0;
+        xSpool.uxTotalLen = 0;
+    }
+
+    xSpool.ulHeadSeq++;
+    xSpool.uxReadOffset = 0;
+    xSpool.uxPeekLen = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvEnforceLimit( void )
+{
+    size_t uxMaxLen = ( size_t ) KVStore_getUInt32( CS_SPOOL_MAX_KB, NULL ) * 1024U;
+
+    if( uxMaxLen < ( SPOOL_MIN_SEGMENTS * TELEMETRY_SPOOL_SEGMENT_LEN ) )
+    {
+        uxMaxLen = SPOOL_MIN_SEGMENTS * TELEMETRY_SPOOL_SEGMENT_LEN;
+    }
+
+    while( ( xSpool.uxTotalLen > uxMaxLen ) &&
+           ( xSpool.ulHeadSeq != xSpool.ulTailSeq ) )
+    {
+        LogWarn( "Spool full, evicting segment %08lx.", ( unsigned long ) xSpool.ulHeadSeq );
+        prvDropHeadSegment();
+        xSpool.xStats.ulEvictedSegments++;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvIsEmpty( void )
+{
+    return( ( xSpool.ulHeadSeq == xSpool.ulTailSeq ) &&
+            ( xSpool.uxReadOffset >= xSpool.uxTailLen ) ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvScanSegments( void )
+{
+    lfs_dir_t xDir = { 0 };
+    struct lfs_info xInfo = { 0 };
+    BaseType_t xFound = pdFALSE;
+
+    xSpool.uxTotalLen = 0;
+
+    if( lfs_dir_open( xSpool.pxLfs, &xDir, TELEMETRY_SPOOL_DIR ) == LFS_ERR_OK )
+    {
+        while( lfs_dir_read( xSpool.pxLfs, &xDir, &xInfo ) > 0 )
+        {
+            char * pcEnd = NULL;
+            uint32_t ulSeq = 0;
+
+            if( ( xInfo.type != LFS_TYPE_REG ) ||
+                ( strlen( xInfo.name ) != SPOOL_SEQ_NAME_LEN ) )
+            {
+                continue;
+            }
+
+            ulSeq = ( uint32_t ) strtoul( xInfo.name, &pcEnd, 16 );
+
+            if( *pcEnd != '\0' )
+            {
+                continue;
+            }
+
+            if( ( xFound == pdFALSE ) || ( ulSeq < xSpool.ulHeadSeq ) )
+            {
+                xSpool.ulHeadSeq = ulSeq;
+            }
+
+            if( ( xFound == pdFALSE ) || ( ulSeq >= xSpool.ulTailSeq ) )
+            {
+                xSpool.ulTailSeq = ulSeq;
+                xSpool.uxTailLen = xInfo.size;
+            }
+
+            xSpool.uxTotalLen += xInfo.size;
+            xFound = pdTRUE;
+        }
+
+        ( void ) lfs_dir_close( xSpool.pxLfs, &xDir );
+    }
+
+    if( xFound == pdFALSE )
+    {
+        /* Numbering restarts, so a cursor left from a drained spool is stale */
+        ( void ) lfs_remove( xSpool.pxLfs, SPOOL_CURSOR_PATH );
+
+        xSpool.ulHeadSeq = 0;
+        xSpool.ulTailSeq = 0;
+        xSpool.uxTailLen = 0;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetrySpool_Init( lfs_t * pxLfs )
+{
+    BaseType_t xResult = pdFALSE;
+    int lError = LFS_ERR_INVAL;
+
+    if( ( pxLfs != NULL ) && ( xSpool.xMutex == NULL ) )
+    {
+        lError = lfs_mkdir( pxLfs, TELEMETRY_SPOOL_DIR );
+    }
+
+    if( ( lError == LFS_ERR_OK ) || ( lError == LFS_ERR_EXIST ) )
+    {
+        xSpool.pxLfs = pxLfs;
+
+        prvScanSegments();
+        prvReadCursor();
+
+        xSpool.xStats.ulBytesPending = ( uint32_t ) ( xSpool.uxTotalLen - xSpool.uxReadOffset );
+
+        /* Publishing the mutex last makes the spool visible to other tasks */
+        xSpool.xMutex = xSemaphoreCreateMutex();
+        xResult = ( xSpool.xMutex != NULL ) ? pdTRUE : pdFALSE;
+    }
+
+    if( xResult == pdTRUE )
+    {
+        LogInfo( "Spool holds %lu bytes in segments %08lx to %08lx.",
+                 ( unsigned long ) xSpool.xStats.ulBytesPending,
+                 ( unsigned long ) xSpool.ulHeadSeq,
+                 ( unsigned long ) xSpool.ulTailSeq );
+    }
+    else
+    {
+        LogError( "Failed to open the telemetry spool." );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static lfs_ssize_t prvWriteRecord( lfs_file_t * pxFile,
+                                   const SpoolRecordHeader_t * pxHeader,
+                                   const char * pcTopic,
+                                   const void * pvPayload )
+{
+    lfs_ssize_t lReturn = lfs_file_write( xSpool.pxLfs, pxFile, pxHeader, sizeof( SpoolRecordHeader_t ) );
+
+    if( lReturn == sizeof( SpoolRecordHeader_t ) )
+    {
+        lReturn = lfs_file_write( xSpool.pxLfs, pxFile, pcTopic, pxHeader->ucTopicLen );
+    }
+
+    if( lReturn == pxHeader->ucTopicLen )
+    {
+        lReturn = lfs_file_write( xSpool.pxLfs, pxFile, pvPayload, pxHeader->usPayloadLen );
+    }
+
+    if( lReturn == pxHeader->usPayloadLen )
+    {
+        lReturn = LFS_ERR_OK;
+    }
+    else if( lReturn >= 0 )
+    {
+        lReturn = LFS_ERR_IO;
+    }
+
+    return lReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+static lfs_ssize_t prvAppendRecord( const SpoolRecordHeader_t * pxHeader,
+                                    const char * pcTopic,
+                                    const void * pvPayload )
+{
+    char pcPath[ SPOOL_PATH_LEN ];
+    lfs_file_t xFile = { 0 };
+    lfs_ssize_t lReturn = LFS_ERR_INVAL;
+
+    prvSegmentPath( pcPath, xSpool.ulTailSeq );
+
+    lReturn = lfs_file_open( xSpool.pxLfs, &xFile, pcPath, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND );
+
+    if( lReturn == LFS_ERR_OK )
+    {
+        lReturn = prvWriteRecord( &xFile, pxHeader, pcTopic, pvPayload );
+
+        if( lReturn != LFS_ERR_OK )
+        {
+            /* Do not commit a partial record */
+            ( void ) lfs_file_truncate( xSpool.pxLfs, &xFile, xSpool.uxTailLen );
+        }
+
+        if( ( lfs_file_close( xSpool.pxLfs, &xFile ) != LFS_ERR_OK ) &&
+            ( lReturn == LFS_ERR_OK ) )
+        {
+            lReturn = LFS_ERR_IO;
+        }
+    }
+
+    return lReturn;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetrySpool_Append( const char * pcTopic,
+                                   const void * pvPayload,
+                                   size_t uxPayloadLen,
+                                   uint8_t ucQoS )
+{
+    lfs_ssize_t lReturn = LFS_ERR_INVAL;
+    SpoolRecordHeader_t xHeader = { 0 };
+    size_t uxTopicLen = 0;
+    size_t uxRecordLen = 0;
+
+    configASSERT( pcTopic != NULL );
+    configASSERT( pvPayload != NULL );
+
+    uxTopicLen = strlen( pcTopic );
+    uxRecordLen = sizeof( SpoolRecordHeader_t ) + uxTopicLen + uxPayloadLen;
+
+    if( ( xSpool.xMutex != NULL ) &&
+        ( uxTopicLen > 0 ) && ( uxTopicLen <= TELEMETRY_SPOOL_MAX_TOPIC_LEN ) &&
+        ( uxPayloadLen > 0 ) && ( uxPayloadLen <= TELEMETRY_SPOOL_MAX_PAYLOAD_LEN ) &&
+        ( xSemaphoreTake( xSpool.xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        xHeader.usMagic = SPOOL_RECORD_MAGIC;
+        xHeader.ucTopicLen = ( uint8_t ) uxTopicLen;
+        xHeader.ucQoS = ucQoS;
+        xHeader.usPayloadLen = ( uint16_t ) uxPayloadLen;
+        xHeader.ulCrc = prvRecordCrc( &xHeader, pcTopic, pvPayload );
+
+        if( ( xSpool.uxTailLen > 0 ) &&
+            ( ( xSpool.uxTailLen + uxRecordLen ) > TELEMETRY_SPOOL_SEGMENT_LEN ) )
+        {
+            xSpool.ulTailSeq++;
+            xSpool.uxTailLen = 0;
+        }
+
+        lReturn = prvAppendRecord( &xHeader, pcTopic, pvPayload );
+
+        if( ( lReturn == LFS_ERR_NOSPC ) &&
+            ( xSpool.ulHeadSeq != xSpool.ulTailSeq ) )
+        {
+            /* The volume is shared with OTA and the config store, so give space back */
+            prvDropHeadSegment();
+            xSpool.xStats.ulEvictedSegments++;
+
+            lReturn = prvAppendRecord( &xHeader, pcTopic, pvPayload );
+        }
+
+        if( lReturn == LFS_ERR_OK )
+        {
+            xSpool.uxTailLen += uxRecordLen;
+            xSpool.uxTotalLen += uxRecordLen;
+            xSpool.xStats.ulAppended++;
+
+            prvEnforceLimit();
+        }
+
+        xSpool.xStats.ulBytesPending = ( uint32_t ) ( xSpool.uxTotalLen - xSpool.uxReadOffset );
+
+        ( void ) xSemaphoreGive( xSpool.xMutex );
+
+        if( lReturn != LFS_ERR_OK )
+        {
+            LogError( "Failed to append to the telemetry spool: %ld.", ( long ) lReturn );
+        }
+    }
+
+    return( lReturn == LFS_ERR_OK ) ? pdTRUE : pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvReadRecord( char * pcTopic,
+                                 void * pvPayload,
+                                 size_t * puxPayloadLen,
+                                 uint8_t * pucQoS )
+{
+    BaseType_t xResult = pdFALSE;
+    char pcPath[ SPOOL_PATH_LEN ];
+    lfs_file_t xFile = { 0 };
+    SpoolRecordHeader_t xHeader = { 0 };
+    size_t uxSegmentLen = 0;
+    size_t uxRecordLen = 0;
+
+    if( xSpool.ulHeadSeq == xSpool.ulTailSeq )
+    {
+        uxSegmentLen = xSpool.uxTailLen;
+    }
+    else
+    {
+        uxSegmentLen = prvSegmentSize( xSpool.ulHeadSeq );
+    }
+
+    if( xSpool.uxReadOffset >= uxSegmentLen )
+    {
+        /* Fully replayed, or missing */
+        prvDropHeadSegment();
+    }
+    else
+    {
+        prvSegmentPath( pcPath, xSpool.ulHeadSeq );
+
+        if( lfs_file_open( xSpool.pxLfs, &xFile, pcPath, LFS_O_RDONLY ) == LFS_ERR_OK )
+        {
+            if( ( lfs_file_seek( xSpool.pxLfs, &xFile, ( lfs_soff_t ) xSpool.uxReadOffset, LFS_SEEK_SET ) >= 0 ) &&
+                ( lfs_file_read( xSpool.pxLfs, &xFile, &xHeader, sizeof( xHeader ) ) == sizeof( xHeader ) ) )
+            {
+                uxRecordLen = sizeof( xHeader ) + xHeader.ucTopicLen + xHeader.usPayloadLen;
+
+                xResult = ( ( xHeader.usMagic == SPOOL_RECORD_MAGIC ) &&
+                            ( xHeader.ucTopicLen > 0 ) &&
+                            ( xHeader.ucTopicLen <= TELEMETRY_SPOOL_MAX_TOPIC_LEN ) &&
+                            ( xHeader.usPayloadLen > 0 ) &&
+                            ( xHeader.usPayloadLen <= TELEMETRY_SPOOL_MAX_PAYLOAD_LEN ) &&
+                            ( ( xSpool.uxReadOffset + uxRecordLen ) <= uxSegmentLen ) ) ? pdTRUE : pdFALSE;
+            }
+
+            if( ( xResult == pdTRUE ) &&
+                ( ( lfs_file_read( xSpool.pxLfs, &xFile, pcTopic, xHeader.ucTopicLen ) != xHeader.ucTopicLen ) ||
+                  ( lfs_file_read( xSpool.pxLfs, &xFile, pvPayload, xHeader.usPayloadLen ) != xHeader.usPayloadLen ) ||
+                  ( prvRecordCrc( &xHeader, pcTopic, pvPayload ) != xHeader.ulCrc ) ) )
+            {
+                xResult = pdFALSE;
+            }
+
+            ( void ) lfs_file_close( xSpool.pxLfs, &xFile );
+        }
+
+        if( xResult == pdTRUE )
+        {
+            pcTopic[ xHeader.ucTopicLen ] = '\0';
+            *puxPayloadLen = xHeader.usPayloadLen;
+            *pucQoS = xHeader.ucQoS;
+            xSpool.uxPeekLen = uxRecordLen;
+        }
+        else
+        {
+            /* The framing can not be trusted past this point, skip the rest of the segment */
+            LogError( "Corrupt spool record in segment %08lx at offset %lu.",
+                      ( unsigned long ) xSpool.ulHeadSeq,
+                      ( unsigned long ) xSpool.uxReadOffset );
+
+            xSpool.xStats.ulCorrupt++;
+            xSpool.uxReadOffset = uxSegmentLen;
+            xSpool.uxPeekLen = 0;
+        }
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetrySpool_Peek( char * pcTopic,
+                                 void * pvPayload,
+                                 size_t * puxPayloadLen,
+                                 uint8_t * pucQoS )
+{
+    BaseType_t xResult = pdFALSE;
+
+    configASSERT( pcTopic != NULL );
+    configASSERT( pvPayload != NULL );
+    configASSERT( puxPayloadLen != NULL );
+    configASSERT( pucQoS != NULL );
+
+    if( ( xSpool.xMutex != NULL ) &&
+        ( xSemaphoreTake( xSpool.xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        while( ( xResult == pdFALSE ) && ( prvIsEmpty() == pdFALSE ) )
+        {
+            xResult = prvReadRecord( pcTopic, pvPayload, puxPayloadLen, pucQoS );
+        }
+
+        xSpool.xStats.ulBytesPending = ( uint32_t ) ( xSpool.uxTotalLen - xSpool.uxReadOffset );
+
+        ( void ) xSemaphoreGive( xSpool.xMutex );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetrySpool_Consume( void )
+{
+    if( ( xSpool.xMutex != NULL ) &&
+        ( xSemaphoreTake( xSpool.xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        /* Nothing to do if the record was evicted since it was peeked */
+        if( xSpool.uxPeekLen > 0 )
+        {
+            xSpool.uxReadOffset += xSpool.uxPeekLen;
+            xSpool.uxPeekLen = 0;
+            xSpool.xStats.ulReplayed++;
+
+            if( ( xSpool.ulHeadSeq == xSpool.ulTailSeq ) &&
+                ( xSpool.uxReadOffset >= xSpool.uxTailLen ) )
+            {
+                /* Drained, start over with an empty segment */
+                prvDropHeadSegment();
+            }
+            else if( ( xSpool.ulHeadSeq != xSpool.ulTailSeq ) &&
+                     ( xSpool.uxReadOffset >= prvSegmentSize( xSpool.ulHeadSeq ) ) )
+            {
+                prvDropHeadSegment();
+            }
+            else
+            {
+                prvWriteCursor();
+            }
+        }
+
+        xSpool.xStats.ulBytesPending = ( uint32_t ) ( xSpool.uxTotalLen - xSpool.uxReadOffset );
+
+        ( void ) xSemaphoreGive( xSpool.xMutex );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetrySpool_IsEmpty( void )
+{
+    BaseType_t xResult = pdTRUE;
+
+    if( ( xSpool.xMutex != NULL ) &&
+        ( xSemaphoreTake( xSpool.xMutex, portMAX_DELAY ) == pdTRUE ) )
+    {
+        xResult = prvIsEmpty();
+
+        ( void ) xSemaphoreGive( xSpool.xMutex );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetrySpool_GetStats( TelemetrySpoolStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    taskENTER_CRITICAL();
+    {
+        *pxStats = xSpool.xStats;
+    }
+    taskEXIT_CRITICAL();
+}
+
+#else /* KV_STORE_NVIMPL_LITTLEFS */
+
+/* No filesystem on this platform, messages that can not be sent are dropped */
+
+BaseType_t xTelemetrySpool_Append( const char * pcTopic,
+                                   const void * pvPayload,
+                                   size_t uxPayloadLen,
+                                   uint8_t ucQoS )
+{
+    ( void ) pcTopic;
+    ( void ) pvPayload;
+    ( void ) uxPayloadLen;
+    ( void ) ucQoS;
+
+    return pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetrySpool_Peek( char * pcTopic,
+                                 void * pvPayload,
+                                 size_t * puxPayloadLen,
+                                 uint8_t * pucQoS )
+{
+    ( void ) pcTopic;
+    ( void ) pvPayload;
+    ( void ) puxPayloadLen;
+    ( void ) pucQoS;
+
+    return pdFALSE;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetrySpool_Consume( void )
+{
+}
+
+/*-----------------------------------------------------------*/
+
+BaseType_t xTelemetrySpool_IsEmpty( void )
+{
+    return pdTRUE;
+}
+
+/*-----------------------------------------------------------*/
+
+void vTelemetrySpool_GetStats( TelemetrySpoolStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    ( void ) memset( pxStats, 0, sizeof( TelemetrySpoolStats_t ) );
+}
+
+#endif /* KV_STORE_NVIMPL_LITTLEFS */
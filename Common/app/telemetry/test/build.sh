@@ -0,0 +1,49 @@
+#!/bin/bash
+#
+# Build and run the host tests of the telemetry modules with the host compiler.
+# Usage: build.sh [test name ...], all tests by default.
+
+SCRIPT_DIR=$(dirname "${0}")
+SCRIPT_DIR=$(realpath "${SCRIPT_DIR}")
+ROOT_DIR=$(realpath "${SCRIPT_DIR}/../../../..")
+OUT_DIR="${SCRIPT_DIR}/out"
+CC=${CC:-cc}
+
+# Set SANITIZE= to time the benchmark without the sanitizer overhead
+SANITIZE=${SANITIZE-"-fsanitize=address,undefined"}
+
+# The FreeRTOS stand-ins are shared with the MQTT host tests
+CFLAGS=(-std=gnu11 -g -O2 -Wall -Wextra -Wno-unused-parameter ${SANITIZE}
+        -I"${ROOT_DIR}/Common/app/mqtt/test/host"
+        -I"${ROOT_DIR}/Common/include"
+        -I"${ROOT_DIR}/Common/config"
+        -I"${ROOT_DIR}/Common/kvstore"
+        -I"${ROOT_DIR}/Projects/b_u585i_iot02a_ntz/Inc"
+        -I"${ROOT_DIR}/Middleware/FreeRTOS/coreJSON/source/include"
+        -I"${ROOT_DIR}/Middleware/tinycbor/src")
+
+CBOR_SRCS=("${ROOT_DIR}/Middleware/tinycbor/src/cborencoder.c"
+           "${ROOT_DIR}/Middleware/tinycbor/src/cborparser.c"
+           "${ROOT_DIR}/Middleware/tinycbor/src/cborvalidation.c")
+
+declare -A TEST_SRCS=(
+    [test_json_extract]="${ROOT_DIR}/Common/app/telemetry/json_extract.c ${ROOT_DIR}/Middleware/FreeRTOS/coreJSON/source/core_json.c"
+    [test_json_writer]=""
+    [test_telemetry_cbor]="${CBOR_SRCS[*]} ${ROOT_DIR}/Common/app/telemetry/json_writer.c ${ROOT_DIR}/Common/app/telemetry/telemetry_batch.c ${ROOT_DIR}/Middleware/FreeRTOS/coreJSON/source/core_json.c"
+)
+
+TESTS=("$@")
+
+if test ${#TESTS[@]} -eq 0; then
+    TESTS=("${!TEST_SRCS[@]}")
+fi
+
+mkdir -p "${OUT_DIR}"
+
+for TEST in "${TESTS[@]}"; do
+    # shellcheck disable=SC2086
+    "${CC}" "${CFLAGS[@]}" -o "${OUT_DIR}/${TEST}" \
+        "${SCRIPT_DIR}/${TEST}.c" ${TEST_SRCS[${TEST}]} || exit 1
+
+    "${OUT_DIR}/${TEST}" || exit 1
+done
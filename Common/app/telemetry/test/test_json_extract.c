@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_json_extract.c
+ * @brief Host test of the single pass JSON extraction, checked against
+ * JSON_Search, and a timing comparison on a shadow /get/accepted document.
+ *
+ * Build and run with build.sh in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "json_extract.h"
+
+#define TEST_DOC_LEN          8192U
+#define TEST_PATH_LEN         96U
+#define TEST_BENCH_ROUNDS     20000U
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+/* Device shadow properties, as laid out by shadow_state.c */
+static const JsonExtractKey_t xPropertyKeys[] =
+{
+    { NULL,         "powerOn",        JSON_EXTRACT_BOOL   },
+    { "telemetry",  "minIntervalMs",  JSON_EXTRACT_UINT   },
+    { "telemetry",  "heartbeatMs",    JSON_EXTRACT_UINT   },
+    { "telemetry",  "relDeadband",    JSON_EXTRACT_UINT   },
+    { "telemetry",  "soilDeadband",   JSON_EXTRACT_UINT   },
+    { "telemetry",  "envDeadband",    JSON_EXTRACT_UINT   },
+    { "telemetry",  "motionDeadband", JSON_EXTRACT_UINT   },
+    { "irrigation", "mode",           JSON_EXTRACT_UINT   },
+    { "irrigation", "setpoints",      JSON_EXTRACT_STRING },
+    { "irrigation", "hysteresis",     JSON_EXTRACT_UINT   },
+    { "irrigation", "minOnMs",        JSON_EXTRACT_UINT   },
+    { "irrigation", "minOffMs",       JSON_EXTRACT_UINT   },
+    { "irrigation", "maxRunMs",       JSON_EXTRACT_UINT   },
+    { "irrigation", "kp",             JSON_EXTRACT_UINT   },
+    { "irrigation", "ki",             JSON_EXTRACT_UINT   },
+    { "irrigation", "kd",             JSON_EXTRACT_UINT   },
+    { "irrigation", "windowMs",       JSON_EXTRACT_UINT   },
+    { "firmware",   "version",        JSON_EXTRACT_STRING }
+};
+
+#define TEST_NUM_PROPERTIES    ( sizeof( xPropertyKeys ) / sizeof( xPropertyKeys[ 0 ] ) )
+
+/* The response table of shadow_device_task.c */
+static const JsonExtractKey_t xResponseKeys[] =
+{
+    { NULL,    "clientToken", JSON_EXTRACT_DIGITS },
+    { NULL,    "version",     JSON_EXTRACT_UINT   },
+    { NULL,    "code",        JSON_EXTRACT_UINT   },
+    { NULL,    "state",       JSON_EXTRACT_ANY    },
+    { "state", "desired",     JSON_EXTRACT_ANY    },
+    { "state", "reported",    JSON_EXTRACT_ANY    }
+};
+
+#define TEST_NUM_RESPONSE_KEYS    ( sizeof( xResponseKeys ) / sizeof( xResponseKeys[ 0 ] ) )
+#define TEST_RESPONSE_DESIRED     4U
+
+static char pcDocument[ TEST_DOC_LEN ];
+static size_t uxDocumentLen;
+
+/* Number of JSON_Search calls made by the last prvSearchDocument */
+static uint32_t ulSearches;
+
+/* Volatile sink so the benchmark loops are not optimised away */
+static volatile uint32_t ulSink;
+
+/*-----------------------------------------------------------*/
+
+static void prvAppend( const char * pcFormat,
+                       const char * pcArg,
+                       uint32_t ulArg )
+{
+    int lWritten = snprintf( &( pcDocument[ uxDocumentLen ] ), TEST_DOC_LEN - uxDocumentLen,
+                             pcFormat, pcArg, ( unsigned long ) ulArg );
+
+    TEST_ASSERT( ( lWritten >= 0 ) && ( ( size_t ) lWritten < ( TEST_DOC_LEN - uxDocumentLen ) ) );
+    uxDocumentLen += ( size_t ) lWritten;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Write one section of properties, grouped into their objects */
+static void prvAppendSection( const char * pcName,
+                              BaseType_t xMetadata )
+{
+    const char * pcGroup = NULL;
+
+    prvAppend( "\"%s\":{", pcName, 0 );
+
+    for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROPERTIES; uxIdx++ )
+    {
+        const JsonExtractKey_t * pxKey = &( xPropertyKeys[ uxIdx ] );
+
+        if( uxIdx > 0 )
+        {
+            if( ( pxKey->pcObject != NULL ) &&
+                ( ( pcGroup == NULL ) || ( strcmp( pxKey->pcObject, pcGroup ) != 0 ) ) )
+            {
+                prvAppend( ( pcGroup != NULL ) ? "}," : ",", NULL, 0 );
+            }
+            else
+            {
+                prvAppend( ",", NULL, 0 );
+            }
+        }
+
+        if( ( pxKey->pcObject != NULL ) &&
+            ( ( pcGroup == NULL ) || ( strcmp( pxKey->pcObject, pcGroup ) != 0 ) ) )
+        {
+            prvAppend( "\"%s\":{", pxKey->pcObject, 0 );
+            pcGroup = pxKey->pcObject;
+        }
+
+        if( xMetadata == pdTRUE )
+        {
+            prvAppend( "\"%s\":{\"timestamp\":%lu}", pxKey->pcKey, 1596573647UL );
+        }
+        else if( pxKey->xType == JSON_EXTRACT_STRING )
+        {
+            prvAppend( "\"%s\":\"40,45,%lu\"", pxKey->pcKey, uxIdx );
+        }
+        else
+        {
+            prvAppend( "\"%s\":%lu", pxKey->pcKey, 1000U + uxIdx );
+        }
+    }
+
+    prvAppend( ( pcGroup != NULL ) ? "}}" : "}", NULL, 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+/* A /get/accepted document with state and metadata for every property */
+static void prvBuildDocument( void )
+{
+    uxDocumentLen = 0;
+
+    prvAppend( "{\"state\":{", NULL, 0 );
+    prvAppendSection( "desired", pdFALSE );
+    prvAppend( ",", NULL, 0 );
+    prvAppendSection( "reported", pdFALSE );
+    prvAppend( "},\"metadata\":{", NULL, 0 );
+    prvAppendSection( "desired", pdTRUE );
+    prvAppend( ",", NULL, 0 );
+    prvAppendSection( "reported", pdTRUE );
+    prvAppend( "},\"version\":%s%lu,", "", 14698 );
+    prvAppend( "%s\"timestamp\":%lu,\"clientToken\":\"022485\"}", "", 1596573647UL );
+
+    TEST_ASSERT( JSON_Validate( pcDocument, uxDocumentLen ) == JSONSuccess );
+}
+
+/*-----------------------------------------------------------*/
+
+/* The former approach: validate, then one JSON_Search from the start per member */
+static uint32_t prvSearchDocument( void )
+{
+    uint32_t ulSum = 0;
+    const char * pcValue = NULL;
+    size_t uxValueLen = 0;
+    JSONTypes_t xType;
+    char pcPath[ TEST_PATH_LEN ];
+
+    ulSearches = 0;
+
+    TEST_ASSERT( JSON_Validate( pcDocument, uxDocumentLen ) == JSONSuccess );
+
+    for( size_t uxSection = 0; uxSection < 2; uxSection++ )
+    {
+        for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROPERTIES; uxIdx++ )
+        {
+            const JsonExtractKey_t * pxKey = &( xPropertyKeys[ uxIdx ] );
+            int lPathLen = snprintf( pcPath, sizeof( pcPath ), "state.%s.%s%s%s",
+                                     ( uxSection == 0 ) ? "desired" : "reported",
+                                     ( pxKey->pcObject != NULL ) ? pxKey->pcObject : "",
+                                     ( pxKey->pcObject != NULL ) ? "." : "",
+                                     pxKey->pcKey );
+
+            ulSearches++;
+
+            if( JSON_SearchConst( pcDocument, uxDocumentLen, pcPath, ( size_t ) lPathLen,
+                                  &pcValue, &uxValueLen, &xType ) == JSONSuccess )
+            {
+                ulSum += ( uint32_t ) uxValueLen;
+            }
+        }
+    }
+
+    ulSearches += 2;
+
+    if( JSON_SearchConst( pcDocument, uxDocumentLen, "version", 7, &pcValue, &uxValueLen, &xType ) == JSONSuccess )
+    {
+        ulSum += ( uint32_t ) uxValueLen;
+    }
+
+    if( JSON_SearchConst( pcDocument, uxDocumentLen, "clientToken", 11, &pcValue, &uxValueLen, &xType ) == JSONSuccess )
+    {
+        ulSum += ( uint32_t ) uxValueLen;
+    }
+
+    return ulSum;
+}
+
+/*-----------------------------------------------------------*/
+
+/* The shadow task approach: one validated walk, then the desired and reported objects */
+static uint32_t prvExtractDocument( void )
+{
+    JsonExtractValue_t pxResponse[ TEST_NUM_RESPONSE_KEYS ];
+    JsonExtractValue_t pxProperties[ TEST_NUM_PROPERTIES ];
+    uint32_t ulFound = 0;
+    uint32_t ulSum = 0;
+
+    TEST_ASSERT( xJsonExtract( pcDocument, uxDocumentLen, xResponseKeys, TEST_NUM_RESPONSE_KEYS,
+                               pxResponse, &ulFound ) == JSONSuccess );
+
+    for( size_t uxSection = 0; uxSection < 2; uxSection++ )
+    {
+        const JsonExtractValue_t * pxObject = &( pxResponse[ TEST_RESPONSE_DESIRED + uxSection ] );
+        uint32_t ulProperties = ulJsonExtract_Validated( pxObject->pcValue, pxObject->uxValueLen,
+                                                         xPropertyKeys, TEST_NUM_PROPERTIES,
+                                                         pxProperties );
+
+        for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROPERTIES; uxIdx++ )
+        {
+            if( ( ulProperties & ( 1UL << uxIdx ) ) != 0 )
+            {
+                ulSum += ( uint32_t ) pxProperties[ uxIdx ].uxValueLen;
+            }
+        }
+    }
+
+    ulSum += ( uint32_t ) ( pxResponse[ 0 ].uxValueLen + pxResponse[ 1 ].uxValueLen );
+
+    return ulSum;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestValues( void )
+{
+    static const JsonExtractKey_t xKeys[] =
+    {
+        { NULL,    "v",     JSON_EXTRACT_UINT   },
+        { NULL,    "t",     JSON_EXTRACT_DIGITS },
+        { "a.b",   "on",    JSON_EXTRACT_BOOL   },
+        { "a.b",   "n",     JSON_EXTRACT_BOOL   },
+        { "a",     "s",     JSON_EXTRACT_STRING },
+        { NULL,    "big",   JSON_EXTRACT_UINT   },
+        { NULL,    "neg",   JSON_EXTRACT_UINT   },
+        { NULL,    "s",     JSON_EXTRACT_UINT   },
+        { "v",     "x",     JSON_EXTRACT_ANY    },
+        { NULL,    "none",  JSON_EXTRACT_ANY    },
+        { NULL,    "a",     JSON_EXTRACT_ANY    }
+    };
+    /* The trailing digits are outside the document and must not be parsed */
+    static const char pcText[] =
+        "{\"a\":{\"b\":{\"on\":true,\"n\":7},\"s\":\"x\\\"y\"},\"t\":\"022485\","
+        "\"big\":4294967296,\"neg\":-1,\"s\":\"1\",\"v\":12}345";
+    const size_t uxLen = sizeof( pcText ) - 4;
+    JsonExtractValue_t pxValues[ sizeof( xKeys ) / sizeof( xKeys[ 0 ] ) ];
+    uint32_t ulFound = 0;
+
+    TEST_ASSERT( xJsonExtract( pcText, uxLen, xKeys, sizeof( xKeys ) / sizeof( xKeys[ 0 ] ),
+                               pxValues, &ulFound ) == JSONSuccess );
+
+    TEST_ASSERT( ulFound == 0x41FU );
+    TEST_ASSERT( pxValues[ 0 ].ulValue == 12U );
+    TEST_ASSERT( pxValues[ 1 ].ulValue == 22485U );
+    TEST_ASSERT( pxValues[ 2 ].ulValue == 1U );
+    TEST_ASSERT( pxValues[ 3 ].ulValue == 1U );
+    TEST_ASSERT( ( pxValues[ 4 ].uxValueLen == 4U ) && ( strncmp( pxValues[ 4 ].pcValue, "x\\\"y", 4 ) == 0 ) );
+
+    /* Present with the wrong type or out of range: value set, bit clear */
+    TEST_ASSERT( pxValues[ 5 ].pcValue != NULL );
+    TEST_ASSERT( pxValues[ 6 ].pcValue != NULL );
+    TEST_ASSERT( pxValues[ 7 ].pcValue != NULL );
+
+    /* Below a value that is not an object, or missing */
+    TEST_ASSERT( pxValues[ 8 ].pcValue == NULL );
+    TEST_ASSERT( pxValues[ 9 ].pcValue == NULL );
+    TEST_ASSERT( pxValues[ 10 ].xJsonType == JSONObject );
+
+    /* An invalid document finds nothing and leaves the values cleared */
+    TEST_ASSERT( xJsonExtract( "{\"v\":", 5, xKeys, 1, pxValues, &ulFound ) != JSONSuccess );
+    TEST_ASSERT( ulFound == 0 );
+    TEST_ASSERT( pxValues[ 0 ].pcValue == NULL );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Every extracted value must be the one JSON_Search finds for the same path */
+static void prvTestShadowDocument( void )
+{
+    JsonExtractValue_t pxResponse[ TEST_NUM_RESPONSE_KEYS ];
+    JsonExtractValue_t pxProperties[ TEST_NUM_PROPERTIES ];
+    uint32_t ulFound = 0;
+    const char * pcValue = NULL;
+    size_t uxValueLen = 0;
+    JSONTypes_t xType;
+    char pcPath[ TEST_PATH_LEN ];
+
+    TEST_ASSERT( xJsonExtract( pcDocument, uxDocumentLen, xResponseKeys, TEST_NUM_RESPONSE_KEYS,
+                               pxResponse, &ulFound ) == JSONSuccess );
+
+    /* No "code" in an accepted document */
+    TEST_ASSERT( ulFound == 0x3BU );
+    TEST_ASSERT( pxResponse[ 0 ].ulValue == 22485U );
+    TEST_ASSERT( pxResponse[ 1 ].ulValue == 14698U );
+
+    for( size_t uxSection = 0; uxSection < 2; uxSection++ )
+    {
+        const JsonExtractValue_t * pxObject = &( pxResponse[ TEST_RESPONSE_DESIRED + uxSection ] );
+
+        TEST_ASSERT( ulJsonExtract_Validated( pxObject->pcValue, pxObject->uxValueLen,
+                                              xPropertyKeys, TEST_NUM_PROPERTIES,
+                                              pxProperties ) == ( ( 1UL << TEST_NUM_PROPERTIES ) - 1U ) );
+
+        for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROPERTIES; uxIdx++ )
+        {
+            const JsonExtractKey_t * pxKey = &( xPropertyKeys[ uxIdx ] );
+            int lPathLen = snprintf( pcPath, sizeof( pcPath ), "state.%s.%s%s%s",
+                                     ( uxSection == 0 ) ? "desired" : "reported",
+                                     ( pxKey->pcObject != NULL ) ? pxKey->pcObject : "",
+                                     ( pxKey->pcObject != NULL ) ? "." : "",
+                                     pxKey->pcKey );
+
+            TEST_ASSERT( JSON_SearchConst( pcDocument, uxDocumentLen, pcPath, ( size_t ) lPathLen,
+                                           &pcValue, &uxValueLen, &xType ) == JSONSuccess );
+            TEST_ASSERT( pxProperties[ uxIdx ].pcValue == pcValue );
+            TEST_ASSERT( pxProperties[ uxIdx ].uxValueLen == uxValueLen );
+            TEST_ASSERT( pxProperties[ uxIdx ].xJsonType == xType );
+        }
+    }
+
+    TEST_ASSERT( prvExtractDocument() == prvSearchDocument() );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint64_t prvNowNs( void )
+{
+    struct timespec xNow;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( ( uint64_t ) xNow.tv_sec * 1000000000ULL ) + ( uint64_t ) xNow.tv_nsec;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Reports the passes and time per document, the numbers are informational only */
+static void prvBenchShadowDocument( void )
+{
+    uint64_t ullStart;
+    uint64_t ullSearch;
+    uint64_t ullExtract;
+
+    ullStart = prvNowNs();
+
+    for( uint32_t ulRound = 0; ulRound < TEST_BENCH_ROUNDS; ulRound++ )
+    {
+        ulSink = prvSearchDocument();
+    }
+
+    ullSearch = prvNowNs() - ullStart;
+
+    ullStart = prvNowNs();
+
+    for( uint32_t ulRound = 0; ulRound < TEST_BENCH_ROUNDS; ulRound++ )
+    {
+        ulSink = prvExtractDocument();
+    }
+
+    ullExtract = prvNowNs() - ullStart;
+
+    ( void ) printf( "test_json_extract: %lu byte document, %lu properties\n",
+                     ( unsigned long ) uxDocumentLen, ( unsigned long ) TEST_NUM_PROPERTIES );
+    ( void ) printf( "test_json_extract: validate + %lu searches %lu ns, validate + 1 walk %lu ns\n",
+                     ( unsigned long ) ulSearches,
+                     ( unsigned long ) ( ullSearch / TEST_BENCH_ROUNDS ),
+                     ( unsigned long ) ( ullExtract / TEST_BENCH_ROUNDS ) );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvBuildDocument();
+
+    prvTestValues();
+    prvTestShadowDocument();
+    prvBenchShadowDocument();
+
+    ( void ) printf( "test_json_extract: OK\n" );
+
+    return 0;
+}
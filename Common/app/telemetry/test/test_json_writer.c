@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_json_writer.c
+ * @brief Host test of the JSON writer, including the nesting limit, and a
+ * timing comparison against the snprintf formatting it replaced.
+ *
+ * Build and run with build.sh in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "json_writer.h"
+
+/* Include the module so the test builds without a separate object */
+#include "../json_writer.c"
+
+#define TEST_BUF_LEN          256U
+#define TEST_NUM_PROBES       4U
+#define TEST_BENCH_ROUNDS     200000U
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+typedef struct
+{
+    uint32_t ulChannel;
+    uint32_t ulMoisture; /* Hundredths of a percent */
+    uint16_t usAdcReading;
+} TestProbe_t;
+
+static const TestProbe_t xTestProbes[ TEST_NUM_PROBES ] =
+{
+    { 1, 4217, 2048 },
+    { 2, 0,    0    },
+    { 3, 10000, 4095 },
+    { 4, 5,    17   }
+};
+
+/* Volatile sink so the benchmark loops are not optimised away */
+static volatile size_t uxSink;
+
+/*-----------------------------------------------------------*/
+
+/* Same layout as prvFormatReport in soilMoisture_sensor_publish.c */
+static size_t prvWriteReport( char * pcBuffer,
+                              size_t uxBufferLen )
+{
+    JsonWriter_t xWriter;
+
+    vJsonWriter_Init( &xWriter, pcBuffer, uxBufferLen );
+
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_BeginArray( &xWriter, "probes" );
+
+    for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROBES; uxIdx++ )
+    {
+        vJsonWriter_BeginObject( &xWriter, NULL );
+        vJsonWriter_UInt( &xWriter, "ch", xTestProbes[ uxIdx ].ulChannel );
+        vJsonWriter_Fixed( &xWriter, "SoilMoisture", ( int32_t ) xTestProbes[ uxIdx ].ulMoisture, 2 );
+        vJsonWriter_UInt( &xWriter, "ADC_Reading", xTestProbes[ uxIdx ].usAdcReading );
+        vJsonWriter_EndObject( &xWriter );
+    }
+
+    vJsonWriter_EndArray( &xWriter );
+    vJsonWriter_EndObject( &xWriter );
+
+    return uxJsonWriter_Finish( &xWriter );
+}
+
+/*-----------------------------------------------------------*/
+
+/* The snprintf version the writer replaced, with the value held as a float */
+static size_t prvPrintReport( char * pcBuffer,
+                              size_t uxBufferLen )
+{
+    size_t uxOffset = 0;
+    int lWritten = snprintf( pcBuffer, uxBufferLen, "{\"probes\":[" );
+
+    for( size_t uxIdx = 0; ( lWritten > 0 ) && ( uxIdx < TEST_NUM_PROBES ); uxIdx++ )
+    {
+        uxOffset += ( size_t ) lWritten;
+        lWritten = snprintf( &( pcBuffer[ uxOffset ] ),
+                             uxBufferLen - uxOffset,
+                             "%s{\"ch\":%lu,\"SoilMoisture\":%.2f,\"ADC_Reading\":%u}",
+                             ( uxIdx > 0 ) ? "," : "",
+                             ( unsigned long ) xTestProbes[ uxIdx ].ulChannel,
+                             ( double ) ( ( float ) xTestProbes[ uxIdx ].ulMoisture / 100.0f ),
+                             xTestProbes[ uxIdx ].usAdcReading );
+    }
+
+    if( lWritten > 0 )
+    {
+        uxOffset += ( size_t ) lWritten;
+        lWritten = snprintf( &( pcBuffer[ uxOffset ] ), uxBufferLen - uxOffset, "]}" );
+        uxOffset += ( size_t ) lWritten;
+    }
+
+    return uxOffset;
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestReport( void )
+{
+    char pcWritten[ TEST_BUF_LEN ];
+    char pcPrinted[ TEST_BUF_LEN ];
+    size_t uxWritten = prvWriteReport( pcWritten, sizeof( pcWritten ) );
+    size_t uxPrinted = prvPrintReport( pcPrinted, sizeof( pcPrinted ) );
+
+    TEST_ASSERT( uxWritten > 0 );
+    TEST_ASSERT( uxWritten == uxPrinted );
+    TEST_ASSERT( strcmp( pcWritten, pcPrinted ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestValues( void )
+{
+    char pcBuf[ TEST_BUF_LEN ];
+    JsonWriter_t xWriter;
+    size_t uxLen;
+
+    vJsonWriter_Init( &xWriter, pcBuf, sizeof( pcBuf ) );
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_Int( &xWriter, "i", -2147483647 - 1 );
+    vJsonWriter_UInt( &xWriter, "u", UINT32_MAX );
+    vJsonWriter_Fixed( &xWriter, "f", -5, 2 );
+    vJsonWriter_Fixed( &xWriter, "g", 12345, 3 );
+    vJsonWriter_UIntString( &xWriter, "s", 42, 4 );
+    vJsonWriter_String( &xWriter, "e", "a\"b\\c\n" );
+    vJsonWriter_BeginArray( &xWriter, "a" );
+    vJsonWriter_Raw( &xWriter, NULL, "true", 4 );
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_EndObject( &xWriter );
+    vJsonWriter_EndArray( &xWriter );
+    vJsonWriter_EndObject( &xWriter );
+    uxLen = uxJsonWriter_Finish( &xWriter );
+
+    TEST_ASSERT( strcmp( pcBuf,
+                         "{\"i\":-2147483648,\"u\":4294967295,\"f\":-0.05,\"g\":12.345,"
+                         "\"s\":\"0042\",\"e\":\"a\\\"b\\\\c\\u000a\",\"a\":[true,{}]}" ) == 0 );
+    TEST_ASSERT( uxLen == strlen( pcBuf ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestDepthLimit( void )
+{
+    char pcBuf[ TEST_BUF_LEN ];
+    JsonWriter_t xWriter;
+    size_t uxLength;
+
+    vJsonWriter_Init( &xWriter, pcBuf, sizeof( pcBuf ) );
+
+    for( uint8_t ucIdx = 0; ucIdx < JSON_WRITER_MAX_DEPTH; ucIdx++ )
+    {
+        vJsonWriter_BeginArray( &xWriter, NULL );
+    }
+
+    TEST_ASSERT( xWriter.xOverflow == pdFALSE );
+    TEST_ASSERT( xWriter.ucDepth == JSON_WRITER_MAX_DEPTH );
+
+    /* One level too deep: nothing may be written and no state may change */
+    xWriter.pucMemberCount[ JSON_WRITER_MAX_DEPTH ] = 0;
+    uxLength = xWriter.uxLength;
+    vJsonWriter_BeginObject( &xWriter, NULL );
+
+    TEST_ASSERT( xWriter.xOverflow == pdTRUE );
+    TEST_ASSERT( xWriter.uxLength == uxLength );
+    TEST_ASSERT( xWriter.ucDepth == JSON_WRITER_MAX_DEPTH );
+    TEST_ASSERT( xWriter.pucMemberCount[ JSON_WRITER_MAX_DEPTH ] == 0 );
+    TEST_ASSERT( uxJsonWriter_Finish( &xWriter ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestOverflow( void )
+{
+    char pcBuf[ TEST_BUF_LEN ];
+    JsonWriter_t xWriter;
+    size_t uxFull = prvWriteReport( pcBuf, sizeof( pcBuf ) );
+
+    /* Every buffer without room for the terminator must be rejected */
+    for( size_t uxLen = 1; uxLen <= uxFull; uxLen++ )
+    {
+        TEST_ASSERT( prvWriteReport( pcBuf, uxLen ) == 0 );
+    }
+
+    TEST_ASSERT( prvWriteReport( pcBuf, uxFull + 1 ) == uxFull );
+
+    /* Unbalanced documents are rejected */
+    vJsonWriter_Init( &xWriter, pcBuf, sizeof( pcBuf ) );
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    TEST_ASSERT( uxJsonWriter_Finish( &xWriter ) == 0 );
+
+    vJsonWriter_Init( &xWriter, pcBuf, sizeof( pcBuf ) );
+    vJsonWriter_EndArray( &xWriter );
+    TEST_ASSERT( uxJsonWriter_Finish( &xWriter ) == 0 );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint64_t prvNowNs( void )
+{
+    struct timespec xNow;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( ( uint64_t ) xNow.tv_sec * 1000000000ULL ) + ( uint64_t ) xNow.tv_nsec;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Reports the time per document, the numbers are informational only */
+static void prvBenchReport( void )
+{
+    char pcBuf[ TEST_BUF_LEN ];
+    uint64_t ullStart;
+    uint64_t ullWriter;
+    uint64_t ullPrintf;
+
+    ullStart = prvNowNs();
+
+    for( uint32_t ulRound = 0; ulRound < TEST_BENCH_ROUNDS; ulRound++ )
+    {
+        uxSink = prvWriteReport( pcBuf, sizeof( pcBuf ) );
+    }
+
+    ullWriter = prvNowNs() - ullStart;
+
+    ullStart = prvNowNs();
+
+    for( uint32_t ulRound = 0; ulRound < TEST_BENCH_ROUNDS; ulRound++ )
+    {
+        uxSink = prvPrintReport( pcBuf, sizeof( pcBuf ) );
+    }
+
+    ullPrintf = prvNowNs() - ullStart;
+
+    ( void ) printf( "test_json_writer: %u probe report, json writer %lu ns, snprintf %lu ns\n",
+                     TEST_NUM_PROBES,
+                     ( unsigned long ) ( ullWriter / TEST_BENCH_ROUNDS ),
+                     ( unsigned long ) ( ullPrintf / TEST_BENCH_ROUNDS ) );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvTestReport();
+    prvTestValues();
+    prvTestDepthLimit();
+    prvTestOverflow();
+    prvBenchReport();
+
+    ( void ) printf( "test_json_writer: OK\n" );
+
+    return 0;
+}
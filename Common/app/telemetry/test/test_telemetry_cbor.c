@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file test_telemetry_cbor.c
+ * @brief Host test of the CBOR telemetry encoding, and a comparison with the
+ * JSON encoding of the same samples in payload size and encode time.
+ *
+ * The soil and motion encoders mirror prvFormatReport / prvEncodeReportCbor in
+ * soilMoisture_sensor_publish.c and prvFormatMotion / prvEncodeMotionCbor in
+ * motion_sensors_publish.c. Batches go through telemetry_batch.c itself.
+ *
+ * Build and run with build.sh in this directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "kvstore.h"
+#include "json_writer.h"
+#include "telemetry_batch.h"
+#include "telemetry_format.h"
+
+#include "cbor.h"
+#include "core_json.h"
+
+#define TEST_BUF_LEN          256U
+#define TEST_ARENA_LEN        4096U
+#define TEST_NUM_PROBES       4U
+#define TEST_BATCH_SAMPLES    10U
+#define TEST_BENCH_ROUNDS     200000U
+
+#define TEST_ASSERT( x )                                                      \
+    do {                                                                      \
+        if( !( x ) )                                                          \
+        {                                                                     \
+            ( void ) printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x ); \
+            exit( 1 );                                                        \
+        }                                                                     \
+    } while( 0 )
+
+typedef struct
+{
+    uint32_t ulChannel;
+    int32_t lMoisture; /* Hundredths of a percent */
+    uint16_t usAdcReading;
+} TestProbe_t;
+
+typedef struct
+{
+    int32_t x;
+    int32_t y;
+    int32_t z;
+} TestAxes_t;
+
+typedef int ( * TestEncoder_t )( uint8_t * pucBuffer,
+                                 size_t uxBufferLen );
+
+static const TestProbe_t xTestProbes[ TEST_NUM_PROBES ] =
+{
+    { 1, 4217,  2048 },
+    { 2, 0,     0    },
+    { 3, 10000, 4095 },
+    { 4, 5,     17   }
+};
+
+/* Typical readings: acceleration in mG, rate in mDPS, field in mGauss */
+static const TestAxes_t xTestMotion[ 3 ] =
+{
+    { -12,   7,     1003 },
+    { 1750,  -2450, 70   },
+    { -285,  120,   -460 }
+};
+
+static const char * const pcAxesKeys[ 3 ] =
+{
+    "acceleration_mG", "gyro_mDPS", "magnetometer_mGauss"
+};
+
+static TickType_t xTestTick;
+
+/* Volatile sink so the benchmark loops are not optimised away */
+static volatile int lSink;
+
+/*-----------------------------------------------------------*/
+
+TickType_t xTaskGetTickCount( void )
+{
+    return xTestTick;
+}
+
+/*-----------------------------------------------------------*/
+
+uint32_t KVStore_getUInt32( KVStoreKey_t xKey,
+                            BaseType_t * pxSuccess )
+{
+    ( void ) xKey;
+
+    if( pxSuccess != NULL )
+    {
+        *pxSuccess = pdTRUE;
+    }
+
+    /* Large enough that no threshold triggers */
+    return UINT32_MAX;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvSoilJson( uint8_t * pucBuffer,
+                        size_t uxBufferLen )
+{
+    JsonWriter_t xWriter;
+
+    vJsonWriter_Init( &xWriter, ( char * ) pucBuffer, uxBufferLen );
+
+    vJsonWriter_BeginObject( &xWriter, NULL );
+    vJsonWriter_BeginArray( &xWriter, "probes" );
+
+    for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROBES; uxIdx++ )
+    {
+        vJsonWriter_BeginObject( &xWriter, NULL );
+        vJsonWriter_UInt( &xWriter, "ch", xTestProbes[ uxIdx ].ulChannel );
+        vJsonWriter_Fixed( &xWriter, "SoilMoisture", xTestProbes[ uxIdx ].lMoisture, 2 );
+        vJsonWriter_UInt( &xWriter, "ADC_Reading", xTestProbes[ uxIdx ].usAdcReading );
+        vJsonWriter_EndObject( &xWriter );
+    }
+
+    vJsonWriter_EndArray( &xWriter );
+    vJsonWriter_EndObject( &xWriter );
+
+    return ( int ) uxJsonWriter_Finish( &xWriter );
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvSoilCbor( uint8_t * pucBuffer,
+                        size_t uxBufferLen )
+{
+    CborEncoder xEncoder;
+    CborEncoder xMapEncoder;
+    CborEncoder xArrayEncoder;
+    CborError xError = CborNoError;
+
+    cbor_encoder_init( &xEncoder, pucBuffer, uxBufferLen, 0 );
+
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, 1 );
+    xError |= cbor_encode_uint( &xMapEncoder, TLM_KEY_PROBES );
+    xError |= cbor_encoder_create_array( &xMapEncoder, &xArrayEncoder, TEST_NUM_PROBES );
+
+    for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROBES; uxIdx++ )
+    {
+        CborEncoder xProbeEncoder;
+
+        xError |= cbor_encoder_create_map( &xArrayEncoder, &xProbeEncoder, 3 );
+        xError |= cbor_encode_uint( &xProbeEncoder, TLM_KEY_CHANNEL );
+        xError |= cbor_encode_uint( &xProbeEncoder, xTestProbes[ uxIdx ].ulChannel );
+        xError |= cbor_encode_uint( &xProbeEncoder, TLM_KEY_MOISTURE );
+        xError |= cbor_encode_int( &xProbeEncoder, xTestProbes[ uxIdx ].lMoisture );
+        xError |= cbor_encode_uint( &xProbeEncoder, TLM_KEY_RAW );
+        xError |= cbor_encode_uint( &xProbeEncoder, xTestProbes[ uxIdx ].usAdcReading );
+        xError |= cbor_encoder_close_container( &xArrayEncoder, &xProbeEncoder );
+    }
+
+    xError |= cbor_encoder_close_container( &xMapEncoder, &xArrayEncoder );
+    xError |= cbor_encoder_close_container( &xEncoder, &xMapEncoder );
+
+    return ( xError == CborNoError ) ? ( int ) cbor_encoder_get_buffer_size( &xEncoder, pucBuffer ) : -1;
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvMotionJson( uint8_t * pucBuffer,
+                          size_t uxBufferLen )
+{
+    JsonWriter_t xWriter;
+
+    vJsonWriter_Init( &xWriter, ( char * ) pucBuffer, uxBufferLen );
+
+    vJsonWriter_BeginObject( &xWriter, NULL );
+
+    for( size_t uxIdx = 0; uxIdx < 3; uxIdx++ )
+    {
+        vJsonWriter_BeginObject( &xWriter, pcAxesKeys[ uxIdx ] );
+        vJsonWriter_Int( &xWriter, "x", xTestMotion[ uxIdx ].x );
+        vJsonWriter_Int( &xWriter, "y", xTestMotion[ uxIdx ].y );
+        vJsonWriter_Int( &xWriter, "z", xTestMotion[ uxIdx ].z );
+        vJsonWriter_EndObject( &xWriter );
+    }
+
+    vJsonWriter_EndObject( &xWriter );
+
+    return ( int ) uxJsonWriter_Finish( &xWriter );
+}
+
+/*-----------------------------------------------------------*/
+
+static int prvMotionCbor( uint8_t * pucBuffer,
+                          size_t uxBufferLen )
+{
+    CborEncoder xEncoder;
+    CborEncoder xMapEncoder;
+    CborError xError = CborNoError;
+
+    cbor_encoder_init( &xEncoder, pucBuffer, uxBufferLen, 0 );
+
+    xError = cbor_encoder_create_map( &xEncoder, &xMapEncoder, 3 );
+
+    for( size_t uxIdx = 0; uxIdx < 3; uxIdx++ )
+    {
+        CborEncoder xArrayEncoder;
+
+        xError |= cbor_encode_uint( &xMapEncoder, TLM_KEY_ACCEL + uxIdx );
+        xError |= cbor_encoder_create_array( &xMapEncoder, &xArrayEncoder, 3 );
+        xError |= cbor_encode_int( &xArrayEncoder, xTestMotion[ uxIdx ].x );
+        xError |= cbor_encode_int( &xArrayEncoder, xTestMotion[ uxIdx ].y );
+        xError |= cbor_encode_int( &xArrayEncoder, xTestMotion[ uxIdx ].z );
+        xError |= cbor_encoder_close_container( &xMapEncoder, &xArrayEncoder );
+    }
+
+    xError |= cbor_encoder_close_container( &xEncoder, &xMapEncoder );
+
+    return ( xError == CborNoError ) ? ( int ) cbor_encoder_get_buffer_size( &xEncoder, pucBuffer ) : -1;
+}
+
+/*-----------------------------------------------------------*/
+
+static uint64_t prvGetUInt( CborValue * pxValue )
+{
+    uint64_t ullValue = 0;
+
+    TEST_ASSERT( cbor_value_is_unsigned_integer( pxValue ) );
+    TEST_ASSERT( cbor_value_get_uint64( pxValue, &ullValue ) == CborNoError );
+    TEST_ASSERT( cbor_value_advance_fixed( pxValue ) == CborNoError );
+
+    return ullValue;
+}
+
+/*-----------------------------------------------------------*/
+
+static int64_t prvGetInt( CborValue * pxValue )
+{
+    int64_t llValue = 0;
+
+    TEST_ASSERT( cbor_value_is_integer( pxValue ) );
+    TEST_ASSERT( cbor_value_get_int64( pxValue, &llValue ) == CborNoError );
+    TEST_ASSERT( cbor_value_advance_fixed( pxValue ) == CborNoError );
+
+    return llValue;
+}
+
+/*-----------------------------------------------------------*/
+
+/* Decode the soil report and check every key and value */
+static void prvTestSoilCbor( void )
+{
+    uint8_t pucBuf[ TEST_BUF_LEN ];
+    int lLen = prvSoilCbor( pucBuf, sizeof( pucBuf ) );
+    CborParser xParser;
+    CborValue xRoot;
+    CborValue xMap;
+    CborValue xArray;
+
+    TEST_ASSERT( lLen > 0 );
+    TEST_ASSERT( cbor_parser_init( pucBuf, ( size_t ) lLen, 0, &xParser, &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_validate_basic( &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_is_map( &xRoot ) );
+    TEST_ASSERT( cbor_value_enter_container( &xRoot, &xMap ) == CborNoError );
+    TEST_ASSERT( prvGetUInt( &xMap ) == TLM_KEY_PROBES );
+    TEST_ASSERT( cbor_value_is_array( &xMap ) );
+    TEST_ASSERT( cbor_value_enter_container( &xMap, &xArray ) == CborNoError );
+
+    for( size_t uxIdx = 0; uxIdx < TEST_NUM_PROBES; uxIdx++ )
+    {
+        CborValue xProbe;
+
+        TEST_ASSERT( cbor_value_is_map( &xArray ) );
+        TEST_ASSERT( cbor_value_enter_container( &xArray, &xProbe ) == CborNoError );
+        TEST_ASSERT( prvGetUInt( &xProbe ) == TLM_KEY_CHANNEL );
+        TEST_ASSERT( prvGetUInt( &xProbe ) == xTestProbes[ uxIdx ].ulChannel );
+        TEST_ASSERT( prvGetUInt( &xProbe ) == TLM_KEY_MOISTURE );
+        TEST_ASSERT( prvGetInt( &xProbe ) == xTestProbes[ uxIdx ].lMoisture );
+        TEST_ASSERT( prvGetUInt( &xProbe ) == TLM_KEY_RAW );
+        TEST_ASSERT( prvGetUInt( &xProbe ) == xTestProbes[ uxIdx ].usAdcReading );
+        TEST_ASSERT( cbor_value_at_end( &xProbe ) );
+        TEST_ASSERT( cbor_value_leave_container( &xArray, &xProbe ) == CborNoError );
+    }
+
+    TEST_ASSERT( cbor_value_at_end( &xArray ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Decode the motion sample and check every key and value */
+static void prvTestMotionCbor( void )
+{
+    uint8_t pucBuf[ TEST_BUF_LEN ];
+    int lLen = prvMotionCbor( pucBuf, sizeof( pucBuf ) );
+    CborParser xParser;
+    CborValue xRoot;
+    CborValue xMap;
+
+    TEST_ASSERT( lLen > 0 );
+    TEST_ASSERT( cbor_parser_init( pucBuf, ( size_t ) lLen, 0, &xParser, &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_validate_basic( &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_enter_container( &xRoot, &xMap ) == CborNoError );
+
+    for( size_t uxIdx = 0; uxIdx < 3; uxIdx++ )
+    {
+        CborValue xAxes;
+
+        TEST_ASSERT( prvGetUInt( &xMap ) == ( TLM_KEY_ACCEL + uxIdx ) );
+        TEST_ASSERT( cbor_value_is_array( &xMap ) );
+        TEST_ASSERT( cbor_value_enter_container( &xMap, &xAxes ) == CborNoError );
+        TEST_ASSERT( prvGetInt( &xAxes ) == xTestMotion[ uxIdx ].x );
+        TEST_ASSERT( prvGetInt( &xAxes ) == xTestMotion[ uxIdx ].y );
+        TEST_ASSERT( prvGetInt( &xAxes ) == xTestMotion[ uxIdx ].z );
+        TEST_ASSERT( cbor_value_leave_container( &xMap, &xAxes ) == CborNoError );
+    }
+
+    TEST_ASSERT( cbor_value_at_end( &xMap ) );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Fill a batch with one sample per second and return the payload length */
+static size_t prvFillBatch( TelemetryFormat_t xFormat,
+                            TestEncoder_t xEncoder,
+                            char * pcArena,
+                            const char ** ppcPayload )
+{
+    TelemetryBatch_t xBatch;
+    uint8_t pucSample[ TEST_BUF_LEN ];
+
+    vTelemetryBatch_Init( &xBatch, pcArena, TEST_ARENA_LEN, xFormat );
+
+    for( size_t uxIdx = 0; uxIdx < TEST_BATCH_SAMPLES; uxIdx++ )
+    {
+        int lLen = xEncoder( pucSample, sizeof( pucSample ) );
+
+        xTestTick = ( TickType_t ) ( 60000U + ( 1000U * uxIdx ) );
+
+        TEST_ASSERT( lLen > 0 );
+        TEST_ASSERT( xTelemetryBatch_Append( &xBatch, ( const char * ) pucSample, ( size_t ) lLen ) == pdTRUE );
+    }
+
+    return uxTelemetryBatch_Finalize( &xBatch, ppcPayload );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvTestBatch( void )
+{
+    static char pcArena[ TEST_ARENA_LEN ];
+    const char * pcPayload = NULL;
+    size_t uxLen;
+    CborParser xParser;
+    CborValue xRoot;
+
+    uxLen = prvFillBatch( TELEMETRY_FORMAT_JSON, prvSoilJson, pcArena, &pcPayload );
+    TEST_ASSERT( uxLen > 0 );
+    TEST_ASSERT( JSON_Validate( pcPayload, uxLen ) == JSONSuccess );
+
+    uxLen = prvFillBatch( TELEMETRY_FORMAT_CBOR, prvSoilCbor, pcArena, &pcPayload );
+    TEST_ASSERT( uxLen > 0 );
+    TEST_ASSERT( cbor_parser_init( ( const uint8_t * ) pcPayload, uxLen, 0, &xParser, &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_validate_basic( &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_advance( &xRoot ) == CborNoError );
+    TEST_ASSERT( cbor_value_at_end( &xRoot ) );
+}
+
+/*-----------------------------------------------------------*/
+
+static uint64_t prvNowNs( void )
+{
+    struct timespec xNow;
+
+    ( void ) clock_gettime( CLOCK_MONOTONIC, &xNow );
+
+    return ( ( uint64_t ) xNow.tv_sec * 1000000000ULL ) + ( uint64_t ) xNow.tv_nsec;
+}
+
+/*-----------------------------------------------------------*/
+
+static unsigned long prvTimeEncoder( TestEncoder_t xEncoder )
+{
+    uint8_t pucBuf[ TEST_BUF_LEN ];
+    uint64_t ullStart = prvNowNs();
+
+    for( uint32_t ulRound = 0; ulRound < TEST_BENCH_ROUNDS; ulRound++ )
+    {
+        lSink = xEncoder( pucBuf, sizeof( pucBuf ) );
+    }
+
+    return ( unsigned long ) ( ( prvNowNs() - ullStart ) / TEST_BENCH_ROUNDS );
+}
+
+/*-----------------------------------------------------------*/
+
+/* Reports bytes per sample and time per encode, the numbers are informational only */
+static void prvBench( const char * pcName,
+                      TestEncoder_t xJsonEncoder,
+                      TestEncoder_t xCborEncoder )
+{
+    static char pcArena[ TEST_ARENA_LEN ];
+    uint8_t pucBuf[ TEST_BUF_LEN ];
+    const char * pcPayload = NULL;
+    size_t uxJsonBatch = prvFillBatch( TELEMETRY_FORMAT_JSON, xJsonEncoder, pcArena, &pcPayload );
+    size_t uxCborBatch = prvFillBatch( TELEMETRY_FORMAT_CBOR, xCborEncoder, pcArena, &pcPayload );
+
+    ( void ) printf( "test_telemetry_cbor: %-6s json %3d B %4lu ns, cbor %3d B %4lu ns, "
+                     "batch of %u json %lu B/sample, cbor %lu B/sample\n",
+                     pcName,
+                     xJsonEncoder( pucBuf, sizeof( pucBuf ) ), prvTimeEncoder( xJsonEncoder ),
+                     xCborEncoder( pucBuf, sizeof( pucBuf ) ), prvTimeEncoder( xCborEncoder ),
+                     TEST_BATCH_SAMPLES,
+                     ( unsigned long ) ( uxJsonBatch / TEST_BATCH_SAMPLES ),
+                     ( unsigned long ) ( uxCborBatch / TEST_BATCH_SAMPLES ) );
+}
+
+/*-----------------------------------------------------------*/
+
+int main( void )
+{
+    prvTestSoilCbor();
+    prvTestMotionCbor();
+    prvTestBatch();
+
+    prvBench( "soil", prvSoilJson, prvSoilCbor );
+    prvBench( "motion", prvMotionJson, prvMotionCbor );
+
+    ( void ) printf( "test_telemetry_cbor: OK\n" );
+
+    return 0;
+}
@@ -0,0 +1,335 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2020-2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "cli.h"
+#include "cli_prv.h"
+#include "logging.h"
+
+#include "moisture_probes.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MODE_ARG_IDX        1
+#define PROBE_ARG_IDX       2
+#define CAPTURE_ARG_IDX     3
+#define READING_ARG_IDX     3
+#define MOISTURE_ARG_IDX    4
+
+static void vCommand_MoistCal( ConsoleIO_t * pxCIO,
+                               uint32_t ulArgc,
+                               char * ppcArgv[] );
+
+const CLI_Command_Definition_t xCommandDef_moistcal =
+{
+    .pcCommand            = "moistcal",
+    .pcHelpString         =
+        "moistcal:\r\n"
+        "    Capture and inspect soil moisture probe calibration curves\r\n"
+        "    Usage:\r\n"
+        "    moistcal show\r\n"
+        "        Outputs the calibration points and latest reading of every probe.\r\n\n"
+        "    moistcal capture <probe> <moisture %>\r\n"
+        "        Add a point mapping the current reading of a probe to the given\r\n"
+        "        moisture, e.g. \"moistcal capture 0 42.5\".\r\n\n"
+        "    moistcal set <probe> <reading> <moisture %>\r\n"
+        "        Add a point for a known raw reading.\r\n\n"
+        "    moistcal clear <probe>\r\n"
+        "        Remove all points of a probe, reverting it to the default curve.\r\n\n"
+        "    Probes are numbered from 0 in moist_channels order. Changes are saved\r\n"
+        "    to NVM and applied immediately. A curve needs at least two points.\r\n\n",
+    .pxCommandInterpreter = vCommand_MoistCal
+};
+
+/* Only used from the CLI task */
+static MoistProbeSet_t xProbeSet;
+static MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ];
+
+/*-----------------------------------------------------------*/
+
+/* Parse a percentage with up to two decimals into hundredths of a percent */
+static BaseType_t prvParseMoisture( const char * pcArg,
+                                    uint16_t * pusMoisture )
+{
+    BaseType_t xResult = pdFALSE;
+    char * pcEnd = NULL;
+    uint32_t ulValue = ( uint32_t ) strtoul( pcArg, &pcEnd, 10 );
+
+    if( ( pcEnd != pcArg ) && ( ulValue <= 100 ) )
+    {
+        uint32_t ulScale = MOIST_MOISTURE_SCALE;
+
+        ulValue *= MOIST_MOISTURE_SCALE;
+        xResult = pdTRUE;
+
+        if( *pcEnd == '.' )
+        {
+            pcEnd++;
+
+            while( ( *pcEnd >= '0' ) && ( *pcEnd <= '9' ) && ( ulScale > 1 ) )
+            {
+                ulScale /= 10;
+                ulValue += ( uint32_t ) ( *pcEnd - '0' ) * ulScale;
+                pcEnd++;
+            }
+        }
+
+        if( ( *pcEnd != '\0' ) || ( ulValue > MOIST_MOISTURE_MAX ) )
+        {
+            xResult = pdFALSE;
+        }
+    }
+
+    if( xResult == pdTRUE )
+    {
+        *pusMoisture = ( uint16_t ) ulValue;
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static BaseType_t prvParseProbe( ConsoleIO_t * pxCIO,
+                                 const char * pcArg,
+                                 size_t * puxProbe )
+{
+    BaseType_t xResult = pdFALSE;
+    char * pcEnd = NULL;
+    uint32_t ulProbe = ( uint32_t ) strtoul( pcArg, &pcEnd, 10 );
+
+    if( ( pcEnd != pcArg ) && ( *pcEnd == '\0' ) && ( ulProbe < xProbeSet.uxNumProbes ) )
+    {
+        *puxProbe = ( size_t ) ulProbe;
+        xResult = pdTRUE;
+    }
+    else
+    {
+        ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                           "Error: probe must be between 0 and %u.\r\n",
+                           ( unsigned int ) xProbeSet.uxNumProbes - 1 );
+        pxCIO->print( pcCliScratchBuffer );
+    }
+
+    return xResult;
+}
+
+/*-----------------------------------------------------------*/
+
+static void vSubCommand_Show( ConsoleIO_t * pxCIO )
+{
+    for( size_t uxProbe = 0; uxProbe < xProbeSet.uxNumProbes; uxProbe++ )
+    {
+        const MoistProbe_t * pxProbe = &( xProbeSet.xProbes[ uxProbe ] );
+        uint16_t usReading = 0;
+        size_t uxLen = 0;
+
+        uxLen = ( size_t ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                                     "probe %u (ADC4_IN%lu):",
+                                     ( unsigned int ) uxProbe, pxProbe->ulAdcInput );
+
+        if( pxCurves[ uxProbe ].uxNumPoints < 2 )
+        {
+            uxLen += ( size_t ) snprintf( &( pcCliScratchBuffer[ uxLen ] ), CLI_OUTPUT_SCRATCH_BUF_LEN - uxLen,
+                                          " default," );
+        }
+
+        for( size_t uxIdx = 0; uxIdx < pxProbe->xCurve.uxNumPoints; uxIdx++ )
+        {
+            const MoistCalPoint_t * pxPoint = &( pxProbe->xCurve.xPoints[ uxIdx ] );
+
+            uxLen += ( size_t ) snprintf( &( pcCliScratchBuffer[ uxLen ] ), CLI_OUTPUT_SCRATCH_BUF_LEN - uxLen,
+                                          " %u=%u.%02u%%",
+                                          pxPoint->usReading,
+                                          pxPoint->usMoisture / MOIST_MOISTURE_SCALE,
+                                          pxPoint->usMoisture % MOIST_MOISTURE_SCALE );
+        }
+
+        if( xMoistProbes_GetLastReading( uxProbe, &usReading ) == pdTRUE )
+        {
+            uint16_t usMoisture = usMoistProbes_ToMoisture( pxProbe, usReading );
+
+            ( void ) snprintf( &( pcCliScratchBuffer[ uxLen ] ), CLI_OUTPUT_SCRATCH_BUF_LEN - uxLen,
+                               ", now %u=%u.%02u%%\r\n",
+                               usReading,
+                               usMoisture / MOIST_MOISTURE_SCALE,
+                               usMoisture % MOIST_MOISTURE_SCALE );
+        }
+        else
+        {
+            ( void ) snprintf( &( pcCliScratchBuffer[ uxLen ] ), CLI_OUTPUT_SCRATCH_BUF_LEN - uxLen,
+                               ", no reading yet\r\n" );
+        }
+
+        pxCIO->print( pcCliScratchBuffer );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void vSubCommand_AddPoint( ConsoleIO_t * pxCIO,
+                                  size_t uxProbe,
+                                  uint16_t usReading,
+                                  uint16_t usMoisture )
+{
+    MoistCalCurve_t xPrevious = pxCurves[ uxProbe ];
+
+    if( xMoistCal_AddPoint( &( pxCurves[ uxProbe ] ), usReading, usMoisture ) == pdFALSE )
+    {
+        pxCIO->print( "Error: calibration curve is full, clear it first.\r\n" );
+    }
+    else if( xMoistProbes_WriteCurves( pxCurves, xProbeSet.uxNumProbes ) == pdFALSE )
+    {
+        /* Keep the stored and the displayed curves the same */
+        pxCurves[ uxProbe ] = xPrevious;
+        pxCIO->print( "Error: Could not save calibration to NVM, too many points?\r\n" );
+    }
+    else
+    {
+        ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                           "probe %u: added %u=%u.%02u%%, %u point(s).\r\n",
+                           ( unsigned int ) uxProbe,
+                           usReading,
+                           usMoisture / MOIST_MOISTURE_SCALE,
+                           usMoisture % MOIST_MOISTURE_SCALE,
+                           ( unsigned int ) pxCurves[ uxProbe ].uxNumPoints );
+        pxCIO->print( pcCliScratchBuffer );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void vSubCommand_Clear( ConsoleIO_t * pxCIO,
+                               size_t uxProbe )
+{
+    ( void ) memset( &( pxCurves[ uxProbe ] ), 0, sizeof( MoistCalCurve_t ) );
+
+    if( xMoistProbes_WriteCurves( pxCurves, xProbeSet.uxNumProbes ) == pdTRUE )
+    {
+        pxCIO->print( "Calibration cleared.\r\n" );
+    }
+    else
+    {
+        pxCIO->print( "Error: Could not save calibration to NVM.\r\n" );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * CLI format:
+ * Argc   1        2        3       4           5
+ * Idx    0        1        2       3           4
+ *      moistcal show
+ *      moistcal capture  <probe> <moisture>
+ *      moistcal set      <probe> <reading>   <moisture>
+ *      moistcal clear    <probe>
+ */
+static void vCommand_MoistCal( ConsoleIO_t * pxCIO,
+                               uint32_t ulArgc,
+                               char * ppcArgv[] )
+{
+    const char * pcMode = NULL;
+    size_t uxProbe = 0;
+    uint16_t usReading = 0;
+    uint16_t usMoisture = 0;
+    BaseType_t xSuccess = pdFALSE;
+
+    /* Start from the stored state, it may have been changed with conf set */
+    ( void ) xMoistProbes_Load( &xProbeSet );
+    ( void ) uxMoistProbes_ReadCurves( pxCurves );
+
+    if( ulArgc > MODE_ARG_IDX )
+    {
+        pcMode = ppcArgv[ MODE_ARG_IDX ];
+
+        if( 0 == strcmp( "show", pcMode ) )
+        {
+            vSubCommand_Show( pxCIO );
+            xSuccess = pdTRUE;
+        }
+        else if( ulArgc <= PROBE_ARG_IDX )
+        {
+            xSuccess = pdFALSE;
+        }
+        else if( prvParseProbe( pxCIO, ppcArgv[ PROBE_ARG_IDX ], &uxProbe ) == pdFALSE )
+        {
+            /* Error already printed */
+            xSuccess = pdTRUE;
+        }
+        else if( ( 0 == strcmp( "capture", pcMode ) ) && ( ulArgc > CAPTURE_ARG_IDX ) )
+        {
+            if( prvParseMoisture( ppcArgv[ CAPTURE_ARG_IDX ], &usMoisture ) == pdFALSE )
+            {
+                pxCIO->print( "Error: moisture must be between 0 and 100.\r\n" );
+            }
+            else if( xMoistProbes_GetLastReading( uxProbe, &usReading ) == pdFALSE )
+            {
+                pxCIO->print( "Error: no reading is available for this probe yet.\r\n" );
+            }
+            else
+            {
+                vSubCommand_AddPoint( pxCIO, uxProbe, usReading, usMoisture );
+            }
+
+            xSuccess = pdTRUE;
+        }
+        else if( ( 0 == strcmp( "set", pcMode ) ) && ( ulArgc > MOISTURE_ARG_IDX ) )
+        {
+            char * pcEnd = NULL;
+            uint32_t ulReading = ( uint32_t ) strtoul( ppcArgv[ READING_ARG_IDX ], &pcEnd, 10 );
+
+            if( ( pcEnd == ppcArgv[ READING_ARG_IDX ] ) || ( *pcEnd != '\0' ) || ( ulReading > UINT16_MAX ) )
+            {
+                pxCIO->print( "Error: reading is not valid.\r\n" );
+            }
+            else if( prvParseMoisture( ppcArgv[ MOISTURE_ARG_IDX ], &usMoisture ) == pdFALSE )
+            {
+                pxCIO->print( "Error: moisture must be between 0 and 100.\r\n" );
+            }
+            else
+            {
+                vSubCommand_AddPoint( pxCIO, uxProbe, ( uint16_t ) ulReading, usMoisture );
+            }
+
+            xSuccess = pdTRUE;
+        }
+        else if( 0 == strcmp( "clear", pcMode ) )
+        {
+            vSubCommand_Clear( pxCIO, uxProbe );
+            xSuccess = pdTRUE;
+        }
+        else
+        {
+            xSuccess = pdFALSE;
+        }
+    }
+
+    if( xSuccess == pdFALSE )
+    {
+        pxCIO->print( xCommandDef_moistcal.pcHelpString );
+    }
+}
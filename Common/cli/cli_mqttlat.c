@@ -0,0 +1,237 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2020-2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "cli.h"
+#include "cli_prv.h"
+#include "logging.h"
+
+#include "mqtt_agent_task.h"
+#include "mbedtls_transport.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void vCommand_MqttLat( ConsoleIO_t * pxCIO,
+                              uint32_t ulArgc,
+                              char * ppcArgv[] );
+
+const CLI_Command_Definition_t xCommandDef_mqttlat =
+{
+    .pcCommand            = "mqttlat",
+    .pcHelpString         =
+        "mqttlat:\r\n"
+        "    Display MQTT agent latency histograms and connection counters\r\n"
+        "    Usage:\r\n"
+        "    mqttlat\r\n"
+        "        Outputs the TLS handshake counters and durations, the queue\r\n"
+        "        depth, the connection counters and, for each command type,\r\n"
+        "        the count, average and percentiles of the time spent queued,\r\n"
+        "        writing to the socket and waiting for the ack.\r\n\n"
+        "    mqttlat hist\r\n"
+        "        Outputs the bucket counts of each histogram. Bucket n counts\r\n"
+        "        latencies below 2^n ms.\r\n\n",
+    .pxCommandInterpreter = vCommand_MqttLat
+};
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintTransportStats( ConsoleIO_t * pxCIO )
+{
+    TlsHandshakeStats_t xStats;
+    TlsSendStats_t xSendStats;
+    uint32_t ulFull = 0;
+
+    mbedtls_transport_gethandshakestats( &xStats );
+    mbedtls_transport_getsendstats( &xSendStats );
+
+    ulFull = xStats.ulHandshakes - xStats.ulResumed;
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "tls: handshakes %lu, resumed %lu, resume rejected %lu, failures %lu\r\n"
+                       "tls: ms last %lu, full avg %lu, resumed avg %lu, max %lu\r\n",
+                       xStats.ulHandshakes,
+                       xStats.ulResumed,
+                       xStats.ulResumeRejected,
+                       xStats.ulFailures,
+                       xStats.ulLastMs,
+                       ( ulFull > 0 ) ? ( xStats.ulFullMsTotal / ulFull ) : 0,
+                       ( xStats.ulResumed > 0 ) ? ( xStats.ulResumedMsTotal / xStats.ulResumed ) : 0,
+                       xStats.ulMsMax );
+    pxCIO->print( pcCliScratchBuffer );
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "tls: send stalls %lu, timeouts %lu, stall ms total %lu, max %lu\r\n",
+                       xSendStats.ulStalls,
+                       xSendStats.ulTimeouts,
+                       xSendStats.ulStallMsTotal,
+                       xSendStats.ulStallMsMax );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+#if MQTT_AGENT_METRICS_ENABLED
+
+static const char * const pcCommandNames[ NUM_COMMANDS ] =
+{
+    "none", "processloop", "publish", "subscribe", "unsubscribe",
+    "ping", "connect", "disconnect", "terminate"
+};
+
+static const char * const pcPhaseNames[ MQTT_AGENT_NUM_PHASES ] = { "queued", "send", "ack" };
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintMetrics( ConsoleIO_t * pxCIO )
+{
+    MQTTAgentMetrics_t xMetrics;
+
+    vMqttAgent_GetMetrics( &xMetrics );
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "queue: depth %lu, high water %lu, awaiting ack %lu\r\n"
+                       "connection: connects %lu, failures %lu, tls failures %lu, disconnects %lu, resumed %lu\r\n"
+                       "publish: coalesced writes %lu, streamed %lu\r\n",
+                       xMetrics.ulQueueDepth,
+                       xMetrics.ulQueueHighWater,
+                       xMetrics.ulAwaitingAck,
+                       xMetrics.ulConnects,
+                       xMetrics.ulConnectFailures,
+                       xMetrics.ulTlsFailures,
+                       xMetrics.ulDisconnects,
+                       xMetrics.ulSessionsResumed,
+                       xMetrics.ulPublishesCoalesced,
+                       xMetrics.ulPublishesStreamed );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintSummary( ConsoleIO_t * pxCIO,
+                             MQTTAgentCommandType_t xType,
+                             MQTTAgentPhase_t xPhase,
+                             const MQTTAgentHistogram_t * pxHistogram )
+{
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "%-11s %-6s: count %lu, ms avg %lu p50 <%lu p90 <%lu p99 <%lu max %lu\r\n",
+                       pcCommandNames[ xType ],
+                       pcPhaseNames[ xPhase ],
+                       pxHistogram->ulCount,
+                       pxHistogram->ulMsTotal / pxHistogram->ulCount,
+                       ulMqttAgent_HistogramPercentile( pxHistogram, 50U ),
+                       ulMqttAgent_HistogramPercentile( pxHistogram, 90U ),
+                       ulMqttAgent_HistogramPercentile( pxHistogram, 99U ),
+                       pxHistogram->ulMsMax );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintBuckets( ConsoleIO_t * pxCIO,
+                             MQTTAgentCommandType_t xType,
+                             MQTTAgentPhase_t xPhase,
+                             const MQTTAgentHistogram_t * pxHistogram )
+{
+    size_t uxLen = 0;
+
+    uxLen = ( size_t ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                                 "%-11s %-6s:", pcCommandNames[ xType ], pcPhaseNames[ xPhase ] );
+
+    for( uint32_t ulBucket = 0; ( ulBucket < MQTT_AGENT_LATENCY_BUCKETS ) && ( uxLen < CLI_OUTPUT_SCRATCH_BUF_LEN ); ulBucket++ )
+    {
+        uxLen += ( size_t ) snprintf( &( pcCliScratchBuffer[ uxLen ] ), CLI_OUTPUT_SCRATCH_BUF_LEN - uxLen,
+                                      " %lu", pxHistogram->pulBuckets[ ulBucket ] );
+    }
+
+    pxCIO->print( pcCliScratchBuffer );
+    pxCIO->print( "\r\n" );
+}
+
+/*-----------------------------------------------------------*/
+
+static void vCommand_MqttLat( ConsoleIO_t * pxCIO,
+                              uint32_t ulArgc,
+                              char * ppcArgv[] )
+{
+    bool xBuckets = false;
+
+    if( ( ulArgc == 2 ) && ( strcmp( ppcArgv[ 1 ], "hist" ) == 0 ) )
+    {
+        xBuckets = true;
+    }
+
+    if( ( ulArgc > 2 ) || ( ( ulArgc == 2 ) && !xBuckets ) )
+    {
+        pxCIO->print( "Error: Unrecognized argument: " );
+        pxCIO->print( ppcArgv[ 1 ] );
+        pxCIO->print( "\r\n" );
+    }
+    else
+    {
+        prvPrintTransportStats( pxCIO );
+        prvPrintMetrics( pxCIO );
+
+        /* Commands that were never used are skipped */
+        for( uint32_t ulType = 0; ulType < NUM_COMMANDS; ulType++ )
+        {
+            for( uint32_t ulPhase = 0; ulPhase < MQTT_AGENT_NUM_PHASES; ulPhase++ )
+            {
+                MQTTAgentHistogram_t xHistogram;
+
+                vMqttAgent_GetHistogram( ( MQTTAgentCommandType_t ) ulType, ( MQTTAgentPhase_t ) ulPhase, &xHistogram );
+
+                if( xHistogram.ulCount == 0 )
+                {
+                    /* Empty */
+                }
+                else if( xBuckets )
+                {
+                    prvPrintBuckets( pxCIO, ( MQTTAgentCommandType_t ) ulType, ( MQTTAgentPhase_t ) ulPhase, &xHistogram );
+                }
+                else
+                {
+                    prvPrintSummary( pxCIO, ( MQTTAgentCommandType_t ) ulType, ( MQTTAgentPhase_t ) ulPhase, &xHistogram );
+                }
+            }
+        }
+    }
+}
+
+#else /* MQTT_AGENT_METRICS_ENABLED */
+
+static void vCommand_MqttLat( ConsoleIO_t * pxCIO,
+                              uint32_t ulArgc,
+                              char * ppcArgv[] )
+{
+    ( void ) ulArgc;
+    ( void ) ppcArgv;
+
+    prvPrintTransportStats( pxCIO );
+    pxCIO->print( "MQTT agent metrics are disabled (MQTT_AGENT_METRICS_ENABLED).\r\n" );
+}
+
+#endif /* MQTT_AGENT_METRICS_ENABLED */
@@ -0,0 +1,189 @@
+/*
+ * FreeRTOS STM32 Reference Integration
+ * Copyright (C) 2020-2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "FreeRTOS.h"
+#include "task.h"
+
+#include "cli.h"
+#include "cli_prv.h"
+#include "logging.h"
+
+#include "freertos_command_pool.h"
+#include "mqtt_agent_task.h"
+#include "publish_buffer_pool.h"
+#include "mqtt_journal.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static void prvPrintWindowStats( ConsoleIO_t * pxCIO )
+{
+    MQTTAgentWindowStats_t xStats;
+
+    vMqttAgent_GetWindowStats( &xStats );
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "qos1 window: size %lu, in flight %lu, high water %lu, blocked %lu, rejected %lu\r\n"
+                       "    acked %lu, resent %lu, ack ms avg %lu max %lu\r\n",
+                       xStats.ulWindow,
+                       xStats.ulInFlight,
+                       xStats.ulHighWater,
+                       xStats.ulBlocked,
+                       xStats.ulRejected,
+                       xStats.ulAcked,
+                       xStats.ulResent,
+                       ( xStats.ulAcked > 0 ) ? ( xStats.ulAckMsTotal / xStats.ulAcked ) : 0UL,
+                       xStats.ulAckMsMax );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintPublishBufferStats( ConsoleIO_t * pxCIO )
+{
+    PublishBufferPoolStats_t xStats;
+
+    MqttAgent_GetPublishBufferStats( &xStats );
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "publish buffers: size %lu, in use %lu, high water %lu, exhausted %lu\r\n"
+                       "    submitted %lu, completed %lu, failed %lu\r\n",
+                       xStats.ulSize,
+                       xStats.ulInUse,
+                       xStats.ulHighWater,
+                       xStats.ulExhausted,
+                       xStats.ulSubmitted,
+                       xStats.ulCompleted,
+                       xStats.ulFailed );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintJournalStats( ConsoleIO_t * pxCIO )
+{
+    MqttJournalStats_t xStats;
+
+    vMqttJournal_GetStats( &xStats );
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "journal: live %lu, appended %lu, removed %lu, replayed %lu\r\n"
+                       "    commits %lu, uncommitted %lu, lost %lu, corrupt %lu, tombstones dropped %lu\r\n",
+                       xStats.ulLive,
+                       xStats.ulAppended,
+                       xStats.ulRemoved,
+                       xStats.ulReplayed,
+                       xStats.ulCommits,
+                       xStats.ulUncommitted,
+                       xStats.ulLost,
+                       xStats.ulCorrupt,
+                       xStats.ulTombstonesDropped );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void vCommand_MqttStat( ConsoleIO_t * pxCIO,
+                               uint32_t ulArgc,
+                               char * ppcArgv[] );
+
+const CLI_Command_Definition_t xCommandDef_mqttstat =
+{
+    .pcCommand            = "mqttstat",
+    .pcHelpString         =
+        "mqttstat:\r\n"
+        "    Display MQTT agent resource usage statistics\r\n"
+        "    Usage:\r\n"
+        "    mqttstat\r\n"
+        "        Outputs the command pool size, current and peak usage, the number\r\n"
+        "        of requests that found the pool empty and the time spent waiting\r\n"
+        "        for a free command, followed by the current and peak depth of each\r\n"
+        "        command priority lane.\r\n\n",
+    .pxCommandInterpreter = vCommand_MqttStat
+};
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintCommandPoolStats( ConsoleIO_t * pxCIO )
+{
+    AgentCommandPoolStats_t xStats;
+
+    Agent_GetPoolStats( &xStats );
+
+    ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                       "command pool: size %lu, in use %lu, high water %lu\r\n"
+                       "    exhausted %lu, waits %lu, wait timeouts %lu, wait ms avg %lu max %lu\r\n",
+                       xStats.ulSize,
+                       xStats.ulInUse,
+                       xStats.ulHighWater,
+                       xStats.ulExhausted,
+                       xStats.ulWaits,
+                       xStats.ulWaitTimeouts,
+                       ( xStats.ulWaits > 0 ) ? ( xStats.ulWaitMsTotal / xStats.ulWaits ) : 0UL,
+                       xStats.ulWaitMsMax );
+    pxCIO->print( pcCliScratchBuffer );
+}
+
+/*-----------------------------------------------------------*/
+
+static void prvPrintLaneStats( ConsoleIO_t * pxCIO )
+{
+    static const char * const pcLaneNames[ MQTT_AGENT_NUM_LANES ] = { "control", "normal", "bulk" };
+    MQTTAgentLaneStats_t pxStats[ MQTT_AGENT_NUM_LANES ];
+
+    vMqttAgent_GetLaneStats( pxStats );
+
+    for( size_t uxLane = 0; uxLane < MQTT_AGENT_NUM_LANES; uxLane++ )
+    {
+        ( void ) snprintf( pcCliScratchBuffer, CLI_OUTPUT_SCRATCH_BUF_LEN,
+                           "lane %-7s: depth %lu, high water %lu, enqueued %lu, rejected %lu\r\n",
+                           pcLaneNames[ uxLane ],
+                           pxStats[ uxLane ].ulDepth,
+                           pxStats[ uxLane ].ulHighWater,
+                           pxStats[ uxLane ].ulEnqueued,
+                           pxStats[ uxLane ].ulRejected );
+        pxCIO->print( pcCliScratchBuffer );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+static void vCommand_MqttStat( ConsoleIO_t * pxCIO,
+                               uint32_t ulArgc,
+                               char * ppcArgv[] )
+{
+    if( ulArgc > 1 )
+    {
+        pxCIO->print( "Error: Unrecognized argument: " );
+        pxCIO->print( ppcArgv[ 1 ] );
+        pxCIO->print( "\r\n" );
+    }
+    else
+    {
+        prvPrintCommandPoolStats( pxCIO );
+        prvPrintLaneStats( pxCIO );
+        prvPrintWindowStats( pxCIO );
+        prvPrintPublishBufferStats( pxCIO );
+        prvPrintJournalStats( pxCIO );
+    }
+}
@@ -133,5 +133,8 @@ extern const CLI_Command_Definition_t xCommandDef_reset;
 extern const CLI_Command_Definition_t xCommandDef_uptime;
 extern const CLI_Command_Definition_t xCommandDef_rngtest;
 extern const CLI_Command_Definition_t xCommandDef_assert;
+extern const CLI_Command_Definition_t xCommandDef_moistcal;
+extern const CLI_Command_Definition_t xCommandDef_mqttstat;
+extern const CLI_Command_Definition_t xCommandDef_mqttlat;
 
 #endif /* _CLI_PRIV */
@@ -77,9 +77,12 @@
 /**
  * @brief Dimensions the buffer used to serialize and deserialize MQTT packets.
  * @note Specified in bytes.  Must be large enough to hold the maximum
- * anticipated MQTT payload.
+ * anticipated MQTT payload, except for publishes received through
+ * MqttAgent_SubscribeStreamSync, which are delivered in chunks of this size.
  */
+#ifndef MQTT_AGENT_NETWORK_BUFFER_SIZE
 #define MQTT_AGENT_NETWORK_BUFFER_SIZE               ( 6 * 1024 )
+#endif
 
 
 #define MQTT_AGENT_MAX_EVENT_QUEUE_WAIT_TIME         ( 1 )
@@ -36,6 +36,35 @@ typedef enum KvStoreEnum
     CS_WIFI_SSID,
     CS_WIFI_CREDENTIAL,
     CS_TIME_HWM_S_1970,
+    CS_MOIST_CHANNELS,
+    CS_MOIST_CAL,
+    CS_RPT_MIN_INTERVAL_MS,
+    CS_RPT_HEARTBEAT_MS,
+    CS_RPT_REL_DEADBAND,
+    CS_SOIL_DEADBAND,
+    CS_ENV_DEADBAND,
+    CS_MOTION_DEADBAND,
+    CS_BATCH_MAX_BYTES,
+    CS_BATCH_MAX_AGE_MS,
+    CS_TELEMETRY_FORMAT,
+    CS_IRR_MODE,
+    CS_IRR_SETPOINTS,
+    CS_IRR_HYSTERESIS,
+    CS_IRR_MIN_ON_MS,
+    CS_IRR_MIN_OFF_MS,
+    CS_IRR_MAX_RUN_MS,
+    CS_IRR_KP,
+    CS_IRR_KI,
+    CS_IRR_KD,
+    CS_IRR_WINDOW_MS,
+    CS_SPOOL_MAX_KB,
+    CS_SPOOL_RATE_MS,
+    CS_MQTT_MAX_SUBS,
+    CS_MQTT_MAX_CBS,
+    CS_MQTT_CMD_POOL,
+    CS_MQTT_QOS1_WIN,
+    CS_MQTT_JOURNAL,
+    CS_TLS_SESSION_STORE,
     CS_NUM_KEYS
 } KVStoreKey_t;
 
@@ -48,6 +77,54 @@ typedef enum KvStoreEnum
 #define WIFI_PASSWORD_DFLT    ""
 #define WIFI_SECURITY_DFLT
 
+/* Comma separated list of ADC4 inputs, one per soil moisture probe */
+#define MOIST_CHANNELS_DFLT   "1"
+/* Per probe calibration curves, "reading=moisture,...;..." with moisture in
+ * hundredths of a percent. See moisture_probes.h */
+#define MOIST_CAL_DFLT        ""
+
+/* Report-on-change policy shared by the sensor publishers */
+#define RPT_MIN_INTERVAL_MS_DFLT    1000
+#define RPT_HEARTBEAT_MS_DFLT       ( 15 * 60 * 1000 )
+/* Deadbands are in thousandths: per mille for relative, milli-units for absolute */
+#define RPT_REL_DEADBAND_DFLT       0
+#define SOIL_DEADBAND_DFLT          1000
+#define ENV_DEADBAND_DFLT           500
+#define MOTION_DEADBAND_DFLT        50000
+
+/* Telemetry batches are flushed when either threshold is reached */
+#define BATCH_MAX_BYTES_DFLT        1024
+#define BATCH_MAX_AGE_MS_DFLT       ( 60 * 1000 )
+
+/* 0: JSON, 1: CBOR */
+#define TELEMETRY_FORMAT_DFLT       0
+
+/* Irrigation controller. 0: manual, 1: hysteresis, 2: PID */
+#define IRR_MODE_DFLT               0
+/* Comma separated list of per zone setpoints, in hundredths of a percent */
+#define IRR_SETPOINTS_DFLT          "6000"
+#define IRR_HYSTERESIS_DFLT         1000
+#define IRR_MIN_ON_MS_DFLT          ( 10 * 1000 )
+#define IRR_MIN_OFF_MS_DFLT         ( 10 * 1000 )
+#define IRR_MAX_RUN_MS_DFLT         ( 30 * 60 * 1000 )
+/* PID gains in thousandths */
+#define IRR_KP_DFLT                 100
+#define IRR_KI_DFLT                 0
+#define IRR_KD_DFLT                 0
+#define IRR_WINDOW_MS_DFLT          ( 60 * 1000 )
+
+/* Offline telemetry spool size and minimum interval between replayed records */
+#define SPOOL_MAX_KB_DFLT           64
+#define SPOOL_RATE_MS_DFLT          2000
+
+/* MQTT subscription manager and command pool capacity, applied when the MQTT agent starts */
+#define MQTT_MAX_SUBS_DFLT          10
+#define MQTT_MAX_CBS_DFLT           10
+#define MQTT_CMD_POOL_DFLT          32
+#define MQTT_QOS1_WIN_DFLT          16
+#define MQTT_JOURNAL_DFLT           0
+#define TLS_SESSION_STORE_DFLT      0
+
 /* Array to map between strings and KVStoreKey_t IDs */
 #define KV_STORE_STRINGS   \
     {                      \
@@ -56,17 +133,75 @@ typedef enum KvStoreEnum
         "mqtt_port",       \
         "wifi_ssid",       \
         "wifi_credential", \
-        "time_hwm"         \
+        "time_hwm",        \
+        "moist_channels",  \
+        "moist_cal",       \
+        "rpt_min_ms",      \
+        "rpt_hb_ms",       \
+        "rpt_rel_db",      \
+        "soil_db",         \
+        "env_db",          \
+        "motion_db",       \
+        "batch_max_b",     \
+        "batch_age_ms",    \
+        "tlm_format",      \
+        "irr_mode",        \
+        "irr_setpoints",   \
+        "irr_hyst",        \
+        "irr_min_on_ms",   \
+        "irr_min_off_ms",  \
+        "irr_max_run_ms",  \
+        "irr_kp",          \
+        "irr_ki",          \
+        "irr_kd",          \
+        "irr_window_ms",   \
+        "spool_max_kb",    \
+        "spool_rate_ms",   \
+        "mqtt_max_subs",   \
+        "mqtt_max_cbs",    \
+        "mqtt_cmd_pool",   \
+        "mqtt_qos1_win",   \
+        "mqtt_journal",    \
+        "tls_sess_store"   \
     }
 
-#define KV_STORE_DEFAULTS                                                          \
-    {                                                                              \
-        KV_DFLT( KV_TYPE_STRING, THING_NAME_DFLT ),    /* CS_CORE_THING_NAME */    \
-        KV_DFLT( KV_TYPE_STRING, MQTT_ENDPOINT_DFLT ), /* CS_CORE_MQTT_ENDPOINT */ \
-        KV_DFLT( KV_TYPE_UINT32, MQTT_PORT_DFLT ),     /* CS_CORE_MQTT_PORT */     \
-        KV_DFLT( KV_TYPE_STRING, WIFI_SSID_DFLT ),     /* CS_WIFI_SSID */          \
-        KV_DFLT( KV_TYPE_STRING, WIFI_PASSWORD_DFLT ), /* CS_WIFI_CREDENTIAL */    \
-        KV_DFLT( KV_TYPE_UINT32, 0 ),                  /* CS_TIME_HWM_S_1970 */    \
+#define KV_STORE_DEFAULTS                                                                 \
+    {                                                                                     \
+        KV_DFLT( KV_TYPE_STRING, THING_NAME_DFLT ),          /* CS_CORE_THING_NAME */     \
+        KV_DFLT( KV_TYPE_STRING, MQTT_ENDPOINT_DFLT ),       /* CS_CORE_MQTT_ENDPOINT */  \
+        KV_DFLT( KV_TYPE_UINT32, MQTT_PORT_DFLT ),           /* CS_CORE_MQTT_PORT */      \
+        KV_DFLT( KV_TYPE_STRING, WIFI_SSID_DFLT ),           /* CS_WIFI_SSID */           \
+        KV_DFLT( KV_TYPE_STRING, WIFI_PASSWORD_DFLT ),       /* CS_WIFI_CREDENTIAL */     \
+        KV_DFLT( KV_TYPE_UINT32, 0 ),                        /* CS_TIME_HWM_S_1970 */     \
+        KV_DFLT( KV_TYPE_STRING, MOIST_CHANNELS_DFLT ),      /* CS_MOIST_CHANNELS */      \
+        KV_DFLT( KV_TYPE_STRING, MOIST_CAL_DFLT ),           /* CS_MOIST_CAL */           \
+        KV_DFLT( KV_TYPE_UINT32, RPT_MIN_INTERVAL_MS_DFLT ), /* CS_RPT_MIN_INTERVAL_MS */ \
+        KV_DFLT( KV_TYPE_UINT32, RPT_HEARTBEAT_MS_DFLT ),    /* CS_RPT_HEARTBEAT_MS */    \
+        KV_DFLT( KV_TYPE_UINT32, RPT_REL_DEADBAND_DFLT ),    /* CS_RPT_REL_DEADBAND */    \
+        KV_DFLT( KV_TYPE_UINT32, SOIL_DEADBAND_DFLT ),       /* CS_SOIL_DEADBAND */       \
+        KV_DFLT( KV_TYPE_UINT32, ENV_DEADBAND_DFLT ),        /* CS_ENV_DEADBAND */        \
+        KV_DFLT( KV_TYPE_UINT32, MOTION_DEADBAND_DFLT ),     /* CS_MOTION_DEADBAND */     \
+        KV_DFLT( KV_TYPE_UINT32, BATCH_MAX_BYTES_DFLT ),     /* CS_BATCH_MAX_BYTES */     \
+        KV_DFLT( KV_TYPE_UINT32, BATCH_MAX_AGE_MS_DFLT ),    /* CS_BATCH_MAX_AGE_MS */    \
+        KV_DFLT( KV_TYPE_UINT32, TELEMETRY_FORMAT_DFLT ),    /* CS_TELEMETRY_FORMAT */    \
+        KV_DFLT( KV_TYPE_UINT32, IRR_MODE_DFLT ),            /* CS_IRR_MODE */            \
+        KV_DFLT( KV_TYPE_STRING, IRR_SETPOINTS_DFLT ),       /* CS_IRR_SETPOINTS */       \
+        KV_DFLT( KV_TYPE_UINT32, IRR_HYSTERESIS_DFLT ),      /* CS_IRR_HYSTERESIS */      \
+        KV_DFLT( KV_TYPE_UINT32, IRR_MIN_ON_MS_DFLT ),       /* CS_IRR_MIN_ON_MS */       \
+        KV_DFLT( KV_TYPE_UINT32, IRR_MIN_OFF_MS_DFLT ),      /* CS_IRR_MIN_OFF_MS */      \
+        KV_DFLT( KV_TYPE_UINT32, IRR_MAX_RUN_MS_DFLT ),      /* CS_IRR_MAX_RUN_MS */      \
+        KV_DFLT( KV_TYPE_UINT32, IRR_KP_DFLT ),              /* CS_IRR_KP */              \
+        KV_DFLT( KV_TYPE_UINT32, IRR_KI_DFLT ),              /* CS_IRR_KI */              \
+        KV_DFLT( KV_TYPE_UINT32, IRR_KD_DFLT ),              /* CS_IRR_KD */              \
+        KV_DFLT( KV_TYPE_UINT32, IRR_WINDOW_MS_DFLT ),       /* CS_IRR_WINDOW_MS */       \
+        KV_DFLT( KV_TYPE_UINT32, SPOOL_MAX_KB_DFLT ),        /* CS_SPOOL_MAX_KB */        \
+        KV_DFLT( KV_TYPE_UINT32, SPOOL_RATE_MS_DFLT ),       /* CS_SPOOL_RATE_MS */       \
+        KV_DFLT( KV_TYPE_UINT32, MQTT_MAX_SUBS_DFLT ),       /* CS_MQTT_MAX_SUBS */       \
+        KV_DFLT( KV_TYPE_UINT32, MQTT_MAX_CBS_DFLT ),        /* CS_MQTT_MAX_CBS */        \
+        KV_DFLT( KV_TYPE_UINT32, MQTT_CMD_POOL_DFLT ),       /* CS_MQTT_CMD_POOL */       \
+        KV_DFLT( KV_TYPE_UINT32, MQTT_QOS1_WIN_DFLT ),       /* CS_MQTT_QOS1_WIN */       \
+        KV_DFLT( KV_TYPE_UINT32, MQTT_JOURNAL_DFLT ),        /* CS_MQTT_JOURNAL */        \
+        KV_DFLT( KV_TYPE_UINT32, TLS_SESSION_STORE_DFLT ),   /* CS_TLS_SESSION_STORE */   \
     }
 
 #endif /* _KVSTORE_CONFIG_H */
@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file irrigation_ctrl.h
+ * @brief Local closed-loop irrigation controller.
+ *
+ * Each zone drives one valve from a soil moisture reading in percent. The
+ * controller is stepped once per sample period and runs entirely on the
+ * device, so irrigation continues while the cloud connection is down.
+ *
+ * Modes:
+ * - IRRIGATION_MODE_MANUAL: the valve follows the remote request (shadow
+ *   powerOn) but is closed once moisture rises above setpoint + hysteresis.
+ * - IRRIGATION_MODE_HYSTERESIS: the valve opens below setpoint - hysteresis
+ *   and closes above setpoint + hysteresis.
+ * - IRRIGATION_MODE_PID: a PID loop on the moisture error sets the fraction
+ *   of each ulPidWindowMs window during which the valve is open.
+ *
+ * In every mode the valve stays in each state for at least ulMinOnMs /
+ * ulMinOffMs, and is forced closed after ulMaxRunMs of continuous running.
+ * A cutoff stays latched until the demand for water goes away, so a failed
+ * probe or an empty supply cannot keep the valve cycling. A missing reading
+ * is treated as no demand.
+ *
+ * The controller has no dependency on the HAL and takes the time as a
+ * parameter so it can be driven by a simulated soil model on a host.
+ */
+#ifndef _IRRIGATION_CTRL_H
+#define _IRRIGATION_CTRL_H
+
+#include "FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define IRRIGATION_MAX_ZONES    4U
+
+typedef enum
+{
+    IRRIGATION_MODE_MANUAL = 0,
+    IRRIGATION_MODE_HYSTERESIS = 1,
+    IRRIGATION_MODE_PID = 2,
+    IRRIGATION_MODE_MAX
+} IrrigationMode_t;
+
+typedef struct
+{
+    IrrigationMode_t xMode;
+    float fSetpoint;   /* Target moisture in percent */
+    float fHysteresis; /* Half width of the band around the setpoint, in percent */
+    uint32_t ulMinOnMs;
+    uint32_t ulMinOffMs;
+    uint32_t ulMaxRunMs; /* 0 disables the cutoff */
+    float fKp;           /* Window fraction per percent of error */
+    float fKi;           /* Window fraction per percent second of error */
+    float fKd;           /* Window fraction per percent per second */
+    uint32_t ulPidWindowMs;
+} IrrigationConfig_t;
+
+typedef struct
+{
+    IrrigationConfig_t xConfig;
+    BaseType_t xValveOn;
+    BaseType_t xManualRequest;
+    BaseType_t xCutoff;
+    BaseType_t xStarted;
+    uint32_t ulLastSwitchMs;
+    uint32_t ulLastStepMs;
+    float fIntegral;
+    float fLastMoisture;
+    BaseType_t xHasLastMoisture;
+    uint32_t ulWindowStartMs;
+    uint32_t ulWindowOnMs;
+    uint32_t ulCutoffs;
+} IrrigationZone_t;
+
+/**
+ * @brief Called from xIrrigation_Step in the stepping task when a valve opens or closes.
+ */
+typedef void ( * IrrigationValveHook_t )( size_t uxZone,
+                                          BaseType_t xValveOn );
+
+/**
+ * @brief Return the statically allocated state of zone uxZone.
+ */
+IrrigationZone_t * pxIrrigation_GetZone( size_t uxZone );
+
+void vIrrigation_Init( IrrigationZone_t * pxZone,
+                       const IrrigationConfig_t * pxConfig );
+
+/**
+ * @brief Replace the configuration. The PID state is reset when the mode changes.
+ */
+void vIrrigation_SetConfig( IrrigationZone_t * pxZone,
+                            const IrrigationConfig_t * pxConfig );
+
+/**
+ * @brief Fill in the configuration of zone uxZone from KVStore.
+ */
+void vIrrigation_LoadConfig( IrrigationConfig_t * pxConfig,
+                             size_t uxZone );
+
+/**
+ * @brief Set the remote on/off request used in IRRIGATION_MODE_MANUAL.
+ * May be called from any task.
+ */
+void vIrrigation_SetManualRequest( IrrigationZone_t * pxZone,
+                                   BaseType_t xOn );
+
+/**
+ * @brief Run one control step.
+ *
+ * @param[in] pfMoisture Current moisture in percent, or NULL if no valid reading.
+ * @param[in] ulNowMs Monotonic time in milliseconds.
+ *
+ * @return pdTRUE if the valve should be open.
+ */
+BaseType_t xIrrigation_Step( IrrigationZone_t * pxZone,
+                             const float * pfMoisture,
+                             uint32_t ulNowMs );
+
+BaseType_t xIrrigation_IsValveOn( const IrrigationZone_t * pxZone );
+
+/**
+ * @brief Register the single valve change hook, or NULL to remove it.
+ */
+void vIrrigation_SetValveHook( IrrigationValveHook_t xHook );
+
+#endif /* _IRRIGATION_CTRL_H */
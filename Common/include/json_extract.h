@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file json_extract.h
+ * @brief Extract several values from a JSON document in a single pass.
+ *
+ * The wanted values are described by a constant table of key paths. The
+ * document is validated once and walked with JSON_Iterate, descending only
+ * into objects on the path to a wanted key and stopping once every key was
+ * resolved. Searching with JSON_Search instead rescans the document from the
+ * start for every key.
+ *
+ * Numbers are converted in place without relying on a terminator after the
+ * value, so values can be read straight out of an MQTT payload, e.g.
+ *
+ *     static const JsonExtractKey_t xKeys[] =
+ *     {
+ *         { NULL,    "version", JSON_EXTRACT_UINT },
+ *         { "state", "powerOn", JSON_EXTRACT_BOOL }
+ *     };
+ *     JsonExtractValue_t pxValues[ 2 ];
+ *     uint32_t ulFound = 0;
+ *
+ *     if( ( xJsonExtract( pcPayload, uxPayloadLen, xKeys, 2, pxValues, &ulFound ) == JSONSuccess ) &&
+ *         ( ( ulFound & ( 1U << 1 ) ) != 0 ) )
+ *     {
+ *         ... pxValues[ 1 ].ulValue is 0 or 1 ...
+ *     }
+ */
+#ifndef _JSON_EXTRACT_H
+#define _JSON_EXTRACT_H
+
+#include "FreeRTOS.h"
+#include "core_json.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Limited by the width of the found mask */
+#define JSON_EXTRACT_MAX_KEYS     32U
+
+/* Most objects on the path to a key, including the key itself */
+#define JSON_EXTRACT_MAX_DEPTH    4U
+
+typedef enum
+{
+    JSON_EXTRACT_UINT,   /* Unsigned decimal number into ulValue */
+    JSON_EXTRACT_DIGITS, /* String of decimal digits into ulValue, e.g. a client token */
+    JSON_EXTRACT_BOOL,   /* true, false or a number into ulValue as 0 or 1 */
+    JSON_EXTRACT_STRING, /* String, not terminated */
+    JSON_EXTRACT_ANY     /* Any value including objects and arrays */
+} JsonExtractType_t;
+
+typedef struct
+{
+    const char * pcObject; /* Dotted path of the enclosing object, NULL for the top level */
+    const char * pcKey;
+    JsonExtractType_t xType;
+} JsonExtractKey_t;
+
+typedef struct
+{
+    const char * pcValue; /* Into the document, quotes stripped from strings; NULL if not present */
+    size_t uxValueLen;
+    JSONTypes_t xJsonType;
+    uint32_t ulValue;     /* JSON_EXTRACT_UINT, JSON_EXTRACT_DIGITS and JSON_EXTRACT_BOOL */
+} JsonExtractValue_t;
+
+/**
+ * @brief Validate pcDocument and fill pxValues[ n ] for every pxKeys[ n ].
+ *
+ * @param[out] pulFound Bit n is set if pxKeys[ n ] is present with the
+ * expected type. A key that is present with another type or out of range
+ * has pcValue set and its bit clear.
+ *
+ * @return JSONSuccess if the document is valid, whether or not keys were found.
+ */
+JSONStatus_t xJsonExtract( const char * pcDocument,
+                           size_t uxDocumentLen,
+                           const JsonExtractKey_t * pxKeys,
+                           size_t uxNumKeys,
+                           JsonExtractValue_t * pxValues,
+                           uint32_t * pulFound );
+
+/**
+ * @brief Like xJsonExtract for an object taken from a validated document,
+ * e.g. a JSON_EXTRACT_ANY value. Paths are relative to that object.
+ *
+ * @return The found mask.
+ */
+uint32_t ulJsonExtract_Validated( const char * pcObject,
+                                  size_t uxObjectLen,
+                                  const JsonExtractKey_t * pxKeys,
+                                  size_t uxNumKeys,
+                                  JsonExtractValue_t * pxValues );
+
+#endif /* _JSON_EXTRACT_H */
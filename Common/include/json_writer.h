@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file json_writer.h
+ * @brief Small streaming JSON writer for building MQTT payloads in place.
+ *
+ * The writer appends directly into a caller supplied buffer without heap
+ * allocation or printf. Commas between members are inserted automatically.
+ * Every emitter is bounds checked; once the buffer overflows the writer stops
+ * writing and uxJsonWriter_Finish returns 0, so callers only need to check
+ * the result once at the end.
+ *
+ * Fractional values are emitted from fixed point integers, e.g.
+ * vJsonWriter_Fixed( &xWriter, "t", 2345, 2 ) emits "t":23.45
+ */
+#ifndef _JSON_WRITER_H
+#define _JSON_WRITER_H
+
+#include "FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum nesting depth of objects and arrays */
+#define JSON_WRITER_MAX_DEPTH    8U
+
+typedef struct
+{
+    char * pcBuffer;
+    size_t uxBufferLen;
+    size_t uxLength;
+    uint8_t ucDepth;
+    uint8_t pucMemberCount[ JSON_WRITER_MAX_DEPTH + 1 ];
+    BaseType_t xOverflow;
+} JsonWriter_t;
+
+void vJsonWriter_Init( JsonWriter_t * pxWriter,
+                       char * pcBuffer,
+                       size_t uxBufferLen );
+
+/*
+ * For all emitters, pcKey is the member name when inside an object and must be
+ * NULL at the top level or inside an array.
+ */
+
+void vJsonWriter_BeginObject( JsonWriter_t * pxWriter,
+                              const char * pcKey );
+
+void vJsonWriter_EndObject( JsonWriter_t * pxWriter );
+
+void vJsonWriter_BeginArray( JsonWriter_t * pxWriter,
+                             const char * pcKey );
+
+void vJsonWriter_EndArray( JsonWriter_t * pxWriter );
+
+void vJsonWriter_Int( JsonWriter_t * pxWriter,
+                      const char * pcKey,
+                      int32_t lValue );
+
+void vJsonWriter_UInt( JsonWriter_t * pxWriter,
+                       const char * pcKey,
+                       uint32_t ulValue );
+
+/**
+ * @brief Emit lValue / 10^ucDecimals as a decimal number.
+ */
+void vJsonWriter_Fixed( JsonWriter_t * pxWriter,
+                        const char * pcKey,
+                        int32_t lValue,
+                        uint8_t ucDecimals );
+
+/**
+ * @brief Emit an unsigned integer as a string, zero padded to ucMinDigits.
+ */
+void vJsonWriter_UIntString( JsonWriter_t * pxWriter,
+                             const char * pcKey,
+                             uint32_t ulValue,
+                             uint8_t ucMinDigits );
+
+/**
+ * @brief Emit a string value, escaping quotes, backslashes and control characters.
+ */
+void vJsonWriter_String( JsonWriter_t * pxWriter,
+                         const char * pcKey,
+                         const char * pcValue );
+
+/**
+ * @brief Emit an already encoded JSON value verbatim.
+ */
+void vJsonWriter_Raw( JsonWriter_t * pxWriter,
+                      const char * pcKey,
+                      const char * pcJson,
+                      size_t uxJsonLen );
+
+/**
+ * @brief NUL terminate the document.
+ *
+ * @return The document length excluding the terminator, or 0 if the buffer
+ * was too small or the objects and arrays were not balanced.
+ */
+size_t uxJsonWriter_Finish( JsonWriter_t * pxWriter );
+
+#endif /* _JSON_WRITER_H */
@@ -28,6 +28,8 @@
 #ifndef _MBEDTLS_TRANSPORT_H
 #define _MBEDTLS_TRANSPORT_H
 
+#include "FreeRTOS.h"
+
 #include "mbedtls_error_utils.h"
 #include "transport_interface.h"
 
@@ -65,6 +67,12 @@
 #define SOCK_OK    0
 #endif
 
+/* Size of the per-connection buffer used by mbedtls_transport_writev to
+ * gather small vectors into a single TLS record. */
+#ifndef MBEDTLS_TRANSPORT_WRITEV_BUF_LEN
+#define MBEDTLS_TRANSPORT_WRITEV_BUF_LEN    1024U
+#endif
+
 
 /* Public Types */
 typedef enum
@@ -97,6 +105,35 @@ typedef enum TlsTransportStatus
 
 typedef void ( * GenericCallback_t )( void * );
 
+/* One buffer of a vectored send */
+typedef struct
+{
+    const void * pvBase;
+    size_t uxLen;
+} TlsOutVector_t;
+
+/* Handshake counters, aggregated over all transport contexts */
+typedef struct
+{
+    uint32_t ulHandshakes;      /* Successful handshakes */
+    uint32_t ulResumed;         /* Successful handshakes that resumed a cached session */
+    uint32_t ulResumeRejected;  /* Cached session offered but a full handshake was needed */
+    uint32_t ulFailures;        /* Failed handshakes */
+    uint32_t ulLastMs;          /* Duration of the last successful handshake */
+    uint32_t ulFullMsTotal;     /* Sum of the durations of full handshakes */
+    uint32_t ulResumedMsTotal;  /* Sum of the durations of resumed handshakes */
+    uint32_t ulMsMax;           /* Longest successful handshake */
+} TlsHandshakeStats_t;
+
+/* Send stall counters, aggregated over all transport contexts */
+typedef struct
+{
+    uint32_t ulStalls;          /* Sends that had to wait for the socket to become writable */
+    uint32_t ulTimeouts;        /* Sends that gave up when the send timeout expired */
+    uint32_t ulStallMsTotal;    /* Sum of the time spent waiting for the socket */
+    uint32_t ulStallMsMax;      /* Longest wait of a single send */
+} TlsSendStats_t;
+
 /*-----------------------------------------------------------*/
 
 /**
@@ -125,6 +162,15 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
                                            GenericCallback_t pxCallback,
                                            void * pvCtx );
 
+/**
+ * @brief Check whether a receive would return data right away, either
+ * decrypted bytes held by mbedtls or unread data on the socket.
+ *
+ * The receive ready callback is edge triggered, so a reader that stops before
+ * consuming everything mbedtls has buffered uses this to schedule another read.
+ */
+BaseType_t mbedtls_transport_recvpending( NetworkContext_t * pxNetworkContext );
+
 
 /**
  * @brief Create a TLS connection
@@ -134,7 +180,8 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
  * @param[in] pHostName The hostname of the remote endpoint.
  * @param[in] port The destination port.
  * @param[in] receiveTimeoutMs Receive socket timeout.
- * @param[in] sendTimeoutMs Send socket timeout.
+ * @param[in] sendTimeoutMs Send socket timeout. Also bounds the time a send
+ * waits for a full socket send buffer to drain, 0 waits without limit.
  *
  * @return #TLS_TRANSPORT_SUCCESS, #TLS_TRANSPORT_INSUFFICIENT_MEMORY, #TLS_TRANSPORT_INVALID_CREDENTIALS,
  * #TLS_TRANSPORT_HANDSHAKE_FAILED, #TLS_TRANSPORT_INTERNAL_ERROR, or #TLS_TRANSPORT_CONNECT_FAILURE.
@@ -145,6 +192,41 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
                                                 uint32_t ulRecvTimeoutMs,
                                                 uint32_t ulSendTimeoutMs );
 
+/**
+ * @brief Copy the handshake counters of all transport contexts.
+ *
+ * After a successful handshake, the negotiated session is kept by the context
+ * and offered to the server on the next mbedtls_transport_connect call, so a
+ * reconnect only needs an abbreviated handshake while the server still
+ * accepts the session id or session ticket.
+ */
+void mbedtls_transport_gethandshakestats( TlsHandshakeStats_t * pxStats );
+
+/**
+ * @brief Copy the send stall counters of all transport contexts.
+ *
+ * When the socket send buffer is full, a send waits for the socket to become
+ * writable for at most the send timeout given to mbedtls_transport_connect.
+ */
+void mbedtls_transport_getsendstats( TlsSendStats_t * pxStats );
+
+#ifdef MBEDTLS_TRANSPORT_PSA
+
+/**
+ * @brief Persist the cached TLS session in PSA protected storage.
+ *
+ * When xPersist is pdTRUE, a session previously stored under xSessionUid is
+ * loaded for use by the next connect and every new session is written back.
+ * When xPersist is pdFALSE, any session stored under xSessionUid is removed.
+ *
+ * @return #TLS_TRANSPORT_SUCCESS or #TLS_TRANSPORT_INVALID_PARAMETER.
+ */
+TlsTransportStatus_t mbedtls_transport_setsessionstorage( NetworkContext_t * pxNetworkContext,
+                                                          psa_storage_uid_t xSessionUid,
+                                                          BaseType_t xPersist );
+
+#endif /* MBEDTLS_TRANSPORT_PSA */
+
 /**
  * @brief Sets the socket option for the underlying socket connection.
  *
@@ -196,6 +278,25 @@ int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
                                 const void * pBuffer,
                                 size_t uxBytesToSend );
 
+/**
+ * @brief Sends several buffers over an established TLS connection.
+ *
+ * Vectors smaller than MBEDTLS_TRANSPORT_WRITEV_BUF_LEN are gathered into
+ * one TLS record instead of one record per buffer, saving the record header,
+ * explicit IV and MAC of each extra record.
+ *
+ * A timeout may leave part of the vectors unsent. The rest of the same data
+ * must then be passed again starting at the returned offset, since mbedtls
+ * may hold a partly sent record that starts there.
+ *
+ * @return Number of bytes (> 0) sent, possibly less than the total;
+ * 0 if the socket times out before any byte was sent;
+ * else a negative value to represent error.
+ */
+int32_t mbedtls_transport_writev( NetworkContext_t * pxNetworkContext,
+                                  const TlsOutVector_t * pxVectors,
+                                  size_t uxVectorCount );
+
 
 #ifdef MBEDTLS_TRANSPORT_PKCS11
 extern mbedtls_pk_info_t mbedtls_pkcs11_pk_ecdsa;
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file moisture_probes.h
+ * @brief Soil moisture probe set configuration and calibration.
+ *
+ * Each probe is an ADC4 input plus a piecewise linear calibration curve of up
+ * to MOIST_CAL_MAX_POINTS (raw reading, moisture) points. The probe list is
+ * read from the "moist_channels" KVStore key and the curves from "moist_cal":
+ *     <reading>=<moisture>,<reading>=<moisture>,...;<next probe>
+ * with moisture in hundredths of a percent. The whole string must fit in one
+ * KVStore value, which limits the total number of points. The older "dry:wet,dry:wet" form,
+ * one pair per probe, is still accepted. Probes with fewer than two points use
+ * the default dry / wet curve.
+ *
+ * The slope of every segment is computed in fixed point when the curves are
+ * loaded, so converting a reading is a table lookup, a multiply and a shift.
+ */
+#ifndef _MOISTURE_PROBES_H
+#define _MOISTURE_PROBES_H
+
+#include "FreeRTOS.h"
+#include "sample_source.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define MOIST_PROBES_MAX              SAMPLE_SOURCE_MAX_CHANNELS
+
+#define MOIST_CAL_MAX_POINTS          6U
+
+/* Moisture values are in hundredths of a percent */
+#define MOIST_MOISTURE_SCALE          100U
+#define MOIST_MOISTURE_MAX            ( 100U * MOIST_MOISTURE_SCALE )
+
+/* Fractional bits of the per segment slopes */
+#define MOIST_CAL_SLOPE_FRAC_BITS     16U
+
+/* Points closer than this many counts replace each other */
+#define MOIST_CAL_MIN_SPACING         8U
+
+/* Raw readings used when a probe has no calibration curve */
+#define MOIST_PROBE_DRY_READING_DFLT  1750U
+#define MOIST_PROBE_WET_READING_DFLT  1000U
+
+typedef struct
+{
+    uint16_t usReading;
+    uint16_t usMoisture;
+} MoistCalPoint_t;
+
+/**
+ * @brief Calibration points sorted by ascending raw reading.
+ */
+typedef struct
+{
+    size_t uxNumPoints;
+    MoistCalPoint_t xPoints[ MOIST_CAL_MAX_POINTS ];
+} MoistCalCurve_t;
+
+typedef struct
+{
+    uint32_t ulAdcInput;
+    MoistCalCurve_t xCurve;
+    int32_t plSlopes[ MOIST_CAL_MAX_POINTS - 1 ];
+} MoistProbe_t;
+
+typedef struct
+{
+    size_t uxNumProbes;
+    MoistProbe_t xProbes[ MOIST_PROBES_MAX ];
+} MoistProbeSet_t;
+
+/**
+ * @brief Load the probe set and its calibration from KVStore.
+ *
+ * @return pdTRUE if at least one probe is configured.
+ */
+BaseType_t xMoistProbes_Load( MoistProbeSet_t * pxProbeSet );
+
+/**
+ * @brief Reload only the calibration curves of an already loaded probe set.
+ */
+void vMoistProbes_LoadCalibration( MoistProbeSet_t * pxProbeSet );
+
+/**
+ * @brief Convert a raw reading to moisture in hundredths of a percent,
+ * clamped to 0..MOIST_MOISTURE_MAX. Readings outside the curve take the value
+ * of the nearest end point.
+ */
+uint16_t usMoistProbes_ToMoisture( const MoistProbe_t * pxProbe,
+                                   uint16_t usReading );
+
+/**
+ * @brief Read the stored curves without substituting defaults.
+ *
+ * @return The number of probes with an entry in "moist_cal".
+ */
+size_t uxMoistProbes_ReadCurves( MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ] );
+
+/**
+ * @brief Store the curves in KVStore, commit them and notify the soil
+ * moisture task that the calibration changed.
+ *
+ * @return pdFALSE if the encoded curves do not fit in a KVStore value or
+ * could not be saved.
+ */
+BaseType_t xMoistProbes_WriteCurves( const MoistCalCurve_t pxCurves[ MOIST_PROBES_MAX ],
+                                     size_t uxNumCurves );
+
+/**
+ * @brief Insert a point, replacing any point within MOIST_CAL_MIN_SPACING counts.
+ *
+ * @return pdFALSE if the curve is full or the moisture is out of range.
+ */
+BaseType_t xMoistCal_AddPoint( MoistCalCurve_t * pxCurve,
+                               uint16_t usReading,
+                               uint16_t usMoisture );
+
+/**
+ * @brief Incremented by every xMoistProbes_WriteCurves call.
+ */
+uint32_t ulMoistProbes_CalibrationVersion( void );
+
+/**
+ * @brief Latest filtered raw reading of each probe, published by the soil
+ * moisture task so calibration points can be captured from the CLI.
+ */
+void vMoistProbes_SetLastReading( size_t uxProbe,
+                                  uint16_t usReading );
+
+BaseType_t xMoistProbes_GetLastReading( size_t uxProbe,
+                                        uint16_t * pusReading );
+
+#endif /* _MOISTURE_PROBES_H */
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file report_policy.h
+ * @brief Report-on-change policy for periodic sensor telemetry.
+ *
+ * A sensor task samples at its own rate and asks the policy whether the latest
+ * values are worth publishing. A report is due when:
+ * - nothing has been reported yet, or
+ * - the maximum silence (heartbeat) interval has elapsed, or
+ * - any value moved outside its deadband and the minimum interval has elapsed.
+ *
+ * A value is outside the deadband when it differs from the last reported value
+ * by more than the absolute deadband or by more than the relative deadband
+ * times the last reported magnitude. A zero deadband term is ignored; when both
+ * are zero any change counts.
+ */
+#ifndef _REPORT_POLICY_H
+#define _REPORT_POLICY_H
+
+#include "FreeRTOS.h"
+#include "kvstore.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPORT_POLICY_MAX_VALUES    16U
+
+typedef struct
+{
+    float fAbsDeadband;
+    float fRelDeadband;
+    uint32_t ulMinIntervalMs;
+    uint32_t ulMaxSilenceMs;
+} ReportPolicyConfig_t;
+
+typedef struct
+{
+    ReportPolicyConfig_t xConfig;
+    float pfLastReported[ REPORT_POLICY_MAX_VALUES ];
+    size_t uxNumValues;
+    TickType_t xLastReportTick;
+    BaseType_t xHasReported;
+    uint32_t ulSuppressed;
+} ReportPolicy_t;
+
+void vReportPolicy_Init( ReportPolicy_t * pxPolicy,
+                         const ReportPolicyConfig_t * pxConfig,
+                         size_t uxNumValues );
+
+/**
+ * @brief Replace the policy configuration without losing the last reported state.
+ */
+void vReportPolicy_SetConfig( ReportPolicy_t * pxPolicy,
+                              const ReportPolicyConfig_t * pxConfig );
+
+/**
+ * @brief Fill in a configuration from KVStore.
+ *
+ * The minimum interval, heartbeat and relative deadband are shared by all
+ * publishers. The absolute deadband is read from xAbsDeadbandKey and is stored
+ * in thousandths of the publisher's unit.
+ */
+void vReportPolicy_LoadConfig( ReportPolicyConfig_t * pxConfig,
+                               KVStoreKey_t xAbsDeadbandKey );
+
+/**
+ * @brief Decide whether pfValues should be published now.
+ */
+BaseType_t xReportPolicy_ShouldReport( ReportPolicy_t * pxPolicy,
+                                       const float * pfValues );
+
+/**
+ * @brief Record that pfValues were successfully published.
+ */
+void vReportPolicy_Reported( ReportPolicy_t * pxPolicy,
+                             const float * pfValues );
+
+#endif /* _REPORT_POLICY_H */
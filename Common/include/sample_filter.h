@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file sample_filter.h
+ * @brief Decimating median + first order IIR filter for raw ADC samples.
+ *
+ * Every SAMPLE_FILTER_MEDIAN_LEN raw samples are reduced to their median, which
+ * rejects impulse noise, and the median is then fed through a fixed point
+ * exponential moving average:
+ *     y += ( x - y ) >> ucIirShift
+ * The filter has no dependency on the HAL so it can be exercised on a host.
+ */
+#ifndef _SAMPLE_FILTER_H
+#define _SAMPLE_FILTER_H
+
+#include "FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Must be odd */
+#ifndef SAMPLE_FILTER_MEDIAN_LEN
+#define SAMPLE_FILTER_MEDIAN_LEN    7U
+#endif
+
+/* Fractional bits kept in the IIR accumulator */
+#define SAMPLE_FILTER_FRAC_BITS     8U
+
+typedef struct
+{
+    uint16_t pusWindow[ SAMPLE_FILTER_MEDIAN_LEN ];
+    size_t uxWindowFill;
+    int32_t lIirState;
+    uint8_t ucIirShift;
+    BaseType_t xPrimed;
+    uint32_t ulOutputCount;
+} SampleFilter_t;
+
+void vSampleFilter_Init( SampleFilter_t * pxFilter,
+                         uint8_t ucIirShift );
+
+/**
+ * @brief Push a single raw sample into the filter.
+ *
+ * @return pdTRUE if a new decimated output was produced and written to pusOut.
+ */
+BaseType_t xSampleFilter_Push( SampleFilter_t * pxFilter,
+                               uint16_t usSample,
+                               uint16_t * pusOut );
+
+/**
+ * @brief Push a block of raw samples into the filter.
+ *
+ * @return The number of decimated outputs produced. The most recent one is
+ * written to pusOut.
+ */
+size_t uxSampleFilter_PushBlock( SampleFilter_t * pxFilter,
+                                 const uint16_t * pusSamples,
+                                 size_t uxNumSamples,
+                                 uint16_t * pusOut );
+
+/**
+ * @brief Return the current filter output without pushing a new sample.
+ */
+uint16_t usSampleFilter_Value( const SampleFilter_t * pxFilter );
+
+#endif /* _SAMPLE_FILTER_H */
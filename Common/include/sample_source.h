@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file sample_source.h
+ * @brief Abstract interface for a stream of raw ADC samples.
+ *
+ * Sensor tasks consume raw samples through this interface rather than touching
+ * the ADC directly, so the same filtering code can be driven by the DMA backed
+ * ADC4 source on target or by a synthetic trace on a host build.
+ */
+#ifndef _SAMPLE_SOURCE_H
+#define _SAMPLE_SOURCE_H
+
+#include "FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Maximum number of channels interleaved in one frame */
+#define SAMPLE_SOURCE_MAX_CHANNELS    8U
+
+typedef struct SampleSource SampleSource_t;
+
+struct SampleSource
+{
+    /**
+     * @brief Start background acquisition. Samples become available to the
+     * calling task through uxRead.
+     */
+    BaseType_t ( * xStart )( SampleSource_t * pxSource );
+
+    /**
+     * @brief Stop background acquisition.
+     */
+    void ( * vStop )( SampleSource_t * pxSource );
+
+    /**
+     * @brief Copy up to uxMaxSamples of the oldest unread samples into pusSamples.
+     * Blocks for up to xTimeout ticks if no samples are available.
+     * Only whole frames of uxChannels interleaved samples are copied.
+     *
+     * @return The number of samples copied.
+     */
+    size_t ( * uxRead )( SampleSource_t * pxSource,
+                         uint16_t * pusSamples,
+                         size_t uxMaxSamples,
+                         TickType_t xTimeout );
+
+    /**
+     * @brief Number of channels interleaved in each frame.
+     */
+    size_t uxChannels;
+
+    /**
+     * @brief Number of samples dropped because the reader fell behind.
+     */
+    uint32_t ulOverruns;
+
+    void * pvCtx;
+};
+
+/**
+ * @brief Return the timer triggered, DMA backed ADC4 sample source.
+ */
+SampleSource_t * pxAdc4DmaSourceGet( void );
+
+/**
+ * @brief Set the ADC4 inputs (by input number, e.g. 1 for ADC4_IN1) converted
+ * in each sweep. Must be called while the source is stopped.
+ */
+BaseType_t xAdc4DmaSourceSetChannels( const uint32_t * pulAdcInputs,
+                                      size_t uxNumInputs );
+
+#endif /* _SAMPLE_SOURCE_H */
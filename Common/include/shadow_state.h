@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file shadow_state.h
+ * @brief Table driven device shadow state with reported/desired diffing.
+ *
+ * The application describes its shadow properties in a constant table. Each
+ * property has a read handler returning the current device value and an
+ * optional apply handler for desired values. The engine keeps a fingerprint
+ * of the last value the shadow service accepted for every property, so a
+ * report only contains the properties that changed since, e.g.
+ * {"state":{"reported":{"powerOn":1,"irrigation":{"mode":2}}},"clientToken":"000123"}
+ *
+ * A property is either a top level member of the state document or a member
+ * of a group object one level down. Properties of one group must be adjacent
+ * in the table.
+ *
+ * Only uxShadowState_ApplyDesired may be called from another task than the
+ * one owning the state, since it only reads the property table.
+ * vShadowState_SetReported may be, as long as the owner is blocked waiting
+ * for the document it is called with.
+ */
+#ifndef _SHADOW_STATE_H
+#define _SHADOW_STATE_H
+
+#include "FreeRTOS.h"
+#include "json_extract.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Limited by the width of the dirty masks */
+#define SHADOW_STATE_MAX_PROPERTIES    JSON_EXTRACT_MAX_KEYS
+
+/* Longest string value including the terminator */
+#define SHADOW_STATE_MAX_STR_LEN       64U
+
+typedef enum
+{
+    SHADOW_PROP_BOOL,  /* Reported as 0 or 1, accepts true, false or a number */
+    SHADOW_PROP_UINT,
+    SHADOW_PROP_STRING
+} ShadowPropType_t;
+
+typedef struct
+{
+    uint32_t ulValue;                         /* SHADOW_PROP_BOOL and SHADOW_PROP_UINT */
+    char pcValue[ SHADOW_STATE_MAX_STR_LEN ]; /* SHADOW_PROP_STRING, NUL terminated */
+} ShadowValue_t;
+
+typedef struct ShadowProperty ShadowProperty_t;
+
+/**
+ * @brief Read the current device value.
+ * @return pdFALSE if the value is not available; the property is then left out of reports.
+ */
+typedef BaseType_t ( * ShadowReadHandler_t )( const ShadowProperty_t * pxProp,
+                                              ShadowValue_t * pxValue );
+
+/**
+ * @brief Apply a desired value to the device.
+ * @return pdTRUE if the value was accepted.
+ */
+typedef BaseType_t ( * ShadowApplyHandler_t )( const ShadowProperty_t * pxProp,
+                                               const ShadowValue_t * pxValue );
+
+struct ShadowProperty
+{
+    const char * pcGroup; /* Enclosing object, or NULL for a top level member */
+    const char * pcName;
+    ShadowPropType_t xType;
+    ShadowReadHandler_t pxRead;
+    ShadowApplyHandler_t pxApply; /* NULL for read only properties */
+    uint32_t ulArg;               /* Passed through to the handlers, e.g. a zone or KVStore key */
+};
+
+typedef struct
+{
+    const ShadowProperty_t * pxProps;
+    size_t uxNumProps;
+    uint32_t pulReported[ SHADOW_STATE_MAX_PROPERTIES ];    /* Fingerprint of the accepted value */
+    uint32_t pulInFlight[ SHADOW_STATE_MAX_PROPERTIES ];    /* Fingerprint of the value being reported */
+    JsonExtractKey_t pxKeys[ SHADOW_STATE_MAX_PROPERTIES ]; /* JSON path of each property */
+    uint32_t ulReportedMask;                                /* Properties with a known accepted value */
+    uint32_t ulInFlightMask;                                /* Properties in the outstanding report */
+} ShadowState_t;
+
+/**
+ * @brief Start with no accepted values, so the first report contains every property.
+ */
+void vShadowState_Init( ShadowState_t * pxState,
+                        const ShadowProperty_t * pxProps,
+                        size_t uxNumProps );
+
+/**
+ * @brief Forget the accepted values, e.g. when the shadow may have changed
+ * while the device was offline.
+ */
+void vShadowState_Invalidate( ShadowState_t * pxState );
+
+/**
+ * @brief Read every property.
+ *
+ * @return Mask of the properties whose value differs from the accepted one.
+ */
+uint32_t ulShadowState_GetDirty( ShadowState_t * pxState );
+
+/**
+ * @brief Build an update document reporting the properties in ulMask and
+ * remember the values sent until vShadowState_ReportDone is called.
+ *
+ * @return The document length, or 0 if the buffer is too small.
+ */
+size_t uxShadowState_FormatReport( ShadowState_t * pxState,
+                                   uint32_t ulMask,
+                                   uint32_t ulClientToken,
+                                   char * pcBuffer,
+                                   size_t uxBufferLen );
+
+/**
+ * @brief Record the response to the outstanding report. Values of a rejected
+ * or unanswered report stay dirty.
+ */
+void vShadowState_ReportDone( ShadowState_t * pxState,
+                              BaseType_t xAccepted );
+
+/**
+ * @brief Take the values in pcReported as the accepted ones, e.g. the
+ * "state.reported" object of a /get/accepted document. Properties not found
+ * are reported again. pcReported must be part of a validated document, or NULL.
+ */
+void vShadowState_SetReported( ShadowState_t * pxState,
+                               const char * pcReported,
+                               size_t uxReportedLen );
+
+/**
+ * @brief Pass the values in pcDesired to the apply handlers, e.g. the "state"
+ * object of an /update/delta document. pcDesired must be part of a validated
+ * document, or NULL.
+ *
+ * @return The number of values applied.
+ */
+size_t uxShadowState_ApplyDesired( const ShadowState_t * pxState,
+                                   const char * pcDesired,
+                                   size_t uxDesiredLen );
+
+#endif /* _SHADOW_STATE_H */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_batch.h
+ * @brief Accumulates timestamped telemetry samples into a single MQTT payload.
+ *
+ * Samples are appended as already encoded JSON values into a caller supplied,
+ * fixed size arena. The finished document looks like:
+ * {"samples":[{"t":1200,"v":<sample>},{"t":4200,"v":<sample>}],"now":5000}
+ * where "t" and "now" are milliseconds since boot. The receiver can recover
+ * the age of each sample from now - t.
+ *
+ * In CBOR format the same structure is produced with the integer keys from
+ * telemetry_format.h, and samples must be a single encoded CBOR item.
+ *
+ * A batch should be flushed once it holds more than ulMaxBytes or its oldest
+ * sample is older than ulMaxAgeMs. Both thresholds are reloaded from KVStore
+ * so they can be tuned at runtime.
+ */
+#ifndef _TELEMETRY_BATCH_H
+#define _TELEMETRY_BATCH_H
+
+#include "FreeRTOS.h"
+#include "telemetry_format.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    char * pcArena;
+    size_t uxArenaLen;
+    size_t uxUsed;
+    size_t uxSamples;
+    TickType_t xOldestTick;
+    uint32_t ulMaxBytes;
+    uint32_t ulMaxAgeMs;
+    TelemetryFormat_t xFormat;
+} TelemetryBatch_t;
+
+void vTelemetryBatch_Init( TelemetryBatch_t * pxBatch,
+                           char * pcArena,
+                           size_t uxArenaLen,
+                           TelemetryFormat_t xFormat );
+
+/**
+ * @brief Reload the flush thresholds from KVStore.
+ */
+void vTelemetryBatch_LoadConfig( TelemetryBatch_t * pxBatch );
+
+/**
+ * @brief Append one encoded sample, timestamped with the current tick count.
+ *
+ * @return pdFALSE if the arena does not have room for the sample. The caller
+ * should flush the batch and try again.
+ */
+BaseType_t xTelemetryBatch_Append( TelemetryBatch_t * pxBatch,
+                                   const char * pcSample,
+                                   size_t uxSampleLen );
+
+/**
+ * @brief Return pdTRUE when either flush threshold has been reached.
+ */
+BaseType_t xTelemetryBatch_IsFlushDue( const TelemetryBatch_t * pxBatch );
+
+/**
+ * @brief Close the document so it can be published.
+ *
+ * The batch is left unchanged, so the same samples can be finalized again if
+ * the publish fails.
+ *
+ * @return Length of the payload at *ppcPayload, or 0 if the batch is empty.
+ */
+size_t uxTelemetryBatch_Finalize( TelemetryBatch_t * pxBatch,
+                                  const char ** ppcPayload );
+
+/**
+ * @brief Discard all samples, typically after a successful publish.
+ */
+void vTelemetryBatch_Reset( TelemetryBatch_t * pxBatch );
+
+#endif /* _TELEMETRY_BATCH_H */
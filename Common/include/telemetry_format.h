@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_format.h
+ * @brief Payload formats and CBOR key assignments for sensor telemetry.
+ *
+ * Telemetry is either JSON (the default) or CBOR, selected with the
+ * "tlm_format" KVStore key. CBOR payloads are published on the JSON topic with
+ * TELEMETRY_CBOR_TOPIC_SUFFIX appended so the backend can route them to a
+ * decoder. CBOR documents use the small integer keys below instead of names,
+ * and send fractional values as integers scaled by TELEMETRY_FIXED_POINT_SCALE.
+ */
+#ifndef _TELEMETRY_FORMAT_H
+#define _TELEMETRY_FORMAT_H
+
+#include "FreeRTOS.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum
+{
+    TELEMETRY_FORMAT_JSON = 0,
+    TELEMETRY_FORMAT_CBOR = 1,
+} TelemetryFormat_t;
+
+#define TELEMETRY_CBOR_TOPIC_SUFFIX    "/cbor"
+
+/* 12.34 is sent as 1234 */
+#define TELEMETRY_FIXED_POINT_SCALE    100
+
+/* Sample timestamps are milliseconds since boot */
+#define TICKS_TO_MS( xTicks )          ( ( uint32_t ) ( ( ( uint64_t ) ( xTicks ) * 1000U ) / configTICK_RATE_HZ ) )
+
+/* Batch envelope */
+#define TLM_KEY_TIME                   0
+#define TLM_KEY_VALUE                  1
+#define TLM_KEY_SAMPLES                2
+#define TLM_KEY_NOW                    3
+
+/* Soil moisture and environment samples */
+#define TLM_KEY_PROBES                 4
+#define TLM_KEY_CHANNEL                5
+#define TLM_KEY_MOISTURE               6
+#define TLM_KEY_RAW                    7
+
+/* Motion samples, each an array of x, y, z */
+#define TLM_KEY_ACCEL                  8
+#define TLM_KEY_GYRO                   9
+#define TLM_KEY_MAGNETO                10
+
+/**
+ * @brief Return the configured telemetry format.
+ */
+TelemetryFormat_t xTelemetryFormat_Get( void );
+
+/**
+ * @brief Append the topic suffix for xFormat to pcTopic.
+ *
+ * @return The resulting topic length as returned by strlcat.
+ */
+size_t uxTelemetryFormat_AppendTopicSuffix( char * pcTopic,
+                                            size_t uxTopicBufLen,
+                                            TelemetryFormat_t xFormat );
+
+#endif /* _TELEMETRY_FORMAT_H */
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_publisher.h
+ * @brief Shared asynchronous publisher for sensor telemetry.
+ *
+ * Sensor tasks hand finished payloads to xTelemetryPublisher_Enqueue, which
+ * copies the topic and payload and returns immediately. A single publisher
+ * task forwards queued messages to the MQTT agent, keeping at most
+ * TELEMETRY_PUBLISHER_MAX_INFLIGHT publishes outstanding at a time, so the
+ * sampling period of the sensor tasks no longer depends on broker latency.
+ *
+ * The optional completion callback runs in the MQTT agent task once the
+ * publish was sent (QoS0), acknowledged (QoS1) or failed. It must not block.
+ * A message that could not be handed to the agent, e.g. while offline, is
+ * completed with MQTTSendFailed in the publisher task and spooled.
+ * Messages that fail in flight are then written to the telemetry spool, and
+ * the publisher task replays spooled messages at the rate set by the
+ * spool_rate_ms KVStore key whenever it has spare capacity.
+ *
+ * A sensor task describes its output as a TelemetryStream_t. The stream
+ * applies the report-on-change policy, collects the encoded samples in a
+ * batch and hands full or aged batches to the publisher, or to the spool
+ * while offline. The task itself only reads and encodes its sensors.
+ */
+#ifndef _TELEMETRY_PUBLISHER_H
+#define _TELEMETRY_PUBLISHER_H
+
+#include "FreeRTOS.h"
+#include "core_mqtt.h"
+#include "kvstore.h"
+#include "report_policy.h"
+#include "telemetry_batch.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of messages waiting to be handed to the MQTT agent */
+#ifndef TELEMETRY_PUBLISHER_QUEUE_LEN
+#define TELEMETRY_PUBLISHER_QUEUE_LEN       8U
+#endif
+
+/* Number of publishes handed to the MQTT agent but not yet completed. QoS1
+ * publishes are further limited by the agent in-flight window. */
+#ifndef TELEMETRY_PUBLISHER_MAX_INFLIGHT
+#define TELEMETRY_PUBLISHER_MAX_INFLIGHT    8U
+#endif
+
+/**
+ * @brief Called once per enqueued message with the final status of the publish.
+ * The topic and payload are only valid for the duration of the call.
+ */
+typedef void ( * TelemetryPublishCallback_t )( void * pvCtx,
+                                               MQTTStatus_t xStatus,
+                                               const char * pcTopic,
+                                               const void * pvPayload,
+                                               size_t uxPayloadLen );
+
+typedef struct
+{
+    const char * pcName; /* Used in log messages */
+    const char * pcTopic;
+    MQTTQoS_t xQoS;
+    KVStoreKey_t xDeadbandKey;
+    ReportPolicy_t xPolicy;
+    TelemetryBatch_t xBatch;
+} TelemetryStream_t;
+
+typedef struct
+{
+    uint32_t ulEnqueued;
+    uint32_t ulRejected;
+    uint32_t ulPublished;
+    uint32_t ulFailed;
+    uint32_t ulInFlight;
+} TelemetryPublisherStats_t;
+
+/**
+ * @brief Create the message queue. Must be called once before any task uses
+ * xTelemetryPublisher_Enqueue or the publisher task is started.
+ */
+BaseType_t xTelemetryPublisher_Init( void );
+
+/**
+ * @brief Queue a copy of the message for publishing without blocking.
+ *
+ * @return pdFALSE if the queue is full or no memory is available. The caller
+ * still owns the data and may retry later.
+ */
+BaseType_t xTelemetryPublisher_Enqueue( const char * pcTopic,
+                                        const void * pvPayload,
+                                        size_t uxPayloadLen,
+                                        MQTTQoS_t xQoS,
+                                        TelemetryPublishCallback_t xCallback,
+                                        void * pvCallbackCtx );
+
+void vTelemetryPublisher_GetStats( TelemetryPublisherStats_t * pxStats );
+
+/**
+ * @brief Set up a stream of uxNumValues values per sample. The topic and the
+ * arena must stay valid while the stream is used.
+ */
+void vTelemetryStream_Init( TelemetryStream_t * pxStream,
+                            const char * pcName,
+                            const char * pcTopic,
+                            MQTTQoS_t xQoS,
+                            KVStoreKey_t xDeadbandKey,
+                            size_t uxNumValues,
+                            char * pcArena,
+                            size_t uxArenaLen,
+                            TelemetryFormat_t xFormat );
+
+/**
+ * @brief Reload the report policy and the batch thresholds, picking up changes
+ * made from the CLI or the device shadow.
+ */
+void vTelemetryStream_LoadConfig( TelemetryStream_t * pxStream );
+
+/**
+ * @brief Decide whether pfValues should be encoded and added now.
+ */
+BaseType_t xTelemetryStream_ShouldReport( TelemetryStream_t * pxStream,
+                                          const float * pfValues );
+
+/**
+ * @brief Add the encoded sample of pfValues, flushing the batch first if it
+ * is full.
+ *
+ * @return pdFALSE if the sample was not added. The values then stay due.
+ */
+BaseType_t xTelemetryStream_Add( TelemetryStream_t * pxStream,
+                                 const char * pcSample,
+                                 size_t uxSampleLen,
+                                 const float * pfValues );
+
+/**
+ * @brief Hand the batch to the publisher once a flush threshold is reached.
+ */
+void vTelemetryStream_FlushIfDue( TelemetryStream_t * pxStream );
+
+void vTelemetryPublisherTask( void * pvParameters );
+
+#endif /* _TELEMETRY_PUBLISHER_H */
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2021 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * https://www.FreeRTOS.org
+ * https://github.com/FreeRTOS
+ *
+ */
+
+/**
+ * @file telemetry_spool.h
+ * @brief Persistent store-and-forward spool for telemetry on littlefs.
+ *
+ * Messages that cannot be published while the MQTT connection is down are
+ * appended to a chain of segment files under TELEMETRY_SPOOL_DIR. Each record
+ * is framed by a small header holding its lengths and a CRC32 over the header,
+ * topic and payload, so a damaged record is detected and skipped on replay.
+ * Since littlefs only commits file contents on sync, a power loss during an
+ * append leaves the previous contents of the segment intact.
+ *
+ * The total size is bounded by the spool_max_kb KVStore key. When it is
+ * exceeded the oldest segment is removed, so the most recent data survives a
+ * long outage. A small cursor file records how far the oldest segment has been
+ * replayed. Replay is at least once: a record may be sent again if the device
+ * resets between the broker acknowledgement and the cursor update.
+ *
+ * The filesystem context is passed to xTelemetrySpool_Init, so the spool can be
+ * exercised against a RAM backed littlefs block device on a host.
+ */
+#ifndef _TELEMETRY_SPOOL_H
+#define _TELEMETRY_SPOOL_H
+
+#include "FreeRTOS.h"
+#include "kvstore_config.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#if KV_STORE_NVIMPL_LITTLEFS
+#include "lfs.h"
+#endif
+
+#define TELEMETRY_SPOOL_DIR                "/spool"
+
+/* A new segment file is started once the current one would exceed this size */
+#ifndef TELEMETRY_SPOOL_SEGMENT_LEN
+#define TELEMETRY_SPOOL_SEGMENT_LEN        ( 8U * 1024U )
+#endif
+
+#define TELEMETRY_SPOOL_MAX_TOPIC_LEN      128U
+#define TELEMETRY_SPOOL_MAX_PAYLOAD_LEN    2048U
+
+typedef struct
+{
+    uint32_t ulAppended;
+    uint32_t ulReplayed;
+    uint32_t ulEvictedSegments;
+    uint32_t ulCorrupt;
+    uint32_t ulBytesPending;
+} TelemetrySpoolStats_t;
+
+#if KV_STORE_NVIMPL_LITTLEFS
+
+/**
+ * @brief Open the spool on a mounted filesystem, creating TELEMETRY_SPOOL_DIR
+ * if needed and recovering the segment chain and replay cursor.
+ */
+BaseType_t xTelemetrySpool_Init( lfs_t * pxLfs );
+#endif
+
+/**
+ * @brief Append one message to the newest segment, evicting the oldest
+ * segments if the spool grows beyond its configured size.
+ *
+ * @return pdFALSE if the spool is not available or the message is too large.
+ */
+BaseType_t xTelemetrySpool_Append( const char * pcTopic,
+                                   const void * pvPayload,
+                                   size_t uxPayloadLen,
+                                   uint8_t ucQoS );
+
+/**
+ * @brief Read the oldest unreplayed message without removing it.
+ *
+ * @param[out] pcTopic Receives the NUL terminated topic, at least
+ * TELEMETRY_SPOOL_MAX_TOPIC_LEN + 1 bytes.
+ * @param[out] pvPayload Receives the payload, at least
+ * TELEMETRY_SPOOL_MAX_PAYLOAD_LEN bytes.
+ *
+ * @return pdFALSE if the spool is empty.
+ */
+BaseType_t xTelemetrySpool_Peek( char * pcTopic,
+                                 void * pvPayload,
+                                 size_t * puxPayloadLen,
+                                 uint8_t * pucQoS );
+
+/**
+ * @brief Remove the message returned by the last xTelemetrySpool_Peek.
+ */
+void vTelemetrySpool_Consume( void );
+
+BaseType_t xTelemetrySpool_IsEmpty( void );
+
+void vTelemetrySpool_GetStats( TelemetrySpoolStats_t * pxStats );
+
+#endif /* _TELEMETRY_SPOOL_H */
@@ -116,4 +116,10 @@ KVStoreKey_t kvStringToKey( const char * pcKey );
 
 BaseType_t KVStore_xCommitChanges( void );
 
+/*
+ * @brief Write a single key to non-volatile storage if it has changed,
+ * leaving other pending changes in the cache.
+ */
+BaseType_t KVStore_xCommitKey( KVStoreKey_t xKey );
+
 #endif /* _KVSTORE_H */
@@ -308,4 +308,27 @@ BaseType_t KVStore_xCommitChanges( void )
     return xSuccess;
 }
 
+BaseType_t KVStore_xCommitKey( KVStoreKey_t xKey )
+{
+    BaseType_t xSuccess = pdTRUE;
+
+    configASSERT( xKey < CS_NUM_KEYS );
+
+#if KV_STORE_NVIMPL_ENABLE
+    if( kvStoreCache[ xKey ].xChangePending == pdTRUE )
+    {
+        xSuccess = xprvWriteValueToImpl( xKey,
+                                         kvStoreCache[ xKey ].type,
+                                         kvStoreCache[ xKey ].length,
+                                         pvGetDataReadPtr( xKey ) );
+
+        if( xSuccess == pdTRUE )
+        {
+            kvStoreCache[ xKey ].xChangePending = pdFALSE;
+        }
+    }
+#endif /* if KV_STORE_NVIMPL_ENABLE */
+    return xSuccess;
+}
+
 #endif /* KV_STORE_CACHE_ENABLE */
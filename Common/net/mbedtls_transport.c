@@ -47,6 +47,7 @@
 #include "mbedtls/pk.h"
 #include "mbedtls/pem.h"
 #include "mbedtls/platform.h"
+#include "mbedtls/platform_util.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/asn1.h"
 #include "mbedtls/oid.h"
@@ -54,6 +55,11 @@
 
 #include "errno.h"
 
+/* lwIP socket internals, used to hook the netconn event callback of a socket */
+#include "lwip/api.h"
+#include "lwip/tcpip.h"
+#include "lwip/priv/sockets_priv.h"
+
 #define MBEDTLS_DEBUG_THRESHOLD    1
 
 #ifdef MBEDTLS_TRANSPORT_PKCS11
@@ -61,16 +67,6 @@
 #include "core_pkcs11.h"
 #endif
 
-typedef struct
-{
-    TaskHandle_t xTaskHandle;
-    void * pvRecvReadyCallbackCtx;
-    GenericCallback_t pxRecvReadyCallback;
-    StackType_t puxStackBuffer[ 128 ];
-    StaticTask_t xTaskBuffer;
-    SockHandle_t xSockHandle;
-} NotifyThreadCtx_t;
-
 /**
  * @brief Secured connection context.
  */
@@ -79,7 +75,12 @@ typedef struct TLSContext
     ConnectionState_t xConnectionState;
     SockHandle_t xSockHandle;
 
-    NotifyThreadCtx_t * pxNotifyThreadCtx;
+    /* Called from the lwIP socket event callback when data can be read */
+    GenericCallback_t pxRecvReadyCallback;
+    void * pvRecvReadyCallbackCtx;
+
+    /* Longest wait of a send for the socket to become writable */
+    TickType_t xSendTimeout;
 
     /* TLS connection */
     mbedtls_ssl_config xSslConfig;
@@ -102,8 +103,31 @@ typedef struct TLSContext
 #ifdef TRANSPORT_USE_CTR_DRBG
     mbedtls_ctr_drbg_context xCtrDrbgCtx;
 #endif /* TRANSPORT_USE_CTR_DRBG */
+
+    /* Session of the last successful handshake, offered on the next connect */
+    mbedtls_ssl_session xSavedSession;
+    BaseType_t xSessionSaved;
+
+#ifdef MBEDTLS_TRANSPORT_PSA
+    psa_storage_uid_t xSessionUid;
+#endif /* MBEDTLS_TRANSPORT_PSA */
+
+    /* Gathers the vectors of mbedtls_transport_writev into one record */
+    uint8_t pucWritevBuf[ MBEDTLS_TRANSPORT_WRITEV_BUF_LEN ];
 } TLSContext_t;
 
+/* Statistics only, updated without locking */
+static TlsHandshakeStats_t xHandshakeStats = { 0 };
+
+/* Statistics only, updated without locking */
+static TlsSendStats_t xSendStats = { 0 };
+
+/* Event callback of the lwIP socket layer, chained from vSocketEventCallback */
+static netconn_callback xLwipSocketCallback = NULL;
+
+/* Contexts waiting for socket events, indexed by lwIP socket number */
+static TLSContext_t * pxSocketEventOwners[ MEMP_NUM_NETCONN ] = { NULL };
+
 
 /*-----------------------------------------------------------*/
 
@@ -115,14 +139,30 @@ static TlsTransportStatus_t xConfigureCAChain( TLSContext_t * pxTLSCtx,
                                                const PkiObject_t * pxRootCaCerts,
                                                const size_t uxNumRootCA );
 
-static inline void vStopSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx );
+static void vAttachSocketEvents( TLSContext_t * pxTLSCtx );
+
+static void vDetachSocketEvents( TLSContext_t * pxTLSCtx );
 
-static void vCreateSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx,
-                                     SockHandle_t xSockHandle );
-static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx );
+static BaseType_t xRecvPending( TLSContext_t * pxTLSCtx,
+                                BaseType_t xPollSocket );
 
+static void vDropSavedSession( TLSContext_t * pxTLSCtx );
+
+static BaseType_t xUpdateSavedSession( TLSContext_t * pxTLSCtx );
+
+static void vRecordHandshake( BaseType_t xOffered,
+                              BaseType_t xResumed,
+                              uint32_t ulHandshakeMs );
+
+static int lWaitWritable( SockHandle_t xSockHandle,
+                          TickType_t xTicksToWait );
+
+static void vRecordSendStall( uint32_t ulStallMs,
+                              BaseType_t xTimedOut );
+
+static int32_t lHandleSendStatus( TLSContext_t * pxTLSCtx,
+                                  int32_t tlsStatus );
 
-static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx );
 
 #ifdef MBEDTLS_DEBUG_C
 /* Used to print mbedTLS log output. */
@@ -135,60 +175,39 @@ static void vTLSDebugPrint( void * ctx,
 
 /*-----------------------------------------------------------*/
 
-static void vSocketNotifyThread( void * pvParameters )
+static void vSocketEventCallback( struct netconn * pxConn,
+                                 enum netconn_evt xEvent,
+                                 u16_t usLen )
 {
-    NotifyThreadCtx_t * pxCtx = ( NotifyThreadCtx_t * ) pvParameters;
-    SockHandle_t xSockHandle = pxCtx->xSockHandle;
-    BaseType_t xExitFlag = pdFALSE;
-    fd_set xReadSet;
-    fd_set xErrorSet;
-    int lRslt;
-    uint32_t ulNotifyValue = 0;
-
-    ( void ) xTaskNotifyStateClear( NULL );
+    TLSContext_t * pxTLSCtx = NULL;
+    int lSockIdx = -1;
 
-    if( pxCtx->pxRecvReadyCallback == NULL )
+    /* Keep the accounting used by select and recv of the socket layer */
+    if( xLwipSocketCallback != NULL )
     {
-        xExitFlag = pdTRUE;
+        xLwipSocketCallback( pxConn, xEvent, usLen );
     }
 
-    while( !xExitFlag )
+    if( pxConn != NULL )
     {
-        FD_ZERO( &xReadSet );
-        FD_ZERO( &xErrorSet );
-        FD_SET( xSockHandle, &xReadSet );
-        FD_SET( xSockHandle, &xErrorSet );
-
-        lRslt = sock_select( xSockHandle + 1, &xReadSet, NULL, &xErrorSet, NULL );
-
-        xExitFlag |= ( lRslt == 0 );
-
-        if( ( lRslt == 0 ) ||
-            FD_ISSET( xSockHandle, &xErrorSet ) )
-        {
-            xExitFlag = pdTRUE;
-        }
-        else
-        {
-            if( FD_ISSET( xSockHandle, &xReadSet ) &&
-                pxCtx->pxRecvReadyCallback )
-            {
-                pxCtx->pxRecvReadyCallback( pxCtx->pvRecvReadyCallbackCtx );
-            }
-        }
+        lSockIdx = pxConn->socket - LWIP_SOCKET_OFFSET;
+    }
 
-        if( xTaskNotifyWait( 0x0, 0xFFFFFFFF, &ulNotifyValue, portMAX_DELAY ) )
-        {
-            if( ulNotifyValue == 0xFFFFFFFF )
-            {
-                xExitFlag = pdTRUE;
-            }
-        }
+    if( ( lSockIdx >= 0 ) &&
+        ( lSockIdx < MEMP_NUM_NETCONN ) )
+    {
+        pxTLSCtx = pxSocketEventOwners[ lSockIdx ];
     }
 
-    /* Delete thread error */
-    pxCtx->xTaskHandle = NULL;
-    vTaskDelete( NULL );
+    /* Runs in the tcpip thread with the core locked, the callback must not block.
+     * An error or a closed connection is reported as readable so the reader sees it. */
+    if( ( pxTLSCtx != NULL ) &&
+        ( pxTLSCtx->pxRecvReadyCallback != NULL ) &&
+        ( ( xEvent == NETCONN_EVT_RCVPLUS ) ||
+          ( xEvent == NETCONN_EVT_ERROR ) ) )
+    {
+        pxTLSCtx->pxRecvReadyCallback( pxTLSCtx->pvRecvReadyCallbackCtx );
+    }
 }
 
 /*-----------------------------------------------------------*/
@@ -341,28 +360,88 @@ static void vLogCertInfo( mbedtls_x509_crt * pxCert,
 }
 
 /*-----------------------------------------------------------*/
-/*TODO add proper timeout */
+static int lWaitWritable( SockHandle_t xSockHandle,
+                          TickType_t xTicksToWait )
+{
+    fd_set xWriteSet;
+    fd_set xErrorSet;
+    struct timeval xTimeout;
+    struct timeval * pxTimeout = NULL;
+    uint32_t ulWaitMs = 0;
+
+    FD_ZERO( &xWriteSet );
+    FD_ZERO( &xErrorSet );
+    FD_SET( xSockHandle, &xWriteSet );
+    FD_SET( xSockHandle, &xErrorSet );
+
+    if( xTicksToWait != portMAX_DELAY )
+    {
+        ulWaitMs = ( uint32_t ) xTicksToWait * portTICK_PERIOD_MS;
+        xTimeout.tv_sec = ( long ) ( ulWaitMs / 1000U );
+        xTimeout.tv_usec = ( long ) ( ( ulWaitMs % 1000U ) * 1000U );
+        pxTimeout = &xTimeout;
+    }
+
+    /* An error on the socket also ends the wait, the next send reports it */
+    return sock_select( xSockHandle + 1, NULL, &xWriteSet, &xErrorSet, pxTimeout );
+}
+
+/*-----------------------------------------------------------*/
+
+static void vRecordSendStall( uint32_t ulStallMs,
+                              BaseType_t xTimedOut )
+{
+    xSendStats.ulStalls++;
+    xSendStats.ulStallMsTotal += ulStallMs;
+
+    if( xTimedOut == pdTRUE )
+    {
+        xSendStats.ulTimeouts++;
+    }
+
+    if( ulStallMs > xSendStats.ulStallMsMax )
+    {
+        xSendStats.ulStallMsMax = ulStallMs;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_transport_getsendstats( TlsSendStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    *pxStats = xSendStats;
+}
+
+/*-----------------------------------------------------------*/
+
 static int mbedtls_ssl_send( void * pvCtx,
                              const unsigned char * pcBuf,
                              size_t uxLen )
 {
-    SockHandle_t * pxSockHandle = ( SockHandle_t * ) pvCtx;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pvCtx;
     int lError = 0;
     size_t uxBytesSent = 0;
-    uint32_t ulBackofftimeMs = 1;
+    BaseType_t xStalled = pdFALSE;
+    BaseType_t xTimedOut = pdFALSE;
+    TickType_t xStallStart = 0;
+    TickType_t xTicksToWait = 0;
+    TimeOut_t xTimeOut;
 
-    if( ( pxSockHandle == NULL ) ||
-        ( *pxSockHandle < 0 ) )
+    if( ( pxTLSCtx == NULL ) ||
+        ( pxTLSCtx->xSockHandle < 0 ) )
     {
         lError = MBEDTLS_ERR_NET_SOCKET_FAILED;
     }
     else
     {
-        while( uxBytesSent < uxLen && lError == 0 )
+        while( uxBytesSent < uxLen && lError == 0 && xTimedOut == pdFALSE )
         {
-            ssize_t xRslt = sock_send( *pxSockHandle,
-                                       ( void * const ) pcBuf,
-                                       uxLen,
+            /* Continue after the bytes accepted by a previous partial send */
+            ssize_t xRslt = sock_send( pxTLSCtx->xSockHandle,
+                                       ( void * const ) &( pcBuf[ uxBytesSent ] ),
+                                       uxLen - uxBytesSent,
                                        0 );
 
             if( xRslt > 0 )
@@ -385,6 +464,7 @@ static int mbedtls_ssl_send( void * pvCtx,
 #endif
                     case EINTR:
                     case EWOULDBLOCK:
+                        lError = EWOULDBLOCK;
                         break;
 
                     case EPIPE:
@@ -399,12 +479,46 @@ static int mbedtls_ssl_send( void * pvCtx,
 
                 if( lError == EWOULDBLOCK )
                 {
-                    vTaskDelay( ulBackofftimeMs );
-                    ulBackofftimeMs = ulBackofftimeMs * 2;
                     lError = 0;
+
+                    /* The send timeout counts from the first time the send buffer was full */
+                    if( xStalled == pdFALSE )
+                    {
+                        xStalled = pdTRUE;
+                        xStallStart = xTaskGetTickCount();
+                        xTicksToWait = pxTLSCtx->xSendTimeout;
+                        vTaskSetTimeOutState( &xTimeOut );
+                    }
+
+                    /* xTaskCheckForTimeOut adjusts xTicksToWait */
+                    if( xTaskCheckForTimeOut( &xTimeOut, &xTicksToWait ) == pdTRUE )
+                    {
+                        xTimedOut = pdTRUE;
+                    }
+                    else if( lWaitWritable( pxTLSCtx->xSockHandle, xTicksToWait ) < 0 )
+                    {
+                        lError = MBEDTLS_ERR_NET_SEND_FAILED;
+                    }
+                    else
+                    {
+                        /* Writable, failed or timed out: the next pass finds out which */
+                    }
                 }
             }
         }
+
+        if( xStalled == pdTRUE )
+        {
+            vRecordSendStall( ( xTaskGetTickCount() - xStallStart ) * portTICK_PERIOD_MS, xTimedOut );
+        }
+
+        /* Nothing was accepted in time, let the caller retry the same data later */
+        if( ( xTimedOut == pdTRUE ) &&
+            ( uxBytesSent == 0 ) )
+        {
+            LogWarn( "Socket not writable for %lu ms.", pxTLSCtx->xSendTimeout * portTICK_PERIOD_MS );
+            lError = MBEDTLS_ERR_SSL_WANT_WRITE;
+        }
     }
 
     return ( int ) lError < 0 ? lError : uxBytesSent;
@@ -416,13 +530,13 @@ static int mbedtls_ssl_recv( void * pvCtx,
                              unsigned char * pcBuf,
                              size_t xLen )
 {
-    SockHandle_t * pxSockHandle = ( SockHandle_t * ) pvCtx;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pvCtx;
     int lError = -1;
 
-    if( ( pxSockHandle != NULL ) &&
-        ( *pxSockHandle >= 0 ) )
+    if( ( pxTLSCtx != NULL ) &&
+        ( pxTLSCtx->xSockHandle >= 0 ) )
     {
-        lError = sock_recv( *pxSockHandle,
+        lError = sock_recv( pxTLSCtx->xSockHandle,
                             ( void * ) pcBuf,
                             xLen,
                             0 );
@@ -473,6 +587,9 @@ NetworkContext_t * mbedtls_transport_allocate( void )
     {
         pxTLSCtx->xConnectionState = STATE_ALLOCATED;
         pxTLSCtx->xSockHandle = -1;
+        pxTLSCtx->pxRecvReadyCallback = NULL;
+        pxTLSCtx->pvRecvReadyCallbackCtx = NULL;
+        pxTLSCtx->xSendTimeout = portMAX_DELAY;
         mbedtls_ssl_config_init( &( pxTLSCtx->xSslConfig ) );
         mbedtls_ssl_init( &( pxTLSCtx->xSslCtx ) );
 
@@ -490,6 +607,13 @@ NetworkContext_t * mbedtls_transport_allocate( void )
         mbedtls_ctr_drbg_init( &( pxTLSCtx->xCtrDrbgCtx ) );
 #endif /* TRANSPORT_USE_CTR_DRBG */
 
+        mbedtls_ssl_session_init( &( pxTLSCtx->xSavedSession ) );
+        pxTLSCtx->xSessionSaved = pdFALSE;
+
+#ifdef MBEDTLS_TRANSPORT_PSA
+        pxTLSCtx->xSessionUid = 0;
+#endif /* MBEDTLS_TRANSPORT_PSA */
+
 #ifdef MBEDTLS_THREADING_ALT
         mbedtls_platform_threading_init();
 #endif /* MBEDTLS_THREADING_ALT */
@@ -506,10 +630,9 @@ void mbedtls_transport_free( NetworkContext_t * pxNetworkContext )
 
     if( pxNetworkContext != NULL )
     {
-        vFreeNotifyThreadCtx( pxTLSCtx->pxNotifyThreadCtx );
-
         if( pxTLSCtx->xSockHandle >= 0 )
         {
+            vDetachSocketEvents( pxTLSCtx );
             ( void ) sock_close( pxTLSCtx->xSockHandle );
         }
 
@@ -518,6 +641,7 @@ void mbedtls_transport_free( NetworkContext_t * pxNetworkContext )
         mbedtls_x509_crt_free( &( pxTLSCtx->xRootCaChain ) );
         mbedtls_x509_crt_free( &( pxTLSCtx->xClientCert ) );
         mbedtls_pk_free( &( pxTLSCtx->xPkCtx ) );
+        mbedtls_ssl_session_free( &( pxTLSCtx->xSavedSession ) );
 
 #ifdef MBEDTLS_TRANSPORT_PKCS11
         if( pxTLSCtx->xP11SessionHandle != CK_INVALID_HANDLE )
@@ -1052,7 +1176,7 @@ TlsTransportStatus_t mbedtls_transport_configure( NetworkContext_t * pxNetworkCo
         else
         {
             /* Setup mbedtls IO callbacks */
-            mbedtls_ssl_set_bio( pxSslCtx, &( pxTLSCtx->xSockHandle ),
+            mbedtls_ssl_set_bio( pxSslCtx, pxTLSCtx,
                                  mbedtls_ssl_send, mbedtls_ssl_recv, NULL );
 
             pxTLSCtx->xConnectionState = STATE_CONFIGURED;
@@ -1224,6 +1348,223 @@ static TlsTransportStatus_t xConnectSocket( TLSContext_t * pxTLSCtx,
 
 /*-----------------------------------------------------------*/
 
+#ifdef MBEDTLS_TRANSPORT_PSA
+
+static void vStoreSavedSession( TLSContext_t * pxTLSCtx )
+{
+    unsigned char * pucSessionBuf = NULL;
+    size_t uxSessionLen = 0;
+    int lError = 0;
+
+    /* The first call only reports the serialized length. */
+    ( void ) mbedtls_ssl_session_save( &( pxTLSCtx->xSavedSession ), NULL, 0, &uxSessionLen );
+
+    if( uxSessionLen > 0 )
+    {
+        pucSessionBuf = mbedtls_calloc( 1, uxSessionLen );
+    }
+
+    if( pucSessionBuf == NULL )
+    {
+        LogError( "Failed to allocate %lu bytes to store the TLS session.", uxSessionLen );
+    }
+    else
+    {
+        lError = mbedtls_ssl_session_save( &( pxTLSCtx->xSavedSession ), pucSessionBuf,
+                                           uxSessionLen, &uxSessionLen );
+
+        if( lError == 0 )
+        {
+            lError = lWriteObjectToPsaPs( pxTLSCtx->xSessionUid, pucSessionBuf, uxSessionLen );
+        }
+
+        if( lError != 0 )
+        {
+            LogError( "Failed to store the TLS session: Error: %s : %s.",
+                      mbedtlsHighLevelCodeOrDefault( lError ),
+                      mbedtlsLowLevelCodeOrDefault( lError ) );
+        }
+
+        mbedtls_platform_zeroize( pucSessionBuf, uxSessionLen );
+        mbedtls_free( pucSessionBuf );
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+TlsTransportStatus_t mbedtls_transport_setsessionstorage( NetworkContext_t * pxNetworkContext,
+                                                          psa_storage_uid_t xSessionUid,
+                                                          BaseType_t xPersist )
+{
+    TlsTransportStatus_t xStatus = TLS_TRANSPORT_SUCCESS;
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    uint8_t * pucSessionBuf = NULL;
+    size_t uxSessionLen = 0;
+
+    if( ( pxTLSCtx == NULL ) || ( xSessionUid == 0 ) )
+    {
+        xStatus = TLS_TRANSPORT_INVALID_PARAMETER;
+    }
+    else if( xPersist == pdFALSE )
+    {
+        pxTLSCtx->xSessionUid = 0;
+        ( void ) psa_ps_remove( xSessionUid );
+    }
+    else
+    {
+        pxTLSCtx->xSessionUid = xSessionUid;
+
+        if( ( pxTLSCtx->xSessionSaved == pdFALSE ) &&
+            ( lReadObjectFromPsaPs( &pucSessionBuf, &uxSessionLen, xSessionUid ) == 0 ) )
+        {
+            if( mbedtls_ssl_session_load( &( pxTLSCtx->xSavedSession ), pucSessionBuf, uxSessionLen ) == 0 )
+            {
+                pxTLSCtx->xSessionSaved = pdTRUE;
+                LogInfo( "Loaded a stored TLS session of %lu bytes.", uxSessionLen );
+            }
+            else
+            {
+                LogWarn( "Discarding an unusable stored TLS session." );
+                mbedtls_ssl_session_free( &( pxTLSCtx->xSavedSession ) );
+                mbedtls_ssl_session_init( &( pxTLSCtx->xSavedSession ) );
+                ( void ) psa_ps_remove( xSessionUid );
+            }
+
+            mbedtls_platform_zeroize( pucSessionBuf, uxSessionLen );
+            mbedtls_free( pucSessionBuf );
+        }
+    }
+
+    return xStatus;
+}
+
+#endif /* MBEDTLS_TRANSPORT_PSA */
+
+/*-----------------------------------------------------------*/
+
+static void vDropSavedSession( TLSContext_t * pxTLSCtx )
+{
+    if( pxTLSCtx->xSessionSaved == pdTRUE )
+    {
+        mbedtls_ssl_session_free( &( pxTLSCtx->xSavedSession ) );
+        mbedtls_ssl_session_init( &( pxTLSCtx->xSavedSession ) );
+        pxTLSCtx->xSessionSaved = pdFALSE;
+
+#ifdef MBEDTLS_TRANSPORT_PSA
+        if( pxTLSCtx->xSessionUid != 0 )
+        {
+            ( void ) psa_ps_remove( pxTLSCtx->xSessionUid );
+        }
+#endif /* MBEDTLS_TRANSPORT_PSA */
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Replace the saved session with the one negotiated by the handshake that
+ * just completed. Returns pdTRUE if the server resumed the offered session,
+ * in which case the master secret is carried over. The session id cannot be
+ * compared instead: when a ticket is offered, the client sends a random id.
+ */
+static BaseType_t xUpdateSavedSession( TLSContext_t * pxTLSCtx )
+{
+    BaseType_t xResumed = pdFALSE;
+    BaseType_t xChanged = pdTRUE;
+    mbedtls_ssl_session xSession;
+    mbedtls_ssl_session * pxSaved = &( pxTLSCtx->xSavedSession );
+    int lError = 0;
+
+    mbedtls_ssl_session_init( &xSession );
+
+    lError = mbedtls_ssl_get_session( &( pxTLSCtx->xSslCtx ), &xSession );
+
+    if( ( pxTLSCtx->xSessionSaved == pdTRUE ) &&
+        ( lError == 0 ) &&
+        ( memcmp( xSession.MBEDTLS_PRIVATE( master ), pxSaved->MBEDTLS_PRIVATE( master ),
+                  sizeof( xSession.MBEDTLS_PRIVATE( master ) ) ) == 0 ) )
+    {
+        xResumed = pdTRUE;
+
+#if defined( MBEDTLS_SSL_SESSION_TICKETS )
+        /* Only rewrite the stored copy when the server issued a new ticket. */
+        xChanged = ( ( xSession.MBEDTLS_PRIVATE( ticket_len ) != pxSaved->MBEDTLS_PRIVATE( ticket_len ) ) ||
+                     ( ( xSession.MBEDTLS_PRIVATE( ticket_len ) > 0 ) &&
+                       ( memcmp( xSession.MBEDTLS_PRIVATE( ticket ), pxSaved->MBEDTLS_PRIVATE( ticket ),
+                                 xSession.MBEDTLS_PRIVATE( ticket_len ) ) != 0 ) ) ) ? pdTRUE : pdFALSE;
+#else
+        xChanged = pdFALSE;
+#endif /* MBEDTLS_SSL_SESSION_TICKETS */
+    }
+
+    /* Session resumption is only supported for TLS 1.2 by this mbedtls version. */
+    if( ( lError != 0 ) ||
+        ( xSession.MBEDTLS_PRIVATE( minor_ver ) != MBEDTLS_SSL_MINOR_VERSION_3 ) )
+    {
+        mbedtls_ssl_session_free( &xSession );
+        vDropSavedSession( pxTLSCtx );
+    }
+    else
+    {
+        /* The saved session takes ownership of the buffers referenced by xSession. */
+        mbedtls_ssl_session_free( pxSaved );
+        *pxSaved = xSession;
+        pxTLSCtx->xSessionSaved = pdTRUE;
+
+#ifdef MBEDTLS_TRANSPORT_PSA
+        if( ( pxTLSCtx->xSessionUid != 0 ) && ( xChanged == pdTRUE ) )
+        {
+            vStoreSavedSession( pxTLSCtx );
+        }
+#else
+        ( void ) xChanged;
+#endif /* MBEDTLS_TRANSPORT_PSA */
+    }
+
+    return xResumed;
+}
+
+/*-----------------------------------------------------------*/
+
+static void vRecordHandshake( BaseType_t xOffered,
+                              BaseType_t xResumed,
+                              uint32_t ulHandshakeMs )
+{
+    xHandshakeStats.ulHandshakes++;
+    xHandshakeStats.ulLastMs = ulHandshakeMs;
+
+    if( xResumed == pdTRUE )
+    {
+        xHandshakeStats.ulResumed++;
+        xHandshakeStats.ulResumedMsTotal += ulHandshakeMs;
+    }
+    else
+    {
+        xHandshakeStats.ulFullMsTotal += ulHandshakeMs;
+
+        if( xOffered == pdTRUE )
+        {
+            xHandshakeStats.ulResumeRejected++;
+        }
+    }
+
+    if( ulHandshakeMs > xHandshakeStats.ulMsMax )
+    {
+        xHandshakeStats.ulMsMax = ulHandshakeMs;
+    }
+}
+
+/*-----------------------------------------------------------*/
+
+void mbedtls_transport_gethandshakestats( TlsHandshakeStats_t * pxStats )
+{
+    configASSERT( pxStats != NULL );
+
+    *pxStats = xHandshakeStats;
+}
+
+/*-----------------------------------------------------------*/
+
 TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkContext,
                                                 const char * pcHostName,
                                                 uint16_t usPort,
@@ -1315,6 +1656,12 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
         }
     }
 
+    /* A non-blocking send waits for writability at most as long as a blocking one */
+    if( xStatus == TLS_TRANSPORT_SUCCESS )
+    {
+        pxTLSCtx->xSendTimeout = ( ulSendTimeoutMs == 0 ) ? portMAX_DELAY : pdMS_TO_TICKS( ulSendTimeoutMs );
+    }
+
     if( ( xStatus == TLS_TRANSPORT_SUCCESS ) &&
         ( ulRecvTimeoutMs == 0 ) )
     {
@@ -1337,9 +1684,27 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
         }
     }
 
+    /* Offer the session of the previous connection for resumption. */
+    if( ( xStatus == TLS_TRANSPORT_SUCCESS ) &&
+        ( pxTLSCtx->xSessionSaved == pdTRUE ) )
+    {
+        lError = mbedtls_ssl_set_session( pxSslCtx, &( pxTLSCtx->xSavedSession ) );
+
+        if( lError != 0 )
+        {
+            LogWarn( "Failed to set the cached TLS session: Error: %s : %s.",
+                     mbedtlsHighLevelCodeOrDefault( lError ),
+                     mbedtlsLowLevelCodeOrDefault( lError ) );
+            vDropSavedSession( pxTLSCtx );
+        }
+    }
+
     /* Perform TLS handshake. */
     if( xStatus == TLS_TRANSPORT_SUCCESS )
     {
+        TickType_t xHandshakeStart = xTaskGetTickCount();
+        BaseType_t xOffered = pxTLSCtx->xSessionSaved;
+
         /* Perform the TLS handshake. */
         do
         {
@@ -1354,12 +1719,30 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
                       mbedtlsHighLevelCodeOrDefault( lError ),
                       mbedtlsLowLevelCodeOrDefault( lError ) );
 
+            xHandshakeStats.ulFailures++;
+
+            /* Keep the cached session across network errors, but start over
+             * with a full handshake after a protocol failure. */
+            if( ( lError != MBEDTLS_ERR_NET_CONN_RESET ) &&
+                ( lError != MBEDTLS_ERR_NET_SEND_FAILED ) &&
+                ( lError != MBEDTLS_ERR_NET_RECV_FAILED ) &&
+                ( lError != MBEDTLS_ERR_NET_SOCKET_FAILED ) &&
+                ( lError != MBEDTLS_ERR_SSL_TIMEOUT ) &&
+                ( lError != MBEDTLS_ERR_SSL_CONN_EOF ) )
+            {
+                vDropSavedSession( pxTLSCtx );
+            }
+
             xStatus = TLS_TRANSPORT_HANDSHAKE_FAILED;
         }
         else
         {
-            LogInfo( "Network connection %p: TLS handshake successful.",
-                     pxTLSCtx );
+            BaseType_t xResumed = xUpdateSavedSession( pxTLSCtx );
+
+            vRecordHandshake( xOffered, xResumed, ( xTaskGetTickCount() - xHandshakeStart ) * portTICK_PERIOD_MS );
+
+            LogInfo( "Network connection %p: TLS handshake successful (%s).",
+                     pxTLSCtx, ( xResumed == pdTRUE ) ? "resumed" : "full" );
         }
     }
 
@@ -1368,13 +1751,9 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
         LogInfo( "Network connection %p: Connection to %s:%u established.",
                  pxNetworkContext, pcHostName, usPort );
 
-        if( ( xStatus == TLS_TRANSPORT_SUCCESS ) &&
-            pxTLSCtx->pxNotifyThreadCtx )
-        {
-            vCreateSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx, pxTLSCtx->xSockHandle );
-        }
-
         pxTLSCtx->xConnectionState = STATE_CONNECTED;
+
+        vAttachSocketEvents( pxTLSCtx );
     }
     else
     {
@@ -1400,54 +1779,91 @@ TlsTransportStatus_t mbedtls_transport_connect( NetworkContext_t * pxNetworkCont
 
 /*-----------------------------------------------------------*/
 
-static inline void vStopSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx )
+/*
+ * Check for received data that no socket event will report. Without
+ * xPollSocket only the data already buffered by mbedtls is considered.
+ */
+static BaseType_t xRecvPending( TLSContext_t * pxTLSCtx,
+                                BaseType_t xPollSocket )
 {
-    configASSERT( pxNotifyThreadCtx );
+    BaseType_t xPending = pdFALSE;
+    fd_set xReadSet;
+    fd_set xErrorSet;
+    struct timeval xNoWait = { 0 };
 
-    while( ( pxNotifyThreadCtx->xTaskHandle != NULL ) &&
-           ( eTaskGetState( pxNotifyThreadCtx->xTaskHandle ) != eDeleted ) )
+    if( ( mbedtls_ssl_get_bytes_avail( &( pxTLSCtx->xSslCtx ) ) > 0 ) ||
+        ( mbedtls_ssl_check_pending( &( pxTLSCtx->xSslCtx ) ) != 0 ) )
+    {
+        xPending = pdTRUE;
+    }
+    else if( ( xPollSocket == pdTRUE ) &&
+             ( pxTLSCtx->xSockHandle >= 0 ) )
     {
-        ( void ) xTaskNotify( pxNotifyThreadCtx->xTaskHandle, 0xFFFFFFFF, eSetValueWithOverwrite );
-        vTaskDelay( 1 );
+        FD_ZERO( &xReadSet );
+        FD_ZERO( &xErrorSet );
+        FD_SET( pxTLSCtx->xSockHandle, &xReadSet );
+        FD_SET( pxTLSCtx->xSockHandle, &xErrorSet );
+
+        /* Poll, select reads the socket state under the lwIP protection */
+        if( sock_select( pxTLSCtx->xSockHandle + 1, &xReadSet, NULL, &xErrorSet, &xNoWait ) > 0 )
+        {
+            xPending = pdTRUE;
+        }
+    }
+    else
+    {
+        /* Empty */
     }
+
+    return xPending;
 }
 
 /*-----------------------------------------------------------*/
 
-static void vCreateSocketNotifyTask( NotifyThreadCtx_t * pxNotifyThreadCtx,
-                                     SockHandle_t xSockHandle )
+static void vAttachSocketEvents( TLSContext_t * pxTLSCtx )
 {
-    TaskHandle_t xTaskHandle = NULL;
+    struct lwip_sock * pxSock = lwip_socket_dbg_get_socket( pxTLSCtx->xSockHandle );
+    int lSockIdx = pxTLSCtx->xSockHandle - LWIP_SOCKET_OFFSET;
 
-    configASSERT_CONTINUE( pxNotifyThreadCtx );
+    if( ( pxSock != NULL ) &&
+        ( pxSock->conn != NULL ) &&
+        ( lSockIdx >= 0 ) &&
+        ( lSockIdx < MEMP_NUM_NETCONN ) )
+    {
+        LOCK_TCPIP_CORE();
 
-    vStopSocketNotifyTask( pxNotifyThreadCtx );
+        pxSocketEventOwners[ lSockIdx ] = pxTLSCtx;
 
-    if( pxNotifyThreadCtx &&
-        pxNotifyThreadCtx->pxRecvReadyCallback )
-    {
-        pxNotifyThreadCtx->xSockHandle = xSockHandle;
+        if( pxSock->conn->callback != vSocketEventCallback )
+        {
+            xLwipSocketCallback = pxSock->conn->callback;
+            pxSock->conn->callback = vSocketEventCallback;
+        }
 
-        xTaskHandle = xTaskCreateStatic( vSocketNotifyThread,
-                                         "SockNotify",
-                                         128,
-                                         ( void * ) pxNotifyThreadCtx,
-                                         tskIDLE_PRIORITY,
-                                         pxNotifyThreadCtx->puxStackBuffer,
-                                         &( pxNotifyThreadCtx->xTaskBuffer ) );
+        UNLOCK_TCPIP_CORE();
 
-        pxNotifyThreadCtx->xTaskHandle = xTaskHandle;
+        /* Data may have arrived during the handshake, before the callback was set */
+        if( ( pxTLSCtx->pxRecvReadyCallback != NULL ) &&
+            ( xRecvPending( pxTLSCtx, pdTRUE ) == pdTRUE ) )
+        {
+            pxTLSCtx->pxRecvReadyCallback( pxTLSCtx->pvRecvReadyCallbackCtx );
+        }
     }
 }
+
 /*-----------------------------------------------------------*/
 
-static void vFreeNotifyThreadCtx( NotifyThreadCtx_t * pxNotifyThreadCtx )
+static void vDetachSocketEvents( TLSContext_t * pxTLSCtx )
 {
-    if( pxNotifyThreadCtx )
-    {
-        vStopSocketNotifyTask( pxNotifyThreadCtx );
+    int lSockIdx = pxTLSCtx->xSockHandle - LWIP_SOCKET_OFFSET;
 
-        vPortFree( pxNotifyThreadCtx );
+    if( ( lSockIdx >= 0 ) &&
+        ( lSockIdx < MEMP_NUM_NETCONN ) )
+    {
+        /* The socket number is reused after close, forget the owner first */
+        LOCK_TCPIP_CORE();
+        pxSocketEventOwners[ lSockIdx ] = NULL;
+        UNLOCK_TCPIP_CORE();
     }
 }
 
@@ -1458,7 +1874,6 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
                                            void * pvCtx )
 {
     TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
-    NotifyThreadCtx_t * pxNotifyThreadCtx = NULL;
     int32_t lError = 0;
 
     if( ( pxTLSCtx == NULL ) ||
@@ -1468,48 +1883,32 @@ int32_t mbedtls_transport_setrecvcallback( NetworkContext_t * pxNetworkContext,
     }
     else
     {
-        pxNotifyThreadCtx = pxTLSCtx->pxNotifyThreadCtx;
-    }
+        pxTLSCtx->pxRecvReadyCallback = pxCallback;
+        pxTLSCtx->pvRecvReadyCallbackCtx = pvCtx;
 
-    if( pxNotifyThreadCtx == NULL )
-    {
-        pxNotifyThreadCtx = pvPortMalloc( sizeof( NotifyThreadCtx_t ) );
-
-        if( pxNotifyThreadCtx == NULL )
-        {
-            LogError( "Failed to allocate memory for a NotifyThreadCtx_t." );
-            lError = -1;
-        }
-        else
+        if( pxTLSCtx->xConnectionState == STATE_CONNECTED )
         {
-            pxTLSCtx->pxNotifyThreadCtx = pxNotifyThreadCtx;
-            pxNotifyThreadCtx->xSockHandle = -1;
-            pxNotifyThreadCtx->xTaskHandle = 0;
+            vAttachSocketEvents( pxTLSCtx );
         }
     }
-    /* Connected and pxNotifyThreadCtx already exists */
-    else if( ( pxTLSCtx->xConnectionState == STATE_CONNECTED ) &&
-             pxNotifyThreadCtx->xTaskHandle )
-    {
-        vStopSocketNotifyTask( pxNotifyThreadCtx );
-    }
-    else
-    {
-        /* Empty */
-    }
 
-    if( lError == 0 )
-    {
-        pxNotifyThreadCtx->pxRecvReadyCallback = pxCallback;
-        pxNotifyThreadCtx->pvRecvReadyCallbackCtx = pvCtx;
+    return lError;
+}
 
-        if( pxTLSCtx->xConnectionState == STATE_CONNECTED )
-        {
-            vCreateSocketNotifyTask( pxNotifyThreadCtx, pxTLSCtx->xSockHandle );
-        }
+/*-----------------------------------------------------------*/
+
+BaseType_t mbedtls_transport_recvpending( NetworkContext_t * pxNetworkContext )
+{
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    BaseType_t xPending = pdFALSE;
+
+    if( ( pxTLSCtx != NULL ) &&
+        ( pxTLSCtx->xConnectionState == STATE_CONNECTED ) )
+    {
+        xPending = xRecvPending( pxTLSCtx, pdTRUE );
     }
 
-    return lError;
+    return xPending;
 }
 
 /*-----------------------------------------------------------*/
@@ -1574,13 +1973,10 @@ void mbedtls_transport_disconnect( NetworkContext_t * pxNetworkContext )
             pxTLSCtx->xConnectionState = STATE_CONFIGURED;
         }
 
-        if( pxTLSCtx->pxNotifyThreadCtx )
-        {
-            vStopSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx );
-        }
-
         if( pxTLSCtx->xSockHandle >= 0 )
         {
+            vDetachSocketEvents( pxTLSCtx );
+
             /* Call socket close function to deallocate the socket. */
             sock_close( pxTLSCtx->xSockHandle );
             pxTLSCtx->xSockHandle = -1;
@@ -1635,11 +2031,7 @@ int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
 
         if( pxTLSCtx->xSockHandle >= 0 )
         {
-            if( pxTLSCtx->pxNotifyThreadCtx )
-            {
-                vStopSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx );
-            }
-
+            vDetachSocketEvents( pxTLSCtx );
             sock_close( pxTLSCtx->xSockHandle );
             pxTLSCtx->xSockHandle = -1;
         }
@@ -1650,13 +2042,18 @@ int32_t mbedtls_transport_recv( NetworkContext_t * pxNetworkContext,
                   mbedtlsHighLevelCodeOrDefault( tlsStatus ),
                   mbedtlsLowLevelCodeOrDefault( tlsStatus ) );
     }
+    else if( ( pxTLSCtx->pxRecvReadyCallback != NULL ) &&
+             ( xRecvPending( pxTLSCtx, ( ( size_t ) tlsStatus == uxBytesToRecv ) ? pdTRUE : pdFALSE ) == pdTRUE ) )
+    {
+        /* Socket events are edge triggered, so report data that is already
+         * buffered and would otherwise wait for the next segment. A short
+         * read ended an mbedtls record, segments behind it raise their own
+         * event, so only a read that filled the buffer polls the socket. */
+        pxTLSCtx->pxRecvReadyCallback( pxTLSCtx->pvRecvReadyCallbackCtx );
+    }
     else
     {
-        if( pxTLSCtx->pxNotifyThreadCtx &&
-            pxTLSCtx->pxNotifyThreadCtx->xTaskHandle )
-        {
-            ( void ) xTaskNotify( pxTLSCtx->pxNotifyThreadCtx->xTaskHandle, 0x0, eSetValueWithOverwrite );
-        }
+        /* Empty else marker. */
     }
 
     return tlsStatus;
@@ -1685,6 +2082,160 @@ int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
         tlsStatus = 0;
     }
 
+    return lHandleSendStatus( pxTLSCtx, tlsStatus );
+}
+
+/*-----------------------------------------------------------*/
+
+/*
+ * Write the whole buffer, which may span several records. Returns the number
+ * of bytes written or the first mbedtls error.
+ */
+static int32_t lSslWriteAll( mbedtls_ssl_context * pxSslCtx,
+                             const uint8_t * pucBuf,
+                             size_t uxLen )
+{
+    size_t uxWritten = 0;
+    int32_t lResult = 0;
+
+    while( ( uxWritten < uxLen ) && ( lResult >= 0 ) )
+    {
+        lResult = ( int32_t ) mbedtls_ssl_write( pxSslCtx, &( pucBuf[ uxWritten ] ), uxLen - uxWritten );
+
+        if( lResult > 0 )
+        {
+            uxWritten += ( size_t ) lResult;
+        }
+        else if( ( lResult == MBEDTLS_ERR_SSL_WANT_READ ) ||
+                 ( lResult == MBEDTLS_ERR_SSL_WANT_WRITE ) )
+        {
+            /* mbedtls must be called again with the same data once a record was started. */
+            if( uxWritten == 0 )
+            {
+                break;
+            }
+
+            lResult = 0;
+        }
+        else
+        {
+            /* Error, ends the loop */
+        }
+    }
+
+    return ( lResult < 0 ) ? lResult : ( int32_t ) uxWritten;
+}
+
+/*-----------------------------------------------------------*/
+
+int32_t mbedtls_transport_writev( NetworkContext_t * pxNetworkContext,
+                                  const TlsOutVector_t * pxVectors,
+                                  size_t uxVectorCount )
+{
+    TLSContext_t * pxTLSCtx = ( TLSContext_t * ) pxNetworkContext;
+    int32_t tlsStatus = 0;
+    size_t uxStaged = 0;
+    size_t uxSent = 0;
+    size_t uxStageLen = MBEDTLS_TRANSPORT_WRITEV_BUF_LEN;
+
+    configASSERT( pxTLSCtx != NULL );
+    configASSERT( pxVectors != NULL );
+    configASSERT( uxVectorCount > 0 );
+
+    if( pxTLSCtx->xConnectionState == STATE_CONNECTED )
+    {
+        int lMaxPayload = mbedtls_ssl_get_max_out_record_payload( &( pxTLSCtx->xSslCtx ) );
+
+        /* Never stage more than fits in a single record */
+        if( ( lMaxPayload > 0 ) && ( ( size_t ) lMaxPayload < uxStageLen ) )
+        {
+            uxStageLen = ( size_t ) lMaxPayload;
+        }
+
+        for( size_t uxIdx = 0; ( uxIdx < uxVectorCount ) && ( tlsStatus >= 0 ); uxIdx++ )
+        {
+            const uint8_t * pucData = ( const uint8_t * ) pxVectors[ uxIdx ].pvBase;
+            size_t uxRemaining = pxVectors[ uxIdx ].uxLen;
+
+            while( ( uxRemaining > 0 ) && ( tlsStatus >= 0 ) )
+            {
+                if( ( uxStaged == 0 ) && ( uxRemaining >= uxStageLen ) )
+                {
+                    /* Too large to share a record, write it without a copy */
+                    tlsStatus = lSslWriteAll( &( pxTLSCtx->xSslCtx ), pucData, uxRemaining );
+
+                    if( tlsStatus > 0 )
+                    {
+                        uxSent += ( size_t ) tlsStatus;
+                        uxRemaining = 0;
+                    }
+                }
+                else
+                {
+                    size_t uxCopy = uxStageLen - uxStaged;
+
+                    if( uxCopy > uxRemaining )
+                    {
+                        uxCopy = uxRemaining;
+                    }
+
+                    ( void ) memcpy( &( pxTLSCtx->pucWritevBuf[ uxStaged ] ), pucData, uxCopy );
+                    uxStaged += uxCopy;
+                    pucData = &( pucData[ uxCopy ] );
+                    uxRemaining -= uxCopy;
+
+                    if( uxStaged == uxStageLen )
+                    {
+                        tlsStatus = lSslWriteAll( &( pxTLSCtx->xSslCtx ), pxTLSCtx->pucWritevBuf, uxStaged );
+                        uxStaged = 0;
+
+                        if( tlsStatus > 0 )
+                        {
+                            uxSent += ( size_t ) tlsStatus;
+                        }
+                    }
+                }
+            }
+        }
+
+        if( ( tlsStatus >= 0 ) && ( uxStaged > 0 ) )
+        {
+            tlsStatus = lSslWriteAll( &( pxTLSCtx->xSslCtx ), pxTLSCtx->pucWritevBuf, uxStaged );
+
+            if( tlsStatus > 0 )
+            {
+                uxSent += ( size_t ) tlsStatus;
+            }
+        }
+
+        if( tlsStatus >= 0 )
+        {
+            tlsStatus = ( int32_t ) uxSent;
+        }
+        else if( ( uxSent > 0 ) &&
+                 ( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
+                   ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
+                   ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) ) )
+        {
+            /* Report the bytes written so far. The record mbedtls may still
+             * hold starts at that offset and is rebuilt identically when the
+             * caller retries the rest of the same vectors. */
+            tlsStatus = ( int32_t ) uxSent;
+        }
+        else
+        {
+            /* Reported below */
+        }
+    }
+
+    return lHandleSendStatus( pxTLSCtx, tlsStatus );
+}
+
+/*-----------------------------------------------------------*/
+
+static int32_t lHandleSendStatus( TLSContext_t * pxTLSCtx,
+                                  int32_t tlsStatus )
+{
     if( ( tlsStatus == MBEDTLS_ERR_SSL_TIMEOUT ) ||
         ( tlsStatus == MBEDTLS_ERR_SSL_WANT_READ ) ||
         ( tlsStatus == MBEDTLS_ERR_SSL_WANT_WRITE ) )
@@ -1702,11 +2253,7 @@ int32_t mbedtls_transport_send( NetworkContext_t * pxNetworkContext,
 
         if( pxTLSCtx->xSockHandle >= 0 )
         {
-            if( pxTLSCtx->pxNotifyThreadCtx )
-            {
-                vStopSocketNotifyTask( pxTLSCtx->pxNotifyThreadCtx );
-            }
-
+            vDetachSocketEvents( pxTLSCtx );
             sock_close( pxTLSCtx->xSockHandle );
             pxTLSCtx->xSockHandle = -1;
         }
@@ -36,6 +36,7 @@ UART_HandleTypeDef * pxHndlUart1 = NULL;
 DCACHE_HandleTypeDef * pxHndlDCache = NULL;
 DMA_HandleTypeDef * pxHndlGpdmaCh4 = NULL;
 DMA_HandleTypeDef * pxHndlGpdmaCh5 = NULL;
+DMA_HandleTypeDef * pxHndlGpdmaCh10 = NULL;
 #ifndef TFM_PSA_API
 RNG_HandleTypeDef * pxHndlRng = NULL;
 #endif /* ! defined( TFM_PSA_API ) */
@@ -159,6 +159,14 @@ void GPDMA1_Channel5_IRQHandler( void )
     }
 }
 
+void GPDMA1_Channel10_IRQHandler( void )
+{
+    if( pxHndlGpdmaCh10 != NULL )
+    {
+        HAL_DMA_IRQHandler( pxHndlGpdmaCh10 );
+    }
+}
+
 /* Handle TIM6 interrupt for STM32 HAL time base. */
 void TIM6_IRQHandler( void )
 {
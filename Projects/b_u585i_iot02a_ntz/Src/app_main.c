@@ -181,6 +181,9 @@ extern void vMQTTAgentTask( void * );
 // MICHAEL - soil moisture sensor
 extern void vSoilMoistureSensorPublishTask( void * );
 
+extern void vTelemetryPublisherTask( void * );
+extern BaseType_t xTelemetryPublisher_Init( void );
+
 extern void vShadowDeviceTask( void * );
 extern void vOTAUpdateTask( void * pvParam );
 extern void vDefenderAgentTask( void * );
@@ -234,6 +237,12 @@ void vInitTask( void * pvArgs )
     xResult = xTaskCreate( vOTAUpdateTask, "OTAUpdate", 4096, NULL, tskIDLE_PRIORITY + 1, NULL );
     configASSERT( xResult == pdTRUE );
 
+    xResult = xTelemetryPublisher_Init();
+    configASSERT( xResult == pdTRUE );
+
+    xResult = xTaskCreate( vTelemetryPublisherTask, "TlmPub", 1024, NULL, 5, NULL );
+    configASSERT( xResult == pdTRUE );
+
     // MICHAEL - not using
 //    xResult = xTaskCreate( vEnvironmentSensorPublishTask, "EnvSense", 1024, NULL, 6, NULL );
 //    configASSERT( xResult == pdTRUE );
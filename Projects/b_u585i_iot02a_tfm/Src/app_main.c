@@ -99,6 +99,8 @@ extern void net_main( void * pvParameters );
 extern void vMQTTAgentTask( void * );
 extern void vMotionSensorsPublish( void * );
 extern void vEnvironmentSensorPublishTask( void * );
+extern void vTelemetryPublisherTask( void * );
+extern BaseType_t xTelemetryPublisher_Init( void );
 extern void vShadowDeviceTask( void * );
 extern void vOTAUpdateTask( void * pvParam );
 extern void vDefenderAgentTask( void * );
@@ -128,6 +130,12 @@ void vInitTask( void * pvArgs )
     xResult = xTaskCreate( vOTAUpdateTask, "OTAUpdate", 2048, NULL, tskIDLE_PRIORITY + 3, NULL );
     configASSERT( xResult == pdTRUE );
 
+    xResult = xTelemetryPublisher_Init();
+    configASSERT( xResult == pdTRUE );
+
+    xResult = xTaskCreate( vTelemetryPublisherTask, "TlmPub", 1024, NULL, tskIDLE_PRIORITY + 2, NULL );
+    configASSERT( xResult == pdTRUE );
+
     xResult = xTaskCreate( vEnvironmentSensorPublishTask, "EnvSense", 1024, NULL, tskIDLE_PRIORITY + 2, NULL );
     configASSERT( xResult == pdTRUE );
 